@@ -62,9 +62,56 @@ struct _bone
 
    float *geometry;         /* Vertex array of geometry for the bone. */
    int tri_count;           /* Number of triangles in the array. */
+   unsigned int vbo;        /* Buffer object copy of geometry, or 0. */
+   float bound[4];          /* Sphere round the geometry, centre then radius. */
 };
 
 
+/**
+ * Ways of interpolating between the key frames of an animation. Catmull-Rom
+ * assumes evenly spaced keys while the Hermite mode scales its tangents by
+ * the actual key intervals.
+ */
+enum { INTERP_LINEAR, INTERP_CATMULL, INTERP_HERMITE };
+
+/**
+ * Default tolerance, in degrees, used when packing animations.
+ */
+#define PACK_TOLERANCE 0.25
+
+/**
+ * A packed channel describes one rotation axis of one bone inside a packed
+ * animation. Constant channels have no keys and just store their value in
+ * base. Other channels index a run of keys whose values are quantised to
+ * 16 bits between base and base + 65535 * scale.
+ */
+typedef struct _packed_chan
+{
+  int first;                    /* Index of the channels first key. */
+  int count;                    /* Number of keys, 0 if constant. */
+  float base;                   /* Constant value or bottom of range. */
+  float scale;                  /* Size of one quantisation step. */
+} packed_chan;
+
+/**
+ * Compressed form of an animation. Redundant keys are dropped per channel
+ * so only the keys needed to stay within the packing tolerance remain.
+ * Key times are in milliseconds from the start of the clip.
+ */
+typedef struct _packed_anim
+{
+  packed_chan *chans;           /* One header per bone channel. */
+  unsigned short *key_times;    /* Time of each key. */
+  unsigned short *key_vals;     /* Quantised value of each key. */
+  int *starts;                  /* Start time of each original frame. */
+
+  int n_chans;                  /* Number of channels, 3 per bone. */
+  int n_keys;                   /* Total keys across all channels. */
+  int duration;                 /* Length of one loop of the clip. */
+  int interp;                   /* Interpolation mode between keys. */
+} packed_anim;
+
+
 /**
  * The animation struct is really just a 2D array of float triplets. These
  * store rotations for the bones of a model. Actual animation state
@@ -77,9 +124,33 @@ typedef struct _anim
 
   int n_frames;                 /* Height of the 2D array. */
   int n_bones;                  /* Width of the 2D array. */
+  int interp;                   /* Interpolation mode between frames. */
+
+  packed_anim *packed;          /* Compressed frames, NULL if unpacked. */
 } anim;
 
 
+/**
+ * Tracks how far through its current animation a model or instance is.
+ */
+typedef struct _anim_state
+{
+  anim *curr_anim;          /* Pointer the current animation. */
+
+  float *n_frame;           /* A pointer to the next animation frame. */
+  float *p_frame;           /* A pointer to the previous animation frame. */
+  int p_index, n_index;     /* p_index is -1 while blending from blend. */
+  int p_time, n_time;       /* Next/Previous actual times. */
+  float *blend;             /* Pose a change of animation blends from. */
+} anim_state;
+
+
+/**
+ * A model's bone meshes merged into one skinned mesh. Defined in skin.h.
+ */
+typedef struct _skin_mesh skin_mesh;
+
+
 /** 
  * The model struct encapsulates all data to do with a specific instance
  * of an object that has a skeleton and geometry. It also stores its own
@@ -97,18 +168,41 @@ typedef struct _model
 
   int texture;              /* Reference to OpenGL Texture object. */
 
-  float *n_frame;           /* A pointer to the next animation frame. */
-  float *p_frame;           /* A pointer to the previous animation frame. */
-  int p_index, n_index; 
-  int p_time, n_time;       /* Next/Previous actual times. */
+  anim_state state;         /* Current animation and place in it. */
 
   anim **anims;             /* An array of pointers to animation structs. */
-  anim *curr_anim;          /* Pointer the current animation. */
   int n_anims;              /* Number of held animations. */
 
+  float *pose;              /* Scratch space for one frame of rotations. */
+
+  skin_mesh *skin;          /* Bone meshes as one skinned mesh, or NULL. */
+  float radius;             /* Bounds the model in any pose, or -1. */
+
 } model;
 
 
+/**
+ * An instance is a light copy of a model for drawing the same thing many
+ * times over. The skeleton, geometry and animations all belong to the base
+ * model and are never changed through an instance; the instance only has
+ * its own place in the world, animation state and pose. The pose holds the
+ * rotations of every bone in skel_make_array order.
+ *
+ * Models can be registered for drawing directly, in which case they are
+ * wrapped in an instance with no pose that just follows its model.
+ */
+typedef struct _instance
+{
+  model *base;              /* Shared skeleton, geometry and animations. */
+
+  float pos[6];             /* Position and rotation of the instance. */
+
+  anim_state state;         /* Current animation and place in it. */
+  float *pose;              /* Bone rotations, NULL to follow the base. */
+
+} instance;
+
+
 /**
  * The vf_node is the way that we track what faces use which vetrtecies. The
  * point of doing so is that when calculating the normals for a mesh object,
@@ -168,9 +262,25 @@ extern void bone_shallow_free(bone *bone);
 extern bool anim_new_frame(anim *curr, float *key_frame, int time_int);
 extern void animate(model *mdl, int now);
 extern bool start_animation(model *mdl, int index, int start_time);
+extern void animate_instance(instance *inst, int now);
+extern bool start_instance_animation(instance *inst, int index,
+    int start_time);
 extern float int_linear(float x0, float y0, float x1, float y1, float x);
 extern float int_linear_quick(float a, float y0, float y1);
-extern void int_keyframes(model *model, int now);
+extern void int_keyframes(anim_state *state, int now, float *pose, int n);
+extern void int_cubic_weights(float a, float r0, float r2, int interp,
+    float w[4]);
+extern void pose_blend4(float *out, float *f[4], float w[4], int n);
+extern void int_keyframes_cubic(anim_state *state, int now, float *pose,
+    int n);
+extern int interp_from_name(const char *name);
+extern const char *interp_name(int interp);
+
+/* anim_pack.c functions. */
+extern bool anim_pack(anim *anim, float tolerance);
+extern void free_packed_anim(packed_anim *trash);
+extern void packed_sample(packed_anim *pack, float t, float *pose);
+extern float packed_max_error(anim *anim, packed_anim *pack);
 
 /* bone.c functions. */
 extern int bone_add_child(bone *parent, bone *child);
@@ -182,7 +292,11 @@ extern void skel_shallow_free(bone *skel);
 extern bone **skel_make_array(bone *skel, int array_size);
 extern float *skel_get_frame(bone **bone_array, int n_bones);
 extern void skel_set_rots(bone **bone_array, float *rots, int n_bones);
+extern void skel_copy_rots(bone **bone_array, float *rots, int n_bones);
 extern bone *clone_skel(bone *skel);
+extern void skel_pose_matrices(bone *skel, float **pose, float m[16],
+    float **out, int stride);
+extern float skel_bounds(bone *skel, float reach);
 
 /* mesh.c functions */
 extern mesh *new_mesh();
@@ -193,6 +307,11 @@ extern void free_model(model *mdl);
 extern void model_shallow_free(model *mdl);
 extern void model_info(model *mdl);
 extern model *clone_model(model *mdl);
+extern instance *new_instance(model *base);
+extern void free_instance(instance *inst);
+extern float *instance_pos(instance *inst);
+extern void model_matrix(float *pos, float m[16]);
+extern void instance_copy_pose(instance *inst, float *rots);
 
 
 #endif
@@ -0,0 +1,397 @@
+/**
+ * anim_pack.c
+ *
+ * Compression of animations. Most bones in a clip hardly move, yet every
+ * frame stores a full rotation triple for each one. Packing an animation
+ * looks at each bone channel on its own, stores channels that never move
+ * as a single value and drops any key that can be rebuilt by interpolating
+ * its neighbours to within a tolerance. The keys that are left are
+ * quantised to 16 bits and sampled directly at run time.
+ */
+
+#include "3d.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define QUANT_MAX 65535
+
+
+/* Function prototypes. */
+float pack_dequant(packed_chan *chan, unsigned short q);
+unsigned short pack_quant(packed_chan *chan, float value);
+float frame_value(anim *anim, int frame, int chan);
+bool pack_span_ok(anim *anim, int *starts, packed_chan *chan, int c,
+    int from, int to, float tolerance);
+float packed_sample_chan(packed_anim *pack, packed_chan *chan, float t);
+bool pack_refine(anim *anim, packed_anim *pack, packed_chan *chan, int c,
+    float tolerance);
+
+
+/**
+ * Turns a quantised key value back into an angle.
+ */
+float pack_dequant(packed_chan *chan, unsigned short q)
+{
+  return chan->base + q * chan->scale;
+}
+
+
+/**
+ * Quantises an angle to the range of a channel, rounding to the nearest
+ * step.
+ */
+unsigned short pack_quant(packed_chan *chan, float value)
+{
+  float q;
+
+  if(chan->scale == 0.0)
+    return 0;
+
+  q = (value - chan->base) / chan->scale + 0.5;
+  if(q < 0) q = 0;
+  if(q > QUANT_MAX) q = QUANT_MAX;
+
+  return (unsigned short)q;
+}
+
+
+/**
+ * Returns the value of a channel at an original frame. Frame n_frames is
+ * the end of the loop and so has the same value as the first frame.
+ */
+float frame_value(anim *anim, int frame, int chan)
+{
+  return anim->key_frames[frame % anim->n_frames][chan];
+}
+
+
+/**
+ * Tests whether every frame strictly between from and to can be rebuilt
+ * from the quantised values at from and to within the given tolerance.
+ */
+bool pack_span_ok(anim *anim, int *starts, packed_chan *chan, int c,
+    int from, int to, float tolerance)
+{
+  float y0, y1, a, v;
+  int i;
+
+  y0 = pack_dequant(chan, pack_quant(chan, frame_value(anim, from, c)));
+  y1 = pack_dequant(chan, pack_quant(chan, frame_value(anim, to, c)));
+
+  for(i = from + 1; i < to; i++)
+  {
+    a = (starts[i] - starts[from]) / (float)(starts[to] - starts[from]);
+    v = int_linear_quick(a, y0, y1);
+
+    if(fabs(v - frame_value(anim, i, c)) > tolerance)
+      return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * Finds the frame of a channel that is furthest from its packed curve and,
+ * if it's outside the tolerance, inserts it as a new key. The channel must
+ * be the last one packed so far as its keys are shifted along to make room.
+ * Returns true if a key was added.
+ */
+bool pack_refine(anim *anim, packed_anim *pack, packed_chan *chan, int c,
+    float tolerance)
+{
+  int i, k, worst = -1;
+  float diff, error = tolerance;
+
+  for(i = 1; i < anim->n_frames; i++)
+  {
+    diff = fabs(packed_sample_chan(pack, chan, pack->starts[i]) -
+        frame_value(anim, i, c));
+    if(diff > error)
+    {
+      error = diff;
+      worst = i;
+    }
+  }
+
+  if(worst < 0)
+    return false;
+
+  /* Shift later keys along and slot the frame in, keeping times sorted. */
+  k = chan->first + chan->count;
+  while(k > chan->first && pack->key_times[k - 1] > pack->starts[worst])
+  {
+    pack->key_times[k] = pack->key_times[k - 1];
+    pack->key_vals[k]  = pack->key_vals[k - 1];
+    k--;
+  }
+  pack->key_times[k] = pack->starts[worst];
+  pack->key_vals[k]  = pack_quant(chan, frame_value(anim, worst, c));
+  chan->count++;
+
+  return true;
+}
+
+
+/**
+ * Compresses the frames of an animation. Channels whose range is within
+ * the tolerance become constant and the rest are reduced greedily, each
+ * key reaching as far forward as it can while all skipped frames stay
+ * within tolerance. Cubic animations are then refined against the curve
+ * they will actually be sampled with.
+ * On success the original key frames are freed and the
+ * animation is sampled from its packed form from then on.
+ * Returns false if the animation could not be packed, in which case it is
+ * left untouched.
+ */
+bool anim_pack(anim *anim, float tolerance)
+{
+  packed_anim *pack;
+  packed_chan *chan;
+  int *starts, i, c, from, to, n_keys, raw_size, pack_size, constant = 0;
+  float lo, hi, v, error;
+
+  if(!anim || anim->packed || anim->n_frames <= 0)
+    return false;
+
+  for(i = 0; i < anim->n_frames; i++)
+    if(anim->key_frames[i] == NULL)
+      return false;
+
+  /* Work out where each frame starts. An extra entry holds the end of the
+   * loop, which must fit into a 16 bit key time. */
+  starts = malloc(sizeof(int) * (anim->n_frames + 1));
+  if(!starts) return false;
+
+  starts[0] = 0;
+  for(i = 0; i < anim->n_frames; i++)
+    starts[i + 1] = starts[i] + anim->times[i];
+
+  if(starts[anim->n_frames] > QUANT_MAX || starts[anim->n_frames] <= 0)
+  {
+    fprintf(stderr, "ERROR(anim_pack): Animation too long to pack.\n");
+    free(starts);
+    return false;
+  }
+
+  NEW(pack);
+  if(!pack)
+  {
+    free(starts);
+    return false;
+  }
+
+  /* Worst case every frame is kept in every channel, plus the end key. */
+  pack->n_chans   = anim->n_bones * TRANS_SIZE;
+  pack->n_keys    = 0;
+  pack->duration  = starts[anim->n_frames];
+  pack->interp    = anim->interp;
+  pack->starts    = starts;
+  pack->chans     = malloc(sizeof(packed_chan) * pack->n_chans);
+  pack->key_times = malloc(sizeof(unsigned short) * pack->n_chans *
+      (anim->n_frames + 1));
+  pack->key_vals  = malloc(sizeof(unsigned short) * pack->n_chans *
+      (anim->n_frames + 1));
+
+  if(!pack->chans || !pack->key_times || !pack->key_vals)
+  {
+    free_packed_anim(pack);
+    return false;
+  }
+
+  for(c = 0; c < pack->n_chans; c++)
+  {
+    chan = pack->chans + c;
+
+    lo = hi = frame_value(anim, 0, c);
+    for(i = 1; i < anim->n_frames; i++)
+    {
+      v = frame_value(anim, i, c);
+      if(v < lo) lo = v;
+      if(v > hi) hi = v;
+    }
+
+    chan->first = pack->n_keys;
+
+    /* Channels that barely move are stored once, in the middle of their
+     * range so the error is at most half of it. */
+    if(hi - lo <= tolerance)
+    {
+      chan->count = 0;
+      chan->base  = (lo + hi) * 0.5;
+      chan->scale = 0.0;
+      constant++;
+      continue;
+    }
+
+    chan->base  = lo;
+    chan->scale = (hi - lo) / QUANT_MAX;
+
+    /* Greedy reduction. The end of the loop is always kept so that the
+     * last span wraps back to the first frame. */
+    n_keys = 0;
+    from = 0;
+    while(true)
+    {
+      pack->key_times[chan->first + n_keys] = starts[from];
+      pack->key_vals[chan->first + n_keys]  =
+        pack_quant(chan, frame_value(anim, from, c));
+      n_keys++;
+
+      if(from == anim->n_frames)
+        break;
+
+      to = from + 1;
+      while(to < anim->n_frames &&
+          pack_span_ok(anim, starts, chan, c, from, to + 1, tolerance))
+        to++;
+
+      from = to;
+    }
+
+    chan->count = n_keys;
+
+    /* Cubic curves also bend between the kept keys, so keep adding the
+     * worst frame back in until the channel is within tolerance. */
+    if(anim->interp != INTERP_LINEAR)
+      while(pack_refine(anim, pack, chan, c, tolerance));
+
+    pack->n_keys += chan->count;
+  }
+
+  /* Trim the key arrays down to what was actually used. */
+  pack->key_times = realloc(pack->key_times,
+      sizeof(unsigned short) * (pack->n_keys ? pack->n_keys : 1));
+  pack->key_vals  = realloc(pack->key_vals,
+      sizeof(unsigned short) * (pack->n_keys ? pack->n_keys : 1));
+
+  error = packed_max_error(anim, pack);
+
+  /* Report how well the clip packed. */
+  raw_size  = anim->n_frames * pack->n_chans * sizeof(float);
+  pack_size = pack->n_chans * sizeof(packed_chan) +
+    pack->n_keys * 2 * sizeof(unsigned short) +
+    (anim->n_frames + 1) * sizeof(int);
+  printf("Packed animation: %d frames, %d/%d constant channels, %d keys.\n",
+      anim->n_frames, constant, pack->n_chans, pack->n_keys);
+  printf("  %d -> %d bytes (%.2f:1), max error %.3f degrees.\n", raw_size,
+      pack_size, raw_size / (float)pack_size, error);
+
+  /* The packed stream replaces the raw frames. */
+  for(i = 0; i < anim->n_frames; i++)
+  {
+    free(anim->key_frames[i]);
+    anim->key_frames[i] = NULL;
+  }
+  anim->packed = pack;
+
+  return true;
+}
+
+
+/**
+ * Frees all memory held by a packed animation.
+ */
+void free_packed_anim(packed_anim *trash)
+{
+  if(!trash) return;
+
+  FREE(trash->chans);
+  FREE(trash->key_times);
+  FREE(trash->key_vals);
+  FREE(trash->starts);
+  free(trash);
+}
+
+
+/**
+ * Samples a single channel of a packed animation at time t.
+ */
+float packed_sample_chan(packed_anim *pack, packed_chan *chan, float t)
+{
+  unsigned short *times = pack->key_times + chan->first;
+  unsigned short *vals  = pack->key_vals + chan->first;
+  int lo = 0, hi = chan->count - 1, mid, before, after;
+  float a, t0, t2, w[4];
+
+  if(chan->count == 0)
+    return chan->base;
+
+  /* Binary search for the span holding t. Keys always cover the whole
+   * loop, from 0 to the duration. */
+  while(hi - lo > 1)
+  {
+    mid = (lo + hi) / 2;
+    if(times[mid] <= t)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  a = (t - times[lo]) / (float)(times[hi] - times[lo]);
+  if(pack->interp == INTERP_LINEAR)
+    return int_linear_quick(a, pack_dequant(chan, vals[lo]),
+        pack_dequant(chan, vals[hi]));
+
+  /* Cubic modes need the keys either side of the span. The first and last
+   * keys are the same point in the loop so neighbours skip over them. */
+  before = lo > 0 ? lo - 1 : chan->count - 2;
+  after  = hi < chan->count - 1 ? hi + 1 : 1;
+  t0 = lo > 0 ? times[before] : times[before] - (float)pack->duration;
+  t2 = hi < chan->count - 1 ? times[after] : times[after] +
+    (float)pack->duration;
+
+  int_cubic_weights(a, (times[hi] - times[lo]) / (times[lo] - t0),
+      (times[hi] - times[lo]) / (t2 - times[hi]), pack->interp, w);
+  return w[0] * pack_dequant(chan, vals[before]) +
+         w[1] * pack_dequant(chan, vals[lo]) +
+         w[2] * pack_dequant(chan, vals[hi]) +
+         w[3] * pack_dequant(chan, vals[after]);
+}
+
+
+/**
+ * Fills a pose with a packed animation at time t, in milliseconds from the
+ * start of the clip. Times outside one loop are wrapped.
+ */
+void packed_sample(packed_anim *pack, float t, float *pose)
+{
+  int c;
+
+  t = fmod(t, pack->duration);
+  if(t < 0) t += pack->duration;
+
+  for(c = 0; c < pack->n_chans; c++)
+    pose[c] = packed_sample_chan(pack, pack->chans + c, t);
+}
+
+
+/**
+ * Finds the largest difference, in degrees, between the original frames of
+ * an animation and its packed form. For linear animations both are
+ * piecewise linear with their corners on the original frames, so checking
+ * the frames is enough. Cubic animations are only checked at the frames.
+ */
+float packed_max_error(anim *anim, packed_anim *pack)
+{
+  int i, c;
+  float error = 0.0, diff;
+
+  for(i = 0; i < anim->n_frames; i++)
+  {
+    if(!anim->key_frames[i]) continue;
+
+    for(c = 0; c < pack->n_chans; c++)
+    {
+      diff = fabs(packed_sample_chan(pack, pack->chans + c, pack->starts[i]) -
+          anim->key_frames[i][c]);
+      if(diff > error)
+        error = diff;
+    }
+  }
+
+  return error;
+}
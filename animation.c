@@ -7,7 +7,13 @@
  */
 
 #include "3d.h"
+#include "global.h"
 #include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 /**
  * Creates a new anim struct, initialises it and allocates memory needed
@@ -47,6 +53,8 @@ anim *new_anim(int frames, int bones)
   /* Initialise the other variables in the struct. */
   new->n_frames = frames;
   new->n_bones = bones;
+  new->interp = INTERP_LINEAR;
+  new->packed = NULL;
 
   return new;
 }
@@ -76,6 +84,10 @@ void free_anim(anim *trash, bool del_frames)
     }
   }
 
+  /* The packed frames are owned by the animation, like the times. */
+  if(del_frames)
+    free_packed_anim(trash->packed);
+
   /* Free the list of times and finally the animation itself. */
   if(trash->times != NULL)
     free(trash->times);
@@ -115,6 +127,119 @@ bool anim_new_frame(anim *curr, float *new_frame, int time_int)
 }
 
 
+/**
+ * Moves an animation state forward to the current time, stepping through
+ * as many key frames as have passed since it was last updated.
+ */
+void anim_advance(anim_state *state, int now)
+{
+  anim *anim = state->curr_anim;
+
+  while(now >= state->n_time)
+  {
+    state->p_time  = state->n_time;
+    state->n_time += anim->times[state->n_index];
+    state->p_index = state->n_index;
+    state->n_index = (state->n_index + 1) % anim->n_frames;
+    state->p_frame = anim->key_frames[state->p_index];
+    state->n_frame = anim->key_frames[state->n_index];
+  }
+}
+
+
+/**
+ * Works out the pose of an animation state at the current time using the
+ * type of interpolation specified by the animation. n is the number of
+ * values in the pose, three per bone.
+ */
+void anim_sample(anim_state *state, int now, float *pose, int n)
+{
+  anim *anim = state->curr_anim;
+  float a;
+  int i;
+
+  /* Blending from the pose the last animation was left in to the first
+   * frame of this one. */
+  if(state->p_index < 0)
+  {
+    if(!anim->packed)
+    {
+      int_keyframes(state, now, pose, n);
+      return;
+    }
+
+    a = (now - state->p_time) / (float)(state->n_time - state->p_time);
+    packed_sample(anim->packed, 0, pose);
+    for(i = 0; i < n; i++)
+      pose[i] = int_linear_quick(a, state->blend[i], pose[i]);
+  }
+  /* Packed animations are sampled straight from the compressed keys using
+   * the time into the clip. */
+  else if(anim->packed)
+    packed_sample(anim->packed, anim->packed->starts[state->p_index] +
+        (now - state->p_time), pose);
+  else if(anim->interp != INTERP_LINEAR)
+    int_keyframes_cubic(state, now, pose, n);
+  else
+    int_keyframes(state, now, pose, n);
+}
+
+
+/**
+ * Starts playing an animation from an animation state. If nothing else is
+ * playing, or the same animation is restarted, the pose jumps straight to
+ * the start of it and true is returned. Otherwise the current pose is
+ * blended into the first frame of the new animation and nothing is written.
+ */
+bool anim_begin(anim_state *state, anim *next, int start_time, float *pose,
+    int n)
+{
+  bool fresh = state->curr_anim == NULL || next == state->curr_anim;
+
+  /* The current pose is kept to blend from, as a packed animation has no
+   * frames of its own to point at. */
+  if(!fresh && !state->blend)
+  {
+    state->blend = malloc(sizeof(float) * n);
+    fresh = state->blend == NULL;
+  }
+
+  /* There are a few assumptions made here regarding having a valid
+   * animation struct. An invalid structure may not function correctly. */
+  if(fresh)
+  {
+    state->curr_anim = next;
+
+    state->n_index =  1 % next->n_frames;
+    state->p_index = 0;
+
+    state->n_time = next->times[state->n_index] + start_time;
+    state->p_time = start_time;
+
+    state->n_frame = next->key_frames[state->n_index];
+    state->p_frame = next->key_frames[state->p_index];
+    if(next->packed)
+      packed_sample(next->packed, 0, pose);
+    else
+      memcpy(pose, state->n_frame, sizeof(float) * n);
+
+    return true;
+  }
+
+  /* There is currently another animation running, so switch between them. */
+  memcpy(state->blend, pose, sizeof(float) * n);
+  state->curr_anim = next;
+  state->p_index = -1;
+  state->p_frame = state->blend;
+  state->p_time  = start_time;
+  state->n_index = 0;
+  state->n_frame = next->key_frames[state->n_index];
+  state->n_time  = start_time + next->times[state->n_index];
+
+  return false;
+}
+
+
 /**
  * Adjusts the bones in a skeleton so that they are at an appropritae
  * interpolated point between two animation key_frames using the type of
@@ -122,29 +247,15 @@ bool anim_new_frame(anim *curr, float *new_frame, int time_int)
  */
 void animate(model *mdl, int now)
 {
-  anim *anim = mdl->curr_anim;
-  
+  anim_state *state = &mdl->state;
+
   /* If we're pointing to the same frame then we generally do not want to
    * animate anything, so return. */
-  if(mdl->n_index == mdl->p_index) return;
-  
-  /* First we need to update the animation loop to the current time. This
-   * loop should correctly forward an animation till it gets to the present
-   * time. */
-  if(now >= mdl->n_time)
-  {
-    while(now >= mdl->n_time)
-    {
-      mdl->p_time  = mdl->n_time;
-      mdl->n_time += anim->times[mdl->n_index];
-      mdl->p_index = mdl->n_index;
-      mdl->n_index = (mdl->n_index + 1) % anim->n_frames;
-      mdl->p_frame = anim->key_frames[mdl->p_index];
-      mdl->n_frame = anim->key_frames[mdl->n_index];
-    }
-  }
+  if(state->n_index == state->p_index) return;
 
-  int_keyframes(mdl, now);
+  anim_advance(state, now);
+  anim_sample(state, now, mdl->pose, mdl->n_bones * TRANS_SIZE);
+  skel_set_rots(mdl->bone_array, mdl->pose, mdl->n_bones);
 }
 
 
@@ -156,31 +267,50 @@ bool start_animation(model *mdl, int index, int start_time)
   if(index >= mdl->n_anims || !mdl->anims[index])
     return false;
 
-
-  /* There are a few assumptions made here regarding having a valid
-   * animation struct. An invalid structure may not function correctly.*/
-  if(mdl->curr_anim == NULL || mdl->anims[index] == mdl->curr_anim)
+  /* Animations are worked out in a flat pose before it is copied into the
+   * skeleton. */
+  if(mdl->pose == NULL)
   {
-    mdl->curr_anim = mdl->anims[index];
+    mdl->pose = malloc(sizeof(float) * mdl->n_bones * TRANS_SIZE);
+    if(mdl->pose == NULL)
+      return false;
+  }
 
-    mdl->n_index =  1 % mdl->curr_anim->n_frames;
-    mdl->p_index = 0;
+  if(anim_begin(&mdl->state, mdl->anims[index], start_time, mdl->pose,
+        mdl->n_bones * TRANS_SIZE))
+    skel_set_rots(mdl->bone_array, mdl->pose, mdl->n_bones);
 
-    mdl->n_time = mdl->curr_anim->times[mdl->n_index] + start_time;
-    mdl->p_time = start_time;
+  return true;
+}
 
-    mdl->n_frame = mdl->curr_anim->key_frames[mdl->n_index];
-    mdl->p_frame = mdl->curr_anim->key_frames[mdl->p_index];
-    skel_set_rots(mdl->bone_array, mdl->n_frame, mdl->n_bones);
-  }
-  /* There is currently another animation running, so switch between them. */
-  else
-  {
-    mdl->curr_anim = mdl->anims[index];
-    mdl->n_index = 0;
-    mdl->n_time = start_time + mdl->curr_anim->times[mdl->n_index];
-  }
 
+/**
+ * Animates an instance. Works just like animate but only ever touches the
+ * pose of the instance, never the shared skeleton.
+ */
+void animate_instance(instance *inst, int now)
+{
+  anim_state *state = &inst->state;
+
+  if(!inst->pose || state->n_index == state->p_index) return;
+
+  anim_advance(state, now);
+  anim_sample(state, now, inst->pose, inst->base->n_bones * TRANS_SIZE);
+}
+
+
+/**
+ * Starts one of the base models animations on an instance.
+ */
+bool start_instance_animation(instance *inst, int index, int start_time)
+{
+  model *base = inst->base;
+
+  if(!inst->pose || index >= base->n_anims || !base->anims[index])
+    return false;
+
+  anim_begin(&inst->state, base->anims[index], start_time, inst->pose,
+      base->n_bones * TRANS_SIZE);
   return true;
 }
 
@@ -211,32 +341,135 @@ float int_linear_quick(float a, float y0, float y1)
 
 
 /**
- * Linearly interpolates between keyframes of an animation for a given
- * model.
+ * Linearly interpolates between keyframes of an animation, filling in a pose
+ * of n values.
  */
-void int_keyframes(model *mdl, int now)
+void int_keyframes(anim_state *state, int now, float *pose, int n)
 {
-  float a = (now - mdl->p_time) / (float)(mdl->n_time - mdl->p_time);
-  float *from = mdl->p_frame;
-  float *to = mdl->n_frame;
-  int i, j;
-  bone *curr_bone;
+  float a = (now - state->p_time) / (float)(state->n_time - state->p_time);
+  float *from = state->p_frame;
+  float *to = state->n_frame;
+  int i;
 
-  /* Loop through all bones in a model. */
-  for(i = 0; i < mdl->n_bones; i++)
-  {
-    curr_bone = mdl->bone_array[i];
+  /* Actual interpolation happens here. */
+  for(i = 0; i < n; i++)
+    pose[i] = int_linear_quick(a, from[i], to[i]);
+}
 
-    /* Actual interpolation happens here. */
-    for(j = 0; j < TRANS_SIZE; j++)
-    {
-      if(curr_bone->rot[j] != *to)
-       curr_bone->rot[j] = int_linear_quick(a, *from, *to);
 
-      from++; to++;
-    }
+
+/**
+ * Looks up an interpolation mode from the name used in model files.
+ * Unknown names fall back to linear interpolation.
+ */
+int interp_from_name(const char *name)
+{
+  if(name == NULL)
+    return INTERP_LINEAR;
+  if(streq(name, "catmull"))
+    return INTERP_CATMULL;
+  if(streq(name, "hermite"))
+    return INTERP_HERMITE;
+
+  return INTERP_LINEAR;
+}
+
+
+/**
+ * Returns the name model files use for an interpolation mode.
+ */
+const char *interp_name(int interp)
+{
+  static const char *names[] = {"linear", "catmull", "hermite"};
+
+  if(interp < INTERP_LINEAR || interp > INTERP_HERMITE)
+    return names[INTERP_LINEAR];
+  return names[interp];
+}
+
+
+/**
+ * Works out the weights given to the four frames around a cubic segment,
+ * the frame before the segment, its two ends and the frame after it. a is
+ * how far through the segment we are. r0 and r2 are the lengths of the
+ * segment divided by the lengths of the segments before and after it, and
+ * are only used by the Hermite mode.
+ *
+ * equation source: en.wikipedia.org/wiki/Cubic_Hermite_spline
+ *
+ * The tangents are finite differences of the neighbouring frames, which
+ * makes every term linear in the frames so the curve for every channel is
+ * just a weighted sum of the same four frames.
+ */
+void int_cubic_weights(float a, float r0, float r2, int interp, float w[4])
+{
+  float a2 = a * a, a3 = a2 * a;
+  float h00 =  2 * a3 - 3 * a2 + 1;
+  float h10 =      a3 - 2 * a2 + a;
+  float h01 = -2 * a3 + 3 * a2;
+  float h11 =      a3 -     a2;
+
+  if(interp == INTERP_CATMULL)
+    r0 = r2 = 1.0;
+
+  w[0] = -0.5 * h10 * r0;
+  w[1] = h00 + 0.5 * h10 * (r0 - 1.0) - 0.5 * h11;
+  w[2] = h01 + 0.5 * h10 + 0.5 * h11 * (1.0 - r2);
+  w[3] = 0.5 * h11 * r2;
+}
+
+
+/**
+ * Computes out[i] = w0 f0[i] + w1 f1[i] + w2 f2[i] + w3 f3[i] for n floats.
+ * This is the whole cost of cubic interpolation once the weights are known
+ * so it's done four channels at a time where SSE is avaliable.
+ */
+void pose_blend4(float *out, float *f[4], float w[4], int n)
+{
+  int i = 0;
+
+#ifdef __SSE__
+  __m128 w0 = _mm_set1_ps(w[0]), w1 = _mm_set1_ps(w[1]);
+  __m128 w2 = _mm_set1_ps(w[2]), w3 = _mm_set1_ps(w[3]);
+  __m128 acc;
+
+  for(; i + 4 <= n; i += 4)
+  {
+    acc = _mm_mul_ps(w0, _mm_loadu_ps(f[0] + i));
+    acc = _mm_add_ps(acc, _mm_mul_ps(w1, _mm_loadu_ps(f[1] + i)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(w2, _mm_loadu_ps(f[2] + i)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(w3, _mm_loadu_ps(f[3] + i)));
+    _mm_storeu_ps(out + i, acc);
   }
+#endif
 
-  return;
+  /* Whatever is left over, or everything without SSE. */
+  for(; i < n; i++)
+    out[i] = w[0] * f[0][i] + w[1] * f[1][i] + w[2] * f[2][i] +
+      w[3] * f[3][i];
 }
 
+
+/**
+ * Cubic version of int_keyframes. The frames either side of the current
+ * pair are found by wrapping around the animation loop and all channels are
+ * blended in one sweep.
+ */
+void int_keyframes_cubic(anim_state *state, int now, float *pose, int n)
+{
+  anim *anim = state->curr_anim;
+  int before = (state->p_index + anim->n_frames - 1) % anim->n_frames;
+  int after  = (state->n_index + 1) % anim->n_frames;
+  float a = (now - state->p_time) / (float)(state->n_time - state->p_time);
+  float span = state->n_time - state->p_time;
+  float w[4], *f[4];
+
+  f[0] = anim->key_frames[before];
+  f[1] = state->p_frame;
+  f[2] = state->n_frame;
+  f[3] = anim->key_frames[after];
+
+  int_cubic_weights(a, span / anim->times[before],
+      span / anim->times[state->n_index], anim->interp, w);
+  pose_blend4(pose, f, w, n);
+}
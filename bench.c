@@ -0,0 +1,953 @@
+/**
+ * bench.c
+ *
+ * Command line benchmarks. Each one is a function taking its own arguments
+ * and is listed in the benches table at the bottom of the file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "3d.h"
+#include "util.h"
+#include "jobs.h"
+#include "load_mdl.h"
+#include "drawing.h"
+#include "flight.h"
+#include "boids.h"
+#include "skin.h"
+#include "bvh.h"
+#include "cull.h"
+#include "capture.h"
+#include "video.h"
+#include "pngstrip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define BENCH_FRAMES 100
+#define BENCH_FRAME_MS 16
+
+
+/**
+ * Returns a time in milliseconds from a fixed point, for timing.
+ */
+double bench_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/**
+ * Reads an optional integer argument, falling back to a default.
+ */
+int bench_arg(int argc, char **argv, int index, int fallback)
+{
+  if(index < argc && atoi(argv[index]) > 0)
+    return atoi(argv[index]);
+  return fallback;
+}
+
+
+/**
+ * Loads a model for use in a benchmark, quitting if it can't be found.
+ */
+model *bench_load(const char *file_name)
+{
+  model *mdl = load_model(file_name);
+
+  if(!mdl)
+  {
+    fprintf(stderr, "ERROR(bench_load): Unable to load '%s'.\n", file_name);
+    exit(1);
+  }
+
+  return mdl;
+}
+
+
+/**
+ * Times a flight mode frame update of a flock of birds with every thread
+ * count from one up to the number of processors.
+ * Arguments: [<birds>] [<frames>] [<max threads>]
+ */
+int bench_jobs(int argc, char **argv)
+{
+  int count  = bench_arg(argc, argv, 0, 10000);
+  int frames = bench_arg(argc, argv, 1, BENCH_FRAMES);
+  int cpus   = bench_arg(argc, argv, 2, jobs_cpu_count()), threads, i;
+  int now = 0;
+  double start, ms, base = 0.0;
+
+  flight_init();
+  for(i = 0; i < count; i++)
+    flight_add_bird(-(int)(R * 1000));
+
+  printf("\nFrame update of %d birds, %d frames.\n", flight_count(), frames);
+  printf("%8s %12s %10s\n", "threads", "ms/frame", "speedup");
+
+  for(threads = 1; threads <= cpus; threads *= 2)
+  {
+    jobs_init(threads);
+
+    start = bench_ms();
+    for(i = 0; i < frames; i++)
+      flight_update(now += BENCH_FRAME_MS);
+    ms = (bench_ms() - start) / frames;
+
+    if(threads == 1)
+      base = ms;
+    printf("%8d %12.3f %9.2fx\n", jobs_threads(), ms, base / ms);
+
+    jobs_shutdown();
+
+    /* Always finish with every processor, even if that's not a power of
+     * two. */
+    if(threads < cpus && threads * 2 > cpus)
+      threads = cpus / 2;
+  }
+
+  draw_cleanup();
+  flight_cleanup();
+
+  return 0;
+}
+
+
+/**
+ * Compares moving the flock with the vectorised update against the same
+ * circles worked out one bird at a time with cos and sin, and checks how
+ * far the sine approximation strays.
+ * Arguments: [<birds>] [<frames>]
+ */
+int bench_flock(int argc, char **argv)
+{
+  int count  = bench_arg(argc, argv, 0, 100000);
+  int frames = bench_arg(argc, argv, 1, BENCH_FRAMES);
+  float *angle, *speed, *radius, *pos, passed = BENCH_FRAME_MS / 1000.0;
+  float x, s, c, error = 0.0;
+  double start, ref_ms, flock_ms;
+  int i, j;
+
+  flight_init();
+  for(i = 0; i < count; i++)
+    flight_add_bird(0);
+
+  /* The reference keeps its own copy of the circles. */
+  angle  = malloc(sizeof(float) * count);
+  speed  = malloc(sizeof(float) * count);
+  radius = malloc(sizeof(float) * count);
+  pos    = malloc(sizeof(float) * count * 2);
+  if(!angle || !speed || !radius || !pos) return 1;
+
+  for(i = 0; i < count; i++)
+  {
+    angle[i]  = R * 360;
+    speed[i]  = R * 40 + 80;
+    radius[i] = R * 100 + 60;
+  }
+
+  start = bench_ms();
+  for(j = 0; j < frames; j++)
+    for(i = 0; i < count; i++)
+    {
+      pos[2 * i]     = radius[i] * cos(RAD(angle[i]));
+      pos[2 * i + 1] = radius[i] * sin(RAD(angle[i]));
+      angle[i] = mod(angle[i] + passed * speed[i], 360);
+    }
+  ref_ms = (bench_ms() - start) / frames;
+
+  start = bench_ms();
+  for(j = 0; j < frames; j++)
+    flight_move(passed, 0, count);
+  flock_ms = (bench_ms() - start) / frames;
+
+  for(x = -MY_PI; x < MY_PI; x += 0.0001)
+  {
+    fast_sincos(x, &s, &c);
+    if(fabs(s - sin(x)) > error) error = fabs(s - sin(x));
+    if(fabs(c - cos(x)) > error) error = fabs(c - cos(x));
+  }
+
+  printf("\nMoving %d birds, %d frames, one thread.\n", count, frames);
+  printf("%-24s %10.3f ms/frame\n", "cos/sin per bird:", ref_ms);
+  printf("%-24s %10.3f ms/frame (%.1fx)\n", "flock update:", flock_ms,
+      ref_ms / flock_ms);
+  printf("%-24s %10.5f\n", "max sin/cos error:", error);
+
+  free(angle);
+  free(speed);
+  free(radius);
+  free(pos);
+  draw_cleanup();
+  flight_cleanup();
+
+  return 0;
+}
+
+
+/**
+ * Fills a flock with birds scattered over the space it keeps to, flying in
+ * random directions, and drops a few obstacles among them. The space grows
+ * with the flock so that every size is as crowded as ten thousand birds in
+ * the flight mode world.
+ */
+void bench_boids_fill(boids *b, int count)
+{
+  float pos[3], vel[3];
+  int i;
+
+  boids_init(b);
+  b->params.bounds *= sqrt(count / 10000.0);
+  for(i = 0; i < count; i++)
+  {
+    pos[0] = (R * 2.0 - 1.0) * b->params.bounds;
+    pos[1] = R * (b->params.ceiling - b->params.floor) + b->params.floor;
+    pos[2] = (R * 2.0 - 1.0) * b->params.bounds;
+    vel[0] = (R * 2.0 - 1.0) * b->params.max_speed;
+    vel[1] = (R * 2.0 - 1.0) * b->params.min_speed;
+    vel[2] = (R * 2.0 - 1.0) * b->params.max_speed;
+    boids_add(b, pos, vel);
+  }
+
+  for(i = 0; i < 4; i++)
+  {
+    pos[0] = (R * 2.0 - 1.0) * b->params.bounds;
+    pos[1] = b->params.floor;
+    pos[2] = (R * 2.0 - 1.0) * b->params.bounds;
+    boids_add_obstacle(b, pos, 30.0);
+  }
+}
+
+
+/**
+ * Times a flocking step using the grid on every thread against checking
+ * every pair of birds on one thread, for flocks of a thousand birds up to
+ * max. Big flocks only time the pairwise check on a sample of the birds and
+ * scale it up.
+ * Arguments: [<max birds>] [<frames>]
+ */
+int bench_boids(int argc, char **argv)
+{
+  int max    = bench_arg(argc, argv, 0, 100000);
+  int frames = bench_arg(argc, argv, 1, BENCH_FRAMES / 10);
+  float passed = BENCH_FRAME_MS / 1000.0, error, *keep;
+  int count, sample, i;
+  double start, grid_ms, brute_ms;
+  boids b;
+
+  jobs_init(global.n_threads);
+
+  printf("\nFlocking step, %d threads for the grid, %d frames.\n",
+      jobs_threads(), frames);
+  printf("%8s %12s %12s %10s %10s\n", "birds", "grid ms", "pairs ms",
+      "speedup", "max diff");
+
+  for(count = 1000; count <= max; count *= 10)
+  {
+    bench_boids_fill(&b, count);
+
+    /* Settle the flock a little so birds have neighbours to find. */
+    for(i = 0; i < 10; i++)
+      boids_step(&b, passed);
+
+    start = bench_ms();
+    for(i = 0; i < frames; i++)
+      boids_step(&b, passed);
+    grid_ms = (bench_ms() - start) / frames;
+
+    /* One step each way from the same state, which should agree. Every
+     * neighbour is counted so the pairwise check does all of its work and
+     * the order neighbours are found in doesn't matter. */
+    sample = count < 1000 ? count : 1000;
+    keep = malloc(sizeof(float) * count);
+    if(!keep) return 1;
+    b.params.max_neighbours = count;
+
+    boids_build_grid(&b);
+    boids_step_grid(&b, passed, 0, count);
+    for(i = 0; i < count; i++)
+      keep[i] = b.nvx[i];
+
+    start = bench_ms();
+    boids_step_brute(&b, passed, 0, sample);
+    brute_ms = (bench_ms() - start) * count / sample;
+
+    error = 0.0;
+    for(i = 0; i < sample; i++)
+      if(fabs(b.nvx[i] - keep[i]) > error)
+        error = fabs(b.nvx[i] - keep[i]);
+    free(keep);
+
+    printf("%8d %12.3f %12.3f %9.1fx %10.4f\n", count, grid_ms, brute_ms,
+        brute_ms / grid_ms, error);
+
+    boids_free(&b);
+  }
+
+  jobs_shutdown();
+
+  return 0;
+}
+
+
+/**
+ * Compares making birds by cloning the whole model against making
+ * instances that share it, in time taken and memory used per bird.
+ * Arguments: [<birds>]
+ */
+int bench_instances(int argc, char **argv)
+{
+  int count = bench_arg(argc, argv, 0, 100000), i;
+  model *base = bench_load("data/model/bird.mdl"), **clones;
+  instance **insts;
+  double start, clone_ms, inst_ms, clone_free_ms, inst_free_ms;
+  size_t clone_bytes, inst_bytes, pose_bytes;
+
+  clones = malloc(sizeof(model *) * count);
+  insts  = malloc(sizeof(instance *) * count);
+  if(!clones || !insts) return 1;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+  {
+    clones[i] = clone_model(base);
+    start_animation(clones[i], 0, 0);
+  }
+  clone_ms = bench_ms() - start;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+    model_shallow_free(clones[i]);
+  clone_free_ms = bench_ms() - start;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+  {
+    insts[i] = new_instance(base);
+    start_instance_animation(insts[i], 0, 0);
+  }
+  inst_ms = bench_ms() - start;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+    free_instance(insts[i]);
+  inst_free_ms = bench_ms() - start;
+
+  /* What each one asks malloc for, not counting malloc's own overhead. */
+  pose_bytes  = sizeof(float) * base->n_bones * TRANS_SIZE;
+  clone_bytes = sizeof(model) + (base->name ? strlen(base->name) + 1 : 0) +
+    sizeof(anim *) * base->n_anims + sizeof(bone) * base->n_bones +
+    sizeof(bone *) * base->n_bones + pose_bytes;
+  inst_bytes  = sizeof(instance) + pose_bytes;
+
+  printf("\nCreating %d birds of %d bones.\n", count, base->n_bones);
+  printf("%-10s %14s %14s %12s %8s\n", "", "create us", "free us",
+      "bytes", "mallocs");
+  printf("%-10s %14.3f %14.3f %12lu %8d\n", "clone", clone_ms * 1000 / count,
+      clone_free_ms * 1000 / count, (unsigned long)clone_bytes,
+      base->n_bones + 5);
+  printf("%-10s %14.3f %14.3f %12lu %8d\n", "instance", inst_ms * 1000 / count,
+      inst_free_ms * 1000 / count, (unsigned long)inst_bytes, 1);
+
+  free(clones);
+  free(insts);
+
+  return 0;
+}
+
+
+/**
+ * Compares the CPU side of drawing a bird bone by bone against drawing it
+ * as one skinned mesh, either skinned by a shader from the palette or
+ * entirely on the CPU as the fallback does. The draw calls each bird takes
+ * are printed too, as the card side can't be timed without a window.
+ * Arguments: [<birds>]
+ */
+int bench_skin(int argc, char **argv)
+{
+  int count = bench_arg(argc, argv, 0, 1000), i, bones = 0;
+  model *base = bench_load("data/model/bird.mdl");
+  skin_mesh *skin = skin_build(base);
+  instance **insts;
+  float m[16], *mats, *out, *pose;
+  double start, bone_ms, palette_ms, cpu_ms;
+
+  insts = malloc(sizeof(instance *) * count);
+  mats  = malloc(sizeof(float) * 16 * base->n_bones);
+  if(!skin || !insts || !mats) return 1;
+
+  /* Spread the birds through the flying animation. */
+  for(i = 0; i < count; i++)
+  {
+    insts[i] = new_instance(base);
+    start_instance_animation(insts[i], 0, 0);
+    animate_instance(insts[i], i * 37);
+  }
+
+  for(i = 0; i < base->n_bones; i++)
+    if(base->bone_array[i]->geometry)
+      bones++;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+  {
+    m4_identity(m);
+    out  = mats;
+    pose = insts[i]->pose;
+    skel_pose_matrices(base->root, &pose, m, &out, 16);
+  }
+  bone_ms = bench_ms() - start;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+    skin_palette(skin, base->root, insts[i]->pose, skin->palette);
+  palette_ms = bench_ms() - start;
+
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+  {
+    skin_palette(skin, base->root, insts[i]->pose, skin->palette);
+    skin_cpu(skin, skin->palette);
+  }
+  cpu_ms = bench_ms() - start;
+
+  printf("\nPosing %d birds of %d bones, %d vertices.\n", count, base->n_bones,
+      skin->n_verts);
+  printf("%-14s %12s %12s\n", "", "us / bird", "draws / bird");
+  printf("%-14s %12.3f %12d\n", "per bone", bone_ms * 1000 / count, bones);
+  printf("%-14s %12.3f %12d\n", "shader skin", palette_ms * 1000 / count, 1);
+  printf("%-14s %12.3f %12d\n", "cpu skin", cpu_ms * 1000 / count, 1);
+
+  for(i = 0; i < count; i++)
+    free_instance(insts[i]);
+  free(insts);
+  free(mats);
+
+  return 0;
+}
+
+
+/**
+ * Counts spheres, 4 floats each, really in the frustum set with
+ * cull_frustum, as the tree finds ones whose boxes are.
+ */
+typedef struct bench_hits
+{
+  float *spheres;
+  int found;
+} bench_hits;
+
+void bench_frustum_visit(void *data, int id)
+{
+  bench_hits *h = data;
+
+  if(!cull_sphere(h->spheres + id * 4, h->spheres[id * 4 + 3]))
+    h->found++;
+}
+
+void bench_sphere_visit(void *data, int id)
+{
+  ((bench_hits *)data)->found++;
+}
+
+float bench_ray_test(void *data, int id, float org[3], float dir[3])
+{
+  return ray_sphere(org, dir, (float *)data + id * 4);
+}
+
+float bench_dist(void *data, int id, float p[3])
+{
+  float d[3];
+
+  v_sub(d, p, (float *)data + id * 4);
+  return v_dot(d, d);
+}
+
+
+/**
+ * Times the bounding volume hierarchy on a crowd of spheres flying around a
+ * world that grows with the crowd, as the flock benchmarks do. Building,
+ * moving and each kind of query are timed, and the queries are checked
+ * against looking at every sphere, which is also timed. The slow checks
+ * only run over a sample of the queries and are scaled up.
+ * Arguments: [<spheres>] [<frames>]
+ */
+int bench_bvh(int argc, char **argv)
+{
+  int count  = bench_arg(argc, argv, 0, 100000);
+  int frames = bench_arg(argc, argv, 1, BENCH_FRAMES / 10);
+  float size = 512.0 * sqrt(count / 10000.0), passed = BENCH_FRAME_MS / 1000.0;
+  float *spheres, *vel, *boxes, proj[16], view[16], clip[16], org[3], dir[3];
+  float best, t, d, f = 1.0 / tan(RAD(65.0) / 2.0);
+  int i, j, k, moved, queries, sample, hit, want, wrong;
+  double start, tree_ms, flat_ms;
+  bench_hits h;
+  bvh tree;
+
+  spheres = malloc(sizeof(float) * 4 * count);
+  vel     = malloc(sizeof(float) * 3 * count);
+  boxes   = malloc(sizeof(float) * 6 * count);
+  if(!spheres || !vel || !boxes) return 1;
+
+  for(i = 0; i < count; i++)
+  {
+    spheres[i * 4 + 0] = (R * 2.0 - 1.0) * size;
+    spheres[i * 4 + 1] = R * 100.0;
+    spheres[i * 4 + 2] = (R * 2.0 - 1.0) * size;
+    spheres[i * 4 + 3] = 2.0 + R * 2.0;
+    for(k = 0; k < 3; k++)
+      vel[i * 3 + k] = (R * 2.0 - 1.0) * 30.0;
+  }
+
+  #define BENCH_BOX(i) \
+    for(k = 0; k < 3; k++) \
+    { \
+      boxes[(i) * 6 + k]     = spheres[(i) * 4 + k] - spheres[(i) * 4 + 3]; \
+      boxes[(i) * 6 + k + 3] = spheres[(i) * 4 + k] + spheres[(i) * 4 + 3]; \
+    }
+
+  for(i = 0; i < count; i++)
+  {
+    BENCH_BOX(i);
+  }
+
+  printf("\nBounding volume hierarchy, %d spheres.\n", count);
+  printf("%-16s %12s %12s %10s %8s\n", "operation", "tree ms", "linear ms",
+      "speedup", "wrong");
+
+  bvh_init(&tree, DRAW_TREE_MARGIN);
+
+  start = bench_ms();
+  bvh_build(&tree, boxes, count);
+  printf("%-16s %12.3f\n", "build", bench_ms() - start);
+
+  bvh_clear(&tree);
+  start = bench_ms();
+  for(i = 0; i < count; i++)
+    bvh_insert(&tree, i, boxes + i * 6);
+  printf("%-16s %12.3f\n", "insert all", bench_ms() - start);
+
+  /* Fly everything about for a while, refitting as it goes. */
+  moved = 0;
+  start = bench_ms();
+  for(j = 0; j < frames; j++)
+    for(i = 0; i < count; i++)
+    {
+      for(k = 0; k < 3; k++)
+        spheres[i * 4 + k] += vel[i * 3 + k] * passed;
+      BENCH_BOX(i);
+      moved += bvh_move(&tree, i, boxes + i * 6);
+    }
+  printf("%-16s %12.3f %12s %10s %8s  (%.1f%% reinserted)\n", "move frame",
+      (bench_ms() - start) / frames, "", "", "",
+      100.0 * moved / ((double)count * frames));
+
+  #undef BENCH_BOX
+
+  /* A camera looking out over the crowd from a few directions. */
+  memset(proj, 0, sizeof(proj));
+  proj[0]  = f / (4.0 / 3.0);
+  proj[5]  = f;
+  proj[10] = -(1024.0 + 1.0) / (1024.0 - 1.0);
+  proj[11] = -1.0;
+  proj[14] = -2.0 * 1024.0 * 1.0 / (1024.0 - 1.0);
+
+  tree_ms = flat_ms = 0.0;
+  wrong = 0;
+  for(j = 0; j < frames; j++)
+  {
+    m4_identity(view);
+    m4_rotate(view, 15.0, X);
+    m4_rotate(view, j * 360.0 / frames, Y);
+    m4_translate(view, 0.0, -60.0, 0.0);
+    m4_mul(clip, proj, view);
+    cull_frustum(clip);
+
+    h.spheres = spheres;
+    h.found = 0;
+    start = bench_ms();
+    cull_tree(&tree, bench_frustum_visit, &h);
+    tree_ms += bench_ms() - start;
+
+    want = 0;
+    start = bench_ms();
+    for(i = 0; i < count; i++)
+      if(!cull_sphere(spheres + i * 4, spheres[i * 4 + 3]))
+        want++;
+    flat_ms += bench_ms() - start;
+
+    wrong += h.found != want;
+  }
+  printf("%-16s %12.3f %12.3f %9.1fx %8d\n", "frustum", tree_ms / frames,
+      flat_ms / frames, flat_ms / tree_ms, wrong);
+
+  /* Rays from above the crowd down into it, as a mouse pick would be. */
+  queries = 1000;
+  sample = 100;
+  tree_ms = flat_ms = 0.0;
+  wrong = 0;
+  for(j = 0; j < queries; j++)
+  {
+    org[0] = (R * 2.0 - 1.0) * size;
+    org[1] = 200.0;
+    org[2] = (R * 2.0 - 1.0) * size;
+    dir[0] = R * 2.0 - 1.0;
+    dir[1] = -1.0;
+    dir[2] = R * 2.0 - 1.0;
+    v_norm(dir);
+
+    start = bench_ms();
+    hit = bvh_ray(&tree, org, dir, HUGE_VAL, bench_ray_test, spheres, NULL);
+    tree_ms += bench_ms() - start;
+
+    if(j >= sample)
+      continue;
+
+    want = -1;
+    best = HUGE_VAL;
+    start = bench_ms();
+    for(i = 0; i < count; i++)
+    {
+      t = ray_sphere(org, dir, spheres + i * 4);
+      if(t >= 0.0 && t < best)
+      {
+        best = t;
+        want = i;
+      }
+    }
+    flat_ms += bench_ms() - start;
+    wrong += hit != want;
+  }
+  printf("%-16s %12.3f %12.3f %9.1fx %8d\n", "ray", tree_ms / queries,
+      flat_ms / sample, flat_ms / sample / (tree_ms / queries), wrong);
+
+  /* The nearest other sphere to each of a sample of them. */
+  queries = count < 10000 ? count : 10000;
+  tree_ms = flat_ms = 0.0;
+  wrong = 0;
+  for(j = 0; j < queries; j++)
+  {
+    start = bench_ms();
+    hit = bvh_nearest(&tree, spheres + j * 4, HUGE_VAL, j, bench_dist,
+        spheres, NULL);
+    tree_ms += bench_ms() - start;
+
+    if(j >= sample)
+      continue;
+
+    want = -1;
+    best = HUGE_VAL;
+    start = bench_ms();
+    for(i = 0; i < count; i++)
+    {
+      d = bench_dist(spheres, i, spheres + j * 4);
+      if(i != j && d < best)
+      {
+        best = d;
+        want = i;
+      }
+    }
+    flat_ms += bench_ms() - start;
+    wrong += hit != want &&
+             bench_dist(spheres, hit, spheres + j * 4) != best;
+  }
+  printf("%-16s %12.3f %12.3f %9.1fx %8d\n", "nearest", tree_ms / queries,
+      flat_ms / sample, flat_ms / sample / (tree_ms / queries), wrong);
+
+  /* Everything within a flock's neighbour radius of each of a sample. */
+  tree_ms = flat_ms = 0.0;
+  wrong = 0;
+  for(j = 0; j < queries; j++)
+  {
+    h.found = 0;
+    start = bench_ms();
+    bvh_sphere(&tree, spheres + j * 4, 24.0, bench_sphere_visit, &h);
+    tree_ms += bench_ms() - start;
+
+    if(j >= sample)
+      continue;
+
+    /* Boxes that come near enough, as the tree measures it. */
+    want = 0;
+    start = bench_ms();
+    for(i = 0; i < count; i++)
+    {
+      if(tree.leaf_of[i] >= 0)
+      {
+        d = 0.0;
+        for(k = 0; k < 3; k++)
+        {
+          t = tree.nodes[tree.leaf_of[i]].box[k] - spheres[j * 4 + k];
+          if(t < 0.0)
+            t = spheres[j * 4 + k] - tree.nodes[tree.leaf_of[i]].box[k + 3];
+          if(t > 0.0)
+            d += t * t;
+        }
+        want += d <= 24.0 * 24.0;
+      }
+    }
+    flat_ms += bench_ms() - start;
+    wrong += h.found != want;
+  }
+  printf("%-16s %12.3f %12.3f %9.1fx %8d\n", "neighbours", tree_ms / queries,
+      flat_ms / sample, flat_ms / sample / (tree_ms / queries), wrong);
+
+  bvh_free(&tree);
+  free(spheres);
+  free(vel);
+  free(boxes);
+
+  return 0;
+}
+
+
+/**
+ * Returns the size of a file in bytes, or 0 if it can't be read.
+ */
+long bench_file_size(const char *name)
+{
+  FILE *f = fopen(name, "rb");
+  long size = 0;
+
+  if(f)
+  {
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+  }
+  return size;
+}
+
+
+/**
+ * Makes up a w by h frame to write out, as there is no window to draw one
+ * in: a smooth sky over noisy ground, which compresses about as well as
+ * the real thing. Rows go from the bottom up, as they are read back.
+ * Returns NULL if there isn't the memory.
+ */
+unsigned char *bench_frame(int w, int h)
+{
+  unsigned char *rgb = malloc(w * h * 3), *p;
+  int x, y, k;
+
+  if(!rgb) return NULL;
+
+  srand(1);
+  for(y = 0; y < h; y++)
+    for(x = 0; x < w; x++)
+    {
+      p = rgb + (y * w + x) * 3;
+      if(y > h / 3)
+      {
+        p[0] = 90 + 100 * y / h;
+        p[1] = 140 + 80 * y / h;
+        p[2] = 230;
+      }
+      else
+      {
+        k = 20 * sin(x * 0.05) * cos(y * 0.07) + rand() % 8;
+        p[0] = 60 + k;
+        p[1] = 100 + k;
+        p[2] = 30 + k / 2;
+      }
+    }
+
+  return rgb;
+}
+
+
+/**
+ * Times writing frames each way -record can: as PNG files, and as Y4M and
+ * raw RGB streams. Converting to YUV is also timed on its own, with SIMD
+ * and a pixel at a time. The files are written in the current directory
+ * and removed afterwards.
+ * Arguments: [<width>] [<height>] [<frames>]
+ */
+int bench_capture(int argc, char **argv)
+{
+  int w = bench_arg(argc, argv, 0, 800), h = bench_arg(argc, argv, 1, 600);
+  int frames = bench_arg(argc, argv, 2, 30), i, k;
+  const char *names[3] = {"bench_capture.png", "bench_capture.y4m",
+                          "bench_capture.rgb"};
+  const char *sinks[3] = {"png", "y4m", "raw rgb"};
+  unsigned char *rgb, *yuv;
+  double start, ms;
+  long bytes;
+  FILE *out;
+
+  rgb = bench_frame(w, h);
+  yuv = malloc(video_yuv_size(w, h));
+  if(!rgb || !yuv) return 1;
+
+  start = bench_ms();
+  for(i = 0; i < frames; i++)
+    video_rgb_to_yuv_scalar(yuv, rgb, w, h);
+  ms = (bench_ms() - start) / frames;
+
+  printf("\nWriting %d frames of %dx%d.\n", frames, w, h);
+  printf("%-14s %10s %10s %12s\n", "", "ms/frame", "frames/s", "KB/frame");
+  printf("%-14s %10.3f %10.1f\n", "yuv scalar", ms, 1000.0 / ms);
+
+  start = bench_ms();
+  for(i = 0; i < frames; i++)
+    video_rgb_to_yuv(yuv, rgb, w, h);
+  ms = (bench_ms() - start) / frames;
+  printf("%-14s %10.3f %10.1f\n", "yuv simd", ms, 1000.0 / ms);
+
+  for(k = 0; k < 3; k++)
+  {
+    out = NULL;
+    if(k > 0 && !(out = fopen(names[k], "wb")))
+    {
+      fprintf(stderr, "ERROR(bench_capture): Unable to open '%s'.\n",
+          names[k]);
+      continue;
+    }
+    if(k == 1)
+      video_y4m_header(out, w, h, 30);
+
+    start = bench_ms();
+    for(i = 0; i < frames; i++)
+    {
+      if(k == 0)
+        capture_png(names[k], rgb, w, h);
+      else if(k == 1)
+      {
+        video_rgb_to_yuv(yuv, rgb, w, h);
+        video_y4m_frame(out, yuv, w, h);
+      }
+      else
+        video_rgb_frame(out, rgb, w, h);
+    }
+    if(out)
+      fclose(out);
+    ms = (bench_ms() - start) / frames;
+
+    bytes = bench_file_size(names[k]);
+    if(k > 0)
+      bytes /= frames;
+    printf("%-14s %10.3f %10.1f %12.1f\n", sinks[k], ms, 1000.0 / ms,
+        bytes / 1024.0);
+    remove(names[k]);
+  }
+
+  free(rgb);
+  free(yuv);
+
+  return 0;
+}
+
+
+/**
+ * Times writing a frame as a PNG with libpng at a few compression levels
+ * and row filters, then compressed in strips on more and more threads.
+ * The file is written in the current directory and removed afterwards.
+ * Arguments: [<width>] [<height>] [<frames>] [<max threads>]
+ */
+int bench_png(int argc, char **argv)
+{
+  int w = bench_arg(argc, argv, 0, 800), h = bench_arg(argc, argv, 1, 600);
+  int frames = bench_arg(argc, argv, 2, 5);
+  int cpus = bench_arg(argc, argv, 3, jobs_cpu_count());
+  int levels[3] = {1, 6, 9}, l, f, threads, i;
+  const char *filters[6] = {"none", "sub", "up", "avg", "paeth", "all"};
+  const char *name = "bench_png.png";
+  unsigned char *rgb = bench_frame(w, h);
+  double start, ms;
+
+  if(!rgb) return 1;
+
+  printf("\nWriting %d frames of %dx%d as PNG.\n", frames, w, h);
+  printf("%-8s %6s %6s %8s %10s %12s\n", "", "level", "filter", "threads",
+      "ms/frame", "KB/frame");
+
+  for(l = 0; l < 3; l++)
+    for(f = PNG_ROW_NONE; f <= PNG_ROW_ADAPTIVE; f++)
+    {
+      if(f == PNG_ROW_SUB || f == PNG_ROW_AVG)
+        continue;
+
+      capture_options(levels[l], f, 1);
+      start = bench_ms();
+      for(i = 0; i < frames; i++)
+        capture_png(name, rgb, w, h);
+      ms = (bench_ms() - start) / frames;
+
+      printf("%-8s %6d %6s %8d %10.3f %12.1f\n", "libpng", levels[l],
+          filters[f], 1, ms, bench_file_size(name) / 1024.0);
+    }
+
+  /* Always finish with every processor, as bench_jobs does. */
+  for(threads = 1; threads <= cpus; threads *= 2)
+  {
+    start = bench_ms();
+    for(i = 0; i < frames; i++)
+      pngstrip_write(name, rgb, w, h, 6, PNG_ROW_ADAPTIVE, threads);
+    ms = (bench_ms() - start) / frames;
+
+    printf("%-8s %6d %6s %8d %10.3f %12.1f\n", "strips", 6,
+        filters[PNG_ROW_ADAPTIVE], threads, ms,
+        bench_file_size(name) / 1024.0);
+
+    if(threads < cpus && threads * 2 > cpus)
+      threads = cpus / 2;
+  }
+
+  capture_options(-1, PNG_ROW_ADAPTIVE, 1);
+  remove(name);
+  free(rgb);
+
+  return 0;
+}
+
+
+/**
+ * Table of avaliable benchmarks.
+ */
+typedef struct bench
+{
+  const char *name;
+  int (*func)(int argc, char **argv);
+  const char *usage;
+} bench;
+
+static bench benches[] = {
+  { "jobs",  bench_jobs,  "[<birds>] [<frames>] [<max threads>]" },
+  { "flock", bench_flock, "[<birds>] [<frames>]" },
+  { "boids", bench_boids, "[<max birds>] [<frames>]" },
+  { "instances", bench_instances, "[<birds>]" },
+  { "skin",  bench_skin,  "[<birds>]" },
+  { "bvh",   bench_bvh,   "[<spheres>] [<frames>]" },
+  { "capture", bench_capture, "[<width>] [<height>] [<frames>]" },
+  { "png",   bench_png,   "[<width>] [<height>] [<frames>] [<max threads>]" },
+};
+
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+
+/**
+ * Runs the benchmark with the given name, passing it the remaining command
+ * line arguments. Returns the benchmark's exit status.
+ */
+int bench_run(const char *name, int argc, char **argv)
+{
+  unsigned int i;
+
+  for(i = 0; name && i < N_BENCHES; i++)
+    if(streq(name, benches[i].name))
+      return benches[i].func(argc, argv);
+
+  fprintf(stderr, "ERROR(bench_run): Unknown benchmark '%s'. Try one of:\n",
+      name ? name : "");
+  for(i = 0; i < N_BENCHES; i++)
+    fprintf(stderr, "  -bench %s %s\n", benches[i].name, benches[i].usage);
+
+  return 1;
+}
@@ -0,0 +1,18 @@
+/**
+ * bench.h
+ *
+ * Benchmarks that can be run from the command line with
+ *
+ *   robot -bench <name> [<args>]
+ *
+ * They run without a window, print their results and exit.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+
+extern int bench_run(const char *name, int argc, char **argv);
+
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * blob.c
+ *
+ * A blob's middle is found by following the sun from the middle of the
+ * model down to the ground plane. A sphere's shadow on the ground is an
+ * ellipse, as wide as the sphere across the sun and drawn out along it by
+ * one over the sine of how high the sun is, so each blob is a quad of that
+ * shape lying in the plane. The quads are written into one vertex array
+ * as they are added and sent together, with the spot texture's alpha
+ * cutting them round so the stencil only catches the spot itself.
+ */
+
+#include "blob.h"
+#include "drawing.h"
+#include "mem.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* A corner of a blob, laid out for GL_T2F_V3F. */
+typedef struct blob_vert
+{
+  float t[2];
+  float v[3];
+} blob_vert;
+
+
+GLuint blob_tex = 0;
+
+blob_vert *blob_verts = NULL;   /* Four corners for each blob. */
+int blob_n = 0, blob_cap = 0;
+
+float blob_ground[4];
+float blob_sun[3];              /* Straight along the sunlight. */
+float blob_u[3], blob_v[3];     /* Along and across the sun in the ground. */
+float blob_stretch;             /* How much longer than wide each blob is. */
+
+
+/**
+ * Makes the spot texture, which is opaque in the middle and fades out to
+ * nothing at the edge. Returns false if the memory could not be found.
+ */
+bool blob_init()
+{
+  GLubyte *spot;
+  float x, y, d;
+  int i, j;
+
+  if(blob_tex)
+    return true;
+
+  spot = malloc(BLOB_TEX_SIZE * BLOB_TEX_SIZE);
+  if(!spot)
+  {
+    fprintf(stderr, "ERROR(blob_init): Out of memory.\n");
+    return false;
+  }
+
+  for(i = 0; i < BLOB_TEX_SIZE; i++)
+    for(j = 0; j < BLOB_TEX_SIZE; j++)
+    {
+      x = (j + 0.5) / BLOB_TEX_SIZE * 2.0 - 1.0;
+      y = (i + 0.5) / BLOB_TEX_SIZE * 2.0 - 1.0;
+      d = clamp((1.0 - sqrt(x * x + y * y)) * 3.0, 0.0, 1.0);
+      spot[i * BLOB_TEX_SIZE + j] = (GLubyte)(255.0 * d);
+    }
+
+  glGenTextures(1, &blob_tex);
+  glBindTexture(GL_TEXTURE_2D, blob_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, BLOB_TEX_SIZE, BLOB_TEX_SIZE, 0,
+      GL_ALPHA, GL_UNSIGNED_BYTE, spot);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  free(spot);
+  return true;
+}
+
+
+/**
+ * Frees the texture and the vertex array.
+ */
+void blob_cleanup()
+{
+  if(blob_tex)
+    glDeleteTextures(1, &blob_tex);
+  blob_tex = 0;
+
+  FREE(blob_verts);
+  blob_verts = NULL;
+  blob_n = blob_cap = 0;
+}
+
+
+/**
+ * Empties the blobs ready for a new frame, with the ground plane they lie
+ * in and the sun direction they are thrown along.
+ */
+void blob_begin(float ground[4], float sun[4])
+{
+  float up, len;
+  int i;
+
+  blob_n = 0;
+
+  len = sqrt(v_dot(ground, ground));
+  for(i = 0; i < 4; i++)
+    blob_ground[i] = ground[i] / len;
+  v_copy(blob_sun, sun);
+  v_norm(blob_sun);
+
+  /* The sun's direction along the ground, or any direction in it if the
+   * sun is straight overhead. */
+  up = v_dot(blob_sun, blob_ground);
+  for(i = 0; i < 3; i++)
+    blob_u[i] = blob_sun[i] - up * blob_ground[i];
+  if(v_dot(blob_u, blob_u) < 1e-6)
+  {
+    v_clear(blob_u);
+    blob_u[fabs(blob_ground[0]) < 0.5 ? 0 : 1] = 1.0;
+    v_cross(blob_v, blob_ground, blob_u);
+    v_cross(blob_u, blob_v, blob_ground);
+  }
+  v_norm(blob_u);
+  v_cross(blob_v, blob_ground, blob_u);
+
+  blob_stretch = fabs(up) > 1e-2 ? 1.0 / fabs(up) : 100.0;
+}
+
+
+/**
+ * Adds the blob of a sphere of radius r about c. Nothing is added if the
+ * sun never takes it down to the ground.
+ */
+void blob_add(float c[3], float r)
+{
+  static const float corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  float along, t, s[3], a, b;
+  blob_vert *verts, *out;
+  int cap, i, k;
+
+  along = v_dot(blob_ground, blob_sun);
+  if(fabs(along) < 1e-4)
+    return;
+
+  /* Follow the sun back from the middle to where it meets the ground. */
+  t = -(v_dot(blob_ground, c) + blob_ground[3]) / along;
+  for(k = 0; k < 3; k++)
+    s[k] = c[k] + t * blob_sun[k];
+
+  if(blob_n == blob_cap)
+  {
+    cap = blob_cap ? blob_cap * 2 : BLOB_START_CAP;
+    verts = realloc(blob_verts, sizeof(blob_vert) * 4 * cap);
+    if(!verts)
+    {
+      fprintf(stderr, "ERROR(blob_add): Out of memory.\n");
+      return;
+    }
+    blob_verts = verts;
+    blob_cap = cap;
+  }
+
+  r *= BLOB_SCALE;
+  out = blob_verts + blob_n * 4;
+  for(i = 0; i < 4; i++)
+  {
+    out[i].t[0] = corners[i][0];
+    out[i].t[1] = corners[i][1];
+
+    a = (corners[i][0] * 2.0 - 1.0) * r * blob_stretch;
+    b = (corners[i][1] * 2.0 - 1.0) * r;
+    for(k = 0; k < 3; k++)
+      out[i].v[k] = s[k] + a * blob_u[k] + b * blob_v[k];
+  }
+  blob_n++;
+}
+
+
+/**
+ * Returns the number of blobs added since blob_begin.
+ */
+int blob_count()
+{
+  return blob_n;
+}
+
+
+/**
+ * Draws every blob added since blob_begin in one call, in the current
+ * colour and with the current stencil and depth settings, as the flat
+ * shadows are.
+ */
+void blob_draw()
+{
+  if(blob_n == 0 || !blob_tex)
+    return;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, blob_tex);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glEnable(GL_ALPHA_TEST);
+  glAlphaFunc(GL_GREATER, 0.0);
+  glDisable(GL_CULL_FACE);
+  global.state_changes += 2;
+
+  glInterleavedArrays(GL_T2F_V3F, 0, blob_verts);
+  glDrawArrays(GL_QUADS, 0, blob_n * 4);
+  global.draw_calls++;
+  global.upload_bytes += sizeof(blob_vert) * 4 * blob_n;
+
+  glPopClientAttrib();
+  glPopAttrib();
+}
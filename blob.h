@@ -0,0 +1,29 @@
+/**
+ * blob.h
+ *
+ * Blob shadows for models too far away for their shadow to be worth
+ * drawing properly. Each is a soft round spot laid flat on the ground
+ * where the sun would throw the middle of the model, stretched out the way
+ * the sun is shining, and every blob in a frame is drawn in one call.
+ */
+
+#ifndef _BLOB_H_
+#define _BLOB_H_
+
+#include "global.h"
+
+#define BLOB_TEX_SIZE  32       /* Width and height of the spot texture. */
+#define BLOB_START_CAP 64       /* Blobs there is first room for. */
+#define BLOB_SCALE     0.3      /* Blob radius over the model's radius. */
+
+
+/* Interface. */
+extern bool blob_init();
+extern void blob_cleanup();
+extern void blob_begin(float ground[4], float sun[4]);
+extern void blob_add(float c[3], float r);
+extern int blob_count();
+extern void blob_draw();
+
+
+#endif
@@ -0,0 +1,512 @@
+/**
+ * boids.c
+ *
+ * Implementation of the flocking in boids.h.
+ *
+ * The grid is built with a counting sort on the hashed cell of each bird,
+ * so rebuilding it is a couple of straight passes over the flock. Different
+ * cells can land on the same slot of the table; that only costs a few extra
+ * distance checks as every candidate is checked against the real radius.
+ *
+ * A step reads only the current arrays and writes only the next ones, so
+ * the birds can be split over any number of threads.
+ */
+
+#include "boids.h"
+#include "jobs.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define BOIDS_START_CAP 64
+#define BOIDS_MIN_CELLS 64
+#define BOIDS_GRAIN 128
+
+/* Large primes for hashing grid cells. */
+#define HASH_X 73856093u
+#define HASH_Y 19349663u
+#define HASH_Z 83492791u
+
+
+/**
+ * Running totals over the neighbours of one bird.
+ */
+typedef struct boid_sums
+{
+  float sep[3];                 /* Push away from birds that are too close. */
+  float vel[3];                 /* Sum of neighbour velocities. */
+  float pos[3];                 /* Sum of neighbour positions. */
+  int n;                        /* Neighbours counted. */
+} boid_sums;
+
+/**
+ * Everything a step job needs.
+ */
+typedef struct boids_frame
+{
+  boids *b;
+  float passed;
+} boids_frame;
+
+
+/* Function prototypes. */
+bool boids_reserve(boids *b, int cap);
+unsigned int boids_hash(boids *b, int cx, int cy, int cz);
+void boids_neighbour(boids_params *p, float self[3], float other[6],
+    boid_sums *s);
+void boids_finish(boids *b, int i, boid_sums *s, float passed);
+void boids_job(void *data, int start, int end);
+
+
+/**
+ * Sets up an empty flock with the default tuning.
+ */
+void boids_init(boids *b)
+{
+  b->x = b->y = b->z = b->vx = b->vy = b->vz = NULL;
+  b->nx = b->ny = b->nz = b->nvx = b->nvy = b->nvz = NULL;
+  b->cell_of = b->cell_start = b->cell_items = NULL;
+  b->cell_data = NULL;
+  b->count = b->cap = b->n_cells = 0;
+  b->n_obstacles = 0;
+
+  b->params.view           = 24.0;
+  b->params.personal       = 8.0;
+  b->params.max_neighbours = 16;
+  b->params.separation     = 3.0;
+  b->params.alignment      = 1.0;
+  b->params.cohesion       = 2.0;
+  b->params.avoidance      = 4.0;
+  b->params.min_speed      = 40.0;
+  b->params.max_speed      = 100.0;
+  b->params.max_accel      = 200.0;
+  b->params.bounds         = 450.0;
+  b->params.floor          = 15.0;
+  b->params.ceiling        = 120.0;
+  b->params.margin         = 40.0;
+}
+
+
+/**
+ * Frees the arrays of a flock.
+ */
+void boids_free(boids *b)
+{
+  FREE(b->x);   FREE(b->y);   FREE(b->z);
+  FREE(b->vx);  FREE(b->vy);  FREE(b->vz);
+  FREE(b->nx);  FREE(b->ny);  FREE(b->nz);
+  FREE(b->nvx); FREE(b->nvy); FREE(b->nvz);
+  FREE(b->cell_of);
+  FREE(b->cell_start);
+  FREE(b->cell_items);
+  FREE(b->cell_data);
+
+  b->x = b->y = b->z = b->vx = b->vy = b->vz = NULL;
+  b->nx = b->ny = b->nz = b->nvx = b->nvy = b->nvz = NULL;
+  b->cell_of = b->cell_start = b->cell_items = NULL;
+  b->cell_data = NULL;
+  b->count = b->cap = b->n_cells = 0;
+}
+
+
+/**
+ * Makes room for at least cap birds. Returns false if the memory could not
+ * be found, in which case the flock is unchanged.
+ */
+bool boids_reserve(boids *b, int cap)
+{
+  float **arrays[12];
+  float *grown;
+  int *ints;
+  int i;
+
+  if(cap <= b->cap)
+    return true;
+  if(cap < b->cap * 2)
+    cap = b->cap * 2;
+  if(cap < BOIDS_START_CAP)
+    cap = BOIDS_START_CAP;
+
+  arrays[0] = &b->x;   arrays[1]  = &b->y;   arrays[2]  = &b->z;
+  arrays[3] = &b->vx;  arrays[4]  = &b->vy;  arrays[5]  = &b->vz;
+  arrays[6] = &b->nx;  arrays[7]  = &b->ny;  arrays[8]  = &b->nz;
+  arrays[9] = &b->nvx; arrays[10] = &b->nvy; arrays[11] = &b->nvz;
+
+  for(i = 0; i < 12; i++)
+  {
+    grown = realloc(*arrays[i], sizeof(float) * cap);
+    if(!grown) return false;
+    *arrays[i] = grown;
+  }
+
+  ints = realloc(b->cell_of, sizeof(int) * cap);
+  if(!ints) return false;
+  b->cell_of = ints;
+
+  ints = realloc(b->cell_items, sizeof(int) * cap);
+  if(!ints) return false;
+  b->cell_items = ints;
+
+  grown = realloc(b->cell_data, sizeof(float) * cap * 6);
+  if(!grown) return false;
+  b->cell_data = grown;
+
+  b->cap = cap;
+  return true;
+}
+
+
+/**
+ * Adds a bird to the flock. Returns its index, or -1 if there was no room.
+ */
+int boids_add(boids *b, float pos[3], float vel[3])
+{
+  int i;
+
+  if(!boids_reserve(b, b->count + 1))
+  {
+    fprintf(stderr, "ERROR(boids_add): Unable to grow flock.\n");
+    return -1;
+  }
+
+  i = b->count++;
+  b->x[i]  = pos[0]; b->y[i]  = pos[1]; b->z[i]  = pos[2];
+  b->vx[i] = vel[0]; b->vy[i] = vel[1]; b->vz[i] = vel[2];
+
+  return i;
+}
+
+
+/**
+ * Takes bird i out of the flock. The last bird is moved into its place.
+ */
+void boids_remove(boids *b, int i)
+{
+  int last;
+
+  if(i < 0 || i >= b->count)
+    return;
+
+  last = --b->count;
+  b->x[i]  = b->x[last];  b->y[i]  = b->y[last];  b->z[i]  = b->z[last];
+  b->vx[i] = b->vx[last]; b->vy[i] = b->vy[last]; b->vz[i] = b->vz[last];
+}
+
+
+/**
+ * Adds a sphere for the flock to fly around. Returns false if there are
+ * already BOIDS_MAX_OBSTACLES.
+ */
+bool boids_add_obstacle(boids *b, float pos[3], float radius)
+{
+  float *o;
+
+  if(b->n_obstacles >= BOIDS_MAX_OBSTACLES)
+    return false;
+
+  o = b->obstacles[b->n_obstacles++];
+  o[0] = pos[0]; o[1] = pos[1]; o[2] = pos[2]; o[3] = radius;
+  return true;
+}
+
+
+/**
+ * Hashes a grid cell into the table.
+ */
+unsigned int boids_hash(boids *b, int cx, int cy, int cz)
+{
+  return ((unsigned int)cx * HASH_X ^ (unsigned int)cy * HASH_Y ^
+      (unsigned int)cz * HASH_Z) & (b->n_cells - 1);
+}
+
+
+/**
+ * Sorts the birds into the grid.
+ */
+void boids_build_grid(boids *b)
+{
+  float inv = 1.0 / b->params.view, *data;
+  int i, c, n_cells = BOIDS_MIN_CELLS, *starts;
+
+  /* Around two slots per bird keeps collisions rare. */
+  while(n_cells < b->count * 2)
+    n_cells *= 2;
+
+  if(n_cells != b->n_cells)
+  {
+    starts = realloc(b->cell_start, sizeof(int) * (n_cells + 1));
+    if(!starts)
+    {
+      fprintf(stderr, "ERROR(boids_build_grid): Out of memory.\n");
+      return;
+    }
+    b->cell_start = starts;
+    b->n_cells = n_cells;
+  }
+
+  for(c = 0; c <= b->n_cells; c++)
+    b->cell_start[c] = 0;
+
+  for(i = 0; i < b->count; i++)
+  {
+    c = boids_hash(b, (int)floor(b->x[i] * inv), (int)floor(b->y[i] * inv),
+        (int)floor(b->z[i] * inv));
+    b->cell_of[i] = c;
+    b->cell_start[c]++;
+  }
+
+  /* Each start becomes the end of its cell, then filling the cells from
+   * the back moves it down to the real start. */
+  for(c = 1; c <= b->n_cells; c++)
+    b->cell_start[c] += b->cell_start[c - 1];
+
+  for(i = b->count - 1; i >= 0; i--)
+    b->cell_items[--b->cell_start[b->cell_of[i]]] = i;
+
+  /* Copy the birds out in cell order so the birds in a cell sit next to
+   * each other in memory. */
+  for(c = 0; c < b->count; c++)
+  {
+    i = b->cell_items[c];
+    data = b->cell_data + c * 6;
+    data[0] = b->x[i];  data[1] = b->y[i];  data[2] = b->z[i];
+    data[3] = b->vx[i]; data[4] = b->vy[i]; data[5] = b->vz[i];
+  }
+}
+
+
+/**
+ * Adds a bird to the totals of the bird at self if it is close enough to
+ * notice. other holds the position then the velocity of the other bird.
+ */
+void boids_neighbour(boids_params *p, float self[3], float other[6],
+    boid_sums *s)
+{
+  float dx = self[0] - other[0];
+  float dy = self[1] - other[1];
+  float dz = self[2] - other[2];
+  float d2 = dx * dx + dy * dy + dz * dz, d, push;
+
+  if(d2 >= p->view * p->view)
+    return;
+
+  if(d2 < p->personal * p->personal)
+  {
+    d = sqrt(d2) + 0.001;
+    push = (p->personal - d) / (p->personal * d);
+    s->sep[0] += dx * push;
+    s->sep[1] += dy * push;
+    s->sep[2] += dz * push;
+  }
+
+  s->pos[0] += other[0]; s->pos[1] += other[1]; s->pos[2] += other[2];
+  s->vel[0] += other[3]; s->vel[1] += other[4]; s->vel[2] += other[5];
+  s->n++;
+}
+
+
+/**
+ * Turns the totals of bird i into a new velocity and position.
+ */
+void boids_finish(boids *b, int i, boid_sums *s, float passed)
+{
+  boids_params *p = &b->params;
+  float pos[3], vel[3], acc[3], avoid[3] = {0.0, 0.0, 0.0};
+  float d, push, len;
+  float *o;
+  int k;
+
+  pos[0] = b->x[i];  pos[1] = b->y[i];  pos[2] = b->z[i];
+  vel[0] = b->vx[i]; vel[1] = b->vy[i]; vel[2] = b->vz[i];
+
+  for(k = 0; k < 3; k++)
+    acc[k] = s->sep[k] * p->separation * p->max_speed;
+
+  if(s->n > 0)
+    for(k = 0; k < 3; k++)
+    {
+      acc[k] += (s->vel[k] / s->n - vel[k]) * p->alignment;
+      acc[k] += (s->pos[k] / s->n - pos[k]) * p->cohesion;
+    }
+
+  /* Turn back from the edges of the world, the ground and the sky. */
+  for(k = 0; k < 3; k += 2)
+  {
+    if(pos[k] > p->bounds - p->margin)
+      avoid[k] -= (pos[k] - p->bounds + p->margin) / p->margin;
+    else if(pos[k] < p->margin - p->bounds)
+      avoid[k] += (p->margin - p->bounds - pos[k]) / p->margin;
+  }
+  if(pos[1] < p->floor + p->margin)
+    avoid[1] += (p->floor + p->margin - pos[1]) / p->margin;
+  else if(pos[1] > p->ceiling - p->margin)
+    avoid[1] -= (pos[1] - p->ceiling + p->margin) / p->margin;
+
+  for(k = 0; k < b->n_obstacles; k++)
+  {
+    o = b->obstacles[k];
+    d = sqrt((pos[0] - o[0]) * (pos[0] - o[0]) +
+        (pos[1] - o[1]) * (pos[1] - o[1]) +
+        (pos[2] - o[2]) * (pos[2] - o[2])) + 0.001;
+    if(d < o[3] + p->margin)
+    {
+      push = (o[3] + p->margin - d) / (p->margin * d);
+      avoid[0] += (pos[0] - o[0]) * push;
+      avoid[1] += (pos[1] - o[1]) * push;
+      avoid[2] += (pos[2] - o[2]) * push;
+    }
+  }
+
+  for(k = 0; k < 3; k++)
+    acc[k] += avoid[k] * p->avoidance * p->max_speed;
+
+  len = sqrt(acc[0] * acc[0] + acc[1] * acc[1] + acc[2] * acc[2]);
+  if(len > p->max_accel)
+    for(k = 0; k < 3; k++)
+      acc[k] *= p->max_accel / len;
+
+  for(k = 0; k < 3; k++)
+    vel[k] += acc[k] * passed;
+
+  len = sqrt(vel[0] * vel[0] + vel[1] * vel[1] + vel[2] * vel[2]) + 0.001;
+  if(len > p->max_speed)
+    for(k = 0; k < 3; k++)
+      vel[k] *= p->max_speed / len;
+  else if(len < p->min_speed)
+    for(k = 0; k < 3; k++)
+      vel[k] *= p->min_speed / len;
+
+  b->nvx[i] = vel[0]; b->nvy[i] = vel[1]; b->nvz[i] = vel[2];
+  b->nx[i] = pos[0] + vel[0] * passed;
+  b->ny[i] = pos[1] + vel[1] * passed;
+  b->nz[i] = pos[2] + vel[2] * passed;
+}
+
+
+/**
+ * Steps the birds using the grid. Each bird looks in its own cell and the
+ * 26 around it. Birds are taken in cell order, from start up to end, so
+ * birds next to each other in the loop look through the same cells.
+ */
+void boids_step_grid(boids *b, float passed, int start, int end)
+{
+  float inv = 1.0 / b->params.view, self[3];
+  unsigned int seen[27], h;
+  int i, n, c, n_seen, cx, cy, cz, dx, dy, dz, k;
+  boid_sums s;
+
+  for(n = start; n < end; n++)
+  {
+    s.sep[0] = s.sep[1] = s.sep[2] = 0.0;
+    s.vel[0] = s.vel[1] = s.vel[2] = 0.0;
+    s.pos[0] = s.pos[1] = s.pos[2] = 0.0;
+    s.n = 0;
+    n_seen = 0;
+
+    i = b->cell_items[n];
+    self[0] = b->x[i]; self[1] = b->y[i]; self[2] = b->z[i];
+    cx = (int)floor(self[0] * inv);
+    cy = (int)floor(self[1] * inv);
+    cz = (int)floor(self[2] * inv);
+
+    for(dx = -1; dx <= 1; dx++)
+      for(dy = -1; dy <= 1; dy++)
+        for(dz = -1; dz <= 1; dz++)
+        {
+          h = boids_hash(b, cx + dx, cy + dy, cz + dz);
+
+          /* Two of the cells may share a slot; only look once. */
+          for(k = 0; k < n_seen && seen[k] != h; k++);
+          if(k < n_seen) continue;
+          seen[n_seen++] = h;
+
+          for(c = b->cell_start[h]; c < b->cell_start[h + 1] &&
+              s.n < b->params.max_neighbours; c++)
+            if(b->cell_items[c] != i)
+              boids_neighbour(&b->params, self, b->cell_data + c * 6, &s);
+        }
+
+    boids_finish(b, i, &s, passed);
+  }
+}
+
+
+/**
+ * Steps the birds from start up to end by checking every other bird. Gives
+ * the same result as the grid as long as no bird has more than
+ * max_neighbours in view. Used to check and time the grid against.
+ */
+void boids_step_brute(boids *b, float passed, int start, int end)
+{
+  float self[3], other[6];
+  boid_sums s;
+  int i, j;
+
+  for(i = start; i < end; i++)
+  {
+    s.sep[0] = s.sep[1] = s.sep[2] = 0.0;
+    s.vel[0] = s.vel[1] = s.vel[2] = 0.0;
+    s.pos[0] = s.pos[1] = s.pos[2] = 0.0;
+    s.n = 0;
+
+    self[0] = b->x[i]; self[1] = b->y[i]; self[2] = b->z[i];
+    for(j = 0; j < b->count && s.n < b->params.max_neighbours; j++)
+    {
+      if(j == i) continue;
+      other[0] = b->x[j];  other[1] = b->y[j];  other[2] = b->z[j];
+      other[3] = b->vx[j]; other[4] = b->vy[j]; other[5] = b->vz[j];
+      boids_neighbour(&b->params, self, other, &s);
+    }
+
+    boids_finish(b, i, &s, passed);
+  }
+}
+
+
+/**
+ * Job that steps a range of the flock.
+ */
+void boids_job(void *data, int start, int end)
+{
+  boids_frame *frame = data;
+
+  boids_step_grid(frame->b, frame->passed, start, end);
+}
+
+
+/**
+ * Makes the next positions and velocities the current ones.
+ */
+void boids_swap(boids *b)
+{
+  float *t;
+
+  t = b->x;  b->x  = b->nx;  b->nx  = t;
+  t = b->y;  b->y  = b->ny;  b->ny  = t;
+  t = b->z;  b->z  = b->nz;  b->nz  = t;
+  t = b->vx; b->vx = b->nvx; b->nvx = t;
+  t = b->vy; b->vy = b->nvy; b->nvy = t;
+  t = b->vz; b->vz = b->nvz; b->nvz = t;
+}
+
+
+/**
+ * Moves the whole flock on by passed seconds, spread over the job system.
+ */
+void boids_step(boids *b, float passed)
+{
+  boids_frame frame;
+
+  if(b->count == 0)
+    return;
+
+  boids_build_grid(b);
+
+  frame.b = b;
+  frame.passed = passed;
+  jobs_parallel_for(boids_job, &frame, b->count, BOIDS_GRAIN);
+
+  boids_swap(b);
+}
@@ -0,0 +1,85 @@
+/**
+ * boids.h
+ *
+ * Flocking birds. Every bird steers away from birds that are too close,
+ * turns to match the heading of its neighbours, drifts towards their centre
+ * and keeps clear of the ground, the edges of the world and any obstacles.
+ *
+ * Neighbours are found through a uniform grid of cells as wide as the
+ * neighbour radius, hashed into a table and rebuilt every step, so a step
+ * is O(N) as long as the birds don't all pile into one cell.
+ */
+
+#ifndef _BOIDS_H_
+#define _BOIDS_H_
+
+#include "global.h"
+
+#define BOIDS_MAX_OBSTACLES 16
+
+
+/**
+ * Tuning for a flock. Distances are in world units and times in seconds.
+ */
+typedef struct boids_params
+{
+  float view;                   /* Neighbour radius, also the cell size. */
+  float personal;               /* Separation radius. */
+  int max_neighbours;           /* Neighbours a bird pays attention to. */
+
+  float separation;             /* Weights of the three rules. */
+  float alignment;
+  float cohesion;
+  float avoidance;              /* Weight of steering clear of obstacles. */
+
+  float min_speed, max_speed;
+  float max_accel;
+
+  float bounds;                 /* 1/2 width of the space to stay inside. */
+  float floor, ceiling;         /* Heights to stay between. */
+  float margin;                 /* Distance from a limit to start turning. */
+} boids_params;
+
+/**
+ * A flock stored as parallel arrays. The next arrays are written by a step
+ * while the current ones are read, then the two are swapped.
+ */
+typedef struct boids
+{
+  float *x, *y, *z;             /* Positions. */
+  float *vx, *vy, *vz;          /* Velocities. */
+  float *nx, *ny, *nz;          /* Next positions. */
+  float *nvx, *nvy, *nvz;       /* Next velocities. */
+
+  int count;                    /* Birds in the flock. */
+  int cap;                      /* Birds there is room for. */
+
+  /* Spatial hash, rebuilt each step. The birds in cell c are
+   * cell_items[cell_start[c]] up to cell_items[cell_start[c + 1]]. */
+  int *cell_of;                 /* Hashed cell of each bird. */
+  int *cell_start;
+  int *cell_items;
+  float *cell_data;             /* Position and velocity in cell order. */
+  int n_cells;                  /* Table size, a power of two. */
+
+  float obstacles[BOIDS_MAX_OBSTACLES][4];      /* Spheres x, y, z, r. */
+  int n_obstacles;
+
+  boids_params params;
+} boids;
+
+
+/* Interface. */
+extern void boids_init(boids *b);
+extern void boids_free(boids *b);
+extern int boids_add(boids *b, float pos[3], float vel[3]);
+extern void boids_remove(boids *b, int i);
+extern bool boids_add_obstacle(boids *b, float pos[3], float radius);
+extern void boids_build_grid(boids *b);
+extern void boids_step(boids *b, float passed);
+extern void boids_step_grid(boids *b, float passed, int start, int end);
+extern void boids_step_brute(boids *b, float passed, int start, int end);
+extern void boids_swap(boids *b);
+
+
+#endif
@@ -7,6 +7,7 @@
 #include "mem.h"
 #include "util.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -212,6 +213,22 @@ float *skel_get_frame(bone **bone_array, int n_bones)
 }
 
 
+/**
+ * Copies the rotations in a bone array into an existing array of floats,
+ * in the same layout as skel_get_frame.
+ */
+void skel_copy_rots(bone **bone_array, float *rots, int n_bones)
+{
+  int i;
+
+  if(!bone_array || !rots)
+    return;
+
+  for(i = 0; i < n_bones; i++)
+    v_copy(rots + (3 * i), bone_array[i]->rot);
+}
+
+
 /**
  * Sets a skeletons rotations to a set of rotations specified in the 
  * rots array.
@@ -228,6 +245,95 @@ void skel_set_rots(bone **bone_array, float *rots, int n_bones)
 }
 
 
+
+/**
+ * Works out the matrix that each bone of a skeleton is drawn with, the same
+ * way draw_skeleton_pose builds them up on the OpenGL stack, starting from
+ * the model matrix m. Rotations come from the pose cursor as there, or from
+ * the bones if it is NULL. Each matrix is written at the out cursor, which
+ * then steps on by stride floats.
+ */
+void skel_pose_matrices(bone *skel, float **pose, float m[16], float **out,
+    int stride)
+{
+  float local[16];
+  float *rot;
+
+  if(skel == NULL) return;
+
+  if(pose)
+  {
+    rot = *pose;
+    *pose += TRANS_SIZE;
+  }
+  else
+    rot = skel->rot;
+
+  memcpy(local, m, sizeof(local));
+  m4_rotate(local, rot[RX], X);
+  m4_rotate(local, rot[RY], Y);
+  m4_rotate(local, rot[RZ], Z);
+
+  memcpy(*out, local, sizeof(local));
+  *out += stride;
+
+  /* Children hang off the end of this bone, siblings off the parent. */
+  m4_translate(local, skel->length, 0.0, 0.0);
+  skel_pose_matrices(skel->child, pose, local, out, stride);
+  skel_pose_matrices(skel->sibling, pose, m, out, stride);
+}
+
+/**
+ * Works out the bounding sphere of each bone's geometry, in the bone's own
+ * space. reach is how far the bone's joint can be from the root of the
+ * model in any pose. Returns the radius, around the root, of a sphere that
+ * holds the whole skeleton whatever its pose.
+ */
+float skel_bounds(bone *skel, float reach)
+{
+  float lo[3], hi[3], d[3], *v, r, far = 0.0;
+  int i, j;
+
+  if(skel == NULL) return 0.0;
+
+  v_clear(skel->bound);
+  skel->bound[3] = 0.0;
+
+  if(skel->geometry && skel->tri_count > 0)
+  {
+    /* Centre on the middle of the box round the vertices. */
+    v_copy(lo, skel->geometry + 5);
+    v_copy(hi, skel->geometry + 5);
+    for(i = 0, v = skel->geometry + 5; i < skel->tri_count; i++, v += 8)
+      for(j = 0; j < 3; j++)
+      {
+        if(v[j] < lo[j]) lo[j] = v[j];
+        if(v[j] > hi[j]) hi[j] = v[j];
+      }
+
+    for(j = 0; j < 3; j++)
+      skel->bound[j] = (lo[j] + hi[j]) * 0.5;
+
+    for(i = 0, v = skel->geometry + 5; i < skel->tri_count; i++, v += 8)
+    {
+      v_sub(d, v, skel->bound);
+      r = v_dot(d, d);
+      if(r > skel->bound[3]) skel->bound[3] = r;
+    }
+    skel->bound[3] = sqrt(skel->bound[3]);
+
+    far = reach + sqrt(v_dot(skel->bound, skel->bound)) + skel->bound[3];
+  }
+
+  /* Children hang off the end of this bone, siblings off the parent. */
+  r = skel_bounds(skel->child, reach + fabs(skel->length));
+  if(r > far) far = r;
+  r = skel_bounds(skel->sibling, reach);
+  if(r > far) far = r;
+
+  return far;
+}
+
 /**
  * Returns a shallow copy of a bone and all it's children. Most elements are
  * not copied but their references copied instead. This is mostly to save on
@@ -249,6 +355,10 @@ bone *clone_skel(bone *skel)
   clone->child_count = skel->child_count;
   clone->geometry    = skel->geometry;
   clone->tri_count   = skel->tri_count;
+  clone->vbo         = skel->vbo;
+
+  for(i = 0; i < 4; i++)
+    clone->bound[i] = skel->bound[i];
 
   /* Copy rotations. */
   for(i = 0; i < TRANS_SIZE; i++)
@@ -0,0 +1,764 @@
+/**
+ * bvh.c
+ *
+ * Implementation of the hierarchy in bvh.h.
+ *
+ * Leaves are put in by walking down from the root towards whichever child
+ * grows least in surface area, and stopping as soon as it would be cheaper
+ * to pair the new leaf with the whole subtree there, as the dynamic trees
+ * in most physics engines do. A full build splits the boxes in half along
+ * the longest axis of their centres, over and over.
+ *
+ * Queries walk the tree with an explicit stack, which never needs to be
+ * longer than the tree has nodes. The frustum query keeps track of the
+ * planes a box is already wholly inside, so deeper boxes are only tested
+ * against the planes they still straddle.
+ */
+
+#include "bvh.h"
+#include "mem.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Function prototypes. */
+bool bvh_reserve(bvh *t, int nodes);
+bool bvh_reserve_ids(bvh *t, int id);
+int bvh_alloc(bvh *t);
+void bvh_release(bvh *t, int n);
+float bvh_area(float b[6]);
+void bvh_union(float r[6], float a[6], float b[6]);
+void bvh_refit(bvh *t, int n);
+void bvh_select(int *idx, float *cent, int axis, int lo, int hi, int k);
+int bvh_build_range(bvh *t, float *boxes, int *idx, float *cent, int lo,
+    int hi);
+float bvh_box_dist(float b[6], float p[3]);
+float bvh_slab(float b[6], float org[3], float inv[3]);
+
+
+/**
+ * Sets up an empty tree. Leaves put in later are kept margin bigger than
+ * their boxes on every side.
+ */
+void bvh_init(bvh *t, float margin)
+{
+  t->nodes = NULL;
+  t->stack = NULL;
+  t->leaf_of = NULL;
+  t->cap = t->n_ids = t->count = 0;
+  t->root = t->free_node = -1;
+  t->margin = margin;
+}
+
+
+/**
+ * Frees everything a tree holds. It is left empty and can be used again.
+ */
+void bvh_free(bvh *t)
+{
+  FREE(t->nodes);
+  FREE(t->stack);
+  FREE(t->leaf_of);
+  bvh_init(t, t->margin);
+}
+
+
+/**
+ * Takes every leaf out of a tree, keeping the memory.
+ */
+void bvh_clear(bvh *t)
+{
+  int i;
+
+  t->root = -1;
+  t->count = 0;
+  t->free_node = -1;
+  for(i = t->cap - 1; i >= 0; i--)
+    bvh_release(t, i);
+
+  for(i = 0; i < t->n_ids; i++)
+    t->leaf_of[i] = -1;
+}
+
+
+/**
+ * Makes sure there are at least nodes unused nodes. Returns false if the
+ * memory could not be found.
+ */
+bool bvh_reserve(bvh *t, int nodes)
+{
+  bvh_node *new_nodes;
+  int *stack, cap, i, unused = 0;
+
+  for(i = t->free_node; i >= 0 && unused < nodes; i = t->nodes[i].parent)
+    unused++;
+  if(unused >= nodes)
+    return true;
+
+  cap = t->cap ? t->cap : BVH_START_CAP;
+  while(cap < t->cap + nodes - unused)
+    cap *= 2;
+
+  new_nodes = realloc(t->nodes, sizeof(bvh_node) * cap);
+  if(!new_nodes) return false;
+  t->nodes = new_nodes;
+
+  /* The frustum query keeps a node and a plane mask for each entry. */
+  stack = realloc(t->stack, sizeof(int) * 2 * cap);
+  if(!stack) return false;
+  t->stack = stack;
+
+  for(i = cap - 1; i >= t->cap; i--)
+    bvh_release(t, i);
+  t->cap = cap;
+
+  return true;
+}
+
+
+/**
+ * Makes room for ids up to and including id. Returns false if the memory
+ * could not be found.
+ */
+bool bvh_reserve_ids(bvh *t, int id)
+{
+  int *leaf_of, n, i;
+
+  if(id < t->n_ids)
+    return true;
+
+  n = t->n_ids ? t->n_ids : BVH_START_CAP;
+  while(n <= id)
+    n *= 2;
+
+  leaf_of = realloc(t->leaf_of, sizeof(int) * n);
+  if(!leaf_of) return false;
+  t->leaf_of = leaf_of;
+
+  for(i = t->n_ids; i < n; i++)
+    t->leaf_of[i] = -1;
+  t->n_ids = n;
+
+  return true;
+}
+
+
+/**
+ * Takes an unused node, which bvh_reserve must have made sure of.
+ */
+int bvh_alloc(bvh *t)
+{
+  int n = t->free_node;
+
+  t->free_node = t->nodes[n].parent;
+  t->nodes[n].parent = -1;
+  t->nodes[n].child[0] = t->nodes[n].child[1] = -1;
+  t->nodes[n].id = -1;
+
+  return n;
+}
+
+
+/**
+ * Gives a node back to be used again.
+ */
+void bvh_release(bvh *t, int n)
+{
+  t->nodes[n].parent = t->free_node;
+  t->nodes[n].id = -1;
+  t->free_node = n;
+}
+
+
+/**
+ * Returns half the surface area of a box, which is all the insertion costs
+ * need.
+ */
+float bvh_area(float b[6])
+{
+  float dx = b[3] - b[0], dy = b[4] - b[1], dz = b[5] - b[2];
+
+  return dx * dy + dy * dz + dz * dx;
+}
+
+
+/**
+ * Works out the box round two boxes. r may be either of them.
+ */
+void bvh_union(float r[6], float a[6], float b[6])
+{
+  int i;
+
+  for(i = 0; i < 3; i++)
+  {
+    r[i]     = a[i] < b[i] ? a[i] : b[i];
+    r[i + 3] = a[i + 3] > b[i + 3] ? a[i + 3] : b[i + 3];
+  }
+}
+
+
+/**
+ * Works the boxes out again from node n up to the root, stopping early once
+ * one comes out the same as it was.
+ */
+void bvh_refit(bvh *t, int n)
+{
+  bvh_node *node;
+  float box[6];
+
+  for(; n >= 0; n = node->parent)
+  {
+    node = &t->nodes[n];
+    bvh_union(box, t->nodes[node->child[0]].box,
+        t->nodes[node->child[1]].box);
+    if(memcmp(box, node->box, sizeof(box)) == 0)
+      return;
+    memcpy(node->box, box, sizeof(box));
+  }
+}
+
+
+/**
+ * Puts something with an id and a box into the tree. Returns false if it
+ * couldn't be, when there is no memory or the id is already there.
+ */
+bool bvh_insert(bvh *t, int id, float box[6])
+{
+  float fat[6], both[6], area, cost, inherit, child_cost[2];
+  int leaf, n, sibling, parent, i, k;
+  bvh_node *node, *c;
+
+  if(id < 0 || !bvh_reserve_ids(t, id) || t->leaf_of[id] >= 0)
+    return false;
+  if(!bvh_reserve(t, 2))
+  {
+    fprintf(stderr, "ERROR(bvh_insert): Out of memory.\n");
+    return false;
+  }
+
+  for(i = 0; i < 3; i++)
+  {
+    fat[i]     = box[i] - t->margin;
+    fat[i + 3] = box[i + 3] + t->margin;
+  }
+
+  leaf = bvh_alloc(t);
+  memcpy(t->nodes[leaf].box, fat, sizeof(fat));
+  t->nodes[leaf].id = id;
+  t->leaf_of[id] = leaf;
+  t->count++;
+
+  if(t->root < 0)
+  {
+    t->root = leaf;
+    return true;
+  }
+
+  /* Walk down to the cheapest place to pair the leaf up. */
+  n = t->root;
+  while(t->nodes[n].id < 0)
+  {
+    node = &t->nodes[n];
+    area = bvh_area(node->box);
+    bvh_union(both, node->box, fat);
+
+    /* Pairing with this node makes a new parent of the combined size, and
+     * going further down grows this node by that much anyway. */
+    cost = 2.0 * bvh_area(both);
+    inherit = 2.0 * (bvh_area(both) - area);
+
+    for(k = 0; k < 2; k++)
+    {
+      c = &t->nodes[node->child[k]];
+      bvh_union(both, c->box, fat);
+      child_cost[k] = bvh_area(both) + inherit;
+      if(c->id < 0)
+        child_cost[k] -= bvh_area(c->box);
+    }
+
+    if(cost < child_cost[0] && cost < child_cost[1])
+      break;
+    n = node->child[child_cost[1] < child_cost[0]];
+  }
+  sibling = n;
+
+  parent = bvh_alloc(t);
+  node = &t->nodes[parent];
+  node->parent = t->nodes[sibling].parent;
+  node->child[0] = sibling;
+  node->child[1] = leaf;
+  bvh_union(node->box, t->nodes[sibling].box, fat);
+
+  if(node->parent >= 0)
+  {
+    c = &t->nodes[node->parent];
+    c->child[c->child[1] == sibling] = parent;
+  }
+  else
+    t->root = parent;
+
+  t->nodes[sibling].parent = parent;
+  t->nodes[leaf].parent = parent;
+
+  bvh_refit(t, node->parent);
+  return true;
+}
+
+
+/**
+ * Takes the leaf with an id out of the tree, if it is there.
+ */
+void bvh_remove(bvh *t, int id)
+{
+  int leaf, parent, grand, sibling;
+  bvh_node *g;
+
+  if(id < 0 || id >= t->n_ids || t->leaf_of[id] < 0)
+    return;
+
+  leaf = t->leaf_of[id];
+  t->leaf_of[id] = -1;
+  t->count--;
+
+  if(leaf == t->root)
+  {
+    t->root = -1;
+    bvh_release(t, leaf);
+    return;
+  }
+
+  /* The leaf's sibling takes the place of their parent. */
+  parent  = t->nodes[leaf].parent;
+  grand   = t->nodes[parent].parent;
+  sibling = t->nodes[parent].child[t->nodes[parent].child[0] == leaf];
+
+  if(grand >= 0)
+  {
+    g = &t->nodes[grand];
+    g->child[g->child[1] == parent] = sibling;
+    t->nodes[sibling].parent = grand;
+    bvh_refit(t, grand);
+  }
+  else
+  {
+    t->root = sibling;
+    t->nodes[sibling].parent = -1;
+  }
+
+  bvh_release(t, parent);
+  bvh_release(t, leaf);
+}
+
+
+/**
+ * Gives the leaf with an id a new box, putting it in if it isn't there yet.
+ * Nothing changes while the box stays inside the leaf's margin. Returns
+ * true if the tree had to change.
+ */
+bool bvh_move(bvh *t, int id, float box[6])
+{
+  float *fat;
+  int i;
+
+  if(id >= 0 && id < t->n_ids && t->leaf_of[id] >= 0)
+  {
+    fat = t->nodes[t->leaf_of[id]].box;
+    for(i = 0; i < 3; i++)
+      if(box[i] < fat[i] || box[i + 3] > fat[i + 3])
+        break;
+    if(i == 3)
+      return false;
+
+    bvh_remove(t, id);
+  }
+
+  return bvh_insert(t, id, box);
+}
+
+
+/**
+ * Puts the index with the kth smallest centre along an axis at k, with
+ * smaller ones before it and larger ones after, between lo and hi.
+ */
+void bvh_select(int *idx, float *cent, int axis, int lo, int hi, int k)
+{
+  float pivot;
+  int i, j, swap;
+
+  while(hi - lo > 1)
+  {
+    pivot = cent[idx[(lo + hi) / 2] * 3 + axis];
+    i = lo;
+    j = hi - 1;
+
+    while(i <= j)
+    {
+      while(cent[idx[i] * 3 + axis] < pivot) i++;
+      while(cent[idx[j] * 3 + axis] > pivot) j--;
+      if(i <= j)
+      {
+        swap = idx[i];
+        idx[i++] = idx[j];
+        idx[j--] = swap;
+      }
+    }
+
+    if(k <= j)
+      hi = j + 1;
+    else if(k >= i)
+      lo = i;
+    else
+      return;
+  }
+}
+
+
+/**
+ * Builds the subtree over the boxes idx[lo] up to idx[hi] and returns its
+ * root.
+ */
+int bvh_build_range(bvh *t, float *boxes, int *idx, float *cent, int lo,
+    int hi)
+{
+  float clo[3], chi[3], *b;
+  int n, i, k, axis, mid;
+
+  if(hi - lo == 1)
+  {
+    n = bvh_alloc(t);
+    b = boxes + idx[lo] * 6;
+    for(k = 0; k < 3; k++)
+    {
+      t->nodes[n].box[k]     = b[k] - t->margin;
+      t->nodes[n].box[k + 3] = b[k + 3] + t->margin;
+    }
+    t->nodes[n].id = idx[lo];
+    t->leaf_of[idx[lo]] = n;
+    return n;
+  }
+
+  /* Split along the longest side of the box round the centres. */
+  for(k = 0; k < 3; k++)
+    clo[k] = chi[k] = cent[idx[lo] * 3 + k];
+  for(i = lo + 1; i < hi; i++)
+    for(k = 0; k < 3; k++)
+    {
+      if(cent[idx[i] * 3 + k] < clo[k]) clo[k] = cent[idx[i] * 3 + k];
+      if(cent[idx[i] * 3 + k] > chi[k]) chi[k] = cent[idx[i] * 3 + k];
+    }
+
+  axis = 0;
+  for(k = 1; k < 3; k++)
+    if(chi[k] - clo[k] > chi[axis] - clo[axis])
+      axis = k;
+
+  mid = (lo + hi) / 2;
+  bvh_select(idx, cent, axis, lo, hi, mid);
+
+  n = bvh_alloc(t);
+  t->nodes[n].child[0] = bvh_build_range(t, boxes, idx, cent, lo, mid);
+  t->nodes[n].child[1] = bvh_build_range(t, boxes, idx, cent, mid, hi);
+  t->nodes[t->nodes[n].child[0]].parent = n;
+  t->nodes[t->nodes[n].child[1]].parent = n;
+  bvh_union(t->nodes[n].box, t->nodes[t->nodes[n].child[0]].box,
+      t->nodes[t->nodes[n].child[1]].box);
+
+  return n;
+}
+
+
+/**
+ * Replaces everything in a tree with count boxes, given as 6 floats each,
+ * with ids 0 up to count - 1. Returns false if the memory could not be
+ * found, leaving the tree empty.
+ */
+bool bvh_build(bvh *t, float *boxes, int count)
+{
+  float *cent;
+  int *idx, i, k;
+
+  bvh_clear(t);
+  if(count <= 0)
+    return true;
+
+  idx  = malloc(sizeof(int) * count);
+  cent = malloc(sizeof(float) * 3 * count);
+  if(!idx || !cent || !bvh_reserve(t, 2 * count - 1) ||
+     !bvh_reserve_ids(t, count - 1))
+  {
+    fprintf(stderr, "ERROR(bvh_build): Out of memory.\n");
+    FREE(idx);
+    FREE(cent);
+    return false;
+  }
+
+  for(i = 0; i < count; i++)
+  {
+    idx[i] = i;
+    for(k = 0; k < 3; k++)
+      cent[i * 3 + k] = (boxes[i * 6 + k] + boxes[i * 6 + k + 3]) * 0.5;
+  }
+
+  t->root = bvh_build_range(t, boxes, idx, cent, 0, count);
+  t->count = count;
+
+  free(idx);
+  free(cent);
+  return true;
+}
+
+
+/**
+ * Calls visit for every leaf whose box is at least partly inside the six
+ * planes, which point inwards. Returns how many there were.
+ */
+int bvh_frustum(bvh *t, float planes[6][4], bvh_visit visit, void *data)
+{
+  int top = 0, found = 0, n, mask, p;
+  bvh_node *node;
+  float *b, *pl;
+
+  if(t->root < 0)
+    return 0;
+
+  t->stack[top++] = t->root;
+  t->stack[top++] = 0x3f;
+
+  while(top > 0)
+  {
+    mask = t->stack[--top];
+    n    = t->stack[--top];
+    node = &t->nodes[n];
+    b    = node->box;
+
+    for(p = 0; p < 6; p++)
+    {
+      if(!(mask & (1 << p)))
+        continue;
+      pl = planes[p];
+
+      /* The corner furthest along the normal decides if it's all out,
+       * the nearest one if it's all in. */
+      if(pl[0] * b[pl[0] > 0 ? 3 : 0] + pl[1] * b[pl[1] > 0 ? 4 : 1] +
+         pl[2] * b[pl[2] > 0 ? 5 : 2] + pl[3] < 0)
+        break;
+      if(pl[0] * b[pl[0] > 0 ? 0 : 3] + pl[1] * b[pl[1] > 0 ? 1 : 4] +
+         pl[2] * b[pl[2] > 0 ? 2 : 5] + pl[3] >= 0)
+        mask &= ~(1 << p);
+    }
+    if(p < 6)
+      continue;
+
+    if(node->id >= 0)
+    {
+      visit(data, node->id);
+      found++;
+      continue;
+    }
+
+    t->stack[top++] = node->child[0];
+    t->stack[top++] = mask;
+    t->stack[top++] = node->child[1];
+    t->stack[top++] = mask;
+  }
+
+  return found;
+}
+
+
+/**
+ * Returns the squared distance from a point to a box, 0 if it's inside.
+ */
+float bvh_box_dist(float b[6], float p[3])
+{
+  float d, sum = 0.0;
+  int k;
+
+  for(k = 0; k < 3; k++)
+  {
+    d = p[k] < b[k] ? b[k] - p[k] : (p[k] > b[k + 3] ? p[k] - b[k + 3] : 0.0);
+    sum += d * d;
+  }
+
+  return sum;
+}
+
+
+/**
+ * Calls visit for every leaf whose box comes within r of c. Returns how
+ * many there were.
+ */
+int bvh_sphere(bvh *t, float c[3], float r, bvh_visit visit, void *data)
+{
+  int top = 0, found = 0, n;
+  bvh_node *node;
+
+  if(t->root < 0)
+    return 0;
+
+  t->stack[top++] = t->root;
+  while(top > 0)
+  {
+    n = t->stack[--top];
+    node = &t->nodes[n];
+    if(bvh_box_dist(node->box, c) > r * r)
+      continue;
+
+    if(node->id >= 0)
+    {
+      visit(data, node->id);
+      found++;
+    }
+    else
+    {
+      t->stack[top++] = node->child[0];
+      t->stack[top++] = node->child[1];
+    }
+  }
+
+  return found;
+}
+
+
+/**
+ * Returns how far along a ray it enters a box, 0 if it starts inside, or
+ * -1 if it misses. inv holds 1 over each part of the direction.
+ */
+float bvh_slab(float b[6], float org[3], float inv[3])
+{
+  float t0 = 0.0, t1 = HUGE_VAL, a, c, swap;
+  int k;
+
+  for(k = 0; k < 3; k++)
+  {
+    a = (b[k] - org[k]) * inv[k];
+    c = (b[k + 3] - org[k]) * inv[k];
+    if(a > c) { swap = a; a = c; c = swap; }
+    if(a > t0) t0 = a;
+    if(c < t1) t1 = c;
+    if(t0 > t1) return -1.0;
+  }
+
+  return t0;
+}
+
+
+/**
+ * Finds the nearest thing a ray from org along dir hits before max_t. With
+ * no test function the leaf boxes themselves are what is hit. Returns the
+ * id hit and sets hit_t to how far along it was, or returns -1.
+ */
+int bvh_ray(bvh *t, float org[3], float dir[3], float max_t,
+    bvh_ray_test test, void *data, float *hit_t)
+{
+  float inv[3], best = max_t, d, d0, d1;
+  int top = 0, hit = -1, n, k;
+  bvh_node *node;
+
+  if(t->root < 0)
+    return -1;
+
+  for(k = 0; k < 3; k++)
+    inv[k] = dir[k] != 0.0 ? 1.0 / dir[k] : HUGE_VAL;
+
+  t->stack[top++] = t->root;
+  while(top > 0)
+  {
+    n = t->stack[--top];
+    node = &t->nodes[n];
+    d = bvh_slab(node->box, org, inv);
+    if(d < 0.0 || d > best)
+      continue;
+
+    if(node->id >= 0)
+    {
+      if(test)
+        d = test(data, node->id, org, dir);
+      if(d >= 0.0 && d < best)
+      {
+        best = d;
+        hit = node->id;
+      }
+      continue;
+    }
+
+    /* Look at the nearer child first so the other can often be skipped. */
+    d0 = bvh_slab(t->nodes[node->child[0]].box, org, inv);
+    d1 = bvh_slab(t->nodes[node->child[1]].box, org, inv);
+    if(d0 >= 0.0 && d1 >= 0.0 && d1 < d0)
+    {
+      t->stack[top++] = node->child[0];
+      t->stack[top++] = node->child[1];
+    }
+    else
+    {
+      if(d1 >= 0.0) t->stack[top++] = node->child[1];
+      if(d0 >= 0.0) t->stack[top++] = node->child[0];
+    }
+  }
+
+  if(hit >= 0 && hit_t)
+    *hit_t = best;
+  return hit;
+}
+
+
+/**
+ * Finds the nearest thing to p within max_dist, other than skip. With no
+ * distance function the leaf boxes themselves are measured. Returns its id
+ * and sets hit_dist to how far it is, or returns -1.
+ */
+int bvh_nearest(bvh *t, float p[3], float max_dist, int skip,
+    bvh_dist dist, void *data, float *hit_dist)
+{
+  float best = max_dist * max_dist, d, d0, d1;
+  int top = 0, hit = -1, n;
+  bvh_node *node;
+
+  if(t->root < 0)
+    return -1;
+
+  t->stack[top++] = t->root;
+  while(top > 0)
+  {
+    n = t->stack[--top];
+    node = &t->nodes[n];
+    d = bvh_box_dist(node->box, p);
+    if(d >= best)
+      continue;
+
+    if(node->id >= 0)
+    {
+      if(node->id == skip)
+        continue;
+      if(dist)
+        d = dist(data, node->id, p);
+      if(d < best)
+      {
+        best = d;
+        hit = node->id;
+      }
+      continue;
+    }
+
+    d0 = bvh_box_dist(t->nodes[node->child[0]].box, p);
+    d1 = bvh_box_dist(t->nodes[node->child[1]].box, p);
+    if(d1 < d0)
+    {
+      t->stack[top++] = node->child[0];
+      t->stack[top++] = node->child[1];
+    }
+    else
+    {
+      t->stack[top++] = node->child[1];
+      t->stack[top++] = node->child[0];
+    }
+  }
+
+  if(hit >= 0 && hit_dist)
+    *hit_dist = sqrt(best);
+  return hit;
+}
@@ -0,0 +1,84 @@
+/**
+ * bvh.h
+ *
+ * A bounding volume hierarchy over boxes, for finding what is in view, what
+ * a ray hits and what is near a point without looking at everything. Each
+ * thing is a leaf, known by an id, and can be added, moved and taken out
+ * one at a time. Leaves are kept a margin bigger than what they hold, so
+ * something moving a little doesn't touch the tree at all; when it leaves
+ * its box it is taken out and put back in where it now fits best.
+ *
+ * A set of boxes known up front can be built in one go instead, which
+ * gives a better tree faster than adding them one at a time.
+ *
+ * Boxes are six floats, the low corner then the high corner.
+ */
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "global.h"
+
+#define BVH_START_CAP 64        /* Nodes a new tree has room for. */
+
+
+/**
+ * A node of the tree. Leaves have an id and no children.
+ */
+typedef struct bvh_node
+{
+  float box[6];
+  int parent;
+  int child[2];
+  int id;                       /* Id of a leaf, -1 for other nodes. */
+} bvh_node;
+
+/**
+ * A tree. Nodes that aren't in use are chained through their parent.
+ */
+typedef struct bvh
+{
+  bvh_node *nodes;
+  int cap;                      /* Nodes there is room for. */
+  int root;                     /* Root node, or -1 when empty. */
+  int free_node;                /* First unused node, or -1. */
+
+  int *leaf_of;                 /* Leaf node of each id, or -1. */
+  int n_ids;                    /* Ids there is room for in leaf_of. */
+  int count;                    /* Leaves in the tree. */
+
+  float margin;                 /* Room left round each leaf. */
+  int *stack;                   /* Scratch for walking the tree. */
+} bvh;
+
+/* Called for every id found by a query. */
+typedef void (*bvh_visit)(void *data, int id);
+
+/* Returns how far along a ray the thing with an id is hit, or a negative
+ * number if it isn't. */
+typedef float (*bvh_ray_test)(void *data, int id, float org[3],
+    float dir[3]);
+
+/* Returns the squared distance from a point to the thing with an id. */
+typedef float (*bvh_dist)(void *data, int id, float p[3]);
+
+
+/* Interface. */
+extern void bvh_init(bvh *t, float margin);
+extern void bvh_free(bvh *t);
+extern void bvh_clear(bvh *t);
+extern bool bvh_build(bvh *t, float *boxes, int count);
+extern bool bvh_insert(bvh *t, int id, float box[6]);
+extern void bvh_remove(bvh *t, int id);
+extern bool bvh_move(bvh *t, int id, float box[6]);
+extern int bvh_frustum(bvh *t, float planes[6][4], bvh_visit visit,
+    void *data);
+extern int bvh_sphere(bvh *t, float c[3], float r, bvh_visit visit,
+    void *data);
+extern int bvh_ray(bvh *t, float org[3], float dir[3], float max_t,
+    bvh_ray_test test, void *data, float *hit_t);
+extern int bvh_nearest(bvh *t, float p[3], float max_dist, int skip,
+    bvh_dist dist, void *data, float *hit_dist);
+
+
+#endif
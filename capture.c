@@ -18,26 +18,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "pngstrip.h"
+
 #ifndef TRUE
 #  define TRUE 1
 #  define FALSE 0
 #endif
 
-int capture(const char *filename)
+/* Compression options, see capture_options. */
+static int capture_level = -1;
+static int capture_filter = PNG_ROW_ADAPTIVE;
+static int capture_threads = 1;
+
+void capture_options(int level, int filter, int threads)
+{
+    capture_level = level;
+    capture_filter = filter;
+    capture_threads = threads;
+}
+
+int capture_png(const char *filename, unsigned char *buffer, int width,
+    int height)
 {
-    int width, height;
     FILE *fp;
-    unsigned char *buffer;
     png_structp png_ptr;
     png_infop info_ptr;
     png_bytep *row_pointers;
     int i;
 
-    /* Determine size of window.  Replace this with lookups to your
-     * own global variables if you have them.
-     */
-    width = glutGet(GLUT_WINDOW_WIDTH);
-    height = glutGet(GLUT_WINDOW_HEIGHT);
+    static const int filter_masks[] = {
+        PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+        PNG_FILTER_PAETH, PNG_ALL_FILTERS
+    };
+
+    /*  Compress strips on several threads and write the file directly */
+    if (capture_threads > 1)
+        return pngstrip_write(filename, buffer, width, height,
+            capture_level, capture_filter, capture_threads);
 
     /* Open output file */
     fp = fopen(filename, "wb");
@@ -46,14 +63,6 @@ int capture(const char *filename)
         fprintf(stderr, "capture: Couln't open output file \"%s\"", filename);
         return FALSE;
     }
-    
-    /* Read buffer data from GL, allowing 3 bytes per pixel.
-     * Be sure to restore the alignment to 4-bytes if you need
-     * to.
-     */
-    buffer = (unsigned char *) malloc(width * height * 3);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
 
     /*  Initialize PNG structs */
     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
@@ -61,6 +70,7 @@ int capture(const char *filename)
     if (!png_ptr)
     {
         fprintf(stderr, "capture: Can't initialize png_ptr");
+        fclose(fp);
         return FALSE;
     }
     
@@ -69,6 +79,7 @@ int capture(const char *filename)
     {
          png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
          fprintf(stderr, "capture: Can't initialze info_ptr");
+         fclose(fp);
          return FALSE;
     }
 
@@ -95,6 +106,13 @@ int capture(const char *filename)
         PNG_INTERLACE_NONE,             /* Interlacing */
         PNG_COMPRESSION_TYPE_DEFAULT,   /* Compression */
         PNG_FILTER_TYPE_DEFAULT);       /* Filter method */
+
+    /*  Compression level and row filters */
+    if (capture_level >= 0)
+        png_set_compression_level(png_ptr, capture_level);
+    if (capture_filter >= PNG_ROW_NONE && capture_filter <= PNG_ROW_ADAPTIVE)
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+            filter_masks[capture_filter]);
     
     /*  Set up row pointers.  OpenGL stores the buffer in reverse
      *  row order to PNG (bottom-to-top instead of top-to-bottom),
@@ -102,20 +120,49 @@ int capture(const char *filename)
      */
     row_pointers = png_malloc(png_ptr, height * sizeof(png_bytep));
     for (i = 0; i< height; i++)
-        row_pointers[i] = &buffer[(height - i) * width * 3];
+        row_pointers[i] = &buffer[(height - 1 - i) * width * 3];
     png_set_rows(png_ptr, info_ptr, row_pointers);
     
     /*  Write the PNG */
     png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
 
     /*  Free up */
+    png_free(png_ptr, row_pointers);
     png_destroy_write_struct(&png_ptr, &info_ptr);
     fclose(fp);
-    free(buffer);
     
     return TRUE;
 }
 
+int capture(const char *filename)
+{
+    int width, height, ok;
+    unsigned char *buffer;
+
+    /* Determine size of window.  Replace this with lookups to your
+     * own global variables if you have them.
+     */
+    width = glutGet(GLUT_WINDOW_WIDTH);
+    height = glutGet(GLUT_WINDOW_HEIGHT);
+
+    /* Read buffer data from GL, allowing 3 bytes per pixel.
+     * Be sure to restore the alignment to 4-bytes if you need
+     * to.
+     */
+    buffer = (unsigned char *) malloc(width * height * 3);
+    if (!buffer)
+    {
+        fprintf(stderr, "capture: Out of memory");
+        return FALSE;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+
+    ok = capture_png(filename, buffer, width, height);
+    free(buffer);
+    return ok;
+}
+
 int captureFrame(const char *prefix)
 {
     static char filename[256];
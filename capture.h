@@ -13,6 +13,22 @@
  */
 int capture(const char *filename);
 
+/* Writes width by height 24-bit RGB pixels to the specified file in PNG
+ * format, the rows bottom-to-top as glReadPixels leaves them.  Returns 1
+ * on success, 0 on failure.  Safe to call from any thread, as it makes no
+ * GL calls.
+ */
+int capture_png(const char *filename, unsigned char *buffer, int width,
+    int height);
+
+/* Sets how PNGs are compressed from then on.  level is the zlib level,
+ * from 0 (fastest) to 9 (smallest), or -1 for the default; filter is one
+ * of the PNG_ROW_ row filters in pngstrip.h; and with more than one
+ * thread the image is compressed in strips on that many threads at once.
+ * The defaults are -1, PNG_ROW_ADAPTIVE and 1, as libpng would choose.
+ */
+void capture_options(int level, int filter, int threads);
+
 /* A convenience function for capturing multiple frames in an 
  * animation.  Names each file as <prefix><frame>.png, where frame
  * is incremented each time the function is called.  For example,
@@ -0,0 +1,154 @@
+/**
+ * cull.c
+ *
+ * The frustum planes are pulled straight out of the combined projection and
+ * modelview matrices, so they are in world space and point inwards. A
+ * sphere is culled when it lies wholly behind any one of them.
+ *
+ * A shadow is the caster squashed onto the ground along the light. The
+ * shadow of a sphere fits in a bigger sphere around where its centre lands,
+ * and the caster and shadow are culled together only if both are behind the
+ * same plane, since the shadow matrix draws everything in between as well.
+ */
+
+#include "cull.h"
+#include "util.h"
+
+#include <math.h>
+#include <GLUT/glut.h>
+
+
+float cull_planes[6][4];        /* Left, right, bottom, top, near, far. */
+
+float cull_ground[4];           /* Ground plane with a unit normal. */
+float cull_light[4];            /* Light the shadows are cast from. */
+float cull_light_dot;           /* Ground normal dotted with the light. */
+float cull_stretch;             /* Shadow radius over caster radius. */
+
+
+/**
+ * Works out the frustum from the current projection and modelview
+ * matrices, which should hold the camera at the start of a frame, and notes
+ * the ground plane and light for cull_shadow.
+ */
+void cull_begin(float ground[4], float light[4])
+{
+  float proj[16], view[16], clip[16], len;
+  int j;
+
+  glGetFloatv(GL_PROJECTION_MATRIX, proj);
+  glGetFloatv(GL_MODELVIEW_MATRIX, view);
+  m4_mul(clip, proj, view);
+  cull_frustum(clip);
+
+  len = sqrt(v_dot(ground, ground));
+  for(j = 0; j < 4; j++)
+  {
+    cull_ground[j] = ground[j] / len;
+    cull_light[j]  = light[j];
+  }
+
+  cull_light_dot = v_dot(cull_ground, cull_light) + cull_ground[3] * light[3];
+  if(fabs(cull_light_dot) > 0.001)
+    cull_stretch = 1.0 + sqrt(v_dot(light, light)) / fabs(cull_light_dot);
+  else
+    cull_stretch = 0.0;
+}
+
+
+/**
+ * Sets the frustum from a combined projection and view matrix.
+ */
+void cull_frustum(float clip[16])
+{
+  float len;
+  int i, j;
+
+  /* Each plane is the last row of the clip matrix plus or minus another. */
+  for(i = 0; i < 6; i++)
+  {
+    for(j = 0; j < 4; j++)
+      cull_planes[i][j] = clip[j * 4 + 3] +
+                          (i % 2 ? -clip[j * 4 + i / 2] : clip[j * 4 + i / 2]);
+
+    len = sqrt(v_dot(cull_planes[i], cull_planes[i]));
+    for(j = 0; j < 4; j++)
+      cull_planes[i][j] /= len;
+  }
+}
+
+
+/**
+ * Calls visit for everything in a tree whose box is at least partly in
+ * view. Returns how many there were.
+ */
+int cull_tree(bvh *t, bvh_visit visit, void *data)
+{
+  return bvh_frustum(t, cull_planes, visit, data);
+}
+
+
+/**
+ * Returns true if a sphere with centre c and radius r is out of view.
+ */
+bool cull_sphere(float c[3], float r)
+{
+  int i;
+
+  for(i = 0; i < 6; i++)
+    if(v_dot(cull_planes[i], c) + cull_planes[i][3] < -r)
+      return true;
+
+  return false;
+}
+
+
+/**
+ * Returns true if neither a sphere with centre c and radius r nor its flat
+ * shadow can be seen. Only directional light is handled, as the sun is;
+ * anything else is never culled.
+ */
+bool cull_shadow(float c[3], float r)
+{
+  float s[3], t;
+  int i;
+
+  if(cull_stretch == 0.0 || cull_light[3] != 0.0)
+    return false;
+
+  t = (v_dot(cull_ground, c) + cull_ground[3]) / cull_light_dot;
+  for(i = 0; i < 3; i++)
+    s[i] = c[i] - cull_light[i] * t;
+
+  for(i = 0; i < 6; i++)
+    if(v_dot(cull_planes[i], c) + cull_planes[i][3] < -r &&
+       v_dot(cull_planes[i], s) + cull_planes[i][3] < -r * cull_stretch)
+      return true;
+
+  return false;
+}
+
+
+/**
+ * Works out a box that holds a sphere and its shadow, and everything the
+ * shadow matrix draws in between, for putting in a tree to find with
+ * cull_tree. Returns false if the shadow can't be bounded.
+ */
+bool cull_shadow_box(float c[3], float r, float box[6])
+{
+  float s[3], t;
+  int i;
+
+  if(cull_stretch == 0.0 || cull_light[3] != 0.0)
+    return false;
+
+  t = (v_dot(cull_ground, c) + cull_ground[3]) / cull_light_dot;
+  for(i = 0; i < 3; i++)
+  {
+    s[i] = c[i] - cull_light[i] * t;
+    box[i]     = fmin(c[i] - r, s[i] - r * cull_stretch);
+    box[i + 3] = fmax(c[i] + r, s[i] + r * cull_stretch);
+  }
+
+  return true;
+}
@@ -0,0 +1,27 @@
+/**
+ * cull.h
+ *
+ * View frustum culling. The frustum is taken from the projection set up in
+ * reshape and the camera's modelview each frame, and bounding spheres are
+ * tested against its six planes so things that can't be seen are never
+ * sent to be drawn. Flat shadows land away from what casts them, so there
+ * is also a test for whether a shadow could be in view.
+ */
+
+#ifndef _CULL_H_
+#define _CULL_H_
+
+#include "global.h"
+#include "bvh.h"
+
+
+/* Interface. */
+extern void cull_begin(float ground[4], float light[4]);
+extern void cull_frustum(float clip[16]);
+extern int cull_tree(bvh *t, bvh_visit visit, void *data);
+extern bool cull_sphere(float c[3], float r);
+extern bool cull_shadow(float c[3], float r);
+extern bool cull_shadow_box(float c[3], float r, float box[6]);
+
+
+#endif
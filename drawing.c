@@ -5,14 +5,29 @@
  */
 
 #include "drawing.h"
+#include "blob.h"
+#include "bvh.h"
 #include "camera.h"
+#include "cull.h"
 #include "editor.h"
+#include "field.h"
+#include "impostor.h"
+#include "instanced.h"
 #include "mem.h"
+#include "pipeline.h"
+#include "record.h"
+#include "render.h"
+#include "shader.h"
+#include "sim.h"
+#include "skin.h"
+#include "smap.h"
+#include "text.h"
+#include "util.h"
 #include <stdio.h>
 
 
 int dlists;
-int dlist_count = 6;
+int dlist_count = 4;
 
 /* The below enum is used to provide easier display list names, quite
  * useful for calling later. Should be used with the call_list
@@ -20,9 +35,6 @@ int dlist_count = 6;
 enum {
   DL_READY_SHADOWS,
 
-  DL_TEX_GROUND,
-  DL_WIRE_GROUND,
-
   DL_READY_GRASS,
   DL_TEX_GRASS,
   DL_WIRE_GRASS,
@@ -30,6 +42,29 @@ enum {
 
 #define call_list(dl) glCallList(dlists + (dl))
 
+/* Set in a model's passes, as well as the RQ_BIT ones, when its shadow is
+ * too far away to be drawn whole and is drawn as a blob instead. */
+#define PASS_BLOB (1 << 8)
+
+/* Set in place of the model pass when a model is too far away to be drawn
+ * whole and is drawn as an impostor instead. */
+#define PASS_IMPOSTOR (1 << 9)
+
+/* The passes a model is drawn whole in. */
+#define PASS_WHOLE (RQ_BIT(RQ_PASS_SHADOW) | RQ_BIT(RQ_PASS_MODELS))
+
+
+/* Function prototypes. */
+void draw_model_seen(void *data, int slot);
+void grass_build_tree();
+void grass_seen_visit(void *data, int tuft);
+int grass_order(const void *a, const void *b);
+void grass_find_seen();
+void grass_matrix(int i, float m[16]);
+bool grass_batched();
+void draw_casters(bool instancing, bool flat);
+void draw_find_lods();
+
 
 /* Shadow variables. */
 float shadow_mat[4][4];
@@ -41,6 +76,7 @@ float ground_tcords[4][2] = {
   {0.0, 0.0}, {1.0, 0.0}, {1.0, 1.0}, {0.0, 1.0}
 };
 float ground_plane[4];
+float ground_array[4][5];       /* The ground as vertices to draw. */
 int   ground_tex;
 bool  shadowing = false;
 
@@ -49,13 +85,37 @@ int    grass_tex;
 int    grass_count = 0;
 float *grass_loc   = NULL;
 float  grass_size  = 1.0;
-
-/* Model register. */
-model *mdl_reg[MODEL_REGISTER_SIZE];
+bvh    grass_tree;              /* Box of each tuft, for culling. */
+int   *grass_seen  = NULL;      /* Tufts in view this frame, in order. */
+int    grass_n_seen = 0;
+
+/* Model register. The models are packed into the front of mdl_reg, and
+ * each has a slot which records where it is now. Every entry is an
+ * instance; models registered directly get an instance that follows them.
+ * Free slots are chained together through their index. */
+typedef struct reg_slot
+{
+  int index;                    /* Place in mdl_reg, or next free slot. */
+  unsigned int gen;             /* Bumped each time the slot is freed. */
+} reg_slot;
+
+instance **mdl_reg = NULL;
+int *mdl_reg_owner = NULL;      /* Slot of each model in mdl_reg. */
+bool *mdl_reg_batched = NULL;   /* Is each model drawn instanced this frame? */
+int *mdl_reg_passes = NULL;     /* Passes each model can be seen in, RQ_BIT. */
+bvh mdl_tree;                   /* Bounds of the models, by slot. */
 int mdl_reg_index = 0;
+int mdl_reg_cap = 0;
+
+reg_slot *reg_slots = NULL;
+int reg_slots_used = 0;
+int reg_free = -1;
 
 bone *curr_bone;
 
+float draw_view[16];            /* Camera matrix of the last frame. */
+float draw_eye[3];              /* Where the camera was in the last frame. */
+
 
 /**
  * Creates some general display lists for potentially increasing performance
@@ -78,29 +138,16 @@ void draw_init()
 
   ground_tex = loadTexture("data/texture/ground.png");
 
-  /* Display list for drawing a 1x1 quad facing the positive y direction. */
-  glNewList(dlists + DL_TEX_GROUND, GL_COMPILE);
-    glBindTexture(GL_TEXTURE_2D, ground_tex);
-    glBegin(GL_QUADS);
-      for(i = 0; i < 4; i++)
-      {
-        glTexCoord2f(ground_tcords[i][0] * GROUND_SCALE,
-                     ground_tcords[i][1] * GROUND_SCALE);
-        glVertex3f  (ground_verts[i][X],
-                     ground_verts[i][Y],
-                     ground_verts[i][Z]);
-      }
-    glEnd();
-  glEndList();
-
-  /* Wireframe version of the above list. */
-  glNewList(dlists + DL_WIRE_GROUND, GL_COMPILE);
-    glColor4f(0.54, 0.43, 0.42, 1.0);
-    glBegin(GL_LINE_LOOP);
-      for(i = 0; i < 4; i++)
-        glVertex3f(ground_verts[i][0], ground_verts[i][1], ground_verts[i][2]);
-    glEnd();
-  glEndList();
+  /* A 1x1 quad facing the positive y direction, drawn as a fan or as a
+   * loop of lines for wireframe. */
+  for(i = 0; i < 4; i++)
+  {
+    ground_array[i][0] = ground_verts[i][X];
+    ground_array[i][1] = ground_verts[i][Y];
+    ground_array[i][2] = ground_verts[i][Z];
+    ground_array[i][3] = ground_tcords[i][0] * GROUND_SCALE;
+    ground_array[i][4] = ground_tcords[i][1] * GROUND_SCALE;
+  }
 
   /* Load grass texture and clamp it's edges. We don't want any
    * artifacts around the edges of a grass sprite. */
@@ -110,7 +157,6 @@ void draw_init()
 
   /* Display list for drawing a grass quad. */
   glNewList(dlists + DL_TEX_GRASS, GL_COMPILE);
-    glBindTexture(GL_TEXTURE_2D, grass_tex);
     glBegin(GL_QUADS);
       glTexCoord2f(0.0, 0.0); glVertex3f(-1.0,  0.0,  0.0);
       glTexCoord2f(1.0, 0.0); glVertex3f( 1.0,  0.0,  0.0);
@@ -149,9 +195,15 @@ void draw_init()
     glColor4f(0.36, 0.58, 0.11, 0.8);
   glEndList();
 
-  gen_grass(GRASS_COUNT, global.world_size, GRASS_ROT, GRASS_SIZE);
+  bvh_init(&mdl_tree, DRAW_TREE_MARGIN);
+  bvh_init(&grass_tree, 0.0);
+  if(global.grass_density > 0)
+    field_stream_init(global.grass_density, GRASS_ROT, GRASS_SIZE);
+  gen_grass(global.grass_count, global.world_size, GRASS_ROT, GRASS_SIZE);
 
   skybox_init();
+  blob_init();
+  text_init();
   
   findPlane(ground_plane, ground_verts[0], ground_verts[1],
       ground_verts[2]);
@@ -167,6 +219,11 @@ void draw_cleanup()
   int i;
 
   FREE(grass_loc);
+  FREE(grass_seen);
+  grass_loc = NULL;
+  grass_seen = NULL;
+  bvh_free(&grass_tree);
+  bvh_free(&mdl_tree);
 
   /**
    * Free all models in the model register. Only shallowly frees them however
@@ -174,7 +231,204 @@ void draw_cleanup()
    * be freeed elsewhere in code.
    */
   for(i = 0; i < mdl_reg_index; i++)
-    model_shallow_free(mdl_reg[i]);
+    draw_free_entry(mdl_reg[i]);
+
+  FREE(mdl_reg);
+  FREE(mdl_reg_owner);
+  FREE(mdl_reg_batched);
+  FREE(mdl_reg_passes);
+  FREE(reg_slots);
+  mdl_reg = NULL;
+  mdl_reg_owner = NULL;
+  mdl_reg_batched = NULL;
+  mdl_reg_passes = NULL;
+  reg_slots = NULL;
+  mdl_reg_index = mdl_reg_cap = reg_slots_used = 0;
+  reg_free = -1;
+
+  inst_cleanup();
+  pipe_cleanup();
+  rq_cleanup();
+  field_cleanup();
+  smap_cleanup();
+  blob_cleanup();
+  text_cleanup();
+  imp_cleanup();
+}
+
+
+/**
+ * Finds where a registered model should be drawn and in what pose. Normally
+ * this is straight from the model, but when the simulation runs on its own
+ * thread the model belongs to that thread and the interpolated snapshot is
+ * used instead. Returns false if there is nothing to draw yet.
+ */
+bool draw_model_view(int index, float **pos, float **pose)
+{
+  if(global.sim_thread)
+    return sim_view(index, pos, pose);
+
+  *pos  = instance_pos(mdl_reg[index]);
+  *pose = mdl_reg[index]->pose;
+  return true;
+}
+
+
+/**
+ * Works out which passes a model placed at pos can be seen in, as RQ_BIT
+ * flags, from a sphere that holds it in any pose. A shadow further from
+ * the camera than global.shadow_lod is given PASS_BLOB in place of the
+ * shadow pass, and a model further than global.imp_lod PASS_IMPOSTOR in
+ * place of the model pass.
+ */
+int draw_model_passes(model *mdl, float *pos)
+{
+  int passes = RQ_BIT(RQ_PASS_MODELS);
+  float d[3], dist;
+
+  if(global.r_shadows)
+    passes |= RQ_BIT(RQ_PASS_SHADOW);
+
+  if(mdl->radius < 0.0)
+    return passes;
+
+  if(global.r_cull)
+  {
+    if(cull_sphere(pos, mdl->radius))
+      passes &= ~RQ_BIT(RQ_PASS_MODELS);
+    if((passes & RQ_BIT(RQ_PASS_SHADOW)) && cull_shadow(pos, mdl->radius))
+      passes &= ~RQ_BIT(RQ_PASS_SHADOW);
+  }
+
+  v_sub(d, pos, draw_eye);
+  dist = v_dot(d, d);
+
+  if((passes & RQ_BIT(RQ_PASS_SHADOW)) && global.r_blob_shadows &&
+     global.shadow_lod > 0.0 && dist > global.shadow_lod * global.shadow_lod)
+    passes ^= RQ_BIT(RQ_PASS_SHADOW) | PASS_BLOB;
+
+  if((passes & RQ_BIT(RQ_PASS_MODELS)) && global.r_impostors &&
+     !global.r_wire && global.imp_lod > 0.0 &&
+     dist > global.imp_lod * global.imp_lod)
+    passes ^= RQ_BIT(RQ_PASS_MODELS) | PASS_IMPOSTOR;
+
+  return passes;
+}
+
+
+/**
+ * Called by the tree for each model whose bounds are at least partly in
+ * view, to work out what of it really is.
+ */
+void draw_model_seen(void *data, int slot)
+{
+  int index = reg_slots[slot].index;
+  float *pos, *pose;
+
+  if(draw_model_view(index, &pos, &pose))
+    mdl_reg_passes[index] = draw_model_passes(mdl_reg[index]->base, pos);
+}
+
+
+/**
+ * Works out the passes every registered model can be seen in. The bounds of
+ * each model, taking in its shadow, are kept in a tree, so only the models
+ * near the view get tested against it properly. Models without bounds are
+ * always drawn.
+ */
+void draw_find_passes()
+{
+  float *pos, *pose, box[6], r, inv[16];
+  model *base;
+  int i, k;
+
+  m4_rigid_inverse(inv, draw_view);
+  v_copy(draw_eye, inv + 12);
+
+  if(global.r_cull)
+    cull_begin(ground_plane, global.sun_pos);
+
+  for(i = 0; i < mdl_reg_index; i++)
+  {
+    mdl_reg_passes[i] = 0;
+    if(!draw_model_view(i, &pos, &pose))
+      continue;
+
+    base = mdl_reg[i]->base;
+    r = base->radius;
+    if(!global.r_cull || r < 0.0)
+    {
+      mdl_reg_passes[i] = draw_model_passes(base, pos);
+      continue;
+    }
+
+    if(!global.r_shadows)
+      for(k = 0; k < 3; k++)
+      {
+        box[k]     = pos[k] - r;
+        box[k + 3] = pos[k] + r;
+      }
+    else if(!cull_shadow_box(pos, r, box))
+    {
+      bvh_remove(&mdl_tree, mdl_reg_owner[i]);
+      mdl_reg_passes[i] = draw_model_passes(base, pos);
+      continue;
+    }
+
+    /* Marked as unseen until the tree finds it. */
+    bvh_move(&mdl_tree, mdl_reg_owner[i], box);
+    mdl_reg_passes[i] = -1;
+  }
+
+  if(!global.r_cull)
+    return;
+
+  cull_tree(&mdl_tree, draw_model_seen, NULL);
+
+  for(i = 0; i < mdl_reg_index; i++)
+  {
+    if(mdl_reg_passes[i] == -1)
+      mdl_reg_passes[i] = 0;
+    if(mdl_reg_passes[i] == 0 && mdl_reg[i]->base->radius >= 0.0)
+      global.culled_models++;
+  }
+}
+
+
+/**
+ * Lays down a blob for every model whose shadow is too far away to draw
+ * whole and an impostor for every model that is, and counts how many of
+ * each there are. A model whose impostor can't be made is drawn whole.
+ */
+void draw_find_lods()
+{
+  float *pos, *pose;
+  bool impostors;
+  int i;
+
+  global.shadow_models = 0;
+  blob_begin(ground_plane, global.sun_pos);
+  impostors = imp_init();
+  imp_begin(draw_eye);
+
+  for(i = 0; i < mdl_reg_index; i++)
+  {
+    if(mdl_reg_passes[i] & RQ_BIT(RQ_PASS_SHADOW))
+      global.shadow_models++;
+    if(!(mdl_reg_passes[i] & (PASS_BLOB | PASS_IMPOSTOR)) ||
+       !draw_model_view(i, &pos, &pose))
+      continue;
+
+    if(mdl_reg_passes[i] & PASS_BLOB)
+      blob_add(pos, mdl_reg[i]->base->radius);
+
+    if((mdl_reg_passes[i] & PASS_IMPOSTOR) &&
+       !(impostors && imp_add(mdl_reg[i]->base, pos, pose)))
+      mdl_reg_passes[i] ^= RQ_BIT(RQ_PASS_MODELS) | PASS_IMPOSTOR;
+  }
+
+  global.shadow_blobs = blob_count();
+  global.impostors = imp_count();
 }
 
 
@@ -185,11 +439,25 @@ void draw_scene()
 {
   int i;
   camera *cam = cam_get();
+  float *pos, *pose;
+  bool instancing, mapped;
+
+  /* Bring the simulation snapshot up to the time being drawn. */
+  if(global.sim_thread)
+    sim_interpolate();
+
+  global.draw_calls = 0;
+  global.upload_bytes = 0;
+  global.state_changes = 0;
+  global.culled_models = global.culled_meshes = global.culled_grass = 0;
 
   glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
   if(global.r_shadows)
     glClear(GL_STENCIL_BUFFER_BIT);
 
+  /* Start from white, whatever colour the last frame left current. */
+  glColor4f(1.0, 1.0, 1.0, 1.0);
+
   glMatrixMode(GL_MODELVIEW);
 
   if(global.world_mode == WORLD_MODE_EDITOR)
@@ -216,8 +484,71 @@ void draw_scene()
   /* Position the light source. */
   glLightfv(GL_LIGHT0, GL_POSITION, global.sun_pos);
 
-  /* Render shadows if they're enabled. */
-  if(global.r_shadows)
+  glGetFloatv(GL_MODELVIEW_MATRIX, draw_view);
+
+  /* Work out which passes each model can be seen in. */
+  draw_find_passes();
+  draw_find_lods();
+
+  /* Sort out which models can be drawn instanced. The rest are drawn one
+   * at a time. */
+  instancing = global.r_instanced && inst_init();
+  if(instancing)
+  {
+    inst_begin();
+    for(i = 0; i < mdl_reg_index; i++)
+      mdl_reg_batched[i] = (mdl_reg_passes[i] & PASS_WHOLE) &&
+                           draw_model_view(i, &pos, &pose) &&
+                           inst_add(mdl_reg[i]->base, pos, pose,
+                               mdl_reg_passes[i] & RQ_BIT(RQ_PASS_MODELS),
+                               mdl_reg_passes[i] & RQ_BIT(RQ_PASS_SHADOW));
+    inst_prepare();
+  }
+
+  /* Queue up everything else that is drawn a piece at a time. */
+  if(global.r_queue)
+  {
+    rq_begin();
+    for(i = 0; i < mdl_reg_index; i++)
+    {
+      if((instancing && mdl_reg_batched[i]) ||
+         !(mdl_reg_passes[i] & PASS_WHOLE))
+        continue;
+      if(draw_model_view(i, &pos, &pose))
+        rq_add_model(mdl_reg[i]->base, pos, pose, mdl_reg_passes[i]);
+    }
+    if(global.r_grass)
+      queue_grass();
+    rq_sort();
+  }
+
+  /* Render shadows if they're enabled. Shadow maps draw what casts the
+   * shadows into them first, then stay bound while the ground and models
+   * are drawn so they take their shadows as they go. Flat shadows are drawn
+   * over the ground after it. Blobs go on the ground the same way either
+   * way. */
+  mapped = global.r_shadows && global.r_shadow_map && !global.r_wire &&
+           smap_init();
+  if(mapped)
+  {
+    smap_begin(draw_view, global.sun_pos);
+    for(i = 0; i < SMAP_CASCADES; i++)
+    {
+      smap_cascade_begin(i);
+      draw_casters(instancing, false);
+      smap_cascade_end();
+    }
+    smap_bind(SHADOW_DEPTH);
+
+    glPushAttrib(GL_ALL_ATTRIB_BITS);
+    call_list(DL_READY_SHADOWS);
+    draw_ground(global.world_size);
+    glDisable(GL_LIGHTING);
+    ready_model_shadow();
+    blob_draw();
+    glPopAttrib();
+  }
+  else if(global.r_shadows)
   {
     glPushAttrib(GL_ALL_ATTRIB_BITS);
     call_list(DL_READY_SHADOWS);
@@ -225,60 +556,313 @@ void draw_scene()
 
     draw_ground(global.world_size);
 
-    shadowing = true;
     glDisable(GL_TEXTURE_2D);
-    for(i = 0; i < mdl_reg_index; i++)
-      draw_shadow(mdl_reg[i]);
-    shadowing = false;
+    draw_casters(instancing, true);
+    ready_model_shadow();
+    blob_draw();
     glPopAttrib();
   }
   else
     draw_ground(global.world_size);
 
   /* Render models. */
+  if(instancing)
+    inst_draw(false);
+
+  if(global.r_queue)
+  {
+    glPushAttrib(GL_ALL_ATTRIB_BITS);
+    ready_models();
+    rq_flush(RQ_PASS_MODELS);
+    glPopAttrib();
+  }
+
   for(i = 0; i < mdl_reg_index; i++)
   {
-    draw_model(mdl_reg[i], DRAW_SKEL_GEOMETRY);
+    if(!(mdl_reg_passes[i] & RQ_BIT(RQ_PASS_MODELS)) ||
+       !draw_model_view(i, &pos, &pose))
+      continue;
+
+    if(!global.r_queue && !(instancing && mdl_reg_batched[i]))
+      draw_model_pose(mdl_reg[i]->base, pos, pose, DRAW_SKEL_GEOMETRY);
 
     /* Render model bones. */
     if(global.r_bones)
     {
       glDisable(GL_DEPTH_TEST);
-      draw_model(mdl_reg[i], DRAW_SKEL_BONES);
+      draw_model_pose(mdl_reg[i]->base, pos, pose, DRAW_SKEL_BONES);
       glEnable(GL_DEPTH_TEST);
     }
   }
 
+  if(mapped)
+    smap_unbind();
+
+  imp_draw();
+
   if(global.r_grass)
     draw_grass();
 
   if(global.r_fps)
+  {
     glPrint(global.fps_str, 10, 10);
+    glPrint(global.cull_str, 10, 25);
+    glPrint(global.lod_str, 10, 40);
+  }
 
   glPrint(mode_str[global.world_mode], 10, global.wh - 20);
   if(global.world_mode == WORLD_MODE_EDITOR)
     glPrint(edit_get_string(), 10, global.wh - 40);
 
-  glutSwapBuffers();
+  record_frame();
+
+  if(!global.headless)
+    glutSwapBuffers();
+}
+
+
+/**
+ * Makes room in the model register for at least one more model. Returns
+ * false if the memory could not be found.
+ */
+bool draw_model_reserve()
+{
+  instance **insts;
+  int *owners, cap;
+  reg_slot *slots;
+  bool *batched;
+  int *passes;
+
+  if(mdl_reg_index < mdl_reg_cap)
+    return true;
+
+  cap = mdl_reg_cap ? mdl_reg_cap * 2 : MODEL_REGISTER_SIZE;
+
+  insts = realloc(mdl_reg, sizeof(instance *) * cap);
+  if(!insts) return false;
+  mdl_reg = insts;
+
+  owners = realloc(mdl_reg_owner, sizeof(int) * cap);
+  if(!owners) return false;
+  mdl_reg_owner = owners;
+
+  slots = realloc(reg_slots, sizeof(reg_slot) * cap);
+  if(!slots) return false;
+  reg_slots = slots;
+
+  batched = realloc(mdl_reg_batched, sizeof(bool) * cap);
+  if(!batched) return false;
+  mdl_reg_batched = batched;
+
+  passes = realloc(mdl_reg_passes, sizeof(int) * cap);
+  if(!passes) return false;
+  mdl_reg_passes = passes;
+
+  mdl_reg_cap = cap;
+  return true;
+}
+
+
+/**
+ * Frees an entry of the register. Instances that follow a model take the
+ * model with them.
+ */
+void draw_free_entry(instance *inst)
+{
+  if(!inst->pose)
+    model_shallow_free(inst->base);
+  free_instance(inst);
 }
 
 
 /**
  * The model register is a simple way of storing models that need to be
- * rendered to the scene.
+ * rendered to the scene. The model is drawn with its own skeleton at its
+ * own position; it is wrapped in an instance with no pose so it can sit in
+ * the register with everything else. Returns a handle to it, see
+ * draw_instance_register.
  */
-void draw_model_register(model *mdl)
+model_handle draw_model_register(model *mdl)
 {
+  model_handle h = { -1, 0 };
+  instance *inst;
+
   if(!mdl)
   {
     fprintf(stderr, "ERROR(model_register): NULL Model supplied.\n");
-    return;
+    return h;
+  }
+
+  NEW(inst);
+  if(!inst)
+  {
+    fprintf(stderr, "ERROR(model_register): Out of memory.\n");
+    return h;
+  }
+
+  inst->base = mdl;
+  inst->pose = NULL;
+  inst->state.curr_anim = NULL;
+  inst->state.blend = NULL;
+
+  h = draw_instance_register(inst);
+  if(h.slot < 0)
+    free(inst);
+  return h;
+}
+
+
+/**
+ * Adds an instance to the model register. Instances are kept packed
+ * together at the front of the register so drawing is a straight run over
+ * them. The handle returned stays valid however they are shuffled around,
+ * until the instance is removed. Returns a handle with a negative slot if
+ * the instance couldn't be added.
+ */
+model_handle draw_instance_register(instance *inst)
+{
+  model_handle h = { -1, 0 };
+  int slot, index;
+
+  if(!inst)
+  {
+    fprintf(stderr, "ERROR(model_register): NULL Instance supplied.\n");
+    return h;
+  }
+
+  if(!draw_model_reserve())
+  {
+    fprintf(stderr, "ERROR(model_register): Unable to grow register.\n");
+    return h;
   }
 
-  if(mdl_reg_index < MODEL_REGISTER_SIZE)
-    mdl_reg[mdl_reg_index++] = mdl;
+  /* Reuse a slot left by a removed model if there is one. */
+  if(reg_free >= 0)
+  {
+    slot = reg_free;
+    reg_free = reg_slots[slot].index;
+  }
   else
-    fprintf(stderr, "ERROR(model_register): Model Register full.\n");
+  {
+    slot = reg_slots_used++;
+    reg_slots[slot].gen = 0;
+  }
+
+  index = mdl_reg_index++;
+  mdl_reg[index] = inst;
+  mdl_reg_owner[index] = slot;
+  reg_slots[slot].index = index;
+
+  h.slot = slot;
+  h.gen  = reg_slots[slot].gen;
+  return h;
+}
+
+
+/**
+ * Returns the instance a handle refers to, or NULL if it has been removed.
+ */
+instance *draw_model_lookup(model_handle h)
+{
+  if(h.slot < 0 || h.slot >= reg_slots_used || reg_slots[h.slot].gen != h.gen)
+    return NULL;
+  return mdl_reg[reg_slots[h.slot].index];
+}
+
+
+/**
+ * Takes an instance out of the register and frees it, along with its model
+ * if it was registered with draw_model_register. The last instance is moved
+ * into the gap so the rest stay packed. Returns false if the handle no
+ * longer refers to a model.
+ */
+bool draw_model_remove(model_handle h)
+{
+  int index, last;
+
+  if(!draw_model_lookup(h))
+    return false;
+
+  index = reg_slots[h.slot].index;
+  last  = --mdl_reg_index;
+
+  draw_free_entry(mdl_reg[index]);
+
+  mdl_reg[index] = mdl_reg[last];
+  mdl_reg_owner[index] = mdl_reg_owner[last];
+  reg_slots[mdl_reg_owner[index]].index = index;
+
+  bvh_remove(&mdl_tree, h.slot);
+
+  /* Bumping the generation makes any other copies of the handle stale. */
+  reg_slots[h.slot].gen++;
+  reg_slots[h.slot].index = reg_free;
+  reg_free = h.slot;
+
+  return true;
+}
+
+
+/**
+ * Returns the number of models in the model register.
+ */
+int draw_model_count()
+{
+  return mdl_reg_index;
+}
+
+
+/**
+ * Returns an instance from the model register, or NULL if the index is out
+ * of range. Indices change as models are removed; keep a handle to refer to
+ * a model for any length of time.
+ */
+instance *draw_model_get(int index)
+{
+  if(index < 0 || index >= mdl_reg_index)
+    return NULL;
+  return mdl_reg[index];
+}
+
+
+/**
+ * Returns the slot of the model at an index, which identifies the model
+ * for as long as it's registered.
+ */
+int draw_model_slot(int index)
+{
+  if(index < 0 || index >= mdl_reg_index)
+    return -1;
+  return mdl_reg_owner[index];
+}
+
+
+/**
+ * Works out the ray through the window at mx, my, as GLUT gives mouse
+ * positions, from where the camera was for the last frame. dir comes out
+ * normalised.
+ */
+void draw_mouse_ray(int mx, int my, float org[3], float dir[3])
+{
+  double view[16], proj[16], p0[3], p1[3];
+  int viewport[4], i;
+
+  glGetDoublev(GL_PROJECTION_MATRIX, proj);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  for(i = 0; i < 16; i++)
+    view[i] = draw_view[i];
+
+  my = viewport[3] - my - 1;
+  gluUnProject(mx, my, 0.0, view, proj, viewport, &p0[0], &p0[1],
+      &p0[2]);
+  gluUnProject(mx, my, 1.0, view, proj, viewport, &p1[0], &p1[1], &p1[2]);
+
+  for(i = 0; i < 3; i++)
+  {
+    org[i] = p0[i];
+    dir[i] = p1[i] - p0[i];
+  }
+  v_norm(dir);
 }
 
 
@@ -294,13 +878,11 @@ void set_curr_bone(bone *bone)
 
 /**
  * Draws a line, used when drawing a representation of a models bone
- * system.
+ * system. Lighting and texturing should be off, as draw_model_pose leaves
+ * them for DRAW_SKEL_BONES.
  */
 void draw_bone(float length, bool curr)
 {
-  glPushAttrib(GL_ALL_ATTRIB_BITS);
-  glDisable(GL_LIGHTING);
-  glDisable(GL_TEXTURE_2D);
   glBegin(GL_LINES);
     if(!curr) glColor3f(1.0, 0.0, 0.0);
     else glColor3f(1.0, 1.0, 0.0);
@@ -308,7 +890,6 @@ void draw_bone(float length, bool curr)
     if(!curr) glColor3f(0.0, 1.0, 0.0);
     glVertex3f(length, 0.0, 0.0);
   glEnd();
-  glPopAttrib();
 }
 
 
@@ -386,27 +967,103 @@ void findPlane(float plane[4], float v0[3], float v1[3], float v2[3])
  * shadows do not have a 'cumulative effect.
  */
 void draw_shadow(model *mdl)
+{
+  draw_shadow_pose(mdl, mdl->pos, NULL);
+}
+
+
+/**
+ * Sets up the stencil and colour for drawing model shadows onto the ground.
+ * The stencil buffer is used to ensure that no area is drawn to more than
+ * once.
+ */
+void ready_model_shadow()
 {
   glStencilFunc(GL_LESS, 2, 0xffffffff);
 
   glStencilOp(GL_REPLACE, GL_REPLACE, GL_REPLACE);
   glEnable(GL_POLYGON_OFFSET_FILL);
   glColor4f(0.07, 0.0, 0.0, SHADOW_DEPTH);
+}
+
+
+/**
+ * Draws the shadow of a model placed at pos and posed with the rotations in
+ * pose, as for draw_model_pose.
+ */
+void draw_shadow_pose(model *mdl, float *pos, float *pose)
+{
+  ready_model_shadow();
 
   glPushMatrix();
   
   glMultMatrixf((float *)shadow_mat);   /* Apply the shadow matrix and */
-  draw_model(mdl, DRAW_SKEL_GEOMETRY);  /* redraw the model.           */
+  draw_model_pose(mdl, pos, pose,       /* redraw the model.           */
+      DRAW_SKEL_GEOMETRY);
 
   glPopMatrix();
 }
 
 
+/**
+ * Draws everything that casts a shadow, untextured and unlit. Flat shadows
+ * are squashed onto the ground and drawn in the shadow colour, otherwise
+ * the models are drawn as they are, for a shadow map.
+ */
+void draw_casters(bool instancing, bool flat)
+{
+  float *pos, *pose;
+  int i;
+
+  shadowing = true;
+  if(global.r_queue)
+  {
+    if(flat)
+      ready_model_shadow();
+    glPushMatrix();
+    if(flat)
+      glMultMatrixf((float *)shadow_mat);
+    rq_flush(RQ_PASS_SHADOW);
+    glPopMatrix();
+  }
+  else
+  {
+    for(i = 0; i < mdl_reg_index; i++)
+    {
+      if((instancing && mdl_reg_batched[i]) ||
+         !(mdl_reg_passes[i] & RQ_BIT(RQ_PASS_SHADOW)))
+        continue;
+      if(!draw_model_view(i, &pos, &pose))
+        continue;
+
+      if(flat)
+        draw_shadow_pose(mdl_reg[i]->base, pos, pose);
+      else
+        draw_model_pose(mdl_reg[i]->base, pos, pose, DRAW_SKEL_GEOMETRY);
+    }
+  }
+
+  if(instancing)
+  {
+    if(flat)
+      ready_model_shadow();
+    glPushMatrix();
+    if(flat)
+      glMultMatrixf((float *)shadow_mat);
+    inst_draw(true);
+    glPopMatrix();
+  }
+  shadowing = false;
+}
+
+
 /**
  * Draws a big plane for the ground.
  */
 void draw_ground(float dist)
 {
+  bool piped;
+
   glPushAttrib(GL_ALL_ATTRIB_BITS);
   glPushMatrix();
 
@@ -414,16 +1071,27 @@ void draw_ground(float dist)
 
   glScalef(dist, 1.0, dist);
 
-  if(global.r_texture) glEnable(GL_TEXTURE_2D);
-  else glColor4f(0.54, 0.43, 0.42, 1.0);
+  if(global.r_texture && !global.r_wire)
+  {
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, ground_tex);
+  }
+  else
+  {
+    glDisable(GL_TEXTURE_2D);
+    glColor4f(0.54, 0.43, 0.42, 1.0);
+  }
 
   if(global.world_mode == WORLD_MODE_EDITOR)
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-  if(global.r_wire)
-    call_list(DL_WIRE_GROUND);
-  else
-    call_list(DL_TEX_GROUND);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  piped = pipe_begin();
+  pipe_arrays(ground_array[0], 5, 0, -1, 3);
+  glDrawArrays(global.r_wire ? GL_LINE_LOOP : GL_TRIANGLE_FAN, 0, 4);
+  if(piped)
+    pipe_end();
+  glPopClientAttrib();
 
   if(global.world_mode == WORLD_MODE_EDITOR)
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -436,15 +1104,22 @@ void draw_ground(float dist)
 /**
  * Generates count random grass locations and rotations. The locations
  * are within a square of length 2 * dist and the rotations are between
- * 0 and max_rot - 1 degrees.
+ * 0 and max_rot - 1 degrees. Streamed grass is made as it's needed, so it
+ * is only given a new seed.
  */
 void gen_grass(int count, float dist, int max_rot, float size)
 {
   int i;
 
+  if(field_streaming())
+  {
+    field_stream_seed(rand());
+    return;
+  }
+
   if(count <= 0 || dist <= 0) return;
 
-  if(grass_loc == NULL) free(grass_loc);
+  FREE(grass_loc);
 
   grass_loc = malloc(sizeof(float) * count * 3);
   if(grass_loc == NULL) return;
@@ -458,43 +1133,188 @@ void gen_grass(int count, float dist, int max_rot, float size)
     grass_loc[i + 1] = R * dist * (R > 0.5 ? -1.0 : 1.0);
     grass_loc[i + 2] = R * max_rot;
   }
+
+  /* Baking the field puts the tufts in the order it draws them. */
+  field_bake(grass_loc, count, size);
+  grass_build_tree();
+}
+
+
+/**
+ * Puts a box round each tuft of grass into a tree for culling. A tuft
+ * reaches grass_size either side of where it's planted and 0.75 of it up,
+ * whichever way it's turned.
+ */
+void grass_build_tree()
+{
+  float *boxes;
+  int i;
+
+  FREE(grass_seen);
+  grass_seen = malloc(sizeof(int) * grass_count);
+  boxes = malloc(sizeof(float) * 6 * grass_count);
+  if(!grass_seen || !boxes)
+  {
+    fprintf(stderr, "ERROR(gen_grass): Out of memory.\n");
+    FREE(boxes);
+    grass_count = 0;
+    return;
+  }
+
+  for(i = 0; i < grass_count; i++)
+  {
+    boxes[i * 6 + 0] = grass_loc[i * 3] - grass_size;
+    boxes[i * 6 + 1] = 0.0;
+    boxes[i * 6 + 2] = grass_loc[i * 3 + 1] - grass_size;
+    boxes[i * 6 + 3] = grass_loc[i * 3] + grass_size;
+    boxes[i * 6 + 4] = grass_size * 0.75;
+    boxes[i * 6 + 5] = grass_loc[i * 3 + 1] + grass_size;
+  }
+
+  if(!bvh_build(&grass_tree, boxes, grass_count))
+    grass_count = 0;
+  free(boxes);
+}
+
+
+/**
+ * Works out the matrix for the tuft of grass at index i of grass_loc.
+ */
+void grass_matrix(int i, float m[16])
+{
+  camera *cam = cam_get();
+
+  m4_identity(m);
+  m4_translate(m, grass_loc[i], 0.0, grass_loc[i + 1]);
+  if(global.bb_grass)
+    m4_rotate(m, -cam->rot[R_Y], Y);
+  else
+    m4_rotate(m, grass_loc[i + 2], Y);
+  m4_scale(m, grass_size, grass_size * 1.5, grass_size);
+}
+
+
+/**
+ * Called by the tree for each tuft of grass in view.
+ */
+void grass_seen_visit(void *data, int tuft)
+{
+  grass_seen[grass_n_seen++] = tuft;
+}
+
+
+/**
+ * Orders tufts of grass as they were planted, so they blend the same way
+ * whatever order the tree finds them in.
+ */
+int grass_order(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+
+/**
+ * Fills grass_seen with the tufts of grass in view, in order, and counts
+ * the rest as culled.
+ */
+void grass_find_seen()
+{
+  int i;
+
+  grass_n_seen = 0;
+  if(!global.r_cull)
+  {
+    for(i = 0; i < grass_count; i++)
+      grass_seen[grass_n_seen++] = i;
+    return;
+  }
+
+  cull_tree(&grass_tree, grass_seen_visit, NULL);
+  qsort(grass_seen, grass_n_seen, sizeof(int), grass_order);
+  global.culled_grass += grass_count - grass_n_seen;
+}
+
+
+/**
+ * Returns true if the grass is drawn as a field from buffer objects rather
+ * than a tuft at a time. Streamed grass always is.
+ */
+bool grass_batched()
+{
+  return field_streaming() || (global.r_grass_batch && field_ready());
+}
+
+
+/**
+ * Puts every tuft of grass in view in the render queue, for draw_grass to draw.
+ */
+void queue_grass()
+{
+  float m[16];
+  int i, k;
+
+  if(grass_batched())
+    return;
+
+  grass_find_seen();
+  for(k = 0; k < grass_n_seen; k++)
+  {
+    i = grass_seen[k] * 3;
+    grass_matrix(i, m);
+    if(global.r_wire)
+      rq_add_list(RQ_PASS_GRASS, -1, dlists + DL_WIRE_GRASS, m);
+    else
+      rq_add_list(RQ_PASS_GRASS, grass_tex, dlists + DL_TEX_GRASS, m);
+  }
 }
 
 
 /**
  * Draws all the patches of grass around the world. The grass locations are
  * stored in the float array grass_loc. Grass locations can be set with the
- * init_grass function above.
+ * init_grass function above. The whole field is drawn in a few calls if it
+ * could be baked, otherwise with the render queue on the grass should
+ * already have been queued with queue_grass.
  */
 void draw_grass()
 {
-  int i;
-  camera *cam = cam_get();
+  float m[16];
+  int i, k;
 
   glPushAttrib(GL_ALL_ATTRIB_BITS);
   if(global.r_texture && !global.r_wire) glEnable(GL_TEXTURE_2D);
   call_list(DL_READY_GRASS);
-
-  for(i = 0; i < grass_count * 3; i += 3)
+  global.state_changes += 2;
+
+  if(field_streaming())
+    field_stream_draw(grass_tex, -cam_get()->rot[R_Y], draw_eye);
+  else if(grass_batched())
+    field_draw(grass_tex, -cam_get()->rot[R_Y]);
+  else if(global.r_queue)
+    rq_flush(RQ_PASS_GRASS);
+  else
   {
-    glPushMatrix();
+    glBindTexture(GL_TEXTURE_2D, grass_tex);
+    global.state_changes++;
 
-    glTranslatef(grass_loc[i], 0.0, grass_loc[i + 1]);
-    if(global.bb_grass)
-      glRotatef(-cam->rot[R_Y], 0.0, 1.0, 0.0);
-    else
-      glRotatef(grass_loc[i + 2], 0.0, 1.0, 0.0);
-    glScalef(grass_size, grass_size * 1.5, grass_size);
+    grass_find_seen();
+    for(k = 0; k < grass_n_seen; k++)
+    {
+      i = grass_seen[k] * 3;
+      glPushMatrix();
 
-    if(global.r_wire)
-      call_list(DL_WIRE_GRASS);
-    else
-      call_list(DL_TEX_GRASS);
+      grass_matrix(i, m);
+      glMultMatrixf(m);
 
-    glPopMatrix();
+      if(global.r_wire)
+        call_list(DL_WIRE_GRASS);
+      else
+        call_list(DL_TEX_GRASS);
+
+      glPopMatrix();
+    }
   }
   glPopAttrib();
-
 }
 
 
@@ -504,14 +1324,37 @@ void draw_grass()
  */
 void draw_skeleton(bone *skel, int type)
 {
+  draw_skeleton_pose(skel, NULL, type);
+}
+
+
+/**
+ * As draw_skeleton, but the rotations can come from a flat pose array
+ * instead of the bones. The array is in the same depth first order as
+ * skel_make_array, which is also the order bones are drawn in, so the
+ * cursor just steps along one bone at a time. A NULL cursor uses the bones
+ * own rotations.
+ */
+void draw_skeleton_pose(bone *skel, float **pose, int type)
+{
+  float *rot;
+
   if(skel == NULL) return;
 
+  if(pose)
+  {
+    rot = *pose;
+    *pose += TRANS_SIZE;
+  }
+  else
+    rot = skel->rot;
+
   glPushMatrix();
 
   /* All translations are taken care of here. */
-  glRotatef(skel->rot[RX], 1.0, 0.0, 0.0);
-  glRotatef(skel->rot[RY], 0.0, 1.0, 0.0);
-  glRotatef(skel->rot[RZ], 0.0, 0.0, 1.0);
+  glRotatef(rot[RX], 1.0, 0.0, 0.0);
+  glRotatef(rot[RY], 0.0, 1.0, 0.0);
+  glRotatef(rot[RZ], 0.0, 0.0, 1.0);
 
   if(type == DRAW_SKEL_BONES)
   {
@@ -522,23 +1365,38 @@ void draw_skeleton(bone *skel, int type)
   }
   else if(type == DRAW_SKEL_GEOMETRY && skel->geometry != NULL)
   {
-    glInterleavedArrays(GL_T2F_N3F_V3F, 0, skel->geometry);
+    /* Draw from the buffer object if there is one, otherwise the whole
+     * mesh has to be sent over again. */
+    if(skel->vbo && global.r_vbos)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, skel->vbo);
+      pipe_arrays(NULL, 8, 5, 2, 0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else
+    {
+      pipe_arrays(skel->geometry, 8, 5, 2, 0);
+      global.upload_bytes += sizeof(float) * 8 * skel->tri_count;
+    }
+    pipe_update();
+    global.state_changes++;
     if(global.r_wire)
       glDrawArrays(GL_LINES, 0, skel->tri_count);
     else
       glDrawArrays(GL_TRIANGLES, 0, skel->tri_count);
+    global.draw_calls++;
   }
 
   /* Translate to the new position. */
   glTranslatef(skel->length, 0.0, 0.0);
 
   /* Draw the skeletons first child. */
-  draw_skeleton(skel->child, type);
+  draw_skeleton_pose(skel->child, pose, type);
 
   glPopMatrix();
 
   /* Draw the skeletons sibling after the pop. */
-  draw_skeleton(skel->sibling, type);
+  draw_skeleton_pose(skel->sibling, pose, type);
 }
 
 
@@ -547,43 +1405,135 @@ void draw_skeleton(bone *skel, int type)
  */
 void draw_model(model *mdl, int type)
 {
-  glPushAttrib(GL_ALL_ATTRIB_BITS);
-  glPushMatrix();
-  if(!shadowing)
-  {
-    if(global.r_texture && !global.r_wire)
-      glEnable(GL_TEXTURE_2D);
-    else
-      glDisable(GL_TEXTURE_2D);
+  draw_model_pose(mdl, mdl->pos, NULL, type);
+}
 
-    if(global.r_wire)
-    {
-      glDisable(GL_LIGHTING);
-      glColor4f(0.6, 0.6, 0.7, 1.0);
-    }
-    else
-      glEnable(GL_LIGHTING);
+
+/**
+ * Sets up texturing, lighting and colour for drawing models, as chosen in
+ * the render options.
+ */
+void ready_models()
+{
+  if(global.r_texture && !global.r_wire)
+    glEnable(GL_TEXTURE_2D);
+  else
+    glDisable(GL_TEXTURE_2D);
+
+  if(global.r_wire)
+  {
+    glDisable(GL_LIGHTING);
+    glColor4f(0.6, 0.6, 0.7, 1.0);
   }
   else
+    glEnable(GL_LIGHTING);
+  global.state_changes += 2;
+}
+
+
+/**
+ * Draws a model at the position and rotation in pos, posed by the flat
+ * array of bone rotations in pose. A NULL pose draws the model as its bones
+ * are currently set.
+ */
+void draw_model_pose(model *mdl, float *pos, float *pose, int type)
+{
+  bool piped;
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glPushMatrix();
+  if(shadowing || type == DRAW_SKEL_BONES)
   {
     glDisable(GL_TEXTURE_2D);
     glDisable(GL_LIGHTING);
+    global.state_changes += 2;
   }
+  else
+    ready_models();
 
   glBindTexture(GL_TEXTURE_2D, mdl->texture);
+  global.state_changes += 3;    /* The bind, push and pop. */
 
-  glTranslatef(mdl->pos[0], mdl->pos[1], mdl->pos[2]);
-  glRotatef(mdl->pos[3], 1.0, 0.0, 0.0);
-  glRotatef(mdl->pos[4], 0.0, 1.0, 0.0);
-  glRotatef(mdl->pos[5], 0.0, 0.0, 1.0);
+  glTranslatef(pos[0], pos[1], pos[2]);
+  glRotatef(pos[3], 1.0, 0.0, 0.0);
+  glRotatef(pos[4], 0.0, 1.0, 0.0);
+  glRotatef(pos[5], 0.0, 0.0, 1.0);
 
-  draw_skeleton(mdl->root, type);
+  if(type == DRAW_SKEL_GEOMETRY && global.r_skinned && mdl->skin)
+    skin_draw(mdl->skin, mdl->root, pose);
+  else
+  {
+    /* Bones are drawn a line at a time, so only meshes are piped. */
+    piped = type == DRAW_SKEL_GEOMETRY && pipe_begin();
+    draw_skeleton_pose(mdl->root, pose ? &pose : NULL, type);
+    if(piped)
+      pipe_end();
+  }
 
   glPopMatrix();
   glPopAttrib();
 }
 
 
+/**
+ * Copies the bone meshes of a newly loaded model, and its skinned mesh if
+ * it has one, into buffer objects so they only cross over to the card
+ * once. Does nothing without buffer objects or a current context, as in
+ * the benchmarks, which leaves the meshes to be drawn from client memory.
+ */
+void draw_upload_model(model *mdl)
+{
+  skin_mesh *skin = mdl->skin;
+  bone *b;
+  int i;
+
+  if(!gl_has_version(1, 5))
+    return;
+
+  for(i = 0; i < mdl->n_bones; i++)
+  {
+    b = mdl->bone_array[i];
+    if(!b->geometry || b->vbo)
+      continue;
+
+    glGenBuffers(1, &b->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 8 * b->tri_count,
+        b->geometry, GL_STATIC_DRAW);
+  }
+
+  if(skin && !skin->vbo)
+  {
+    glGenBuffers(1, &skin->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, skin->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * SKIN_VERT_SIZE *
+        skin->n_verts, skin->verts, GL_STATIC_DRAW);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/**
+ * Deletes the buffer objects of a model's bones before it is freed. Clones
+ * share them, so only the original model should do this.
+ */
+void draw_release_model(model *mdl)
+{
+  int i;
+
+  if(!mdl->bone_array)
+    return;
+
+  for(i = 0; i < mdl->n_bones; i++)
+  {
+    if(mdl->bone_array[i]->vbo)
+      glDeleteBuffers(1, &mdl->bone_array[i]->vbo);
+    mdl->bone_array[i]->vbo = 0;
+  }
+}
+
+
 /**
  * Utility function, allows the printing of text onto the screen using screen
  * coordinates. Needs to change the current projection and modelview matrixes
@@ -592,9 +1542,7 @@ void draw_model(model *mdl, int type)
 void glPrint(char *string, int x, int y)
 {
   glPushAttrib(GL_ALL_ATTRIB_BITS);
-  glDisable(GL_LIGHTING);
-  glDisable(GL_TEXTURE_2D);
-  glColor4f(0.0, 0.0, 0.0,1.0);
+  glColor4f(0.0, 0.0, 0.0, 1.0);
 
   /* Reset the Projection matrix and set up the screen. */
   glMatrixMode(GL_PROJECTION);
@@ -608,9 +1556,7 @@ void glPrint(char *string, int x, int y)
   glLoadIdentity();
 
   /* Draw the text. */
-  glRasterPos2d(x, y);
-  glColor3f(1.0, 1.0, 1.0);
-  // glutBitmapString(GLUT_BITMAP_9_BY_15, (unsigned char *) string);
+  text_draw(string, x, y);
 
   /* Reset the matrices. */
   glMatrixMode(GL_PROJECTION);
@@ -16,16 +16,31 @@
 #include "texture.h"
 
 #define SHADOW_DEPTH 0.2
+#define SHADOW_LOD   160.0      /* Shadows further than this are blobs. */
+#define IMPOSTOR_LOD 450.0      /* Models further than this are impostors. */
 
 #define GRASS_COUNT 128
 #define GRASS_ROT    45
 #define GRASS_SIZE  6.0
 
+#define DRAW_TREE_MARGIN 4.0    /* Room round models in the culling tree. */
+
 #define GROUND_SCALE 6.0
 
 #define MODEL_REGISTER_SIZE 128
 
 
+/**
+ * Handle to a model in the model register. Stays valid while the model is
+ * registered and goes stale once it is removed.
+ */
+typedef struct model_handle
+{
+  int slot;
+  unsigned int gen;
+} model_handle;
+
+
 /* States for drawing a skeleton. Can draw either mesh or bones. */
 enum {
   DRAW_SKEL_BONES,
@@ -41,7 +56,18 @@ extern void draw_scene();
 extern void glPrint(char *string, int x, int y);
 
 /* Model register functions. */
-extern void draw_model_register(model *mdl);
+extern model_handle draw_model_register(model *mdl);
+extern model_handle draw_instance_register(instance *inst);
+extern instance *draw_model_lookup(model_handle h);
+extern bool draw_model_remove(model_handle h);
+extern int draw_model_count();
+extern instance *draw_model_get(int index);
+extern int draw_model_slot(int index);
+extern bool draw_model_view(int index, float **pos, float **pose);
+extern int draw_model_passes(model *mdl, float *pos);
+extern void draw_find_passes();
+extern void draw_mouse_ray(int mx, int my, float org[3], float dir[3]);
+extern void draw_free_entry(instance *inst);
 
 /* Shadow functions. */
 extern void shadowMatrix(float shadowMat[4][4], float groundplane[4],
@@ -49,22 +75,30 @@ extern void shadowMatrix(float shadowMat[4][4], float groundplane[4],
 extern void ready_shadows();
 extern void finish_shadows();
 extern void draw_shadow(model *mdl);
+extern void ready_model_shadow();
+extern void draw_shadow_pose(model *mdl, float *pos, float *pose);
 extern void findPlane(float plane[4], float v0[3], float v1[3], float v2[3]);
 
 /* Environment functions. */
 extern void draw_ground(float dist);
 extern void gen_grass(int count, float dist, int max_rot, float size);
+extern void queue_grass();
 extern void draw_grass();
 
 /* Model drawing functions. */
 extern void set_curr_bone(bone *bone);
 extern void draw_bone(float length, bool curr);
 extern void draw_skeleton(bone *skel, int type);
+extern void draw_skeleton_pose(bone *skel, float **pose, int type);
+extern void ready_models();
 extern void draw_model(model *mdl, int type);
+extern void draw_model_pose(model *mdl, float *pos, float *pose, int type);
+extern void draw_upload_model(model *mdl);
+extern void draw_release_model(model *mdl);
 
 /* Skybox functions. (from skybox.c) */
 extern void skybox_init();
-extern void skybox_gen_lists(float size);
+extern void skybox_gen_arrays(float size);
 extern bool skybox_render();
 
 #endif
@@ -3,12 +3,16 @@
  */
 
 #include "editor.h"
+#include "bvh.h"
 #include "camera.h"
 #include "global.h"
 #include "load_mdl.h"
 #include "mem.h"
 #include "drawing.h"
+#include "util.h"
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <GLUT/glut.h>
 
 #define EDIT_ROT_AMOUNT 5.0
@@ -25,6 +29,7 @@ typedef struct edit_anim
 { 
   int n_frames;
   int frame_width;
+  int interp;                   /* How it is interpolated, INTERP_*. */
 
   struct frame {
     float *rots;
@@ -41,6 +46,11 @@ int curr_bone;                  /* Currently selected bone index. */
 model *mdl;                     /* Model we're editing. */
 int time_int = 200;             /* Interval between frames. */
 char edit_string[32];           /* String for displaying info. */
+bvh pick_tree;                  /* Posed bone meshes, for picking. */
+
+
+/* Function prototypes. */
+float edit_pick_test(void *data, int id, float org[3], float dir[3]);
 
 
 /**
@@ -53,6 +63,8 @@ void edit_init()
   NEW(e_anim);
   CHECK_NR(e_anim);
 
+  bvh_init(&pick_tree, 0.0);
+
   mdl = load_model("data/model/bird.mdl");
   if(!mdl)
   {
@@ -65,6 +77,15 @@ void edit_init()
   e_anim->frame_width = mdl->n_bones;
   e_anim->head        = NULL;
 
+  /* Keep the interpolation of the clip the model plays, so saving doesn't
+   * turn it back to linear. */
+  if(mdl->state.curr_anim)
+    e_anim->interp = mdl->state.curr_anim->interp;
+  else if(mdl->n_anims > 0 && mdl->anims[0])
+    e_anim->interp = mdl->anims[0]->interp;
+  else
+    e_anim->interp = INTERP_LINEAR;
+
   global.r_skybox = false;
   global.r_grass  = false;
   global.r_bones  =  true;
@@ -95,7 +116,8 @@ void edit_update(int now)
  */
 char *edit_get_string()
 {
-  sprintf(edit_string, "Frame %d of %d.", frame_index, e_anim->n_frames);
+  sprintf(edit_string, "Frame %d of %d, %s.", frame_index, e_anim->n_frames,
+      interp_name(e_anim->interp));
   return edit_string;
 }
 
@@ -120,6 +142,7 @@ void edit_cleanup()
   }
 
   FREE(e_anim);
+  bvh_free(&pick_tree);
 }
 
 
@@ -222,6 +245,12 @@ void edit_keyboard(unsigned char key, int mx, int my)
     case 'l':
       edit_add_frame();
       break;
+    case 'p':
+      edit_pick(mx, my);
+      break;
+    case 'i':
+      e_anim->interp = (e_anim->interp + 1) % (INTERP_HERMITE + 1);
+      break;
     case ';':
       edit_del_frame(this_frame);
       this_frame = e_anim->head;
@@ -274,6 +303,74 @@ void edit_keyboard(unsigned char key, int mx, int my)
 }
 
 
+/**
+ * Returns how far along a ray it hits the bounding sphere of a posed bone
+ * mesh, or -1 if it misses. data holds the spheres, 4 floats each.
+ */
+float edit_pick_test(void *data, int id, float org[3], float dir[3])
+{
+  float *sphere = (float *)data + id * 4;
+
+  if(sphere[3] <= 0.0)
+    return -1.0;
+  return ray_sphere(org, dir, sphere);
+}
+
+
+/**
+ * Selects the bone whose mesh is under the mouse. The meshes are put in a
+ * tree as they are posed now and a ray from the mouse is cast through it.
+ */
+void edit_pick(int mx, int my)
+{
+  float m[16], *mats, *out, *spheres, *boxes, org[3], dir[3];
+  int i, k, hit;
+  bone *b;
+
+  mats    = malloc(sizeof(float) * 16 * mdl->n_bones);
+  spheres = malloc(sizeof(float) * 4 * mdl->n_bones);
+  boxes   = malloc(sizeof(float) * 6 * mdl->n_bones);
+  if(!mats || !spheres || !boxes)
+  {
+    fprintf(stderr, "ERROR(edit_pick): Out of memory.\n");
+    FREE(mats);
+    FREE(spheres);
+    FREE(boxes);
+    return;
+  }
+
+  model_matrix(mdl->pos, m);
+  out = mats;
+  skel_pose_matrices(mdl->root, NULL, m, &out, 16);
+
+  for(i = 0; i < mdl->n_bones; i++)
+  {
+    b = mdl->bone_array[i];
+    m4_point(spheres + i * 4, mats + i * 16, b->bound);
+    spheres[i * 4 + 3] = b->bound[3];
+
+    for(k = 0; k < 3; k++)
+    {
+      boxes[i * 6 + k]     = spheres[i * 4 + k] - b->bound[3];
+      boxes[i * 6 + k + 3] = spheres[i * 4 + k] + b->bound[3];
+    }
+  }
+
+  draw_mouse_ray(mx, my, org, dir);
+  if(bvh_build(&pick_tree, boxes, mdl->n_bones))
+  {
+    hit = bvh_ray(&pick_tree, org, dir, HUGE_VAL, edit_pick_test, spheres,
+        NULL);
+    if(hit >= 0)
+      curr_bone = hit;
+  }
+
+  free(mats);
+  free(spheres);
+  free(boxes);
+}
+
+
 /**
  * Saves the current animation to the file filename.
  */
@@ -291,7 +388,8 @@ void edit_save_anim(const char *filename)
     return;
   }
 
-  fprintf(outfile, "a %d\n", e_anim->n_frames);
+  fprintf(outfile, "a %d %s\n", e_anim->n_frames,
+      interp_name(e_anim->interp));
   for(c_frame = e_anim->head; c_frame; c_frame = c_frame->next)
   {
     fprintf(outfile, "f %d", c_frame->time_int);
@@ -14,6 +14,7 @@ extern void edit_update(int now);
 extern void edit_cleanup();
 char *edit_get_string();
 extern void edit_keyboard(unsigned char key, int mx, int my);
+extern void edit_pick(int mx, int my);
 extern void edit_save_anim(const char *filename);
 
 
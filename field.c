@@ -0,0 +1,773 @@
+/**
+ * field.c
+ *
+ * Each tuft is two crossed quads, eight vertices in the buffer. A vertex
+ * holds where its tuft is planted and how it is turned, which go in as
+ * gl_Vertex, and which corner of which quad it is, as a small attribute.
+ * The shader turns the corner by the tuft's own angle, or by the camera's
+ * when billboarding, scales it and moves it out to the tuft, so nothing
+ * about the field changes from frame to frame and it is only sent to the
+ * card once.
+ *
+ * The tufts are sorted into chunks as they are baked, and the caller's
+ * list is put in the same order so that drawing the field the old way
+ * blends it in the same order too.
+ *
+ * Streamed grass is made instead a tile at a time as the camera comes near,
+ * from a seed and where the tile is, so a tile that is thrown away and made
+ * again comes out the same. Tiles live in a fixed pool of slots in one
+ * buffer, and the one that has gone longest without being seen is thrown
+ * away to make room, so however big the world is the grass takes the same
+ * memory.
+ */
+
+#include "field.h"
+#include "bvh.h"
+#include "cull.h"
+#include "mem.h"
+#include "shader.h"
+#include "util.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * One corner of a tuft. corner is x and z across the quad, -1 to 1, and y
+ * up it, 0 to 1.
+ */
+typedef struct field_vert
+{
+  float tuft[3];                /* x, z and turn in degrees. */
+  signed char corner[4];
+} field_vert;
+
+/**
+ * A chunk of the field, a run of tufts in the buffer.
+ */
+typedef struct field_chunk
+{
+  int first;
+  int count;
+} field_chunk;
+
+/**
+ * A slot in the pool of streamed tiles.
+ */
+typedef struct field_tile
+{
+  int x, z;                     /* Place in the grid of tiles. */
+  int count;                    /* Tufts made, or -1 if the slot is empty. */
+  int used;                     /* Frame it was last drawn in. */
+  int next;                     /* Next slot in the same bucket, or -1. */
+} field_tile;
+
+/**
+ * A tile wanted this frame.
+ */
+typedef struct field_want
+{
+  int x, z;
+  float dist;                   /* From the eye to the middle of it. */
+  int slot;                     /* Slot it is in, or -1 if not made yet. */
+} field_want;
+
+
+/* Function prototypes. */
+int field_sort(float *loc, int count);
+void field_seen_visit(void *data, int chunk);
+int field_order(const void *a, const void *b);
+void field_bind(GLuint vbo, int texture, float yaw, float size);
+void field_unbind();
+unsigned int field_hash(int x, int z);
+float field_rand(unsigned int *state);
+int field_tile_find(int x, int z);
+int field_tile_load(int x, int z);
+int field_want_order(const void *a, const void *b);
+
+
+const char *field_vert_src =
+  "uniform float yaw, size;\n"
+  "uniform bool billboard;\n"
+  "attribute vec4 corner;\n"
+  "void main()\n"
+  "{\n"
+  "  float a = radians(billboard ? yaw : gl_Vertex.z);\n"
+  "  vec3 v = corner.xyz * vec3(size, size * 0.75, size);\n"
+  "  vec2 r = vec2(cos(a), sin(a));\n"
+  "\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix *\n"
+  "                vec4(gl_Vertex.x + r.x * v.x + r.y * v.z, v.y,\n"
+  "                     gl_Vertex.y - r.y * v.x + r.x * v.z, 1.0);\n"
+  "  gl_TexCoord[0] = vec4((corner.x + corner.z + 1.0) * 0.5, corner.y,\n"
+  "                        0.0, 1.0);\n"
+  "  gl_FrontColor = gl_Color;\n"
+  "}\n";
+
+/* Grass replaces its colour with the texture's, as the old way does. */
+const char *field_frag_src =
+  "uniform bool textured;\n"
+  "uniform sampler2D tex;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = textured ? texture2D(tex, gl_TexCoord[0].st) : gl_Color;\n"
+  "}\n";
+
+const char *field_attribs[] = {"corner", NULL};
+
+/* The corners of the two quads of a tuft, in drawing order. */
+const signed char field_corners[8][4] = {
+  {-1, 0,  0, 0}, { 1, 0,  0, 0}, { 1, 1,  0, 0}, {-1, 1,  0, 0},
+  { 0, 0, -1, 0}, { 0, 0,  1, 0}, { 0, 1,  1, 0}, { 0, 1, -1, 0}
+};
+
+int field_state = 0;            /* 0 untried, 1 ready, -1 unsupported. */
+GLuint field_prog = 0;
+GLint field_yaw_loc, field_size_loc, field_billboard_loc, field_textured_loc;
+
+GLuint field_vbo = 0;
+float field_size = 1.0;
+
+field_chunk *chunks = NULL;
+int n_chunks = 0;
+bvh field_tree;                 /* Box round each chunk, for culling. */
+int *field_seen = NULL;         /* Chunks in view this frame, in order. */
+int field_n_seen = 0;
+
+field_tile *tiles = NULL;       /* Pool of streamed tiles, or NULL. */
+int buckets[FIELD_BUCKETS];     /* First slot of each hash bucket, or -1. */
+field_vert *stream_verts = NULL; /* Scratch for making a tile. */
+GLuint stream_vbo = 0;
+int stream_density, stream_rot, stream_frame;
+unsigned int stream_seed;
+float stream_size;
+
+
+/**
+ * Checks the driver can run the field's shader and builds it. Only does
+ * the work once. Returns false if the field can't be used, in which case
+ * the grass should be drawn the old way.
+ */
+bool field_init()
+{
+  if(field_state)
+    return field_state > 0;
+
+  field_state = -1;
+
+  if(!gl_has_version(2, 0))
+    return false;
+
+  field_prog = shader_build("field", field_vert_src, field_frag_src,
+      field_attribs, FIELD_ATTRIB);
+  if(!field_prog)
+    return false;
+
+  field_yaw_loc       = glGetUniformLocation(field_prog, "yaw");
+  field_size_loc      = glGetUniformLocation(field_prog, "size");
+  field_billboard_loc = glGetUniformLocation(field_prog, "billboard");
+  field_textured_loc  = glGetUniformLocation(field_prog, "textured");
+
+  glUseProgram(field_prog);
+  glUniform1i(glGetUniformLocation(field_prog, "tex"), 0);
+  glUseProgram(0);
+
+  bvh_init(&field_tree, 0.0);
+
+  field_state = 1;
+  return true;
+}
+
+
+/**
+ * Frees the field and its shader. field_init may be called again after.
+ */
+void field_cleanup()
+{
+  if(field_vbo)
+    glDeleteBuffers(1, &field_vbo);
+  field_vbo = 0;
+
+  if(stream_vbo)
+    glDeleteBuffers(1, &stream_vbo);
+  stream_vbo = 0;
+  FREE(tiles);
+  FREE(stream_verts);
+  tiles = NULL;
+  stream_verts = NULL;
+
+  FREE(chunks);
+  FREE(field_seen);
+  chunks = NULL;
+  field_seen = NULL;
+  n_chunks = 0;
+
+  if(field_state > 0)
+    bvh_free(&field_tree);
+
+  shader_free(field_prog);
+  field_prog = 0;
+  field_state = 0;
+}
+
+
+/**
+ * Sorts count tufts, 3 floats each of x, z and turn, into chunks of the
+ * grid, keeping them in the order they were in within each chunk, and
+ * fills in chunks. Returns how many chunks there are, or -1 if the memory
+ * could not be found.
+ */
+int field_sort(float *loc, int count)
+{
+  float lo[2], hi[2], *sorted;
+  int *cell, *start, nx, nz, cells, i, k, c;
+
+  lo[0] = hi[0] = loc[0];
+  lo[1] = hi[1] = loc[1];
+  for(i = 1; i < count; i++)
+    for(k = 0; k < 2; k++)
+    {
+      if(loc[i * 3 + k] < lo[k]) lo[k] = loc[i * 3 + k];
+      if(loc[i * 3 + k] > hi[k]) hi[k] = loc[i * 3 + k];
+    }
+
+  nx = (int)((hi[0] - lo[0]) / FIELD_CHUNK) + 1;
+  nz = (int)((hi[1] - lo[1]) / FIELD_CHUNK) + 1;
+  cells = nx * nz;
+
+  cell   = malloc(sizeof(int) * count);
+  start  = calloc(cells + 1, sizeof(int));
+  sorted = malloc(sizeof(float) * 3 * count);
+  chunks = malloc(sizeof(field_chunk) * (count < cells ? count : cells));
+  if(!cell || !start || !sorted || !chunks)
+  {
+    FREE(cell);
+    FREE(start);
+    FREE(sorted);
+    return -1;
+  }
+
+  /* Count the tufts in each cell, then turn the counts into where each
+   * cell's run starts and deal the tufts out. */
+  for(i = 0; i < count; i++)
+  {
+    cell[i] = (int)((loc[i * 3] - lo[0]) / FIELD_CHUNK) * nz +
+              (int)((loc[i * 3 + 1] - lo[1]) / FIELD_CHUNK);
+    start[cell[i] + 1]++;
+  }
+
+  n_chunks = 0;
+  for(c = 0; c < cells; c++)
+  {
+    if(start[c + 1] > 0)
+    {
+      chunks[n_chunks].first = start[c];
+      chunks[n_chunks].count = start[c + 1];
+      n_chunks++;
+    }
+    start[c + 1] += start[c];
+  }
+
+  for(i = 0; i < count; i++)
+    memcpy(sorted + start[cell[i]]++ * 3, loc + i * 3, sizeof(float) * 3);
+  memcpy(loc, sorted, sizeof(float) * 3 * count);
+
+  free(cell);
+  free(start);
+  free(sorted);
+  return n_chunks;
+}
+
+
+/**
+ * Bakes count tufts of grass, given as 3 floats each of x, z and turn in
+ * degrees, into the buffer and puts them in chunk order. Each tuft reaches
+ * size either side of where it's planted. Returns false if the field could
+ * not be made, and the grass should then be drawn the old way.
+ */
+bool field_bake(float *loc, int count, float size)
+{
+  field_vert *verts;
+  float *boxes, *b;
+  int i, j, k;
+
+  if(!field_init())
+    return false;
+
+  FREE(chunks);
+  FREE(field_seen);
+  chunks = NULL;
+  field_seen = NULL;
+  n_chunks = 0;
+  field_size = size;
+  bvh_clear(&field_tree);
+
+  if(count <= 0)
+    return true;
+
+  if(field_sort(loc, count) < 0)
+  {
+    fprintf(stderr, "ERROR(field_bake): Out of memory.\n");
+    return false;
+  }
+
+  /* Box each chunk for culling. */
+  field_seen = malloc(sizeof(int) * n_chunks);
+  boxes = malloc(sizeof(float) * 6 * n_chunks);
+  verts = malloc(sizeof(field_vert) * 8 * count);
+  if(!field_seen || !boxes || !verts)
+  {
+    fprintf(stderr, "ERROR(field_bake): Out of memory.\n");
+    FREE(boxes);
+    FREE(verts);
+    n_chunks = 0;
+    return false;
+  }
+
+  for(i = 0; i < n_chunks; i++)
+  {
+    b = boxes + i * 6;
+    for(j = chunks[i].first; j < chunks[i].first + chunks[i].count; j++)
+      for(k = 0; k < 2; k++)
+      {
+        if(j == chunks[i].first || loc[j * 3 + k] < b[k * 2])
+          b[k * 2] = loc[j * 3 + k];
+        if(j == chunks[i].first || loc[j * 3 + k] > b[k * 2 + 3])
+          b[k * 2 + 3] = loc[j * 3 + k];
+      }
+
+    /* The grid is x by z, the boxes x, y and z. */
+    b[0] -= size;
+    b[1]  = 0.0;
+    b[2] -= size;
+    b[3] += size;
+    b[4]  = size * 0.75;
+    b[5] += size;
+  }
+
+  /* Every corner of a tuft carries the tuft with it. */
+  for(i = 0; i < count; i++)
+    for(j = 0; j < 8; j++)
+    {
+      memcpy(verts[i * 8 + j].tuft, loc + i * 3, sizeof(float) * 3);
+      memcpy(verts[i * 8 + j].corner, field_corners[j], 4);
+    }
+
+  if(!field_vbo)
+    glGenBuffers(1, &field_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, field_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(field_vert) * 8 * count, verts,
+      GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  global.upload_bytes += sizeof(field_vert) * 8 * count;
+
+  if(!bvh_build(&field_tree, boxes, n_chunks))
+    n_chunks = 0;
+
+  free(boxes);
+  free(verts);
+  return n_chunks > 0;
+}
+
+
+/**
+ * Returns true if there is a baked field to draw.
+ */
+bool field_ready()
+{
+  return field_state > 0 && n_chunks > 0;
+}
+
+
+/**
+ * Called by the tree for each chunk in view.
+ */
+void field_seen_visit(void *data, int chunk)
+{
+  field_seen[field_n_seen++] = chunk;
+}
+
+
+/**
+ * Orders chunks as they are in the buffer.
+ */
+int field_order(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+
+/**
+ * Draws the chunks of the field in view with texture, or in wireframe,
+ * with everything else already readied for grass. yaw is how far round
+ * billboards are turned to face the camera, in degrees. Runs of chunks
+ * next to each other in the buffer are drawn in one call.
+ */
+void field_draw(int texture, float yaw)
+{
+  int i, k, first, end;
+
+  if(!field_ready())
+    return;
+
+  field_n_seen = 0;
+  if(global.r_cull)
+  {
+    cull_tree(&field_tree, field_seen_visit, NULL);
+    qsort(field_seen, field_n_seen, sizeof(int), field_order);
+  }
+  else
+    for(i = 0; i < n_chunks; i++)
+      field_seen[field_n_seen++] = i;
+
+  field_bind(field_vbo, texture, yaw, field_size);
+
+  for(i = 0; i < field_n_seen; i = k)
+  {
+    first = chunks[field_seen[i]].first;
+    end   = first + chunks[field_seen[i]].count;
+    for(k = i + 1; k < field_n_seen && field_seen[k] == field_seen[k - 1] + 1;
+        k++)
+      end += chunks[field_seen[k]].count;
+
+    glDrawArrays(GL_QUADS, first * 8, (end - first) * 8);
+  }
+
+  /* Whatever didn't make it into a chunk in view was culled. */
+  if(global.r_cull)
+  {
+    end = 0;
+    for(i = 0; i < field_n_seen; i++)
+      end += chunks[field_seen[i]].count;
+    global.culled_grass += chunks[n_chunks - 1].first +
+                           chunks[n_chunks - 1].count - end;
+  }
+
+  field_unbind();
+}
+
+
+/**
+ * Readies the field's shader to draw tufts of a size from a buffer, with
+ * texture or in wireframe. yaw is how far round billboards are turned to
+ * face the camera, in degrees.
+ */
+void field_bind(GLuint vbo, int texture, float yaw, float size)
+{
+  size_t stride = sizeof(field_vert);
+
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+  glUseProgram(field_prog);
+  glUniform1f(field_yaw_loc, yaw);
+  glUniform1f(field_size_loc, size);
+  glUniform1i(field_billboard_loc, global.bb_grass);
+  glUniform1i(field_textured_loc, global.r_texture && !global.r_wire);
+
+  if(global.r_wire)
+  {
+    glColor4f(0.63, 0.73, 0.51, 1.0);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  }
+  else
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, stride, NULL);
+  glEnableVertexAttribArray(FIELD_ATTRIB);
+  glVertexAttribPointer(FIELD_ATTRIB, 4, GL_BYTE, GL_FALSE, stride,
+      (char *)NULL + offsetof(field_vert, corner));
+  global.state_changes += 3;
+}
+
+
+/**
+ * Puts back what field_bind changed, apart from the attributes the caller
+ * pushed.
+ */
+void field_unbind()
+{
+  glDisableVertexAttribArray(FIELD_ATTRIB);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glUseProgram(0);
+
+  glPopClientAttrib();
+}
+
+
+/**
+ * Mixes a tile's place in the grid into a number to find it by, and to
+ * seed the tufts made for it.
+ */
+unsigned int field_hash(int x, int z)
+{
+  unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)z * 19349663u;
+
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/**
+ * Returns the next number from 0 up to 1 from a xorshift generator, so a
+ * tile comes out the same every time it is made whatever rand is doing.
+ */
+float field_rand(unsigned int *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return (*state >> 8) / 16777216.0;
+}
+
+
+/**
+ * Sets up a pool of tiles for streaming grass, with density tufts on a
+ * whole tile turned up to max_rot degrees and reaching size either side.
+ * Returns false if it can't be done, in which case grass should be planted
+ * once as usual.
+ */
+bool field_stream_init(int density, int max_rot, float size)
+{
+  field_vert *verts;
+  int i, j;
+
+  if(density <= 0 || !field_init())
+    return false;
+
+  tiles  = malloc(sizeof(field_tile) * FIELD_POOL);
+  verts  = malloc(sizeof(field_vert) * 8 * density);
+  if(!tiles || !verts)
+  {
+    fprintf(stderr, "ERROR(field_stream_init): Out of memory.\n");
+    FREE(tiles);
+    FREE(verts);
+    tiles = NULL;
+    return false;
+  }
+
+  stream_density = density;
+  stream_rot = max_rot;
+  stream_size = size;
+  stream_verts = verts;
+  field_stream_seed(0);
+
+  /* The corners never change, so they are only filled in once. */
+  for(i = 0; i < density; i++)
+    for(j = 0; j < 8; j++)
+      memcpy(verts[i * 8 + j].corner, field_corners[j], 4);
+
+  glGenBuffers(1, &stream_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
+  glBufferData(GL_ARRAY_BUFFER,
+      sizeof(field_vert) * 8 * density * FIELD_POOL, NULL, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  return true;
+}
+
+
+/**
+ * Returns true if grass is being streamed in tiles.
+ */
+bool field_streaming()
+{
+  return field_state > 0 && tiles;
+}
+
+
+/**
+ * Forgets every tile, so they are made again from a new seed as they come
+ * into view.
+ */
+void field_stream_seed(unsigned int seed)
+{
+  int i;
+
+  stream_seed = seed;
+  stream_frame = 0;
+
+  for(i = 0; i < FIELD_BUCKETS; i++)
+    buckets[i] = -1;
+  for(i = 0; tiles && i < FIELD_POOL; i++)
+  {
+    tiles[i].count = -1;
+    tiles[i].used = -1;
+  }
+}
+
+
+/**
+ * Returns the slot holding the tile at x, z of the grid, or -1 if it
+ * isn't in the pool.
+ */
+int field_tile_find(int x, int z)
+{
+  int t = buckets[field_hash(x, z) % FIELD_BUCKETS];
+
+  while(t >= 0 && (tiles[t].x != x || tiles[t].z != z))
+    t = tiles[t].next;
+
+  return t;
+}
+
+
+/**
+ * Makes the tile at x, z of the grid in the slot that has gone longest
+ * without being drawn. Tufts that would be off the edge of the world are
+ * left out. Returns the slot, or -1 if every slot is in use this frame.
+ */
+int field_tile_load(int x, int z)
+{
+  unsigned int state;
+  float *t, world = global.world_size;
+  int slot = -1, i, j, *link;
+
+  for(i = 0; i < FIELD_POOL; i++)
+    if(tiles[i].used < stream_frame &&
+       (slot < 0 || tiles[i].used < tiles[slot].used))
+      slot = i;
+  if(slot < 0)
+    return -1;
+
+  /* Take the old tile out of its bucket. */
+  if(tiles[slot].count >= 0)
+  {
+    link = &buckets[field_hash(tiles[slot].x, tiles[slot].z) % FIELD_BUCKETS];
+    while(*link != slot)
+      link = &tiles[*link].next;
+    *link = tiles[slot].next;
+  }
+
+  state = field_hash(x, z) ^ stream_seed;
+  if(state == 0)
+    state = 1;
+
+  tiles[slot].count = 0;
+  for(i = 0; i < stream_density; i++)
+  {
+    t = stream_verts[tiles[slot].count * 8].tuft;
+    t[0] = (x + field_rand(&state)) * FIELD_TILE;
+    t[1] = (z + field_rand(&state)) * FIELD_TILE;
+    t[2] = field_rand(&state) * stream_rot;
+    if(fabs(t[0]) > world || fabs(t[1]) > world)
+      continue;
+
+    for(j = 1; j < 8; j++)
+      memcpy(stream_verts[tiles[slot].count * 8 + j].tuft, t,
+          sizeof(float) * 3);
+    tiles[slot].count++;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER,
+      sizeof(field_vert) * 8 * stream_density * slot,
+      sizeof(field_vert) * 8 * tiles[slot].count, stream_verts);
+  global.upload_bytes += sizeof(field_vert) * 8 * tiles[slot].count;
+
+  tiles[slot].x = x;
+  tiles[slot].z = z;
+  link = &buckets[field_hash(x, z) % FIELD_BUCKETS];
+  tiles[slot].next = *link;
+  *link = slot;
+
+  return slot;
+}
+
+
+/**
+ * Orders tiles wanted this frame nearest first.
+ */
+int field_want_order(const void *a, const void *b)
+{
+  float da = ((const field_want *)a)->dist, db = ((const field_want *)b)->dist;
+
+  return da < db ? -1 : da > db;
+}
+
+
+/**
+ * Draws the streamed grass round the eye, making tiles that have come into
+ * view and thinning out ones further away. A tile's tufts are made in a
+ * random order, so drawing only the first few of them still spreads them
+ * over the whole tile. Tiles are drawn furthest first so they blend over
+ * each other properly.
+ */
+void field_stream_draw(int texture, float yaw, float eye[3])
+{
+  field_want want[FIELD_POOL];
+  int x0, x1, z0, z1, x, z, n = 0, loads = 0, i, count;
+  float c[3], d[3], reach, keep;
+
+  if(!field_streaming())
+    return;
+
+  stream_frame++;
+
+  /* Every tile on the world that might come within reach of the eye. */
+  x0 = (int)floor(fmax(eye[0] - FIELD_RADIUS, -global.world_size) / FIELD_TILE);
+  x1 = (int)floor(fmin(eye[0] + FIELD_RADIUS,  global.world_size) / FIELD_TILE);
+  z0 = (int)floor(fmax(eye[2] - FIELD_RADIUS, -global.world_size) / FIELD_TILE);
+  z1 = (int)floor(fmin(eye[2] + FIELD_RADIUS,  global.world_size) / FIELD_TILE);
+  reach = FIELD_TILE * 0.7072 + stream_size;
+
+  for(x = x0; x <= x1; x++)
+    for(z = z0; z <= z1; z++)
+    {
+      c[0] = (x + 0.5) * FIELD_TILE;
+      c[1] = stream_size * 0.375;
+      c[2] = (z + 0.5) * FIELD_TILE;
+      v_sub(d, c, eye);
+      if(v_dot(d, d) > FIELD_RADIUS * FIELD_RADIUS)
+        continue;
+      if(global.r_cull && cull_sphere(c, reach))
+      {
+        global.culled_grass += stream_density;
+        continue;
+      }
+      if(n == FIELD_POOL)
+        continue;
+
+      want[n].x = x;
+      want[n].z = z;
+      want[n].dist = sqrt(v_dot(d, d));
+      want[n].slot = field_tile_find(x, z);
+      if(want[n].slot >= 0)
+        tiles[want[n].slot].used = stream_frame;
+      n++;
+    }
+
+  /* Only make a few tiles a frame, nearest first, so turning round doesn't
+   * stall. The rest come in over the next few frames. */
+  qsort(want, n, sizeof(field_want), field_want_order);
+  for(i = 0; i < n && loads < FIELD_LOADS; i++)
+    if(want[i].slot < 0)
+    {
+      want[i].slot = field_tile_load(want[i].x, want[i].z);
+      if(want[i].slot >= 0)
+        tiles[want[i].slot].used = stream_frame;
+      loads++;
+    }
+
+  field_bind(stream_vbo, texture, yaw, stream_size);
+
+  for(i = n - 1; i >= 0; i--)
+  {
+    if(want[i].slot < 0)
+      continue;
+
+    /* Keep the tufts about as far apart on screen as they are up close. */
+    keep = FIELD_NEAR / fmax(want[i].dist, FIELD_NEAR);
+    count = (int)ceil(tiles[want[i].slot].count * keep * keep);
+    if(count > 0)
+      glDrawArrays(GL_QUADS, stream_density * 8 * want[i].slot, count * 8);
+  }
+
+  field_unbind();
+}
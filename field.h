@@ -0,0 +1,43 @@
+/**
+ * field.h
+ *
+ * The whole field of grass baked into one buffer object and drawn with a
+ * vertex shader that plants, turns and billboards each tuft, rather than a
+ * matrix and a display list call per tuft. The tufts are grouped into
+ * square chunks that each take a run of the buffer, so culling is done a
+ * chunk at a time and what is left in view is drawn in a few calls.
+ *
+ * For a world too big to plant all at once the grass can be streamed
+ * instead, made a tile at a time round the camera and thinned out with
+ * distance, with a fixed pool of tiles reused least recently seen first.
+ */
+
+#ifndef _FIELD_H_
+#define _FIELD_H_
+
+#include "global.h"
+
+#define FIELD_CHUNK  64.0       /* Width of a chunk of grass. */
+#define FIELD_ATTRIB 10         /* First attribute used for tufts. */
+
+#define FIELD_TILE    128.0     /* Width of a streamed tile. */
+#define FIELD_RADIUS  768.0     /* Tiles further than this aren't drawn. */
+#define FIELD_NEAR    128.0     /* Tiles nearer than this are drawn whole. */
+#define FIELD_POOL    192       /* Tiles kept at once. */
+#define FIELD_BUCKETS 256       /* Hash buckets for finding tiles. */
+#define FIELD_LOADS   8         /* Tiles made at most each frame. */
+
+
+/* Interface. */
+extern bool field_init();
+extern void field_cleanup();
+extern bool field_bake(float *loc, int count, float size);
+extern bool field_ready();
+extern void field_draw(int texture, float yaw);
+extern bool field_stream_init(int density, int max_rot, float size);
+extern bool field_streaming();
+extern void field_stream_seed(unsigned int seed);
+extern void field_stream_draw(int texture, float yaw, float eye[3]);
+
+
+#endif
@@ -3,6 +3,15 @@
  *
  * Creates some simple code to create multiple instances of birds and
  * animate them.
+ *
+ * Each bird flies in a circle. The circles are stored as a flock, a set of
+ * parallel arrays with one entry per bird, so that moving the whole flock
+ * is a straight run over a few arrays. The update works on four birds at a
+ * time where SSE is avaliable and uses a cheap sine approximation rather
+ * than calling cos and sin for every bird.
+ *
+ * With flocking turned on the circles only give each bird somewhere to
+ * start, after which the birds are steered by the boids in boids.c.
  */
 
 #include "flight.h"
@@ -11,31 +20,150 @@
 #include "drawing.h"
 #include "mem.h"
 #include "load_mdl.h"
+#include "jobs.h"
+#include "boids.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
-typedef struct flight_pat
+
+/**
+ * The flock. Angles are in radians between -PI and PI and speeds in radians
+ * per second. The out arrays hold the result of the last update, ready to
+ * be copied into the models.
+ */
+typedef struct flock
 {
-  model *mdl;
-  float pos[3];
-  float angle;
-  float dist;
-  float speed;
-} flight_pat;
+  float *center_x;              /* Centre of each circle. */
+  float *center_z;
+  float *height;                /* Height the bird flies at. */
+  float *radius;                /* Radius of the circle. */
+  float *angle;                 /* Current angle around the circle. */
+  float *speed;                 /* Angular speed. */
+
+  float *out_x;                 /* Position worked out by the update. */
+  float *out_z;
+
+  instance **insts;             /* Instance drawn for each bird. */
+  model_handle *handles;        /* Register handle of each model. */
+
+  int count;                    /* Birds in the flock. */
+  int cap;                      /* Birds there is room for. */
+} flock;
+
+/**
+ * Everything a flight job needs to know about the current frame.
+ */
+typedef struct flight_frame
+{
+  int now;
+  float passed;
+} flight_frame;
+
+#define FLIGHT_GRAIN 64
+#define FLOCK_START_CAP 64
+
+/* Longest step the flock takes in one go, in seconds. Keeps every step
+ * under a full turn so angles only ever need wrapping once. */
+#define FLIGHT_MAX_STEP 1.0
+
+/* Longest step the boids take in one go. Steering is only stable over
+ * short steps. */
+#define FLOCK_MAX_STEP 0.05
 
 model *base_bird;
-flight_pat *patterns[MODEL_REGISTER_SIZE];
-int pat_index = 0;
+flock birds;
+boids flockers;
+
+
+/* Function prototypes. */
+bool flock_reserve(flock *f, int cap);
+void flock_free(flock *f);
 
 
 /**
- * Create a new flight pattern array.
+ * Makes room in the flock for at least cap birds. Returns false if the
+ * memory could not be found, in which case the flock is unchanged.
+ */
+bool flock_reserve(flock *f, int cap)
+{
+  float **arrays[8];
+  float *grown;
+  instance **insts;
+  model_handle *handles;
+  int i;
+
+  if(cap <= f->cap)
+    return true;
+  if(cap < f->cap * 2)
+    cap = f->cap * 2;
+  if(cap < FLOCK_START_CAP)
+    cap = FLOCK_START_CAP;
+
+  arrays[0] = &f->center_x; arrays[1] = &f->center_z;
+  arrays[2] = &f->height;   arrays[3] = &f->radius;
+  arrays[4] = &f->angle;    arrays[5] = &f->speed;
+  arrays[6] = &f->out_x;    arrays[7] = &f->out_z;
+
+  /* Each array is grown on its own. One failing part way through just
+   * leaves some arrays bigger than they need to be. */
+  for(i = 0; i < 8; i++)
+  {
+    grown = realloc(*arrays[i], sizeof(float) * cap);
+    if(!grown) return false;
+    *arrays[i] = grown;
+  }
+
+  insts = realloc(f->insts, sizeof(instance *) * cap);
+  if(!insts) return false;
+  f->insts = insts;
+
+  handles = realloc(f->handles, sizeof(model_handle) * cap);
+  if(!handles) return false;
+  f->handles = handles;
+
+  f->cap = cap;
+  return true;
+}
+
+
+/**
+ * Frees the arrays of a flock. The models are not freed.
+ */
+void flock_free(flock *f)
+{
+  FREE(f->center_x);
+  FREE(f->center_z);
+  FREE(f->height);
+  FREE(f->radius);
+  FREE(f->angle);
+  FREE(f->speed);
+  FREE(f->out_x);
+  FREE(f->out_z);
+  FREE(f->insts);
+  FREE(f->handles);
+
+  f->count = f->cap = 0;
+}
+
+
+/**
+ * Create a new, empty flock.
  */
 void flight_init()
 {
-  patterns[pat_index] = NULL;
+  birds.center_x = birds.center_z = birds.height = birds.radius = NULL;
+  birds.angle = birds.speed = birds.out_x = birds.out_z = NULL;
+  birds.insts = NULL;
+  birds.handles = NULL;
+  birds.count = birds.cap = 0;
+
+  boids_init(&flockers);
+  flockers.params.bounds = global.world_size * 0.9;
 
   base_bird = load_model("data/model/bird.mdl");
   CHECK_NR(base_bird);
@@ -43,89 +171,252 @@ void flight_init()
 
 
 /**
- * Note that models in the pattern are NOT freed. Often this will be done with
+ * Note that models in the flock are NOT freed. Often this will be done with
  * the draw_cleanup() function in drawing.c
  */
 void flight_cleanup()
 {
-  int i = 0;
-
-  while(patterns[i])
-    FREE(patterns[i++]);
+  flock_free(&birds);
+  boids_free(&flockers);
 
   FREE(base_bird);
 }
 
 
 /**
- * Updates the position of a single flight pattern.
+ * Moves the birds from start up to end around their circles. This is the
+ * scalar version of the update, used for whatever the SSE version can't
+ * handle.
+ */
+void flight_move_scalar(float passed, int start, int end)
+{
+  float s, c, a;
+  int i;
+
+  for(i = start; i < end; i++)
+  {
+    a = birds.angle[i] + passed * birds.speed[i];
+    if(a >= MY_PI)
+      a -= 2 * MY_PI;
+    birds.angle[i] = a;
+
+    fast_sincos(a, &s, &c);
+    birds.out_x[i] = birds.radius[i] * c + birds.center_x[i];
+    birds.out_z[i] = birds.radius[i] * s + birds.center_z[i];
+  }
+}
+
+
+#ifdef __SSE__
+/**
+ * SSE version of fast_sincos in util.c for four angles at once.
+ */
+static void sincos_ps(__m128 x, __m128 *s, __m128 *c)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 pi   = _mm_set1_ps(MY_PI);
+  const __m128 b    = _mm_set1_ps(4.0 / MY_PI);
+  const __m128 cc   = _mm_set1_ps(-4.0 / (MY_PI * MY_PI));
+  const __m128 p    = _mm_set1_ps(0.225f);
+  const __m128 half = _mm_set1_ps(MY_PI / 2.0);
+  __m128 y, xc;
+
+  /* Sine. */
+  y  = _mm_add_ps(_mm_mul_ps(b, x),
+      _mm_mul_ps(cc, _mm_mul_ps(x, _mm_andnot_ps(sign, x))));
+  *s = _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(_mm_mul_ps(y,
+      _mm_andnot_ps(sign, y)), y)), y);
+
+  /* Cosine is sine a quarter turn on, wrapped back into range. */
+  xc = _mm_add_ps(x, half);
+  xc = _mm_sub_ps(xc, _mm_and_ps(_mm_cmpgt_ps(xc, pi),
+      _mm_set1_ps(2.0 * MY_PI)));
+  y  = _mm_add_ps(_mm_mul_ps(b, xc),
+      _mm_mul_ps(cc, _mm_mul_ps(xc, _mm_andnot_ps(sign, xc))));
+  *c = _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(_mm_mul_ps(y,
+      _mm_andnot_ps(sign, y)), y)), y);
+}
+#endif
+
+
+/**
+ * Moves the birds from start up to end around their circles, four at a
+ * time where possible.
  */
-void flight_update_single(flight_pat *pat, float passed)
+void flight_move(float passed, int start, int end)
 {
-  pat->mdl->pos[0] = pat->dist * cos(RAD(pat->angle)) + pat->pos[0];
-  pat->mdl->pos[2] = pat->dist * sin(RAD(pat->angle)) + pat->pos[2];
-  pat->mdl->pos[1] = pat->pos[1];
-  pat->mdl->pos[4] = - pat->angle + 90;
+  int i = start;
 
-  pat->angle += passed * pat->speed;
-  pat->angle  = mod(pat->angle, 360);
+#ifdef __SSE__
+  const __m128 pi  = _mm_set1_ps(MY_PI);
+  const __m128 two = _mm_set1_ps(2.0 * MY_PI);
+  const __m128 dt  = _mm_set1_ps(passed);
+  __m128 a, s, c, r;
+
+  for(; i + 4 <= end; i += 4)
+  {
+    a = _mm_add_ps(_mm_loadu_ps(birds.angle + i),
+        _mm_mul_ps(dt, _mm_loadu_ps(birds.speed + i)));
+    a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpge_ps(a, pi), two));
+    _mm_storeu_ps(birds.angle + i, a);
+
+    sincos_ps(a, &s, &c);
+    r = _mm_loadu_ps(birds.radius + i);
+    _mm_storeu_ps(birds.out_x + i, _mm_add_ps(_mm_mul_ps(r, c),
+        _mm_loadu_ps(birds.center_x + i)));
+    _mm_storeu_ps(birds.out_z + i, _mm_add_ps(_mm_mul_ps(r, s),
+        _mm_loadu_ps(birds.center_z + i)));
+  }
+#endif
+
+  flight_move_scalar(passed, i, end);
+}
+
+
+/**
+ * Copies the result of the last move into the models of the birds from
+ * start up to end.
+ */
+void flight_place(int start, int end)
+{
+  instance *inst;
+  int i;
+
+  for(i = start; i < end; i++)
+  {
+    inst = birds.insts[i];
+    inst->pos[0] = birds.out_x[i];
+    inst->pos[1] = birds.height[i];
+    inst->pos[2] = birds.out_z[i];
+    inst->pos[4] = 90.0 - birds.angle[i] * (180.0 / MY_PI);
+  }
 }
 
 
 /**
- * Clones the passed in model and adds it to the flight.
+ * Creates an instance of the passed in model and adds it to the flight.
  */
 void flight_new_bird(model *ref, int now)
 {
-  model *clone = clone_model(ref);
-  flight_pat *pat;
-  CHECK_NR(clone);
+  instance *inst;
+  float vel[3];
+  int i;
 
-  if(pat_index >= MODEL_REGISTER_SIZE)
+  if(!flock_reserve(&birds, birds.count + 1))
   {
-    fprintf(stderr, "ERROR(flight_add_bird): Flight array full.\n");
+    fprintf(stderr, "ERROR(flight_new_bird): Unable to grow flock.\n");
     return;
   }
 
-  draw_model_register(clone);
+  inst = new_instance(ref);
+  CHECK_NR(inst);
 
-  NEW(pat);
-  pat->mdl    = clone;
-  pat->angle  = R * 180.0;
-  pat->dist   = R * 100 + 60;
-  pat->pos[0] = R * global.world_size / 2.0 * (R > 0.5 ? -1.0 : 1.0);
-  pat->pos[1] = R * 40.0 + 20.0;
-  pat->pos[2] = R * global.world_size / 2.0 * (R > 0.5 ? -1.0 : 1.0);
-  pat->speed  = R * 40 + 80;
+  i = birds.count++;
+  birds.handles[i]  = draw_instance_register(inst);
+  birds.insts[i]    = inst;
+  birds.angle[i]    = R * MY_PI;
+  birds.radius[i]   = R * 100 + 60;
+  birds.center_x[i] = R * global.world_size / 2.0 * (R > 0.5 ? -1.0 : 1.0);
+  birds.height[i]   = R * 40.0 + 20.0;
+  birds.center_z[i] = R * global.world_size / 2.0 * (R > 0.5 ? -1.0 : 1.0);
+  birds.speed[i]    = RAD(R * 40 + 80);
 
-  patterns[pat_index++] = pat;
+  flight_move(0, i, i + 1);
+  flight_place(i, i + 1);
 
-  flight_update_single(pat, 0);
+  /* Boids start off heading the same way around the circle. */
+  if(global.flocking)
+  {
+    vel[0] = -sin(birds.angle[i]) * flockers.params.min_speed * 1.5;
+    vel[1] = 0.0;
+    vel[2] =  cos(birds.angle[i]) * flockers.params.min_speed * 1.5;
+    boids_add(&flockers, inst->pos, vel);
+  }
 
-  start_animation(clone, 0, now);
+  start_instance_animation(inst, 0, now);
 }
 
 
 /**
- * Updates the positions of all the birds in the scene.
+ * Job that animates and moves a range of the birds. Each bird only touches
+ * its own model and its own entries in the flock so ranges can run on any
+ * thread.
  */
-void flight_update(int now)
+void flight_job(void *data, int start, int end)
 {
+  flight_frame *frame = data;
   int i;
+
+  flight_move(frame->passed, start, end);
+  flight_place(start, end);
+
+  for(i = start; i < end; i++)
+    animate_instance(birds.insts[i], frame->now);
+}
+
+
+/**
+ * Job that places and animates a range of the birds from the boids.
+ */
+void flight_flock_job(void *data, int start, int end)
+{
+  flight_frame *frame = data;
+  instance *inst;
+  float speed;
+  int i;
+
+  for(i = start; i < end && i < flockers.count; i++)
+  {
+    inst = birds.insts[i];
+    inst->pos[0] = flockers.x[i];
+    inst->pos[1] = flockers.y[i];
+    inst->pos[2] = flockers.z[i];
+
+    /* Face along the velocity, nose up when climbing. The bird model
+     * faces down its -x axis. */
+    speed = sqrt(flockers.vx[i] * flockers.vx[i] +
+        flockers.vz[i] * flockers.vz[i]);
+    inst->pos[4] = 180.0 - atan2(flockers.vz[i], flockers.vx[i]) *
+      (180.0 / MY_PI);
+    inst->pos[5] = -atan2(flockers.vy[i], speed) * (180.0 / MY_PI);
+
+    animate_instance(inst, frame->now);
+  }
+}
+
+
+/**
+ * Updates the positions of all the birds in the scene. The birds are spread
+ * over the job system and are all finished by the time this returns.
+ */
+void flight_update(int now)
+{
   static int last = 0;
+  flight_frame frame;
 
-  for(i = 0; i < pat_index; i++)
+  frame.now    = now;
+  frame.passed = (now - last) / 1000.0;
+
+  if(global.flocking)
   {
-    animate(patterns[i]->mdl, now);
-    flight_update_single(patterns[i], (now - last) / 1000.0);
+    if(frame.passed > FLOCK_MAX_STEP)
+      frame.passed = FLOCK_MAX_STEP;
+    boids_step(&flockers, frame.passed);
+    jobs_parallel_for(flight_flock_job, &frame, birds.count, FLIGHT_GRAIN);
+    last = now;
+    return;
   }
-  
+
+  if(frame.passed > FLIGHT_MAX_STEP)
+    frame.passed = FLIGHT_MAX_STEP;
+  jobs_parallel_for(flight_job, &frame, birds.count, FLIGHT_GRAIN);
+
   last = now;
 }
 
 
 /**
- * Adds a clone of the passed in model to the flight pattern array. Initialises
+ * Adds an instance of the bird model to the flight pattern array. Initialises
  * the flight pattern.
  */
 void flight_add_bird(int now)
@@ -133,3 +424,42 @@ void flight_add_bird(int now)
   flight_new_bird(base_bird, now);
 }
 
+
+/**
+ * Takes a random bird out of the flock and frees its model. The last bird
+ * in the flock takes its place.
+ */
+void flight_remove_bird()
+{
+  int i, last;
+
+  if(birds.count == 0)
+    return;
+
+  i = (int)(R * birds.count);
+  last = --birds.count;
+
+  draw_model_remove(birds.handles[i]);
+  if(global.flocking)
+    boids_remove(&flockers, i);
+
+  birds.center_x[i] = birds.center_x[last];
+  birds.center_z[i] = birds.center_z[last];
+  birds.height[i]   = birds.height[last];
+  birds.radius[i]   = birds.radius[last];
+  birds.angle[i]    = birds.angle[last];
+  birds.speed[i]    = birds.speed[last];
+  birds.out_x[i]    = birds.out_x[last];
+  birds.out_z[i]    = birds.out_z[last];
+  birds.insts[i]    = birds.insts[last];
+  birds.handles[i]  = birds.handles[last];
+}
+
+
+/**
+ * Returns the number of birds in the flock.
+ */
+int flight_count()
+{
+  return birds.count;
+}
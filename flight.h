@@ -12,7 +12,10 @@
 extern void flight_init();
 extern void flight_cleanup();
 extern void flight_add_bird(int now);
+extern void flight_remove_bird();
 extern void flight_update(int now);
+extern void flight_move(float passed, int start, int end);
+extern int flight_count();
 
 
 #endif
@@ -51,17 +51,39 @@ typedef struct _global_s
   /* GLOBAL STATE */
 
   int world_mode;               /* Current world mode. */
+  int headless;                 /* Frames to draw offscreen, 0 for a window. */
+  int check;                    /* Allowed pipeline difference, -1 for no
+                                 * check. */
+  const char *record;           /* Where recorded frames go, or NULL. */
 
   /* WORLD DIMENSIONS */
 
   float sun_pos[4];             /* Sun direction. */
   float ground_plane[4];        /* Planar representation of the ground. */
   float world_size;             /* 1/2 width of the world. */
+  int grass_count;              /* Tufts of grass planted. */
+  int grass_density;            /* Tufts per streamed tile, 0 to plant. */
+  float shadow_lod;             /* Shadows further than this are blobs. */
+  float imp_lod;                /* Models further than this are impostors. */
 
   /* FPS COUNTER */
 
   float fps;                    /* FPS for current second. */
-  char fps_str[16];             /* String version of FPS. */
+  char fps_str[64];             /* String version of FPS. */
+  char cull_str[64];            /* What was culled, to go under it. */
+  char lod_str[64];             /* How much was drawn simpler, under that. */
+
+  /* FRAME STATISTICS */
+
+  int draw_calls;               /* Model draw calls in the last frame. */
+  int upload_bytes;             /* Vertex data sent in the last frame. */
+  int state_changes;            /* GL state changes in the last frame. */
+  int culled_models;            /* Models out of view in the last frame. */
+  int culled_meshes;            /* Bone meshes of the rest out of view. */
+  int culled_grass;             /* Tufts of grass out of view. */
+  int shadow_models;            /* Models casting their whole shadow. */
+  int shadow_blobs;             /* Models casting a blob instead. */
+  int impostors;                /* Models drawn as impostors. */
 
   /* RENDERING OPTIONS */
 
@@ -74,9 +96,33 @@ typedef struct _global_s
   bool r_ground;                /* Render the ground? */
   bool r_bones;                 /* Render the bones of the model? */
   bool r_fps;
+  bool r_instanced;             /* Draw shared models instanced? */
+  bool r_skinned;               /* Draw models as one skinned mesh? */
+  bool r_vbos;                  /* Draw meshes from buffer objects? */
+  bool r_queue;                 /* Sort draws to save state changes? */
+  bool r_cull;                  /* Skip what is out of view? */
+  bool r_grass_batch;           /* Draw the grass as one field? */
+  bool r_shadow_map;            /* Shadow maps rather than flat shadows? */
+  bool r_blob_shadows;          /* Blobs for far shadows? */
+  bool r_impostors;             /* Impostors for far models? */
+  bool r_glsl;                  /* Shaders in place of fixed function? */
 
   bool bb_grass;                /* Render grass billboard or normal style. */
 
+  /* THREADING */
+
+  int n_threads;                /* Worker threads, 0 for one per core. */
+  bool sim_thread;              /* Simulate on a separate thread? */
+
+  /* FLIGHT OPTIONS */
+
+  bool flocking;                /* Steer birds as a flock, not in circles? */
+
+  /* ANIMATION OPTIONS */
+
+  bool pack_anims;              /* Compress animations as they load? */
+  float pack_tol;               /* Allowed packing error in degrees. */
+
 } global_s;
 
 global_s global;                /* Global struct. */
@@ -0,0 +1,149 @@
+/**
+ * headless.c
+ *
+ * The context is made on Mesa's surfaceless platform when the driver has
+ * it, so there's no need for an X server or a GPU at all (llvmpipe draws in
+ * software), and on EGL's default display otherwise. The pbuffer has the
+ * same depth and stencil bits the window asks GLUT for, so everything is
+ * drawn just as it would be on screen.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "headless.h"
+
+#include <GLUT/glut.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+EGLDisplay hl_display = EGL_NO_DISPLAY;
+EGLContext hl_context = EGL_NO_CONTEXT;
+EGLSurface hl_surface = EGL_NO_SURFACE;
+#endif
+
+struct timespec hl_start;
+
+
+#ifdef HEADLESS_EGL
+/**
+ * Finds the display to draw on, without a display server if it can.
+ */
+EGLDisplay headless_display()
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_display;
+  const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+  get_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+  if(exts && strstr(exts, "EGL_MESA_platform_surfaceless") && get_display)
+    return get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY,
+        NULL);
+
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+#endif
+
+
+/**
+ * Makes an OpenGL context drawing to a w by h offscreen framebuffer and
+ * makes it current. Returns false if it couldn't be made.
+ */
+bool headless_init(int w, int h)
+{
+#ifdef HEADLESS_EGL
+  EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE,        8,
+    EGL_GREEN_SIZE,      8,
+    EGL_BLUE_SIZE,       8,
+    EGL_DEPTH_SIZE,      24,
+    EGL_STENCIL_SIZE,    8,
+    EGL_NONE
+  };
+  EGLint surface_attribs[] = {EGL_WIDTH, w, EGL_HEIGHT, h, EGL_NONE};
+  EGLint major, minor, n = 0;
+  EGLConfig config;
+
+  clock_gettime(CLOCK_MONOTONIC, &hl_start);
+
+  hl_display = headless_display();
+  if(hl_display == EGL_NO_DISPLAY || !eglInitialize(hl_display, &major,
+        &minor))
+  {
+    fprintf(stderr, "ERROR(headless_init): No EGL display.\n");
+    return false;
+  }
+
+  if(!eglChooseConfig(hl_display, config_attribs, &config, 1, &n) || n < 1)
+  {
+    fprintf(stderr, "ERROR(headless_init): No suitable EGL config.\n");
+    headless_cleanup();
+    return false;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+  hl_context = eglCreateContext(hl_display, config, EGL_NO_CONTEXT, NULL);
+  hl_surface = eglCreatePbufferSurface(hl_display, config, surface_attribs);
+  if(hl_context == EGL_NO_CONTEXT || hl_surface == EGL_NO_SURFACE ||
+     !eglMakeCurrent(hl_display, hl_surface, hl_surface, hl_context))
+  {
+    fprintf(stderr, "ERROR(headless_init): Unable to make a context "
+        "(EGL error 0x%x).\n", eglGetError());
+    headless_cleanup();
+    return false;
+  }
+
+  printf("Drawing headless with EGL %d.%d, %s.\n", major, minor,
+      (const char *)glGetString(GL_RENDERER));
+  return true;
+#else
+  fprintf(stderr, "ERROR(headless_init): Built without a headless backend, "
+      "see HEADLESS in the Makefile.\n");
+  return false;
+#endif
+}
+
+
+/**
+ * Frees the context and framebuffer made by headless_init.
+ */
+void headless_cleanup()
+{
+#ifdef HEADLESS_EGL
+  if(hl_display == EGL_NO_DISPLAY)
+    return;
+
+  eglMakeCurrent(hl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if(hl_surface != EGL_NO_SURFACE)
+    eglDestroySurface(hl_display, hl_surface);
+  if(hl_context != EGL_NO_CONTEXT)
+    eglDestroyContext(hl_display, hl_context);
+  eglTerminate(hl_display);
+
+  hl_display = EGL_NO_DISPLAY;
+  hl_context = EGL_NO_CONTEXT;
+  hl_surface = EGL_NO_SURFACE;
+#endif
+}
+
+
+/**
+ * Returns the milliseconds since headless_init, standing in for GLUT's
+ * elapsed time.
+ */
+int headless_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec - hl_start.tv_sec) * 1000 +
+    (ts.tv_nsec - hl_start.tv_nsec) / 1000000;
+}
@@ -0,0 +1,30 @@
+/**
+ * headless.h
+ *
+ * Drawing without a window, for render nodes and batch jobs with no display
+ * server. An OpenGL context is made on an offscreen pbuffer through EGL in
+ * place of the GLUT window, and the usual frame loop is driven from the
+ * command line with
+ *
+ *   robot -headless <frames> [-e | -f] ...
+ *
+ * The EGL backend is only built with HEADLESS_EGL defined (see the
+ * Makefile). Without it -headless reports that it can't run.
+ */
+
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+#include "global.h"
+
+#define HEADLESS_WIDTH  800     /* Size of the offscreen framebuffer, */
+#define HEADLESS_HEIGHT 600     /* the same as the window's. */
+
+
+/* Interface. */
+extern bool headless_init(int w, int h);
+extern void headless_cleanup();
+extern int headless_clock();
+
+
+#endif
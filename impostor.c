@@ -0,0 +1,645 @@
+/**
+ * impostor.c
+ *
+ * An atlas is laid out in square cells, each frame of the model taking a
+ * run of IMP_YAWS * IMP_PITCHES cells, one for each direction it is seen
+ * from. Each picture looks at the model's origin from outside the sphere
+ * that bounds it in any pose, through an orthographic box just holding
+ * that sphere, with the model's own up kept up. The sun lights it as it
+ * would a model that hasn't been turned at all.
+ *
+ * The renderer only has the pose of a far model to go on, so the frame it
+ * is showing is found by comparing the few pose values that differ most
+ * between the frames, picked out when the atlas is made. The quad for a
+ * model is turned round the line to the camera by the model's own up, so a
+ * model that rolls rolls its picture with it.
+ */
+
+#include "impostor.h"
+#include "drawing.h"
+#include "mem.h"
+#include "shader.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* A corner of a quad, laid out for GL_T2F_V3F. */
+typedef struct imp_vert
+{
+  float t[2];
+  float v[3];
+} imp_vert;
+
+/* The pictures of a base model and the quads using them this frame. */
+typedef struct imp_atlas
+{
+  model *base;
+  GLuint tex;                   /* 0 if the atlas couldn't be made. */
+  int height;                   /* Texels high, as many rows as needed. */
+  float radius;                 /* Holds the model in every frame pictured. */
+
+  int n_phases;                 /* Frames pictured. */
+  int keys[IMP_KEYS];           /* Pose values that tell frames apart, */
+  int n_keys;
+  float *sigs;                  /* and what they are in each frame. */
+
+  imp_vert *verts;              /* Four corners for each quad. */
+  int n, cap;
+} imp_atlas;
+
+
+/* Function prototypes. */
+imp_atlas *imp_atlas_for(model *base);
+int imp_frames(model *base, float **poses);
+void imp_pick_keys(imp_atlas *a, float *poses, int size);
+float imp_reach(model *base, float *poses, int n);
+void imp_view_dir(int view, float d[3]);
+void imp_basis(float d[3], float up[3], float right[3], float top[3]);
+bool imp_bake(imp_atlas *a);
+int imp_match(imp_atlas *a, float *pose);
+bool imp_reserve(imp_atlas *a);
+
+
+int imp_state = 0;              /* 0 untried, 1 ready, -1 unsupported. */
+
+imp_atlas *atlases = NULL;
+int n_atlases = 0;
+
+float imp_eye[3];               /* Where the camera is this frame. */
+int imp_n = 0;                  /* Quads added this frame. */
+
+
+/**
+ * Checks the driver can draw into a texture. Only does the work once.
+ * Returns false if impostors can't be used, in which case far models are
+ * drawn whole.
+ */
+bool imp_init()
+{
+  GLint size = 0;
+
+  if(imp_state)
+    return imp_state > 0;
+
+  imp_state = -1;
+
+  if(!gl_has_version(3, 0) && !gl_has_extension("GL_ARB_framebuffer_object"))
+    return false;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+  if(size < IMP_ATLAS)
+    return false;
+
+  imp_state = 1;
+  return true;
+}
+
+
+/**
+ * Frees every atlas. They are made again as they are needed after
+ * imp_init is called again.
+ */
+void imp_cleanup()
+{
+  int i;
+
+  for(i = 0; i < n_atlases; i++)
+  {
+    if(atlases[i].tex)
+      glDeleteTextures(1, &atlases[i].tex);
+    FREE(atlases[i].sigs);
+    FREE(atlases[i].verts);
+  }
+
+  FREE(atlases);
+  atlases = NULL;
+  n_atlases = 0;
+  imp_state = 0;
+}
+
+
+/**
+ * Empties the quads ready for a new frame seen from eye.
+ */
+void imp_begin(float eye[3])
+{
+  int i;
+
+  v_copy(imp_eye, eye);
+  for(i = 0; i < n_atlases; i++)
+    atlases[i].n = 0;
+  imp_n = 0;
+}
+
+
+/**
+ * Finds the atlas for a base model, making it if this is the first time it
+ * has been needed. Returns NULL if there was no memory for it.
+ */
+imp_atlas *imp_atlas_for(model *base)
+{
+  imp_atlas *a;
+  int i;
+
+  for(i = 0; i < n_atlases; i++)
+    if(atlases[i].base == base)
+      return &atlases[i];
+
+  a = realloc(atlases, sizeof(imp_atlas) * (n_atlases + 1));
+  if(!a)
+  {
+    fprintf(stderr, "ERROR(imp_atlas_for): Out of memory.\n");
+    return NULL;
+  }
+  atlases = a;
+
+  a = &atlases[n_atlases++];
+  memset(a, 0, sizeof(imp_atlas));
+  a->base = base;
+
+  /* A failed atlas is kept, without a texture, so it isn't tried again. */
+  if(!imp_bake(a))
+    fprintf(stderr, "ERROR(imp_atlas_for): No impostors for '%s'.\n",
+        base->name);
+
+  return a;
+}
+
+
+/**
+ * Puts the pose of every key frame of every animation of a model, one
+ * after the other, into a new array at poses. Returns how many there are,
+ * or 0 if there are none or there was no memory for them.
+ */
+int imp_frames(model *base, float **poses)
+{
+  int size = base->n_bones * TRANS_SIZE;
+  int i, k, n = 0;
+  float *out;
+  anim *an;
+
+  for(i = 0; i < base->n_anims; i++)
+    n += base->anims[i]->n_frames;
+  if(n == 0 || size == 0)
+    return 0;
+
+  out = *poses = malloc(sizeof(float) * size * n);
+  if(!out)
+    return 0;
+
+  for(i = 0; i < base->n_anims; i++)
+  {
+    an = base->anims[i];
+    for(k = 0; k < an->n_frames; k++, out += size)
+    {
+      if(an->packed)
+        packed_sample(an->packed, an->packed->starts[k], out);
+      else
+        memcpy(out, an->key_frames[k], sizeof(float) * size);
+    }
+  }
+
+  return n;
+}
+
+
+/**
+ * Picks the pose values that vary most over the frames pictured in an
+ * atlas, and keeps what they are in each frame to match poses against.
+ */
+void imp_pick_keys(imp_atlas *a, float *poses, int size)
+{
+  float mean, var, best, d;
+  int i, k, c, pick;
+
+  a->n_keys = size < IMP_KEYS ? size : IMP_KEYS;
+
+  for(k = 0; k < a->n_keys; k++)
+  {
+    best = -1.0;
+    pick = 0;
+    for(c = 0; c < size; c++)
+    {
+      for(i = 0; i < k; i++)
+        if(a->keys[i] == c)
+          break;
+      if(i < k)
+        continue;
+
+      mean = var = 0.0;
+      for(i = 0; i < a->n_phases; i++)
+        mean += poses[i * size + c];
+      mean /= a->n_phases;
+      for(i = 0; i < a->n_phases; i++)
+      {
+        d = poses[i * size + c] - mean;
+        var += d * d;
+      }
+
+      if(var > best)
+      {
+        best = var;
+        pick = c;
+      }
+    }
+    a->keys[k] = pick;
+  }
+
+  for(i = 0; i < a->n_phases; i++)
+    for(k = 0; k < a->n_keys; k++)
+      a->sigs[i * a->n_keys + k] = poses[i * size + a->keys[k]];
+}
+
+
+/**
+ * Works out how far the geometry of a model reaches from its root in any
+ * of n poses. This is usually well inside the model's own radius, which
+ * has to hold it in any pose at all, so the pictures can be closer up.
+ * Returns 0 if there was no memory to work it out.
+ */
+float imp_reach(model *base, float *poses, int n)
+{
+  float *mats, *out, *pose, m[16], c[3], r, far = 0.0;
+  bone *b;
+  int i, k;
+
+  mats = malloc(sizeof(float) * 16 * base->n_bones);
+  if(!mats)
+    return 0.0;
+
+  m4_identity(m);
+  for(i = 0; i < n; i++)
+  {
+    /* The bone matrices come out in bone_array order. */
+    out = mats;
+    pose = poses + i * base->n_bones * TRANS_SIZE;
+    skel_pose_matrices(base->root, &pose, m, &out, 16);
+
+    for(k = 0; k < base->n_bones; k++)
+    {
+      b = base->bone_array[k];
+      if(!b->geometry)
+        continue;
+
+      m4_point(c, mats + k * 16, b->bound);
+      r = sqrt(v_dot(c, c)) + b->bound[3];
+      if(r > far)
+        far = r;
+    }
+  }
+
+  free(mats);
+  return far;
+}
+
+
+/**
+ * Finds the direction from the model out to where picture view of a frame
+ * is seen from, in the model's own space.
+ */
+void imp_view_dir(int view, float d[3])
+{
+  float yaw   = RAD(360.0 * (view % IMP_YAWS) / IMP_YAWS);
+  float pitch = RAD(-IMP_PITCH + 2.0 * IMP_PITCH * (view / IMP_YAWS) /
+                    (IMP_PITCHES - 1));
+
+  d[0] = cos(pitch) * sin(yaw);
+  d[1] = sin(pitch);
+  d[2] = cos(pitch) * cos(yaw);
+}
+
+
+/**
+ * Works out the right and top of a picture seen looking back along d, so
+ * that up stays as near to the top as it can.
+ */
+void imp_basis(float d[3], float up[3], float right[3], float top[3])
+{
+  v_cross(right, up, d);
+  if(v_dot(right, right) < 1e-6)
+  {
+    right[0] = d[2];
+    right[1] = 0.0;
+    right[2] = -d[0];
+    if(v_dot(right, right) < 1e-6)
+      right[0] = 1.0;
+  }
+  v_norm(right);
+  v_cross(top, d, right);
+}
+
+
+/**
+ * Draws every frame of an atlas's model from every direction into a new
+ * texture. Returns false if it couldn't be done.
+ */
+bool imp_bake(imp_atlas *a)
+{
+  static float up[3] = {0.0, 1.0, 0.0};
+  static float place[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  model *base = a->base;
+  int size = base->n_bones * TRANS_SIZE;
+  int views = IMP_YAWS * IMP_PITCHES;
+  int cols = IMP_ATLAS / IMP_CELL;
+  float *poses = NULL, d[3], right[3], top[3], m[16], light[4];
+  float r;
+  int i, v, cell, levels;
+  GLuint fbo, depth;
+  GLenum status;
+
+  a->n_phases = imp_frames(base, &poses);
+  if(a->n_phases == 0)
+    return false;
+
+  /* Frames that don't fit are left out. */
+  if(a->n_phases > cols * cols / views)
+    a->n_phases = cols * cols / views;
+  a->height = (a->n_phases * views + cols - 1) / cols * IMP_CELL;
+
+  a->sigs = malloc(sizeof(float) * a->n_phases * IMP_KEYS);
+  if(!a->sigs)
+  {
+    free(poses);
+    return false;
+  }
+  imp_pick_keys(a, poses, size);
+
+  /* A texel spare all round keeps the filtering off the next picture. */
+  r = imp_reach(base, poses, a->n_phases);
+  if(r <= 0.0 || r > base->radius)
+    r = base->radius;
+  r *= (float)IMP_CELL / (IMP_CELL - 2);
+  a->radius = r;
+
+  /* Smaller mipmaps than a few texels a picture would bleed together. */
+  for(levels = 0; (IMP_CELL >> levels) > 4; levels++);
+
+  glGenTextures(1, &a->tex);
+  glBindTexture(GL_TEXTURE_2D, a->tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, IMP_ATLAS, a->height, 0, GL_RGBA,
+      GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+      GL_LINEAR_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels);
+
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMP_ATLAS,
+      a->height);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+      a->tex, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER, depth);
+  status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+  if(status == GL_FRAMEBUFFER_COMPLETE)
+  {
+    /* The light is kept in eye space, so it has to be put back after. */
+    glGetLightfv(GL_LIGHT0, GL_POSITION, light);
+
+    glPushAttrib(GL_ALL_ATTRIB_BITS);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glViewport(0, 0, IMP_ATLAS, a->height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(-r, r, -r, r, r, 3.0 * r);
+    glMatrixMode(GL_MODELVIEW);
+
+    for(i = 0; i < a->n_phases; i++)
+      for(v = 0; v < views; v++)
+      {
+        cell = i * views + v;
+        glViewport(cell % cols * IMP_CELL, cell / cols * IMP_CELL, IMP_CELL,
+            IMP_CELL);
+
+        /* Looking back at the origin along d from 2r away. */
+        imp_view_dir(v, d);
+        imp_basis(d, up, right, top);
+        m4_identity(m);
+        m[0] = right[0]; m[4] = right[1]; m[8]  = right[2];
+        m[1] = top[0];   m[5] = top[1];   m[9]  = top[2];
+        m[2] = d[0];     m[6] = d[1];     m[10] = d[2];
+        m[14] = -2.0 * r;
+        glLoadMatrixf(m);
+        glLightfv(GL_LIGHT0, GL_POSITION, global.sun_pos);
+
+        draw_model_pose(base, place, poses + i * size, DRAW_SKEL_GEOMETRY);
+      }
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glPopAttrib();
+
+    glPushMatrix();
+    glLoadIdentity();
+    glLightfv(GL_LIGHT0, GL_POSITION, light);
+    glPopMatrix();
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &depth);
+  free(poses);
+
+  if(status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    glDeleteTextures(1, &a->tex);
+    a->tex = 0;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return false;
+  }
+
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return true;
+}
+
+
+/**
+ * Finds the frame in an atlas nearest to a pose.
+ */
+int imp_match(imp_atlas *a, float *pose)
+{
+  float dist, best = -1.0, d, *sig;
+  int i, k, pick = 0;
+
+  for(i = 0; i < a->n_phases; i++)
+  {
+    sig = a->sigs + i * a->n_keys;
+    dist = 0.0;
+    for(k = 0; k < a->n_keys; k++)
+    {
+      d = fmod(fabs(pose[a->keys[k]] - sig[k]), 360.0);
+      if(d > 180.0)
+        d = 360.0 - d;
+      dist += d * d;
+    }
+
+    if(best < 0.0 || dist < best)
+    {
+      best = dist;
+      pick = i;
+    }
+  }
+
+  return pick;
+}
+
+
+/**
+ * Makes room in an atlas for at least one more quad. Returns false if the
+ * memory could not be found.
+ */
+bool imp_reserve(imp_atlas *a)
+{
+  int cap = a->cap ? a->cap * 2 : IMP_START_CAP;
+  imp_vert *verts;
+
+  if(a->n < a->cap)
+    return true;
+
+  verts = realloc(a->verts, sizeof(imp_vert) * 4 * cap);
+  if(!verts)
+  {
+    fprintf(stderr, "ERROR(imp_reserve): Out of memory.\n");
+    return false;
+  }
+  a->verts = verts;
+  a->cap = cap;
+  return true;
+}
+
+
+/**
+ * Adds the impostor of a model placed at pos and posed with the rotations
+ * in pose, as for draw_model_pose. Returns false if it couldn't be, and
+ * the model should be drawn whole.
+ */
+bool imp_add(model *base, float *pos, float *pose)
+{
+  static const float corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  float m[16], e[3], l[3], right[3], top[3], yaw, pitch, s, t, r;
+  int yi, pi, cell, cols = IMP_ATLAS / IMP_CELL;
+  imp_vert *out;
+  imp_atlas *a;
+  int i, k;
+
+  if(imp_state <= 0 || !pose || base->radius <= 0.0 || base->n_anims == 0)
+    return false;
+
+  a = imp_atlas_for(base);
+  if(!a || !a->tex || !imp_reserve(a))
+    return false;
+
+  v_sub(e, imp_eye, pos);
+  if(v_dot(e, e) < 1e-6)
+    return false;
+  v_norm(e);
+
+  /* The line to the camera in the model's own space picks the picture. */
+  model_matrix(pos, m);
+  for(k = 0; k < 3; k++)
+    l[k] = v_dot(m + k * 4, e);
+
+  yaw = atan2(l[0], l[2]) * 180.0 / MY_PI;
+  yi = (int)floor(yaw * IMP_YAWS / 360.0 + 0.5);
+  yi = (yi % IMP_YAWS + IMP_YAWS) % IMP_YAWS;
+
+  pitch = asin(clamp(l[1], -1.0, 1.0)) * 180.0 / MY_PI;
+  pi = (int)floor((pitch + IMP_PITCH) / (2.0 * IMP_PITCH) *
+                  (IMP_PITCHES - 1) + 0.5);
+  pi = clamp(pi, 0, IMP_PITCHES - 1);
+
+  cell = imp_match(a, pose) * IMP_YAWS * IMP_PITCHES + pi * IMP_YAWS + yi;
+  s = (float)(cell % cols * IMP_CELL) / IMP_ATLAS;
+  t = (float)(cell / cols * IMP_CELL) / a->height;
+
+  imp_basis(e, m + 4, right, top);
+
+  r = a->radius;
+  out = a->verts + a->n * 4;
+  for(i = 0; i < 4; i++)
+  {
+    out[i].t[0] = s + corners[i][0] * IMP_CELL / IMP_ATLAS;
+    out[i].t[1] = t + corners[i][1] * IMP_CELL / a->height;
+    for(k = 0; k < 3; k++)
+      out[i].v[k] = pos[k] + (corners[i][0] * 2.0 - 1.0) * r * right[k] +
+                             (corners[i][1] * 2.0 - 1.0) * r * top[k];
+  }
+
+  a->n++;
+  imp_n++;
+  return true;
+}
+
+
+/**
+ * Returns the number of impostors added since imp_begin.
+ */
+int imp_count()
+{
+  return imp_n;
+}
+
+
+/**
+ * Draws every impostor added since imp_begin, one call for each base
+ * model.
+ */
+void imp_draw()
+{
+  imp_atlas *a;
+  int i;
+
+  if(imp_n == 0)
+    return;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+  glDisable(GL_LIGHTING);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_TEXTURE_2D);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glEnable(GL_ALPHA_TEST);
+  glAlphaFunc(GL_GREATER, 0.5);
+  global.state_changes += 3;
+
+  for(i = 0; i < n_atlases; i++)
+  {
+    a = &atlases[i];
+    if(a->n == 0)
+      continue;
+
+    glBindTexture(GL_TEXTURE_2D, a->tex);
+    glInterleavedArrays(GL_T2F_V3F, 0, a->verts);
+    glDrawArrays(GL_QUADS, 0, a->n * 4);
+    global.state_changes += 2;
+    global.draw_calls++;
+    global.upload_bytes += sizeof(imp_vert) * 4 * a->n;
+  }
+
+  glPopClientAttrib();
+  glPopAttrib();
+}
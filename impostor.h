@@ -0,0 +1,37 @@
+/**
+ * impostor.h
+ *
+ * Impostors for models too far away to be worth drawing whole. The first
+ * time a base model is needed far away, every key frame of every one of
+ * its animations is drawn from a ring of directions round it into one
+ * texture atlas. After that a far model is a single quad turned to face
+ * the camera, showing the frame nearest its pose from the direction
+ * nearest the camera's, and all the quads for a base model are drawn in
+ * one call.
+ */
+
+#ifndef _IMPOSTOR_H_
+#define _IMPOSTOR_H_
+
+#include "global.h"
+#include "3d.h"
+
+#define IMP_CELL      64        /* Width and height of one picture. */
+#define IMP_ATLAS     2048      /* Width of an atlas, and most height. */
+#define IMP_YAWS      8         /* Directions round the model, */
+#define IMP_PITCHES   3         /* by directions above and below it */
+#define IMP_PITCH     50.0      /* out to this many degrees. */
+#define IMP_KEYS      6         /* Pose values compared to find a frame. */
+#define IMP_START_CAP 64        /* Quads an atlas first has room for. */
+
+
+/* Interface. */
+extern bool imp_init();
+extern void imp_cleanup();
+extern void imp_begin(float eye[3]);
+extern bool imp_add(model *base, float *pos, float *pose);
+extern int imp_count();
+extern void imp_draw();
+
+
+#endif
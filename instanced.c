@@ -0,0 +1,449 @@
+/**
+ * instanced.c
+ *
+ * Draws models in batches that share a base model, from the buffer objects
+ * the bone meshes were put in when the base was loaded. Each frame
+ * the matrix of every bone of every queued model is worked out on the CPU,
+ * laid out bone by bone, and sent up in one go into a buffer that is
+ * orphaned first so the driver never has to wait on the previous frame.
+ *
+ * The vertex shader reads the bone matrix as four vec4 attributes that step
+ * once per instance, and lights the result with light_sun so it matches the
+ * rest of the scene.
+ */
+
+#include "instanced.h"
+#include "drawing.h"
+#include "jobs.h"
+#include "mem.h"
+#include "shader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/**
+ * Models sharing a base model that are drawn together. The matrices are
+ * stored bone by bone, so that bone b of model i is at
+ * mats[(b * count + i) * 16]. The models are kept as those only casting
+ * a shadow, then those drawn and casting one, then those only drawn, so
+ * that what each pass draws is one run of each bone's matrices.
+ */
+typedef struct inst_batch
+{
+  model *base;
+
+  float **pos;                  /* Placement of each queued model. */
+  float **pose;                 /* Pose of each queued model. */
+  int count, cap;
+  int casters;                  /* How many of them cast a shadow. */
+  int first_drawn;              /* The first of them that is drawn. */
+
+  float *mats;                  /* Bone matrices, 16 floats each. */
+  int mats_cap;                 /* Models there is room for in mats. */
+  GLuint mats_vbo;
+} inst_batch;
+
+
+/* Function prototypes. */
+bool inst_reserve(inst_batch *b);
+inst_batch *inst_batch_for(model *base);
+void inst_matrices_job(void *data, int start, int end);
+void inst_draw_batch(inst_batch *b, GLenum mode, int first, int count);
+
+
+const char *inst_vert_src =
+  "attribute vec4 bone0, bone1, bone2, bone3;\n"
+  "void main()\n"
+  "{\n"
+  "  mat4 bone = mat4(bone0, bone1, bone2, bone3);\n"
+  "\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix * (bone * gl_Vertex);\n"
+  "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+  "  light_sun(normalize(gl_NormalMatrix * (mat3(bone) * gl_Normal)));\n"
+  "}\n";
+
+/* Shadows are flat so they get by with a much cheaper program. */
+const char *inst_shadow_vert_src =
+  "attribute vec4 bone0, bone1, bone2, bone3;\n"
+  "void main()\n"
+  "{\n"
+  "  mat4 bone = mat4(bone0, bone1, bone2, bone3);\n"
+  "\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix * (bone * gl_Vertex);\n"
+  "  gl_FrontColor = gl_Color;\n"
+  "}\n";
+
+const char *inst_shadow_frag_src =
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = gl_Color;\n"
+  "}\n";
+
+const char *inst_attribs[] = {"bone0", "bone1", "bone2", "bone3", NULL};
+
+int inst_state = 0;             /* 0 untried, 1 ready, -1 unsupported. */
+GLuint inst_prog = 0;
+GLuint inst_shadow_prog = 0;
+GLint inst_lit_loc, inst_textured_loc;
+
+inst_batch *batches = NULL;
+int n_batches = 0;
+
+
+/**
+ * Checks the driver can draw instanced and builds the shaders. Only does the
+ * work once. Returns false if instanced drawing can't be used, in which case
+ * everything should be drawn the old way.
+ */
+bool inst_init()
+{
+  if(inst_state)
+    return inst_state > 0;
+
+  inst_state = -1;
+
+  if(!gl_has_version(3, 3) &&
+     !(gl_has_extension("GL_ARB_instanced_arrays") &&
+       gl_has_extension("GL_ARB_draw_instanced")))
+    return false;
+
+  inst_prog = shader_build("instanced", inst_vert_src, shader_frag_lit,
+      inst_attribs, INST_ATTRIB);
+  inst_shadow_prog = shader_build("instanced shadow", inst_shadow_vert_src,
+      inst_shadow_frag_src, inst_attribs, INST_ATTRIB);
+  if(!inst_prog || !inst_shadow_prog)
+  {
+    shader_free(inst_prog);
+    shader_free(inst_shadow_prog);
+    inst_prog = inst_shadow_prog = 0;
+    return false;
+  }
+
+  inst_lit_loc      = glGetUniformLocation(inst_prog, "lit");
+  inst_textured_loc = glGetUniformLocation(inst_prog, "textured");
+
+  glUseProgram(inst_prog);
+  glUniform1i(glGetUniformLocation(inst_prog, "tex"), 0);
+  glUseProgram(0);
+
+  inst_state = 1;
+  return true;
+}
+
+
+/**
+ * Frees every batch and the shaders. inst_init may be called again after.
+ */
+void inst_cleanup()
+{
+  int i;
+
+  for(i = 0; i < n_batches; i++)
+  {
+    glDeleteBuffers(1, &batches[i].mats_vbo);
+
+    FREE(batches[i].pos);
+    FREE(batches[i].pose);
+    FREE(batches[i].mats);
+  }
+
+  FREE(batches);
+  batches = NULL;
+  n_batches = 0;
+
+  shader_free(inst_prog);
+  shader_free(inst_shadow_prog);
+  inst_prog = inst_shadow_prog = 0;
+  inst_state = 0;
+}
+
+
+/**
+ * Empties every batch ready to queue up a new frame.
+ */
+void inst_begin()
+{
+  int i;
+
+  for(i = 0; i < n_batches; i++)
+    batches[i].count = batches[i].casters = batches[i].first_drawn = 0;
+}
+
+
+/**
+ * Makes room in a batch for at least one more model. Returns false if the
+ * memory could not be found.
+ */
+bool inst_reserve(inst_batch *b)
+{
+  int cap = b->cap ? b->cap * 2 : INST_START_CAP;
+  float **pos, **pose;
+
+  if(b->count < b->cap)
+    return true;
+
+  pos = realloc(b->pos, sizeof(float *) * cap);
+  if(!pos) return false;
+  b->pos = pos;
+
+  pose = realloc(b->pose, sizeof(float *) * cap);
+  if(!pose) return false;
+  b->pose = pose;
+
+  b->cap = cap;
+  return true;
+}
+
+
+/**
+ * Finds the batch for a base model, making it if this is the first time it
+ * has been seen. Returns NULL if it could not be made.
+ */
+inst_batch *inst_batch_for(model *base)
+{
+  inst_batch *b;
+  int i;
+
+  for(i = 0; i < n_batches; i++)
+    if(batches[i].base == base)
+      return &batches[i];
+
+  b = realloc(batches, sizeof(inst_batch) * (n_batches + 1));
+  if(!b)
+  {
+    fprintf(stderr, "ERROR(inst_batch_for): Out of memory.\n");
+    return NULL;
+  }
+  batches = b;
+
+  b = &batches[n_batches];
+  memset(b, 0, sizeof(inst_batch));
+  b->base = base;
+
+  glGenBuffers(1, &b->mats_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  n_batches++;
+  return b;
+}
+
+
+/**
+ * Queues a model to be drawn with the batch for its base model if drawn is
+ * set, and with the shadows if shadow is set. Returns false if it couldn't
+ * be, and it should be drawn the old way.
+ */
+bool inst_add(model *base, float *pos, float *pose, bool drawn, bool shadow)
+{
+  inst_batch *b;
+  int i;
+
+  if(inst_state <= 0 || !pose || base->n_bones == 0)
+    return false;
+
+  /* Skinned models are drawn whole, one at a time. */
+  if(global.r_skinned && base->skin)
+    return false;
+
+  b = inst_batch_for(base);
+  if(!b || !inst_reserve(b))
+    return false;
+
+  /* A new model takes the place of the first in the group after its own,
+   * which goes to the back of that group. */
+  i = b->count++;
+  if(shadow)
+  {
+    if(b->casters < i)
+    {
+      b->pos[i]  = b->pos[b->casters];
+      b->pose[i] = b->pose[b->casters];
+    }
+    i = b->casters++;
+
+    if(!drawn)
+    {
+      if(b->first_drawn < i)
+      {
+        b->pos[i]  = b->pos[b->first_drawn];
+        b->pose[i] = b->pose[b->first_drawn];
+      }
+      i = b->first_drawn++;
+    }
+  }
+  b->pos[i]  = pos;
+  b->pose[i] = pose;
+
+  return true;
+}
+
+
+/**
+ * Works out the bone matrices for the models from start up to end of a
+ * batch.
+ */
+void inst_matrices_job(void *data, int start, int end)
+{
+  inst_batch *b = data;
+  float m[16], *out, *pose, *pos;
+  int i;
+
+  for(i = start; i < end; i++)
+  {
+    pos  = b->pos[i];
+    pose = b->pose[i];
+    out  = b->mats + i * 16;
+
+    model_matrix(pos, m);
+    skel_pose_matrices(b->base->root, &pose, m, &out, b->count * 16);
+  }
+}
+
+
+/**
+ * Works out the bone matrices of everything queued and sends them to the
+ * card. Done once a frame, before any of the passes that use them.
+ */
+void inst_prepare()
+{
+  inst_batch *b;
+  float *mats;
+  size_t size;
+  int i;
+
+  for(i = 0; i < n_batches; i++)
+  {
+    b = &batches[i];
+    if(b->count == 0)
+      continue;
+
+    if(b->count > b->mats_cap)
+    {
+      mats = realloc(b->mats, sizeof(float) * 16 * b->base->n_bones * b->cap);
+      if(!mats)
+      {
+        fprintf(stderr, "ERROR(inst_prepare): Out of memory.\n");
+        b->count = 0;
+        continue;
+      }
+      b->mats = mats;
+      b->mats_cap = b->cap;
+    }
+
+    jobs_parallel_for(inst_matrices_job, b, b->count, INST_GRAIN);
+
+    size = sizeof(float) * 16 * b->base->n_bones * b->count;
+    glBindBuffer(GL_ARRAY_BUFFER, b->mats_vbo);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, b->mats);
+    global.upload_bytes += size;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/**
+ * Draws count models in a batch starting from first, one instanced draw
+ * call per bone mesh.
+ */
+void inst_draw_batch(inst_batch *b, GLenum mode, int first, int count)
+{
+  size_t stride = sizeof(float) * 16;
+  bone *bn;
+  int i, k;
+
+  glBindTexture(GL_TEXTURE_2D, b->base->texture);
+  global.state_changes++;
+
+  for(i = 0; i < b->base->n_bones; i++)
+  {
+    bn = b->base->bone_array[i];
+    if(!bn->geometry)
+      continue;
+
+    /* Point the matrix attributes at this bone's run of matrices. */
+    glBindBuffer(GL_ARRAY_BUFFER, b->mats_vbo);
+    for(k = 0; k < 4; k++)
+      glVertexAttribPointer(INST_ATTRIB + k, 4, GL_FLOAT, GL_FALSE, stride,
+          (char *)NULL + stride * (i * b->count + first) +
+          sizeof(float) * 4 * k);
+
+    if(bn->vbo && global.r_vbos)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, bn->vbo);
+      glInterleavedArrays(GL_T2F_N3F_V3F, 0, NULL);
+    }
+    else
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glInterleavedArrays(GL_T2F_N3F_V3F, 0, bn->geometry);
+      global.upload_bytes += sizeof(float) * 8 * bn->tri_count;
+    }
+    global.state_changes++;
+    glDrawArraysInstancedARB(mode, 0, bn->tri_count, count);
+    global.draw_calls++;
+  }
+}
+
+
+/**
+ * Draws everything queued since inst_begin, with the matrices from the last
+ * inst_prepare. For shadows only the models queued as casting one are
+ * drawn, flat in the current colour, and the caller sets up the shadow
+ * matrix and stencil as usual.
+ */
+void inst_draw(bool shadow)
+{
+  GLenum mode = global.r_wire ? GL_LINES : GL_TRIANGLES;
+  int i, k, first, count;
+  inst_batch *b;
+
+  if(inst_state <= 0)
+    return;
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+  if(shadow)
+    glUseProgram(inst_shadow_prog);
+  else
+  {
+    if(global.r_wire)
+      glColor4f(0.6, 0.6, 0.7, 1.0);
+
+    glUseProgram(inst_prog);
+    glUniform1i(inst_lit_loc, !global.r_wire);
+    glUniform1i(inst_textured_loc, global.r_texture && !global.r_wire);
+  }
+
+  global.state_changes++;
+
+  for(k = 0; k < 4; k++)
+  {
+    glEnableVertexAttribArray(INST_ATTRIB + k);
+    glVertexAttribDivisorARB(INST_ATTRIB + k, 1);
+  }
+
+  for(i = 0; i < n_batches; i++)
+  {
+    b = &batches[i];
+    first = shadow ? 0 : b->first_drawn;
+    count = shadow ? b->casters : b->count - first;
+    if(count > 0)
+      inst_draw_batch(b, mode, first, count);
+  }
+
+  for(k = 0; k < 4; k++)
+  {
+    glVertexAttribDivisorARB(INST_ATTRIB + k, 0);
+    glDisableVertexAttribArray(INST_ATTRIB + k);
+  }
+
+  glUseProgram(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glPopClientAttrib();
+  glPopAttrib();
+}
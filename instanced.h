@@ -0,0 +1,32 @@
+/**
+ * instanced.h
+ *
+ * Hardware instanced drawing of models that share a skeleton. Every model
+ * queued for a frame is grouped with the others of the same base model and
+ * each bone mesh is then drawn once for the whole group, with the matrix of
+ * that bone in each model streamed in as a per instance attribute. A flock
+ * of birds takes one draw call per bone rather than one per bone per bird.
+ */
+
+#ifndef _INSTANCED_H_
+#define _INSTANCED_H_
+
+#include "global.h"
+#include "3d.h"
+
+#define INST_START_CAP 16       /* Models a new batch has room for. */
+#define INST_ATTRIB    10       /* First attribute used for bone matrices. */
+#define INST_GRAIN     64       /* Models per job when working out matrices. */
+
+
+/* Interface. */
+extern bool inst_init();
+extern void inst_cleanup();
+extern void inst_begin();
+extern bool inst_add(model *base, float *pos, float *pose, bool drawn,
+    bool shadow);
+extern void inst_prepare();
+extern void inst_draw(bool shadow);
+
+
+#endif
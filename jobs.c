@@ -0,0 +1,346 @@
+/**
+ * jobs.c
+ *
+ * Implementation of the job system in jobs.h. Each thread owns a queue. The
+ * owner takes jobs from the bottom of its queue and thieves take them from
+ * the top, so an owner keeps working through the jobs it was given while
+ * idle threads pull work off the far end. Queues are only ever touched for
+ * a moment so they each have a plain mutex. Each call counts down its own
+ * jobs, so several threads can hand out work at once, and anyone with
+ * nothing to do sleeps rather than spins.
+ */
+
+#include "jobs.h"
+#include "mem.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/* The jobs of one call to jobs_parallel_for. */
+typedef struct job_batch
+{
+  volatile int pending;         /* Jobs not finished yet. */
+} job_batch;
+
+typedef struct job
+{
+  job_func func;
+  void *data;
+  int start, end;
+  job_batch *batch;
+} job;
+
+typedef struct job_queue
+{
+  pthread_mutex_t lock;
+  job jobs[JOB_QUEUE_SIZE];
+  int top;                      /* Next job for a thief. */
+  int bottom;                   /* One past the owners next job. */
+} job_queue;
+
+
+static job_queue queues[JOBS_MAX_THREADS];
+static pthread_t threads[JOBS_MAX_THREADS];
+static int n_workers = 1;       /* Worker count including the caller. */
+static bool started = false;
+
+static volatile int queued = 0;         /* Jobs in a queue, not taken yet. */
+static volatile bool quitting = false;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+
+/* Function prototypes. */
+bool queue_push(job_queue *q, job *j);
+bool queue_pop(job_queue *q, job *j);
+bool queue_steal(job_queue *q, job *j);
+bool jobs_find(int self, job *j);
+void jobs_run(job *j);
+void *jobs_worker(void *arg);
+
+
+/**
+ * Adds a job to the bottom of a queue. Returns false if the queue is full.
+ */
+bool queue_push(job_queue *q, job *j)
+{
+  bool pushed = false;
+
+  pthread_mutex_lock(&q->lock);
+  if(q->bottom - q->top < JOB_QUEUE_SIZE)
+  {
+    q->jobs[q->bottom % JOB_QUEUE_SIZE] = *j;
+    q->bottom++;
+    __sync_fetch_and_add(&queued, 1);
+    pushed = true;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return pushed;
+}
+
+
+/**
+ * Takes the most recently pushed job from a queue, for use by its owner.
+ */
+bool queue_pop(job_queue *q, job *j)
+{
+  bool popped = false;
+
+  pthread_mutex_lock(&q->lock);
+  if(q->bottom > q->top)
+  {
+    q->bottom--;
+    *j = q->jobs[q->bottom % JOB_QUEUE_SIZE];
+    __sync_fetch_and_sub(&queued, 1);
+    popped = true;
+  }
+
+  /* Rewind an empty queue so the counters never grow without bound. */
+  if(q->bottom == q->top)
+    q->bottom = q->top = 0;
+  pthread_mutex_unlock(&q->lock);
+
+  return popped;
+}
+
+
+/**
+ * Takes the oldest job from someone else's queue.
+ */
+bool queue_steal(job_queue *q, job *j)
+{
+  bool stolen = false;
+
+  pthread_mutex_lock(&q->lock);
+  if(q->bottom > q->top)
+  {
+    *j = q->jobs[q->top % JOB_QUEUE_SIZE];
+    q->top++;
+    __sync_fetch_and_sub(&queued, 1);
+    stolen = true;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return stolen;
+}
+
+
+/**
+ * Finds a job for a worker, first from its own queue and then by stealing
+ * from the others in turn.
+ */
+bool jobs_find(int self, job *j)
+{
+  int i;
+
+  if(queue_pop(&queues[self], j))
+    return true;
+
+  for(i = 1; i < n_workers; i++)
+    if(queue_steal(&queues[(self + i) % n_workers], j))
+      return true;
+
+  return false;
+}
+
+
+/**
+ * Runs a job and counts it off its batch, waking whoever is waiting on the
+ * batch if it was the last.
+ */
+void jobs_run(job *j)
+{
+  j->func(j->data, j->start, j->end);
+
+  if(__sync_sub_and_fetch(&j->batch->pending, 1) == 0)
+  {
+    pthread_mutex_lock(&done_lock);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&done_lock);
+  }
+}
+
+
+/**
+ * Main loop of each worker thread. Workers sleep while no job is queued
+ * and otherwise keep looking for jobs.
+ */
+void *jobs_worker(void *arg)
+{
+  int self = (int)(long)arg;
+  job j;
+
+  while(true)
+  {
+    pthread_mutex_lock(&wake_lock);
+    while(queued == 0 && !quitting)
+      pthread_cond_wait(&wake_cond, &wake_lock);
+    pthread_mutex_unlock(&wake_lock);
+
+    if(quitting)
+      break;
+
+    if(jobs_find(self, &j))
+      jobs_run(&j);
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Returns the number of processors that are online, or 1 if it can't be
+ * found out.
+ */
+int jobs_cpu_count()
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+
+
+/**
+ * Starts the job system with the given number of threads, counting the
+ * calling thread. A count of 0 or less uses one thread per processor.
+ */
+void jobs_init(int n_threads)
+{
+  int i;
+
+  if(started)
+    jobs_shutdown();
+
+  if(n_threads <= 0)
+    n_threads = jobs_cpu_count();
+  if(n_threads > JOBS_MAX_THREADS)
+    n_threads = JOBS_MAX_THREADS;
+
+  for(i = 0; i < n_threads; i++)
+  {
+    pthread_mutex_init(&queues[i].lock, NULL);
+    queues[i].top = queues[i].bottom = 0;
+  }
+
+  quitting  = false;
+  queued    = 0;
+  n_workers = 1;
+
+  /* Worker 0 is whoever calls jobs_parallel_for. */
+  for(i = 1; i < n_threads; i++)
+  {
+    if(pthread_create(&threads[i], NULL, jobs_worker, (void *)(long)i))
+    {
+      fprintf(stderr, "ERROR(jobs_init): Unable to start thread %d.\n", i);
+      break;
+    }
+    n_workers++;
+  }
+
+  started = true;
+}
+
+
+/**
+ * Stops and joins all the worker threads.
+ */
+void jobs_shutdown()
+{
+  int i;
+
+  if(!started) return;
+
+  pthread_mutex_lock(&wake_lock);
+  quitting = true;
+  pthread_cond_broadcast(&wake_cond);
+  pthread_mutex_unlock(&wake_lock);
+
+  for(i = 1; i < n_workers; i++)
+    pthread_join(threads[i], NULL);
+
+  for(i = 0; i < n_workers; i++)
+    pthread_mutex_destroy(&queues[i].lock);
+
+  n_workers = 1;
+  started = false;
+}
+
+
+/**
+ * Returns the number of threads that work is spread over.
+ */
+int jobs_threads()
+{
+  return n_workers;
+}
+
+
+/**
+ * Runs func over the range [0, count) split into jobs of about grain items
+ * each. The jobs are dealt out over every worker's queue and the calling
+ * thread works through them too. Returns once all of them are done. Any
+ * number of threads may call this at once, each only waiting for its own
+ * jobs, but calls must not be nested.
+ */
+void jobs_parallel_for(job_func func, void *data, int count, int grain)
+{
+  job_batch batch;
+  job j;
+  int i, w = 0;
+
+  if(count <= 0)
+    return;
+
+  /* Not worth the trouble of handing out. */
+  if(n_workers == 1 || count <= grain)
+  {
+    func(data, 0, count);
+    return;
+  }
+
+  /* Make sure there are a few jobs for each worker so there's something
+   * left to steal when the work is uneven. */
+  if(grain < 1)
+    grain = 1;
+  if(count / grain < n_workers * 4)
+    grain = count / (n_workers * 4) + 1;
+
+  j.func  = func;
+  j.data  = data;
+  j.batch = &batch;
+
+  /* Count every job as pending before any can be started, so a fast
+   * worker can't see the count reach zero early. */
+  batch.pending = (count + grain - 1) / grain;
+
+  for(i = 0; i < count; i += grain)
+  {
+    j.start = i;
+    j.end   = i + grain < count ? i + grain : count;
+
+    if(!queue_push(&queues[w], &j))
+      jobs_run(&j);
+    w = (w + 1) % n_workers;
+  }
+
+  pthread_mutex_lock(&wake_lock);
+  pthread_cond_broadcast(&wake_cond);
+  pthread_mutex_unlock(&wake_lock);
+
+  /* Help out while there is work left to take, which may belong to another
+   * caller, then sleep until the workers have finished the last of ours. */
+  while(batch.pending > 0 && jobs_find(0, &j))
+    jobs_run(&j);
+
+  /* Taking the lock also makes sure everything the workers wrote is seen
+   * by this thread. */
+  pthread_mutex_lock(&done_lock);
+  while(batch.pending > 0)
+    pthread_cond_wait(&done_cond, &done_lock);
+  pthread_mutex_unlock(&done_lock);
+}
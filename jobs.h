@@ -0,0 +1,35 @@
+/**
+ * jobs.h
+ *
+ * A small work stealing job system. Work is handed out as ranges of some
+ * array, split into jobs and spread over a worker queue per thread. Threads
+ * that run out of work steal from the others. The calling thread joins in
+ * and only returns once every job it handed out has finished, so each call
+ * acts as a barrier. Several threads can hand out work at once.
+ */
+
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include "global.h"
+
+#define JOBS_MAX_THREADS 64
+#define JOB_QUEUE_SIZE 1024
+
+
+/**
+ * A job function processes the items from start up to (not including) end
+ * of whatever data it was given.
+ */
+typedef void (*job_func)(void *data, int start, int end);
+
+
+/* Interface. */
+extern void jobs_init(int n_threads);
+extern void jobs_shutdown();
+extern int jobs_threads();
+extern int jobs_cpu_count();
+extern void jobs_parallel_for(job_func func, void *data, int count, int grain);
+
+
+#endif
@@ -8,10 +8,12 @@
  */
 
 #include "load_mdl.h"
+#include "drawing.h"
+#include "skin.h"
 
 
 /* Function prototypes. */
-bool load_animation(model *mdl, int frames, FILE *fp);
+bool load_animation(model *mdl, int frames, int interp, FILE *fp);
 bool parse_frame(anim *anim, char *frame, int bones);
 
 
@@ -155,6 +157,7 @@ model *load_model(const char *file_name)
       b_new->child = NULL;
       b_new->sibling = NULL;
       b_new->child_count = 0;
+      b_new->vbo = 0;
 
       /**
        * Allocate memory for the bone name and copy the string accross.
@@ -226,14 +229,24 @@ model *load_model(const char *file_name)
           "ERROR(load_mdl): Attempted load animation without model decl.\n");
         continue;
       }
-      if(arg_count != 2) continue;
+      if(arg_count != 2 && arg_count != 3) continue;
 
-      load_animation(new_mdl, atoi(arg_list[1]), fp);
+      load_animation(new_mdl, atoi(arg_list[1]),
+          interp_from_name(arg_list[2]), fp);
     }
   }
 
   if(new_mdl != NULL)
+  {
     new_mdl->bone_array = skel_make_array(new_mdl->root, new_mdl->n_bones);
+    new_mdl->radius = skel_bounds(new_mdl->root, 0.0);
+
+    /* Merge the bone meshes while the bones are still in the bind pose. */
+    if(global.r_skinned)
+      new_mdl->skin = skin_build(new_mdl);
+
+    draw_upload_model(new_mdl);
+  }
 
   printf("New model '%s' successfully loaded.\n", new_mdl->name);
   printf("%d bones loaded.\n", new_mdl->n_bones);
@@ -244,9 +257,10 @@ model *load_model(const char *file_name)
 
 
 /**
- * Loads a set of frames from a file into a model. Returns true on success.
+ * Loads a set of frames from a file into a model. The animation will be
+ * interpolated using the given mode. Returns true on success.
  */
-bool load_animation(model *mdl, int frames, FILE *fp)
+bool load_animation(model *mdl, int frames, int interp, FILE *fp)
 {
   int i;
   anim *anim;
@@ -265,6 +279,8 @@ bool load_animation(model *mdl, int frames, FILE *fp)
       printf("Creating new animation, %d frames, %d bones\n", frames,
           mdl->n_bones);
       anim = new_anim(frames, mdl->n_bones);
+      if(anim == NULL) return false;
+      anim->interp = interp;
       mdl->anims[i] = anim;
       break;
     }
@@ -283,6 +299,10 @@ bool load_animation(model *mdl, int frames, FILE *fp)
   if(i != frames)
     return false;
 
+  /* Optionally compress the animation now that all its frames are in. */
+  if(global.pack_anims)
+    anim_pack(anim, global.pack_tol);
+
   return true;
 }
 
@@ -5,6 +5,8 @@
  */
 
 #include "3d.h"
+#include "drawing.h"
+#include "skin.h"
 #include "util.h"
 #include "mem.h"
 
@@ -224,10 +226,14 @@ model *new_model(char *name, int anims)
   mdl->root = NULL;
   mdl->bone_array = NULL;
   mdl->n_bones = mdl->n_anims = 0;
-  mdl->p_frame = mdl->n_frame = NULL;
-  mdl->p_index = mdl->n_index = 0;
-  mdl->p_time = mdl->n_time = 0;
-  mdl->curr_anim = NULL;
+  mdl->state.p_frame = mdl->state.n_frame = NULL;
+  mdl->state.p_index = mdl->state.n_index = 0;
+  mdl->state.p_time = mdl->state.n_time = 0;
+  mdl->state.curr_anim = NULL;
+  mdl->state.blend = NULL;
+  mdl->pose = NULL;
+  mdl->skin = NULL;
+  mdl->radius = -1.0;
 
   if(anims < 0) anims = 1;
   
@@ -259,6 +265,7 @@ void free_model(model *mdl)
 
   if(!mdl) return;
 
+  draw_release_model(mdl);
   free_skel(mdl->root);
   for(i = 0; i < mdl->n_anims; i++)
     free_anim(mdl->anims[i], true);
@@ -266,6 +273,9 @@ void free_model(model *mdl)
   FREE(mdl->anims);
   FREE(mdl->bone_array);
   FREE(mdl->name);
+  FREE(mdl->pose);
+  FREE(mdl->state.blend);
+  skin_free(mdl->skin);
 
   FREE(mdl);
 }
@@ -284,6 +294,8 @@ void model_shallow_free(model *mdl)
   FREE(mdl->anims);
   FREE(mdl->bone_array);
   FREE(mdl->name);
+  FREE(mdl->pose);
+  FREE(mdl->state.blend);
 
   FREE(mdl);
 }
@@ -306,6 +318,8 @@ model *clone_model(model *mdl)
   clone->n_bones    = mdl->n_bones;
   clone->bone_array = skel_make_array(clone->root, clone->n_bones);
   clone->texture    = mdl->texture;
+  clone->skin       = mdl->skin;
+  clone->radius     = mdl->radius;
 
   v_clear(clone->pos);
   v_clear(clone->pos + 3);
@@ -319,3 +333,84 @@ model *clone_model(model *mdl)
   return clone;
 }
 
+
+
+/**
+ * Creates a new instance of a model. The instance and its pose come from a
+ * single allocation, so creating and freeing one is cheap. Starts in the
+ * base models current pose at the origin. Returns NULL on failure.
+ */
+instance *new_instance(model *base)
+{
+  instance *inst;
+  int i;
+
+  if(!base) return NULL;
+
+  inst = malloc(sizeof(instance) + sizeof(float) * base->n_bones * TRANS_SIZE);
+  CHECK(inst);
+
+  inst->base = base;
+  inst->pose = (float *)(inst + 1);
+  skel_copy_rots(base->bone_array, inst->pose, base->n_bones);
+
+  for(i = 0; i < 6; i++)
+    inst->pos[i] = 0.0;
+
+  inst->state.p_frame = inst->state.n_frame = NULL;
+  inst->state.p_index = inst->state.n_index = 0;
+  inst->state.p_time = inst->state.n_time = 0;
+  inst->state.curr_anim = NULL;
+  inst->state.blend = NULL;
+
+  return inst;
+}
+
+
+/**
+ * Frees an instance. The base model is left alone.
+ */
+void free_instance(instance *inst)
+{
+  if(!inst) return;
+
+  FREE(inst->state.blend);
+  FREE(inst);
+}
+
+
+/**
+ * Returns the position of an instance, which is its base models own
+ * position if it follows the model.
+ */
+float *instance_pos(instance *inst)
+{
+  return inst->pose ? inst->pos : inst->base->pos;
+}
+
+
+/**
+ * Works out the matrix that places a model at the position and rotation in
+ * pos, as draw_model_pose does.
+ */
+void model_matrix(float *pos, float m[16])
+{
+  m4_identity(m);
+  m4_translate(m, pos[0], pos[1], pos[2]);
+  m4_rotate(m, pos[3], X);
+  m4_rotate(m, pos[4], Y);
+  m4_rotate(m, pos[5], Z);
+}
+
+
+/**
+ * Copies the bone rotations of an instance into rots, in skel_make_array
+ * order.
+ */
+void instance_copy_pose(instance *inst, float *rots)
+{
+  if(inst->pose)
+    memcpy(rots, inst->pose, sizeof(float) * inst->base->n_bones * TRANS_SIZE);
+  else
+    skel_copy_rots(inst->base->bone_array, rots, inst->base->n_bones);
+}
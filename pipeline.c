@@ -0,0 +1,463 @@
+/**
+ * pipeline.c
+ *
+ * The programs use none of GLSL's built in state, so they also build on a
+ * core profile context. The matrices, current colour, light, material,
+ * lighting, texturing and texture environment are read back from OpenGL
+ * and passed in as uniforms, so callers set them up exactly as they would
+ * without the programs, and the geometry goes in as vertex attributes
+ * through pipe_arrays. The vertex shader lights each vertex by the sun as
+ * the fixed function pipeline does, and the fragment shader does what the
+ * texture environment would have: nothing, GL_MODULATE or GL_REPLACE, then
+ * adds the separate specular colour. There is a program for each shade
+ * model. Wireframe, blending, alpha, depth and stencil tests all still
+ * apply around the program as they do round the fixed function stages.
+ *
+ * While pipe_shadows has cascaded shadow maps turned on, the program is
+ * used whether or not -p is, and each fragment looks itself up in the map
+ * of the slice of the view it falls in. Lit fragments lose the sun's
+ * diffuse and specular light where something is between them and the sun,
+ * and unlit ones, like the ground, get the flat shadows' colour blended
+ * over them instead, so shadowed ground looks as it did with them.
+ */
+
+#include "pipeline.h"
+#include "shader.h"
+#include "smap.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+/* What the fragment shader does with the texture. */
+enum { PIPE_TEX_OFF, PIPE_TEX_MODULATE, PIPE_TEX_REPLACE };
+
+/* Uniforms, the same in both programs. */
+enum {
+  PIPE_U_MODELVIEW, PIPE_U_PROJECTION, PIPE_U_NORMAL_MATRIX, PIPE_U_COLOUR,
+  PIPE_U_LIT, PIPE_U_TEXTURED, PIPE_U_LIGHT_DIR, PIPE_U_LIGHT_HALF,
+  PIPE_U_AMBIENT, PIPE_U_DIFFUSE, PIPE_U_SPECULAR, PIPE_U_SHININESS,
+  PIPE_U_SHADOWED, PIPE_U_TO_MAP, PIPE_U_SPLITS, PIPE_U_DARKNESS,
+  PIPE_UNIFORMS
+};
+
+const char *pipe_uniform_names[PIPE_UNIFORMS] = {
+  "modelview", "projection", "normal_matrix", "colour",
+  "lit", "textured", "light_dir", "light_half",
+  "ambient", "diffuse", "specular", "shininess",
+  "shadowed", "to_map", "splits", "darkness"
+};
+
+const char *pipe_attribs[] = { "position", "normal", "texcoord", NULL };
+
+const char *pipe_vert_src =
+  "attribute vec3 position;\n"
+  "attribute vec3 normal;\n"
+  "attribute vec2 texcoord;\n"
+  "uniform mat4 modelview;\n"
+  "uniform mat4 projection;\n"
+  "uniform mat3 normal_matrix;\n"
+  "uniform vec4 colour;\n"
+  "uniform bool lit;\n"
+  "uniform vec3 light_dir;\n"
+  "uniform vec3 light_half;\n"
+  "uniform vec4 ambient;\n"
+  "uniform vec3 diffuse;\n"
+  "uniform vec3 specular;\n"
+  "uniform float shininess;\n"
+  "uniform bool shadowed;\n"
+  "uniform mat4 to_map[3];\n"
+  "SHADE varying vec4 front;\n"
+  "SHADE varying vec4 front_dark;\n"
+  "SHADE varying vec3 front_spec;\n"
+  "varying vec2 uv;\n"
+  "varying vec4 coord[3];\n"
+  "varying float depth;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 eye = modelview * vec4(position, 1.0);\n"
+  "  vec3 n = normalize(normal_matrix * normal);\n"
+  "  float d, s;\n"
+  "  int i;\n"
+  "\n"
+  "  gl_Position = projection * eye;\n"
+  "  uv = texcoord;\n"
+  "\n"
+  "  if(shadowed)\n"
+  "  {\n"
+  "    for(i = 0; i < 3; i++)\n"
+  "      coord[i] = to_map[i] * eye;\n"
+  "    depth = -eye.z;\n"
+  "  }\n"
+  "\n"
+  "  if(!lit)\n"
+  "  {\n"
+  "    front = front_dark = colour;\n"
+  "    front_spec = vec3(0.0);\n"
+  "    return;\n"
+  "  }\n"
+  "\n"
+  "  d = max(dot(n, light_dir), 0.0);\n"
+  "  s = d > 0.0 ? pow(max(dot(n, light_half), 0.0), shininess) : 0.0;\n"
+  "\n"
+  "  front = clamp(vec4(ambient.rgb + diffuse * d, ambient.a), 0.0, 1.0);\n"
+  "  front_dark = clamp(ambient, 0.0, 1.0);\n"
+  "  front_spec = clamp(specular * s, 0.0, 1.0);\n"
+  "}\n";
+
+const char *pipe_frag_src =
+  "uniform bool lit;\n"
+  "uniform int textured;\n"
+  "uniform sampler2D tex;\n"
+  "uniform bool shadowed;\n"
+  "uniform sampler2DShadow maps[3];\n"
+  "uniform float splits[3];\n"
+  "uniform float darkness;\n"
+  "SHADE varying vec4 front;\n"
+  "SHADE varying vec4 front_dark;\n"
+  "SHADE varying vec3 front_spec;\n"
+  "varying vec2 uv;\n"
+  "varying vec4 coord[3];\n"
+  "varying float depth;\n"
+  "void main()\n"
+  "{\n"
+  "  float sun = 1.0;\n"
+  "  vec4 c;\n"
+  "\n"
+  "  if(shadowed)\n"
+  "  {\n"
+  "    if(depth < splits[0])\n"
+  "      sun = shadow2DProj(maps[0], coord[0]).r;\n"
+  "    else if(depth < splits[1])\n"
+  "      sun = shadow2DProj(maps[1], coord[1]).r;\n"
+  "    else if(depth < splits[2])\n"
+  "      sun = shadow2DProj(maps[2], coord[2]).r;\n"
+  "  }\n"
+  "\n"
+  "  c = mix(front_dark, front, sun);\n"
+  "  if(textured == 1)\n"
+  "    c *= texture2D(tex, uv);\n"
+  "  else if(textured == 2)\n"
+  "    c = texture2D(tex, uv);\n"
+  "  if(!lit)\n"
+  "    c.rgb = mix(c.rgb, vec3(0.07, 0.0, 0.0), darkness * (1.0 - sun));\n"
+  "  frag_colour = vec4(c.rgb + front_spec * sun, c.a);\n"
+  "}\n";
+
+int pipe_state = 0;             /* 0 untried, 1 ready, -1 unsupported. */
+GLuint pipe_progs[2] = {0, 0};  /* Smooth and flat shaded. */
+GLint pipe_locs[2][PIPE_UNIFORMS];
+GLuint pipe_prog = 0;           /* The program in use, or 0. */
+GLint *pipe_loc = NULL;         /* And its uniforms. */
+
+const float *pipe_to_map = NULL;  /* Shadow maps set by pipe_shadows, */
+const float *pipe_splits = NULL;  /* or NULL for none. */
+float pipe_darkness = 0.0;
+
+
+/* Function prototypes. */
+void pipe_light();
+
+
+/**
+ * Builds the programs the first time they are needed. Returns false if the
+ * driver can't run them, in which case everything stays fixed function.
+ */
+bool pipe_init()
+{
+  const char *defines[2] = {"", "#define FLAT\n"};
+  GLint maps[SMAP_CASCADES];
+  int i, j;
+
+  if(pipe_state)
+    return pipe_state > 0;
+
+  pipe_state = -1;
+
+  for(i = 0; i < 2; i++)
+  {
+    pipe_progs[i] = shader_build_core(i ? "flat pipeline" : "pipeline",
+        defines[i], pipe_vert_src, pipe_frag_src, pipe_attribs,
+        PIPE_POSITION);
+    if(!pipe_progs[i])
+    {
+      pipe_cleanup();
+      pipe_state = -1;
+      return false;
+    }
+
+    for(j = 0; j < PIPE_UNIFORMS; j++)
+      pipe_locs[i][j] = glGetUniformLocation(pipe_progs[i],
+          pipe_uniform_names[j]);
+
+    /* The shadow maps go on the units after the texture. */
+    for(j = 0; j < SMAP_CASCADES; j++)
+      maps[j] = j + 1;
+
+    glUseProgram(pipe_progs[i]);
+    glUniform1i(glGetUniformLocation(pipe_progs[i], "tex"), 0);
+    glUniform1iv(glGetUniformLocation(pipe_progs[i], "maps"), SMAP_CASCADES,
+        maps);
+  }
+  glUseProgram(0);
+
+  pipe_state = 1;
+  return true;
+}
+
+
+/**
+ * Frees the programs. They are built again if pipe_init is called again.
+ */
+void pipe_cleanup()
+{
+  shader_free(pipe_progs[0]);
+  shader_free(pipe_progs[1]);
+  pipe_progs[0] = pipe_progs[1] = 0;
+  pipe_prog = 0;
+  pipe_state = 0;
+}
+
+
+/**
+ * Passes the sun and the front material to the program in use, lit the
+ * way the fixed function pipeline lights with light 0 and the light model
+ * ambient. The sun is always taken to be directional.
+ */
+void pipe_light()
+{
+  float pos[4], model_amb[4], light_amb[4], light_diff[4], light_spec[4];
+  float emission[4], mat_amb[4], mat_diff[4], mat_spec[4], shininess;
+  float ambient[4], diffuse[3], specular[3], dir[3], half[3], len;
+  int i;
+
+  glGetLightfv(GL_LIGHT0, GL_POSITION, pos);
+  glGetLightfv(GL_LIGHT0, GL_AMBIENT, light_amb);
+  glGetLightfv(GL_LIGHT0, GL_DIFFUSE, light_diff);
+  glGetLightfv(GL_LIGHT0, GL_SPECULAR, light_spec);
+  glGetFloatv(GL_LIGHT_MODEL_AMBIENT, model_amb);
+  glGetMaterialfv(GL_FRONT, GL_EMISSION, emission);
+  glGetMaterialfv(GL_FRONT, GL_AMBIENT, mat_amb);
+  glGetMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diff);
+  glGetMaterialfv(GL_FRONT, GL_SPECULAR, mat_spec);
+  glGetMaterialfv(GL_FRONT, GL_SHININESS, &shininess);
+
+  for(i = 0; i < 3; i++)
+  {
+    ambient[i]  = emission[i] + (model_amb[i] + light_amb[i]) * mat_amb[i];
+    diffuse[i]  = light_diff[i] * mat_diff[i];
+    specular[i] = light_spec[i] * mat_spec[i];
+  }
+  ambient[3] = mat_diff[3];
+
+  /* The light position is kept in eye space, and the viewer is taken to
+   * be infinitely far away down z, as the fixed function pipeline does
+   * without GL_LIGHT_MODEL_LOCAL_VIEWER. */
+  len = sqrt(pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2]);
+  for(i = 0; i < 3; i++)
+    dir[i] = len > 0.0 ? pos[i] / len : 0.0;
+  for(i = 0; i < 3; i++)
+    half[i] = dir[i] + (i == 2 ? 1.0 : 0.0);
+  len = sqrt(half[0] * half[0] + half[1] * half[1] + half[2] * half[2]);
+  for(i = 0; i < 3; i++)
+    half[i] = len > 0.0 ? half[i] / len : 0.0;
+
+  glUniform3fv(pipe_loc[PIPE_U_LIGHT_DIR], 1, dir);
+  glUniform3fv(pipe_loc[PIPE_U_LIGHT_HALF], 1, half);
+  glUniform4fv(pipe_loc[PIPE_U_AMBIENT], 1, ambient);
+  glUniform3fv(pipe_loc[PIPE_U_DIFFUSE], 1, diffuse);
+  glUniform3fv(pipe_loc[PIPE_U_SPECULAR], 1, specular);
+  glUniform1f(pipe_loc[PIPE_U_SHININESS], shininess);
+}
+
+
+/**
+ * Turns shadow maps on for whatever is drawn through the programs from now
+ * on, or off if to_map is NULL. to_map holds a matrix for each cascade,
+ * taking eye space into its map, splits holds how far from the camera
+ * each cascade reaches, and unlit fragments in full shadow have the
+ * shadow colour blended over them with an alpha of darkness. The maps
+ * themselves should be bound on the texture units after the first. Both
+ * arrays are kept, not copied, until shadows are turned off.
+ */
+void pipe_shadows(const float *to_map, const float *splits, float darkness)
+{
+  pipe_to_map   = to_map;
+  pipe_splits   = splits;
+  pipe_darkness = darkness;
+}
+
+
+/**
+ * Puts a program in use, if it is turned on or there are shadow maps to
+ * look up and it can be, set up from whatever shade model, lighting and
+ * texturing are enabled now. A program
+ * that is already in use, such as the skinning shader's, is left to do the
+ * drawing. Returns true if the program was put in use, in which case
+ * geometry should go through pipe_arrays and pipe_update, and pipe_end
+ * should be called after drawing.
+ */
+bool pipe_begin()
+{
+  GLint env = GL_MODULATE, prog = 0, shade = GL_SMOOTH;
+  int textured = PIPE_TEX_OFF, flat;
+  bool lit;
+
+  if((!global.r_glsl && !pipe_to_map) || !pipe_init())
+    return false;
+
+  glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+  if(prog && (GLuint)prog != pipe_progs[0] && (GLuint)prog != pipe_progs[1])
+    return false;
+
+  if(glIsEnabled(GL_TEXTURE_2D))
+  {
+    glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &env);
+    textured = env == GL_REPLACE ? PIPE_TEX_REPLACE : PIPE_TEX_MODULATE;
+  }
+
+  glGetIntegerv(GL_SHADE_MODEL, &shade);
+  flat = shade == GL_FLAT;
+  pipe_prog = pipe_progs[flat];
+  pipe_loc  = pipe_locs[flat];
+  lit = glIsEnabled(GL_LIGHTING);
+
+  glUseProgram(pipe_prog);
+  glUniform1i(pipe_loc[PIPE_U_LIT], lit);
+  glUniform1i(pipe_loc[PIPE_U_TEXTURED], textured);
+  glUniform1i(pipe_loc[PIPE_U_SHADOWED], pipe_to_map != NULL);
+  if(pipe_to_map)
+  {
+    glUniformMatrix4fv(pipe_loc[PIPE_U_TO_MAP], SMAP_CASCADES, GL_FALSE,
+        pipe_to_map);
+    glUniform1fv(pipe_loc[PIPE_U_SPLITS], SMAP_CASCADES, pipe_splits);
+    glUniform1f(pipe_loc[PIPE_U_DARKNESS], pipe_darkness);
+  }
+  if(lit)
+    pipe_light();
+  pipe_update();
+
+  global.state_changes += 3;
+  return true;
+}
+
+
+/**
+ * Passes the current matrices and colour to the program in use, if there
+ * is one. Should be called after they change and before drawing.
+ */
+void pipe_update()
+{
+  float mv[16], proj[16], colour[4], n[9], det;
+  int i;
+
+  if(!pipe_prog)
+    return;
+
+  glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+  glGetFloatv(GL_PROJECTION_MATRIX, proj);
+  glGetFloatv(GL_CURRENT_COLOR, colour);
+
+  /* Normals go through the inverse transpose of the top left of the
+   * modelview matrix, which is its cofactors over its determinant. */
+  n[0] = mv[5] * mv[10] - mv[6] * mv[9];
+  n[1] = mv[6] * mv[8]  - mv[4] * mv[10];
+  n[2] = mv[4] * mv[9]  - mv[5] * mv[8];
+  n[3] = mv[2] * mv[9]  - mv[1] * mv[10];
+  n[4] = mv[0] * mv[10] - mv[2] * mv[8];
+  n[5] = mv[1] * mv[8]  - mv[0] * mv[9];
+  n[6] = mv[1] * mv[6]  - mv[2] * mv[5];
+  n[7] = mv[2] * mv[4]  - mv[0] * mv[6];
+  n[8] = mv[0] * mv[5]  - mv[1] * mv[4];
+  det = mv[0] * n[0] + mv[1] * n[1] + mv[2] * n[2];
+  if(det != 0.0)
+    for(i = 0; i < 9; i++)
+      n[i] /= det;
+
+  glUniformMatrix4fv(pipe_loc[PIPE_U_MODELVIEW], 1, GL_FALSE, mv);
+  glUniformMatrix4fv(pipe_loc[PIPE_U_PROJECTION], 1, GL_FALSE, proj);
+  glUniformMatrix3fv(pipe_loc[PIPE_U_NORMAL_MATRIX], 1, GL_FALSE, n);
+  glUniform4fv(pipe_loc[PIPE_U_COLOUR], 1, colour);
+}
+
+
+/**
+ * Points the geometry to draw at interleaved floats from base, or from the
+ * bound array buffer if base is NULL. stride and the offsets of the
+ * position, normal and texture coordinate of each vertex are counted in
+ * floats, and a normal or texture coordinate offset of -1 leaves it out.
+ * Goes to the program's attributes if one is in use, and to the fixed
+ * function arrays if not.
+ */
+void pipe_arrays(const float *base, int stride, int pos, int normal,
+    int tex)
+{
+  const char *at = (const char *)base;
+
+  stride *= sizeof(float);
+
+  if(!pipe_prog)
+  {
+    glDisableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, at + pos * sizeof(float));
+
+    if(normal >= 0)
+    {
+      glEnableClientState(GL_NORMAL_ARRAY);
+      glNormalPointer(GL_FLOAT, stride, at + normal * sizeof(float));
+    }
+    else
+      glDisableClientState(GL_NORMAL_ARRAY);
+
+    if(tex >= 0)
+    {
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      glTexCoordPointer(2, GL_FLOAT, stride, at + tex * sizeof(float));
+    }
+    else
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    return;
+  }
+
+  glEnableVertexAttribArray(PIPE_POSITION);
+  glVertexAttribPointer(PIPE_POSITION, 3, GL_FLOAT, GL_FALSE, stride,
+      at + pos * sizeof(float));
+
+  if(normal >= 0)
+  {
+    glEnableVertexAttribArray(PIPE_NORMAL);
+    glVertexAttribPointer(PIPE_NORMAL, 3, GL_FLOAT, GL_FALSE, stride,
+        at + normal * sizeof(float));
+  }
+  else
+  {
+    glDisableVertexAttribArray(PIPE_NORMAL);
+    glVertexAttrib3f(PIPE_NORMAL, 0.0, 0.0, 1.0);
+  }
+
+  if(tex >= 0)
+  {
+    glEnableVertexAttribArray(PIPE_TEXCOORD);
+    glVertexAttribPointer(PIPE_TEXCOORD, 2, GL_FLOAT, GL_FALSE, stride,
+        at + tex * sizeof(float));
+  }
+  else
+  {
+    glDisableVertexAttribArray(PIPE_TEXCOORD);
+    glVertexAttrib2f(PIPE_TEXCOORD, 0.0, 0.0);
+  }
+}
+
+
+/**
+ * Goes back to the fixed function pipeline after pipe_begin.
+ */
+void pipe_end()
+{
+  glDisableVertexAttribArray(PIPE_POSITION);
+  glDisableVertexAttribArray(PIPE_NORMAL);
+  glDisableVertexAttribArray(PIPE_TEXCOORD);
+  glUseProgram(0);
+  pipe_prog = 0;
+}
@@ -0,0 +1,36 @@
+/**
+ * pipeline.h
+ *
+ * A GLSL stand in for the fixed function pipeline, for what is still drawn
+ * through it: the bone meshes, the ground, the sky and text. It takes the
+ * same lights, materials, colours, textures and matrices as the fixed
+ * function pipeline does and gives the same picture, so it can be switched
+ * on and off without anything else changing. `-check` compares the two.
+ * It is also what looks up the shadow maps, so it is used for everything
+ * drawn while they are on.
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "global.h"
+
+/* Attribute locations. */
+#define PIPE_POSITION 0
+#define PIPE_NORMAL   1
+#define PIPE_TEXCOORD 2
+
+
+/* Interface. */
+extern bool pipe_init();
+extern void pipe_cleanup();
+extern void pipe_shadows(const float *to_map, const float *splits,
+    float darkness);
+extern bool pipe_begin();
+extern void pipe_update();
+extern void pipe_arrays(const float *base, int stride, int pos, int normal,
+    int tex);
+extern void pipe_end();
+
+
+#endif
@@ -0,0 +1,414 @@
+/**
+ * pngstrip.c
+ *
+ * A strip of rows is filtered, then deflated as raw deflate data ending
+ * with a sync flush, so it finishes on a byte boundary and the next strip
+ * can follow straight on; only the last strip finishes the stream. Before
+ * compressing, each strip filters the rows just above it too and gives the
+ * last 32K of them to zlib as a dictionary, so matches can still reach
+ * back over the join. The Adler-32 checksums of the strips are combined
+ * for the end of the stream, which is wrapped in a zlib header and written
+ * as one IDAT chunk.
+ *
+ * Rows come in from the bottom up, as glReadPixels leaves them, and are
+ * written top down.
+ */
+
+#include "pngstrip.h"
+#include "mem.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define PNGSTRIP_WINDOW 32768   /* How far back deflate can look. */
+
+
+/**
+ * One strip of the image and what it compresses to.
+ */
+typedef struct strip
+{
+  const unsigned char *rgb;
+  int w, h;
+  int start, end;               /* Rows of the PNG image, top down. */
+  int level, filter;
+  bool last;
+
+  unsigned char *out;           /* The deflated strip. */
+  unsigned long out_len;
+  unsigned long adler;          /* Checksum of the filtered rows. */
+  unsigned long raw_len;        /* Length of the filtered rows. */
+  bool ok;
+} strip;
+
+
+/* Function prototypes. */
+void pngstrip_filter(unsigned char *out, const unsigned char *row,
+    const unsigned char *prev, int len, int type);
+void pngstrip_filter_rows(unsigned char *out, const unsigned char *rgb,
+    int w, int h, int start, int end, int filter, unsigned char *scratch);
+void *pngstrip_deflate(void *data);
+bool pngstrip_chunk(FILE *fp, const char *type, const unsigned char *data,
+    unsigned long len);
+void pngstrip_put32(unsigned char *p, unsigned long v);
+
+
+/**
+ * Returns the row filter with the given name, one of none, sub, up, avg,
+ * paeth and all for adaptive, or adaptive if there is none by that name.
+ */
+int pngstrip_filter_id(const char *name)
+{
+  static const char *names[] = {"none", "sub", "up", "avg", "paeth", "all"};
+  int i;
+
+  for(i = PNG_ROW_NONE; i <= PNG_ROW_ADAPTIVE; i++)
+    if(streq(name, names[i]))
+      return i;
+
+  fprintf(stderr, "ERROR(pngstrip_filter_id): Unknown filter '%s'.\n",
+      name);
+  return PNG_ROW_ADAPTIVE;
+}
+
+
+/**
+ * Filters one row of len bytes with the given filter into out, after the
+ * filter type byte. prev is the row above, or NULL for the top row. Each
+ * filter has its own loop, as this is most of the time spent outside zlib.
+ */
+void pngstrip_filter(unsigned char *out, const unsigned char *row,
+    const unsigned char *prev, int len, int type)
+{
+  int i, a, b, c, p, pa, pb, pc;
+
+  out[0] = type;
+  out++;
+
+  /* The top row filters against a row of zeros. */
+  if(!prev && (type == PNG_ROW_UP || type == PNG_ROW_PAETH))
+    type = type == PNG_ROW_UP ? PNG_ROW_NONE : PNG_ROW_SUB;
+
+  switch(type)
+  {
+    case PNG_ROW_SUB:
+      for(i = 0; i < 3 && i < len; i++)
+        out[i] = row[i];
+      for(; i < len; i++)
+        out[i] = row[i] - row[i - 3];
+      break;
+
+    case PNG_ROW_UP:
+      for(i = 0; i < len; i++)
+        out[i] = row[i] - prev[i];
+      break;
+
+    case PNG_ROW_AVG:
+      for(i = 0; i < 3 && i < len; i++)
+        out[i] = row[i] - (prev ? prev[i] >> 1 : 0);
+      for(; i < len; i++)
+        out[i] = row[i] - ((row[i - 3] + (prev ? prev[i] : 0)) >> 1);
+      break;
+
+    case PNG_ROW_PAETH:
+      for(i = 0; i < 3 && i < len; i++)
+        out[i] = row[i] - prev[i];
+      for(; i < len; i++)
+      {
+        a  = row[i - 3];
+        b  = prev[i];
+        c  = prev[i - 3];
+        p  = b - c;
+        pc = a - c;
+        pa = p < 0 ? -p : p;
+        pb = pc < 0 ? -pc : pc;
+        pc = p + pc < 0 ? -(p + pc) : p + pc;
+        out[i] = row[i] - (pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+      }
+      break;
+
+    default:
+      memcpy(out, row, len);
+  }
+}
+
+
+/**
+ * Filters the rows of the PNG image from start up to end into out, each a
+ * filter type byte and the row. An adaptive filter keeps, for each row,
+ * whichever filter gives the smallest sum of bytes taken as signed, as
+ * libpng does; scratch has room for a filtered row while trying them.
+ */
+void pngstrip_filter_rows(unsigned char *out, const unsigned char *rgb,
+    int w, int h, int start, int end, int filter, unsigned char *scratch)
+{
+  const unsigned char *row, *prev;
+  long sum, best_sum;
+  int len = w * 3, y, type, best, i;
+
+  for(y = start; y < end; y++, out += len + 1)
+  {
+    row  = rgb + (h - 1 - y) * len;
+    prev = y > 0 ? row + len : NULL;
+
+    if(filter != PNG_ROW_ADAPTIVE)
+    {
+      pngstrip_filter(out, row, prev, len, filter);
+      continue;
+    }
+
+    best = PNG_ROW_NONE;
+    best_sum = -1;
+    for(type = PNG_ROW_NONE; type <= PNG_ROW_PAETH; type++)
+    {
+      pngstrip_filter(scratch, row, prev, len, type);
+      for(sum = 0, i = 1; i <= len; i++)
+        sum += scratch[i] < 128 ? scratch[i] : 256 - scratch[i];
+      if(best_sum < 0 || sum < best_sum)
+      {
+        best_sum = sum;
+        best = type;
+      }
+    }
+    pngstrip_filter(out, row, prev, len, best);
+  }
+}
+
+
+/**
+ * Thread function that filters and deflates one strip.
+ */
+void *pngstrip_deflate(void *data)
+{
+  strip *s = data;
+  int len = s->w * 3 + 1, before, ret;
+  unsigned char *raw, *scratch, *own;
+  unsigned long dict, room;
+  z_stream z;
+
+  s->ok = false;
+
+  /* Enough of the rows above to fill the window. */
+  before = (PNGSTRIP_WINDOW + len - 1) / len;
+  if(before > s->start)
+    before = s->start;
+
+  raw     = malloc((long)len * (s->end - s->start + before));
+  scratch = malloc(len);
+  if(!raw || !scratch)
+  {
+    fprintf(stderr, "ERROR(pngstrip_deflate): Out of memory.\n");
+    free(raw);
+    free(scratch);
+    return NULL;
+  }
+
+  pngstrip_filter_rows(raw, s->rgb, s->w, s->h, s->start - before, s->end,
+      s->filter, scratch);
+  own        = raw + (long)len * before;
+  s->raw_len = (unsigned long)len * (s->end - s->start);
+  s->adler   = adler32(adler32(0L, Z_NULL, 0), own, s->raw_len);
+
+  memset(&z, 0, sizeof(z));
+  if(deflateInit2(&z, s->level, Z_DEFLATED, -15, 8,
+        s->filter == PNG_ROW_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED) != Z_OK)
+  {
+    fprintf(stderr, "ERROR(pngstrip_deflate): Unable to start zlib.\n");
+    free(raw);
+    free(scratch);
+    return NULL;
+  }
+
+  if(before)
+  {
+    dict = (unsigned long)len * before;
+    if(dict > PNGSTRIP_WINDOW)
+      dict = PNGSTRIP_WINDOW;
+    deflateSetDictionary(&z, own - dict, dict);
+  }
+
+  /* Room for the worst case, and the marker a sync flush adds. */
+  room   = deflateBound(&z, s->raw_len) + 16;
+  s->out = malloc(room);
+  if(s->out)
+  {
+    z.next_in   = own;
+    z.avail_in  = s->raw_len;
+    z.next_out  = s->out;
+    z.avail_out = room;
+
+    ret = deflate(&z, s->last ? Z_FINISH : Z_SYNC_FLUSH);
+    s->out_len = z.total_out;
+    s->ok = s->last ? ret == Z_STREAM_END : ret == Z_OK && z.avail_in == 0;
+  }
+  else
+    fprintf(stderr, "ERROR(pngstrip_deflate): Out of memory.\n");
+
+  deflateEnd(&z);
+  free(raw);
+  free(scratch);
+  return NULL;
+}
+
+
+/**
+ * Stores v as four bytes, most significant first, as PNG wants.
+ */
+void pngstrip_put32(unsigned char *p, unsigned long v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+
+/**
+ * Writes a whole chunk with the given type and data. Returns false if it
+ * could not be written.
+ */
+bool pngstrip_chunk(FILE *fp, const char *type, const unsigned char *data,
+    unsigned long len)
+{
+  unsigned char head[8], tail[4];
+  unsigned long crc;
+
+  pngstrip_put32(head, len);
+  memcpy(head + 4, type, 4);
+  crc = crc32(crc32(0L, Z_NULL, 0), head + 4, 4);
+  if(len > 0)
+    crc = crc32(crc, data, len);
+  pngstrip_put32(tail, crc);
+
+  return fwrite(head, 1, 8, fp) == 8 &&
+         (len == 0 || fwrite(data, 1, len, fp) == len) &&
+         fwrite(tail, 1, 4, fp) == 4;
+}
+
+
+/**
+ * Writes w by h RGB pixels, given bottom-up, to a PNG file, compressed at
+ * zlib level (-1 for the default) with the given row filter, split over
+ * up to threads threads. Returns false on failure.
+ */
+bool pngstrip_write(const char *filename, const unsigned char *rgb, int w,
+    int h, int level, int filter, int threads)
+{
+  static const unsigned char signature[8] =
+    {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  static const unsigned char zlib_flags[4] = {0x01, 0x5e, 0x9c, 0xda};
+  strip strips[PNGSTRIP_MAX_THREADS];
+  pthread_t ids[PNGSTRIP_MAX_THREADS];
+  bool started[PNGSTRIP_MAX_THREADS];
+  unsigned char ihdr[13], head[8], zhead[2], tail[4];
+  unsigned long idat_len, adler, crc;
+  int n, rows, i;
+  bool ok = true;
+  FILE *fp;
+
+  /* zlib's default level. */
+  if(level < 0 || level > 9)
+    level = 6;
+  if(filter < PNG_ROW_NONE || filter > PNG_ROW_ADAPTIVE)
+    filter = PNG_ROW_ADAPTIVE;
+
+  n = threads;
+  if(n > h / PNGSTRIP_MIN_ROWS) n = h / PNGSTRIP_MIN_ROWS;
+  if(n > PNGSTRIP_MAX_THREADS) n = PNGSTRIP_MAX_THREADS;
+  if(n < 1) n = 1;
+  rows = (h + n - 1) / n;
+
+  for(i = 0; i < n; i++)
+  {
+    strips[i].rgb    = rgb;
+    strips[i].w      = w;
+    strips[i].h      = h;
+    strips[i].start  = i * rows;
+    strips[i].end    = i == n - 1 ? h : (i + 1) * rows;
+    strips[i].level  = level;
+    strips[i].filter = filter;
+    strips[i].last   = i == n - 1;
+    strips[i].out    = NULL;
+  }
+
+  /* The last strip is done on this thread while the others go. */
+  for(i = 0; i < n - 1; i++)
+    started[i] = pthread_create(&ids[i], NULL, pngstrip_deflate,
+        &strips[i]) == 0;
+  pngstrip_deflate(&strips[n - 1]);
+  for(i = 0; i < n - 1; i++)
+  {
+    if(started[i])
+      pthread_join(ids[i], NULL);
+    else
+      pngstrip_deflate(&strips[i]);
+  }
+
+  idat_len = 2 + 4;
+  adler = strips[0].adler;
+  for(i = 0; i < n; i++)
+  {
+    ok = ok && strips[i].ok;
+    idat_len += strips[i].out_len;
+    if(i > 0)
+      adler = adler32_combine(adler, strips[i].adler, strips[i].raw_len);
+  }
+
+  fp = ok ? fopen(filename, "wb") : NULL;
+  if(ok && !fp)
+    fprintf(stderr, "ERROR(pngstrip_write): Unable to open '%s'.\n",
+        filename);
+
+  if(fp)
+  {
+    pngstrip_put32(ihdr, w);
+    pngstrip_put32(ihdr + 4, h);
+    ihdr[8]  = 8;               /* Bit depth. */
+    ihdr[9]  = 2;               /* RGB. */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    ok = fwrite(signature, 1, 8, fp) == 8 &&
+         pngstrip_chunk(fp, "IHDR", ihdr, 13);
+
+    /* The IDAT chunk is written a piece at a time with a running CRC. */
+    zhead[0] = 0x78;
+    zhead[1] = zlib_flags[level < 2 ? 0 : (level < 6 ? 1 :
+        (level == 6 ? 2 : 3))];
+    pngstrip_put32(tail, adler);
+
+    pngstrip_put32(head, idat_len);
+    memcpy(head + 4, "IDAT", 4);
+    crc = crc32(crc32(0L, Z_NULL, 0), head + 4, 4);
+    crc = crc32(crc, zhead, 2);
+    ok = ok && fwrite(head, 1, 8, fp) == 8 && fwrite(zhead, 1, 2, fp) == 2;
+    for(i = 0; i < n; i++)
+    {
+      crc = crc32(crc, strips[i].out, strips[i].out_len);
+      ok = ok && fwrite(strips[i].out, 1, strips[i].out_len, fp) ==
+           strips[i].out_len;
+    }
+    crc = crc32(crc, tail, 4);
+    ok = ok && fwrite(tail, 1, 4, fp) == 4;
+    pngstrip_put32(tail, crc);
+    ok = ok && fwrite(tail, 1, 4, fp) == 4;
+
+    ok = ok && pngstrip_chunk(fp, "IEND", NULL, 0);
+    ok = fclose(fp) == 0 && ok;
+    if(!ok)
+      fprintf(stderr, "ERROR(pngstrip_write): Unable to write '%s'.\n",
+          filename);
+  }
+  else
+    ok = false;
+
+  for(i = 0; i < n; i++)
+  {
+    FREE(strips[i].out);
+    strips[i].out = NULL;
+  }
+
+  return ok;
+}
@@ -0,0 +1,35 @@
+/**
+ * pngstrip.h
+ *
+ * Writes PNG files with the image compressed in horizontal strips on
+ * several threads at once. Each strip is deflated on its own, primed with
+ * the end of the strip above so it compresses nearly as well as one
+ * stream, and the pieces are joined into a single zlib stream that any PNG
+ * reader takes as usual.
+ */
+
+#ifndef _PNGSTRIP_H_
+#define _PNGSTRIP_H_
+
+#include "global.h"
+
+#define PNGSTRIP_MAX_THREADS 16 /* Most strips an image is split into. */
+#define PNGSTRIP_MIN_ROWS    16 /* Fewest rows worth a strip of their own. */
+
+/* Row filters, the same numbers PNG gives them, and trying every one for
+ * each row and keeping whichever looks smallest. */
+#define PNG_ROW_NONE     0
+#define PNG_ROW_SUB      1
+#define PNG_ROW_UP       2
+#define PNG_ROW_AVG      3
+#define PNG_ROW_PAETH    4
+#define PNG_ROW_ADAPTIVE 5
+
+
+/* Interface. */
+extern int pngstrip_filter_id(const char *name);
+extern bool pngstrip_write(const char *filename, const unsigned char *rgb,
+    int w, int h, int level, int filter, int threads);
+
+
+#endif
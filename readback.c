@@ -0,0 +1,183 @@
+/**
+ * readback.c
+ *
+ * Frame k goes into slot k % n. With pixel buffer objects glReadPixels
+ * returns as soon as the copy is queued, and mapping the slot later only
+ * waits if the card hasn't got to it yet, which it will have once n - 1
+ * more frames have been drawn. Frames are given out as RGB rows from the
+ * bottom up, tightly packed, the way glReadPixels leaves them.
+ */
+
+#include "readback.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Sets up a ring of n slots for frames w by h. Returns false, leaving the
+ * ring empty, if the memory could not be found.
+ */
+bool rb_init(readback *r, int w, int h, int n)
+{
+  int i;
+
+  memset(r, 0, sizeof(readback));
+  r->w = w;
+  r->h = h;
+  r->n = n < 1 ? 1 : (n > READBACK_MAX ? READBACK_MAX : n);
+
+  r->use_pbos = gl_has_version(2, 1) ||
+                gl_has_extension("GL_ARB_pixel_buffer_object");
+  if(r->use_pbos)
+  {
+    glGenBuffers(r->n, r->pbos);
+    for(i = 0; i < r->n; i++)
+    {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, w * h * 3, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+  }
+
+  for(i = 0; i < r->n; i++)
+  {
+    r->pixels[i] = malloc(w * h * 3);
+    if(!r->pixels[i])
+    {
+      fprintf(stderr, "ERROR(rb_init): Out of memory.\n");
+      rb_free(r);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Frees the ring's buffers. Frames still pending are lost.
+ */
+void rb_free(readback *r)
+{
+  int i;
+
+  if(r->use_pbos && r->n > 0)
+  {
+    if(r->mapped)
+    {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[r->done % r->n]);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    glDeleteBuffers(r->n, r->pbos);
+  }
+
+  for(i = 0; i < READBACK_MAX; i++)
+  {
+    FREE(r->pixels[i]);
+    r->pixels[i] = NULL;
+  }
+
+  memset(r, 0, sizeof(readback));
+}
+
+
+/**
+ * Starts reading the current read buffer into the next slot. Returns false
+ * if every slot still holds a frame that hasn't been mapped.
+ */
+bool rb_read(readback *r)
+{
+  int slot;
+
+  if(r->n == 0 || r->read - r->done == r->n)
+    return false;
+  slot = r->read % r->n;
+
+  glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  if(r->use_pbos)
+  {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[slot]);
+    glReadPixels(0, 0, r->w, r->h, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  else
+    glReadPixels(0, 0, r->w, r->h, GL_RGB, GL_UNSIGNED_BYTE,
+        r->pixels[slot]);
+  glPopClientAttrib();
+
+  r->read++;
+  return true;
+}
+
+
+/**
+ * Returns the number of frames read but not yet mapped and given back.
+ */
+int rb_pending(readback *r)
+{
+  return r->read - r->done;
+}
+
+
+/**
+ * Maps the oldest pending frame and returns its pixels, which stay valid
+ * until rb_unmap, setting frame to its number if it isn't NULL. Returns
+ * NULL if nothing is pending, or if the frame could not be mapped, in
+ * which case it is dropped.
+ */
+unsigned char *rb_map(readback *r, int *frame)
+{
+  unsigned char *pixels;
+
+  if(r->mapped || r->read == r->done)
+    return NULL;
+
+  if(frame)
+    *frame = r->done;
+
+  if(!r->use_pbos)
+  {
+    r->mapped = true;
+    return r->pixels[r->done % r->n];
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[r->done % r->n]);
+  pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if(!pixels)
+  {
+    fprintf(stderr, "ERROR(rb_map): Unable to map frame %d.\n", r->done);
+    r->done++;
+    return NULL;
+  }
+
+  r->mapped = true;
+  return pixels;
+}
+
+
+/**
+ * Gives the frame from rb_map back to the ring, so its slot can be read
+ * into again.
+ */
+void rb_unmap(readback *r)
+{
+  if(!r->mapped)
+    return;
+
+  if(r->use_pbos)
+  {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbos[r->done % r->n]);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  r->mapped = false;
+  r->done++;
+}
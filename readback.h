@@ -0,0 +1,51 @@
+/**
+ * readback.h
+ *
+ * Reads frames back from the card without waiting for it. A ring holds
+ * room for a few frames; reading one only asks the card to copy the
+ * colour buffer into the next slot, and the pixels are mapped once the
+ * ring has moved on far enough that the copy is long finished. Used for
+ * screenshots and for recording, it keeps the same buffers for every frame
+ * instead of finding memory each time.
+ *
+ * Rings use pixel buffer objects when the driver has them (OpenGL 2.1, or
+ * ARB_pixel_buffer_object), and otherwise read straight into buffers in
+ * memory, which stalls but keeps the same interface.
+ */
+
+#ifndef _READBACK_H_
+#define _READBACK_H_
+
+#include "global.h"
+#include "shader.h"
+
+#define READBACK_MAX 8          /* Most frames a ring can hold. */
+
+
+/**
+ * A ring of frames being read back. Frames are numbered from 0 in the
+ * order they were read, and are always mapped in that order.
+ */
+typedef struct readback
+{
+  int w, h;                     /* Size of every frame read. */
+  int n;                        /* Slots in the ring. */
+  bool use_pbos;
+  GLuint pbos[READBACK_MAX];
+  unsigned char *pixels[READBACK_MAX];  /* Slots when there are no PBOs. */
+  int read;                     /* Frames read so far. */
+  int done;                     /* Frames mapped and given back. */
+  bool mapped;                  /* Whether the oldest frame is mapped. */
+} readback;
+
+
+/* Interface. */
+extern bool rb_init(readback *r, int w, int h, int n);
+extern void rb_free(readback *r);
+extern bool rb_read(readback *r);
+extern int rb_pending(readback *r);
+extern unsigned char *rb_map(readback *r, int *frame);
+extern void rb_unmap(readback *r);
+
+
+#endif
@@ -0,0 +1,522 @@
+/**
+ * record.c
+ *
+ * Reading back a frame with glReadPixels straight into memory makes the
+ * CPU wait until the card has finished drawing it, and writing a PNG takes
+ * longer again, so neither is done while the next frame could be drawing.
+ * Each frame is read into a readback ring of RECORD_PBOS slots, and once
+ * the ring is full the frame read RECORD_PBOS - 1 frames ago, long since
+ * finished, is mapped and copied out. The copy goes to a pool of encoder
+ * threads, which compress and write the files while drawing carries on.
+ * Buffers for frames come from a fixed pool, and when every one is waiting
+ * to be encoded the renderer waits for one to come back, so memory stays
+ * bounded if the disk can't keep up.
+ *
+ * Frames go to numbered PNGs, or one after another into a single Y4M or
+ * raw RGB stream. A stream must get its frames in order, so it has a single
+ * encoder thread, which has far less to do as nothing is compressed.
+ *
+ * Screenshots go through a ring of their own: the frame is read when the
+ * shot is asked for and written out the next frame, so taking one doesn't
+ * stall the card.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "record.h"
+#include "capture.h"
+#include "jobs.h"
+#include "mem.h"
+#include "readback.h"
+#include "video.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Function prototypes. */
+bool record_begin();
+bool record_open();
+bool record_close();
+bool record_write(unsigned char *pixels, int number);
+void *record_encoder(void *data);
+unsigned char *record_take_free();
+void record_push(unsigned char *pixels, int number);
+void record_collect();
+void record_take_shot();
+
+
+int rec_state = 0;              /* 0 not started, 1 recording, -1 failed. */
+int rec_w, rec_h;               /* Size of every frame recorded. */
+int rec_frames = 0;             /* Frames drawn so far. */
+int rec_written = 0;            /* Frames written out so far. */
+bool rec_failed = false;        /* Whether any of the recording was lost. */
+
+readback rec_rb;
+
+/* Where frames go. */
+enum { RECORD_PNG, RECORD_Y4M, RECORD_RAW };
+int rec_sink = RECORD_PNG;
+FILE *rec_out = NULL;           /* The stream, for Y4M and raw. */
+bool rec_piped = false;         /* Whether rec_out is a pipe. */
+unsigned char *rec_yuv = NULL;  /* A frame converted for Y4M. */
+bool rec_write_failed = false;
+
+pthread_t rec_threads[RECORD_MAX_ENCODERS];
+int rec_n_threads = 0;
+
+/* The frame buffers, free or queued up for the encoders in order. */
+unsigned char *rec_buffers[RECORD_BUFFERS];
+unsigned char *rec_free[RECORD_BUFFERS];
+int rec_n_free = 0;
+unsigned char *rec_ready[RECORD_BUFFERS];
+int rec_numbers[RECORD_BUFFERS];
+int rec_ready_head = 0, rec_n_ready = 0;
+bool rec_stopping = false;
+
+readback shot_rb;               /* Empty until the first screenshot. */
+const char *shot_prefix = NULL; /* Set while a screenshot is asked for. */
+bool shot_reading = false;      /* Whether one is being read back. */
+int shot_number = 0;            /* Screenshots written so far. */
+
+pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t rec_free_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t rec_ready_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * Returns the simulated time of the frame about to be drawn, in
+ * milliseconds.
+ */
+int record_time()
+{
+  return (int)((long)rec_frames * 1000 / RECORD_FPS);
+}
+
+
+/**
+ * Sets up the buffers and starts the encoders for frames the size of the
+ * window. Returns false if recording can't be done.
+ */
+bool record_begin()
+{
+  int i, n;
+
+  rec_w = global.ww;
+  rec_h = global.wh;
+
+  for(i = 0; i < RECORD_BUFFERS; i++)
+  {
+    rec_buffers[i] = rec_free[i] = malloc(rec_w * rec_h * 3);
+    if(!rec_buffers[i])
+    {
+      fprintf(stderr, "ERROR(record_begin): Out of memory.\n");
+      while(i--)
+        free(rec_buffers[i]);
+      return false;
+    }
+  }
+  rec_n_free = RECORD_BUFFERS;
+
+  if(!record_open())
+  {
+    for(i = 0; i < RECORD_BUFFERS; i++)
+      free(rec_buffers[i]);
+    return false;
+  }
+
+  if(!rb_init(&rec_rb, rec_w, rec_h, RECORD_PBOS))
+  {
+    record_close();
+    for(i = 0; i < RECORD_BUFFERS; i++)
+      free(rec_buffers[i]);
+    return false;
+  }
+
+  /* Leave a processor for drawing, and keep a stream's frames in order. */
+  n = jobs_cpu_count() - 1;
+  if(n < 1 || rec_sink != RECORD_PNG) n = 1;
+  if(n > RECORD_MAX_ENCODERS) n = RECORD_MAX_ENCODERS;
+
+  rec_stopping = false;
+  for(rec_n_threads = 0; rec_n_threads < n; rec_n_threads++)
+    if(pthread_create(&rec_threads[rec_n_threads], NULL, record_encoder,
+          NULL))
+      break;
+
+  if(rec_n_threads == 0)
+  {
+    fprintf(stderr, "ERROR(record_begin): Unable to start encoders.\n");
+    rb_free(&rec_rb);
+    record_close();
+    for(i = 0; i < RECORD_BUFFERS; i++)
+      free(rec_buffers[i]);
+    return false;
+  }
+
+  if(rec_sink == RECORD_PNG)
+    printf("Recording %dx%d frames to %s####.png with %d encoders.\n",
+        rec_w, rec_h, global.record, rec_n_threads);
+  else
+    printf("Recording %dx%d frames to %s as %s.\n", rec_w, rec_h,
+        global.record, rec_sink == RECORD_Y4M ? "Y4M" : "raw RGB");
+  return true;
+}
+
+
+/**
+ * Works out where frames go from the name given to -record, and opens the
+ * stream if they go to one. A name starting with '|' is a command to pipe
+ * a Y4M stream to, a name ending in .y4m or .rgb is a file to write a Y4M
+ * or raw stream to, and anything else is the prefix of numbered PNGs.
+ * Returns false if the stream could not be opened.
+ */
+bool record_open()
+{
+  const char *name = global.record, *ext = strrchr(name, '.');
+
+  rec_sink = RECORD_PNG;
+  rec_piped = name[0] == '|';
+  rec_write_failed = false;
+  rec_written = 0;
+
+  if(rec_piped || (ext && streq(ext, ".y4m")))
+    rec_sink = RECORD_Y4M;
+  else if(ext && streq(ext, ".rgb"))
+    rec_sink = RECORD_RAW;
+  else
+    return true;
+
+  if(rec_piped)
+  {
+    /* Let a write fail, rather than the program end, if the command quits. */
+    signal(SIGPIPE, SIG_IGN);
+    rec_out = popen(name + 1, "w");
+  }
+  else
+    rec_out = fopen(name, "wb");
+
+  if(!rec_out)
+  {
+    fprintf(stderr, "ERROR(record_open): Unable to open '%s'.\n", name);
+    return false;
+  }
+
+  if(rec_sink == RECORD_Y4M)
+  {
+    rec_yuv = malloc(video_yuv_size(rec_w, rec_h));
+    if(!rec_yuv)
+    {
+      fprintf(stderr, "ERROR(record_open): Out of memory.\n");
+      record_close();
+      return false;
+    }
+    video_y4m_header(rec_out, rec_w, rec_h, RECORD_FPS);
+  }
+
+  return true;
+}
+
+
+/**
+ * Closes the stream, if there is one, waiting for a piped command to
+ * finish. Returns false if the last of the stream could not be written or
+ * the command failed.
+ */
+bool record_close()
+{
+  bool ok = true;
+
+  if(rec_out)
+  {
+    if(rec_piped)
+      ok = pclose(rec_out) == 0;
+    else
+      ok = fclose(rec_out) == 0;
+  }
+  rec_out = NULL;
+
+  FREE(rec_yuv);
+  rec_yuv = NULL;
+
+  return ok;
+}
+
+
+/**
+ * Writes frame number to wherever frames go. Returns false if it could not
+ * be written.
+ */
+bool record_write(unsigned char *pixels, int number)
+{
+  char filename[512];
+
+  switch(rec_sink)
+  {
+    case RECORD_Y4M:
+      video_rgb_to_yuv(rec_yuv, pixels, rec_w, rec_h);
+      return video_y4m_frame(rec_out, rec_yuv, rec_w, rec_h);
+    case RECORD_RAW:
+      return video_rgb_frame(rec_out, pixels, rec_w, rec_h);
+  }
+
+  snprintf(filename, sizeof(filename), "%s%04d.png", global.record,
+      number + 1);
+  return capture_png(filename, pixels, rec_w, rec_h);
+}
+
+
+/**
+ * Encoder thread. Writes frames from the queue until told to stop and the
+ * queue is empty.
+ */
+void *record_encoder(void *data)
+{
+  unsigned char *pixels;
+  int number;
+  bool ok;
+
+  pthread_mutex_lock(&rec_lock);
+  for(;;)
+  {
+    while(rec_n_ready == 0 && !rec_stopping)
+      pthread_cond_wait(&rec_ready_cond, &rec_lock);
+    if(rec_n_ready == 0)
+      break;
+
+    pixels = rec_ready[rec_ready_head];
+    number = rec_numbers[rec_ready_head];
+    rec_ready_head = (rec_ready_head + 1) % RECORD_BUFFERS;
+    rec_n_ready--;
+    pthread_mutex_unlock(&rec_lock);
+
+    ok = record_write(pixels, number);
+
+    pthread_mutex_lock(&rec_lock);
+    if(!ok && !rec_write_failed)
+    {
+      fprintf(stderr, "ERROR(record_encoder): Unable to write frame %d.\n",
+          number + 1);
+      rec_write_failed = true;
+    }
+    if(ok)
+      rec_written++;
+    rec_free[rec_n_free++] = pixels;
+    pthread_cond_signal(&rec_free_cond);
+  }
+  pthread_mutex_unlock(&rec_lock);
+
+  return NULL;
+}
+
+
+/**
+ * Takes a buffer from the pool, waiting for the encoders to give one back
+ * if they are all in use.
+ */
+unsigned char *record_take_free()
+{
+  unsigned char *pixels;
+
+  pthread_mutex_lock(&rec_lock);
+  while(rec_n_free == 0)
+    pthread_cond_wait(&rec_free_cond, &rec_lock);
+  pixels = rec_free[--rec_n_free];
+  pthread_mutex_unlock(&rec_lock);
+
+  return pixels;
+}
+
+
+/**
+ * Queues a frame's pixels for the encoders.
+ */
+void record_push(unsigned char *pixels, int number)
+{
+  int i;
+
+  pthread_mutex_lock(&rec_lock);
+  i = (rec_ready_head + rec_n_ready++) % RECORD_BUFFERS;
+  rec_ready[i] = pixels;
+  rec_numbers[i] = number;
+  pthread_cond_signal(&rec_ready_cond);
+  pthread_mutex_unlock(&rec_lock);
+}
+
+
+/**
+ * Copies the oldest frame out of the readback ring and queues it.
+ */
+void record_collect()
+{
+  unsigned char *pixels, *mapped;
+  int number;
+
+  mapped = rb_map(&rec_rb, &number);
+  if(!mapped)
+    return;
+
+  pixels = record_take_free();
+  memcpy(pixels, mapped, rec_w * rec_h * 3);
+  rb_unmap(&rec_rb);
+  record_push(pixels, number);
+}
+
+
+/**
+ * Asks for the next frame drawn to be saved as <prefix><number>.png,
+ * numbered from 0001 on.
+ */
+void record_shot(const char *prefix)
+{
+  shot_prefix = prefix;
+}
+
+
+/**
+ * Reads the frame just drawn back for a screenshot, or writes out the one
+ * read last frame.
+ */
+void record_take_shot()
+{
+  char filename[512];
+  unsigned char *pixels;
+
+  if(shot_reading)
+  {
+    pixels = rb_map(&shot_rb, NULL);
+    if(pixels)
+    {
+      snprintf(filename, sizeof(filename), "%s%04d.png", shot_prefix,
+          ++shot_number);
+      capture_png(filename, pixels, shot_rb.w, shot_rb.h);
+      rb_unmap(&shot_rb);
+    }
+    shot_reading = false;
+    shot_prefix = NULL;
+    return;
+  }
+
+  if(shot_rb.w != global.ww || shot_rb.h != global.wh)
+  {
+    rb_free(&shot_rb);
+    if(!rb_init(&shot_rb, global.ww, global.wh, 2))
+    {
+      shot_prefix = NULL;
+      return;
+    }
+  }
+
+  shot_reading = rb_read(&shot_rb);
+  if(!shot_reading)
+    shot_prefix = NULL;
+}
+
+
+/**
+ * Records the frame just drawn, before the buffers are swapped. The first
+ * call starts recording at the size of the window.
+ */
+void record_frame()
+{
+  if(shot_prefix)
+    record_take_shot();
+
+  if(!global.record || rec_state < 0)
+    return;
+
+  if(rec_state == 0)
+  {
+    rec_state = record_begin() ? 1 : -1;
+    if(rec_state < 0)
+    {
+      rec_failed = true;
+      global.record = NULL;
+      return;
+    }
+  }
+
+  if(global.ww != rec_w || global.wh != rec_h)
+  {
+    fprintf(stderr, "ERROR(record_frame): The window changed size, "
+        "stopping recording.\n");
+    record_stop();
+    return;
+  }
+
+  rb_read(&rec_rb);
+  rec_frames++;
+
+  /* The oldest frame in a full ring is done by now. */
+  if(rb_pending(&rec_rb) == rec_rb.n)
+    record_collect();
+}
+
+
+/**
+ * Collects the frames still being read back, waits for every frame to be
+ * written and frees everything. Nothing more is recorded after this, and
+ * time goes back to the real clock. A screenshot still being read back is
+ * lost.
+ */
+void record_stop()
+{
+  int i;
+
+  rb_free(&shot_rb);
+  shot_reading = false;
+  shot_prefix = NULL;
+
+  if(rec_state <= 0)
+    return;
+  rec_state = -1;
+
+  while(rb_pending(&rec_rb) > 0)
+    record_collect();
+  rb_free(&rec_rb);
+
+  pthread_mutex_lock(&rec_lock);
+  rec_stopping = true;
+  pthread_cond_broadcast(&rec_ready_cond);
+  pthread_mutex_unlock(&rec_lock);
+
+  for(i = 0; i < rec_n_threads; i++)
+    pthread_join(rec_threads[i], NULL);
+  rec_n_threads = 0;
+  if(!record_close())
+  {
+    fprintf(stderr, "ERROR(record_stop): Unable to finish '%s'.\n",
+        global.record);
+    rec_write_failed = true;
+  }
+
+  for(i = 0; i < RECORD_BUFFERS; i++)
+  {
+    FREE(rec_buffers[i]);
+    rec_buffers[i] = NULL;
+  }
+  rec_n_free = 0;
+
+  if(rec_write_failed || rec_written < rec_frames)
+  {
+    fprintf(stderr, "ERROR(record_stop): Only %d of %d frames were "
+        "written.\n", rec_written, rec_frames);
+    rec_failed = true;
+  }
+  else
+    printf("Recorded %d frames.\n", rec_frames);
+  global.record = NULL;
+}
+
+
+/**
+ * Returns true if recording could not start or any frame drawn was not
+ * written, even after recording has stopped.
+ */
+bool record_failed()
+{
+  return rec_failed;
+}
@@ -0,0 +1,41 @@
+/**
+ * record.h
+ *
+ * Records every frame drawn, started from the command line with
+ *
+ *   robot -record <prefix> ...        numbered PNG files
+ *   robot -record <file>.y4m ...      a Y4M video stream
+ *   robot -record <file>.rgb ...      a raw RGB video stream
+ *   robot -record '|<command>' ...    a Y4M stream piped to a command
+ *
+ * While recording the world moves on by exactly 1 / RECORD_FPS of a
+ * second each frame, whatever the real time taken, and the random seed is
+ * fixed, so the same options always give the same frames. It goes well
+ * with -headless to render a set number of frames on a machine without a
+ * display.
+ *
+ * Screenshots are taken the same way, a frame late, without holding up
+ * drawing while the card catches up.
+ */
+
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include "global.h"
+
+#define RECORD_FPS          30  /* Simulated frames a second. */
+#define RECORD_SEED    3081491  /* Random seed used while recording. */
+#define RECORD_PBOS          3  /* Frames being read back at once. */
+#define RECORD_BUFFERS      12  /* Frames waiting for or being encoded. */
+#define RECORD_MAX_ENCODERS  8  /* Most encoder threads. */
+
+
+/* Interface. */
+extern void record_frame();
+extern void record_stop();
+extern bool record_failed();
+extern void record_shot(const char *prefix);
+extern int record_time();
+
+
+#endif
@@ -0,0 +1,384 @@
+/**
+ * render.c
+ *
+ * The render queue. Items are added with a sort key made up, from the most
+ * significant end, of the pass, the kind of item (and so the shader), the
+ * texture and the mesh. After sorting, a pass is flushed by walking its run
+ * of items and only binding a texture, program or set of vertex arrays when
+ * it differs from the last item's.
+ *
+ * Matrices and skinning palettes live in one float arena that is reused
+ * every frame. Items refer to them by offset, since the arena moves when it
+ * grows.
+ */
+
+#include "render.h"
+#include "cull.h"
+#include "mem.h"
+#include "pipeline.h"
+#include "shader.h"
+#include "skin.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * One thing to draw. texture is -1 if the item doesn't care what is bound,
+ * as for shadows. seq keeps items with equal keys in the order they were
+ * added, which matters for blended grass.
+ */
+typedef struct rq_item
+{
+  unsigned long long key;
+  int seq;
+
+  int kind;
+  int texture;
+  void *mesh;                   /* bone for RQ_MESH, skin_mesh for RQ_SKIN. */
+  int list;                     /* Display list for RQ_LIST. */
+
+  int matrix;                   /* Offset of the model matrix in the arena. */
+  int palette;                  /* Offset of the skinning palette, or -1. */
+} rq_item;
+
+
+/* Function prototypes. */
+bool rq_reserve(int items, int floats);
+int rq_alloc(int floats);
+rq_item *rq_push(int pass, int kind, int texture, void *mesh, int id);
+int rq_compare(const void *a, const void *b);
+
+
+rq_item *rq_items = NULL;
+int rq_count = 0;
+int rq_cap = 0;
+
+float *rq_arena = NULL;
+int rq_arena_used = 0;
+int rq_arena_cap = 0;
+
+
+/**
+ * Frees the queue.
+ */
+void rq_cleanup()
+{
+  FREE(rq_items);
+  FREE(rq_arena);
+  rq_items = NULL;
+  rq_arena = NULL;
+  rq_count = rq_cap = 0;
+  rq_arena_used = rq_arena_cap = 0;
+}
+
+
+/**
+ * Empties the queue ready to collect a new frame.
+ */
+void rq_begin()
+{
+  rq_count = 0;
+  rq_arena_used = 0;
+}
+
+
+/**
+ * Makes room in the queue for at least items more items and floats more
+ * floats in the arena. Returns false if the memory could not be found.
+ */
+bool rq_reserve(int items, int floats)
+{
+  rq_item *new_items;
+  float *arena;
+  int cap;
+
+  if(rq_count + items > rq_cap)
+  {
+    cap = rq_cap ? rq_cap : RQ_START_ITEMS;
+    while(cap < rq_count + items)
+      cap *= 2;
+
+    new_items = realloc(rq_items, sizeof(rq_item) * cap);
+    if(!new_items) return false;
+    rq_items = new_items;
+    rq_cap = cap;
+  }
+
+  if(rq_arena_used + floats > rq_arena_cap)
+  {
+    cap = rq_arena_cap ? rq_arena_cap : RQ_START_FLOATS;
+    while(cap < rq_arena_used + floats)
+      cap *= 2;
+
+    arena = realloc(rq_arena, sizeof(float) * cap);
+    if(!arena) return false;
+    rq_arena = arena;
+    rq_arena_cap = cap;
+  }
+
+  return true;
+}
+
+
+/**
+ * Takes floats floats from the arena, which must have been reserved.
+ * Returns their offset.
+ */
+int rq_alloc(int floats)
+{
+  int offset = rq_arena_used;
+
+  rq_arena_used += floats;
+  return offset;
+}
+
+
+/**
+ * Adds an item to the queue, which must have room for it. id stands in for
+ * the mesh in the sort key.
+ */
+rq_item *rq_push(int pass, int kind, int texture, void *mesh, int id)
+{
+  rq_item *it = &rq_items[rq_count];
+
+  it->key = (unsigned long long)pass << 60 |
+            (unsigned long long)kind << 56 |
+            (unsigned long long)((texture + 1) & 0xffff) << 40 |
+            (unsigned long long)(id & 0xffffff) << 16;
+  it->seq     = rq_count++;
+  it->kind    = kind;
+  it->texture = texture;
+  it->mesh    = mesh;
+  it->list    = 0;
+  it->matrix  = 0;
+  it->palette = -1;
+
+  return it;
+}
+
+
+/**
+ * Queues a model placed at pos and posed by the flat rotations in pose, as
+ * for draw_model_pose, in each pass set in passes with RQ_BIT. Each bone
+ * mesh becomes an item of its own, unless the model is being skinned, when
+ * the whole model is one item. The passes share the same matrices. With
+ * culling on, bone meshes that can't be seen in a pass are left out of it.
+ */
+void rq_add_model(model *mdl, float *pos, float *pose, int passes)
+{
+  skin_mesh *skin = global.r_skinned ? mdl->skin : NULL;
+  int items = 2 * (skin ? 1 : mdl->n_bones);
+  int mats, pass, i;
+  float m[16], c[3], *out;
+  rq_item *it;
+  bone *b;
+
+  if(!rq_reserve(items, 16 * (mdl->n_bones + 1)))
+  {
+    fprintf(stderr, "ERROR(rq_add_model): Out of memory.\n");
+    return;
+  }
+
+  model_matrix(pos, m);
+
+  if(skin)
+  {
+    mats = rq_alloc(16);
+    memcpy(rq_arena + mats, m, sizeof(m));
+
+    i = rq_alloc(16 * skin->n_bones);
+    skin_palette(skin, mdl->root, pose, rq_arena + i);
+
+    for(pass = RQ_PASS_SHADOW; pass <= RQ_PASS_MODELS; pass++)
+    {
+      if(!(passes & RQ_BIT(pass)))
+        continue;
+
+      it = rq_push(pass, RQ_SKIN, pass == RQ_PASS_SHADOW ? -1 : mdl->texture,
+          skin, skin->vbo);
+      it->matrix  = mats;
+      it->palette = i;
+    }
+    return;
+  }
+
+  /* The bone matrices come out in bone_array order. */
+  mats = rq_alloc(16 * mdl->n_bones);
+  out  = rq_arena + mats;
+  skel_pose_matrices(mdl->root, pose ? &pose : NULL, m, &out, 16);
+
+  for(i = 0; i < mdl->n_bones; i++)
+  {
+    b = mdl->bone_array[i];
+    if(!b->geometry)
+      continue;
+
+    m4_point(c, rq_arena + mats + i * 16, b->bound);
+
+    for(pass = RQ_PASS_SHADOW; pass <= RQ_PASS_MODELS; pass++)
+    {
+      if(!(passes & RQ_BIT(pass)))
+        continue;
+
+      if(global.r_cull &&
+         (pass == RQ_PASS_SHADOW ? cull_shadow(c, b->bound[3]) :
+                                   cull_sphere(c, b->bound[3])))
+      {
+        global.culled_meshes++;
+        continue;
+      }
+
+      it = rq_push(pass, RQ_MESH, pass == RQ_PASS_SHADOW ? -1 : mdl->texture,
+          b, b->vbo ? (int)b->vbo : (int)((size_t)b >> 4));
+      it->matrix = mats + i * 16;
+    }
+  }
+}
+
+
+/**
+ * Queues a display list to be drawn in a pass with the matrix m and a
+ * texture, or -1 for whatever is bound.
+ */
+void rq_add_list(int pass, int texture, int list, float m[16])
+{
+  rq_item *it;
+
+  if(!rq_reserve(1, 16))
+  {
+    fprintf(stderr, "ERROR(rq_add_list): Out of memory.\n");
+    return;
+  }
+
+  it = rq_push(pass, RQ_LIST, texture, NULL, list);
+  it->list   = list;
+  it->matrix = rq_alloc(16);
+  memcpy(rq_arena + it->matrix, m, sizeof(float) * 16);
+}
+
+
+/**
+ * Orders items by key, then by the order they were added.
+ */
+int rq_compare(const void *a, const void *b)
+{
+  const rq_item *i0 = a, *i1 = b;
+
+  if(i0->key != i1->key)
+    return i0->key < i1->key ? -1 : 1;
+  return i0->seq - i1->seq;
+}
+
+
+/**
+ * Sorts everything queued. Done once a frame, before any pass is flushed.
+ */
+void rq_sort()
+{
+  if(rq_count > 1)
+    qsort(rq_items, rq_count, sizeof(rq_item), rq_compare);
+}
+
+
+/**
+ * Draws every item queued in a pass. Everything else about the pass, such
+ * as lighting or the stencil, is left to the caller, and the current
+ * modelview matrix is taken as the view the item matrices are placed in.
+ */
+void rq_flush(int pass)
+{
+  GLenum mode = global.r_wire ? GL_LINES : GL_TRIANGLES;
+  float view[16], mv[16];
+  skin_mesh *skin = NULL;
+  bone *mesh = NULL;
+  int texture = -1;
+  bool piped;
+  rq_item *it;
+  int i;
+
+  glGetFloatv(GL_MODELVIEW_MATRIX, view);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+  /* The grass lists set up their own texturing as they go. */
+  piped = pass != RQ_PASS_GRASS && pipe_begin();
+
+  for(i = 0; i < rq_count; i++)
+  {
+    it = &rq_items[i];
+    if((int)(it->key >> 60) != pass)
+      continue;
+
+    if(it->texture >= 0 && it->texture != texture)
+    {
+      glBindTexture(GL_TEXTURE_2D, it->texture);
+      texture = it->texture;
+      global.state_changes++;
+    }
+
+    /* Leaving the skinning shader puts the arrays back as they were. */
+    if(skin && it->mesh != skin)
+    {
+      skin_end(skin);
+      skin = NULL;
+      mesh = NULL;
+      global.state_changes++;
+      if(piped)
+        pipe_begin();
+    }
+
+    m4_mul(mv, view, rq_arena + it->matrix);
+    glLoadMatrixf(mv);
+
+    switch(it->kind)
+    {
+      case RQ_MESH:
+        if(it->mesh != mesh)
+        {
+          mesh = it->mesh;
+          if(mesh->vbo && global.r_vbos)
+          {
+            glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+            pipe_arrays(NULL, 8, 5, 2, 0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+          }
+          else
+            pipe_arrays(mesh->geometry, 8, 5, 2, 0);
+          global.state_changes++;
+        }
+
+        /* Client arrays are sent over again with every draw. */
+        if(!mesh->vbo || !global.r_vbos)
+          global.upload_bytes += sizeof(float) * 8 * mesh->tri_count;
+
+        pipe_update();
+        glDrawArrays(mode, 0, mesh->tri_count);
+        global.draw_calls++;
+        break;
+
+      case RQ_SKIN:
+        if(!skin)
+        {
+          skin = it->mesh;
+          skin_begin(skin);
+          global.state_changes++;
+        }
+        skin_submit(skin, rq_arena + it->palette);
+        break;
+
+      case RQ_LIST:
+        glCallList(it->list);
+        break;
+    }
+  }
+
+  if(skin)
+    skin_end(skin);
+  if(piped)
+    pipe_end();
+
+  glPopClientAttrib();
+  glLoadMatrixf(view);
+}
@@ -0,0 +1,46 @@
+/**
+ * render.h
+ *
+ * A queue of things to draw, collected over a frame and then sorted so that
+ * everything sharing a pass, shader, texture and mesh is drawn together.
+ * Each item carries its own matrix, so nothing is pushed or popped between
+ * items and state is only touched when the next item needs something
+ * different. Every state change made is counted in global.state_changes.
+ */
+
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include "global.h"
+#include "3d.h"
+
+#define RQ_START_ITEMS 256      /* Items a new queue has room for. */
+#define RQ_START_FLOATS 4096    /* Floats of matrices it has room for. */
+
+/* Passes, drawn in this order. */
+enum {
+  RQ_PASS_SHADOW,
+  RQ_PASS_MODELS,
+  RQ_PASS_GRASS
+};
+
+#define RQ_BIT(pass) (1 << (pass))
+
+/* Kinds of item, which is also the shader they are drawn with. */
+enum {
+  RQ_MESH,                      /* A bone mesh, fixed function. */
+  RQ_LIST,                      /* A display list, fixed function. */
+  RQ_SKIN                       /* A skinned mesh, skinning shader. */
+};
+
+
+/* Interface. */
+extern void rq_cleanup();
+extern void rq_begin();
+extern void rq_add_model(model *mdl, float *pos, float *pose, int passes);
+extern void rq_add_list(int pass, int texture, int list, float m[16]);
+extern void rq_sort();
+extern void rq_flush(int pass);
+
+
+#endif
@@ -26,13 +26,19 @@
 #include "global.h"
 #include "3d.h"
 #include "load_mdl.h"
-#include "capture.h"
 #include "drawing.h"
 #include "camera.h"
 #include "editor.h"
 #include "util.h"
 #include "flight.h"
 #include "util.h"
+#include "jobs.h"
+#include "bench.h"
+#include "sim.h"
+#include "headless.h"
+#include "record.h"
+#include "capture.h"
+#include "pngstrip.h"
 
 
 /* Enumerations for menu constants. */
@@ -51,7 +57,17 @@ enum {
 enum {
   RM_TEXTURE,
   RM_WIRE,
-  RM_SHADING
+  RM_SHADING,
+  RM_INSTANCED,
+  RM_SKINNED,
+  RM_VBOS,
+  RM_QUEUE,
+  RM_CULL,
+  RM_GRASS_BATCH,
+  RM_SHADOW_MAP,
+  RM_BLOB_SHADOWS,
+  RM_IMPOSTORS,
+  RM_GLSL
 };
 
 enum {
@@ -64,6 +80,28 @@ enum {
 model *bird; /* Only used in solo mode now. */
 
 
+/* Function prototypes. */
+void update_world(int now, float passed);
+int elapsed();
+int run_headless();
+unsigned char *check_draw(bool glsl);
+bool check_pipeline(const char *name);
+bool run_check();
+
+
+/**
+ * Returns the milliseconds since the program started drawing, from GLUT or
+ * from the headless backend's clock, or the simulated time of the frame
+ * when recording.
+ */
+int elapsed()
+{
+  if(global.record)
+    return record_time();
+  return global.headless ? headless_clock() : glutGet(GLUT_ELAPSED_TIME);
+}
+
+
 /**
  * Init function initialises the program and performs all operations
  * required for the program to execute.
@@ -76,11 +114,12 @@ void init(void)
   float mat_amb_diff[] = {0.6, 0.6, 0.6, 1.0};
   float white_light[]  = {1.0, 1.0, 0.9, 1.0};
   float lmodel_amb[]   = {0.4, 0.4, 0.4, 1.0};
-  int now = glutGet(GLUT_ELAPSED_TIME);
+  int now = elapsed();
   camera *cam;
 
-  /* Init random seed to the current time. */
-  srand(time(0));
+  /* Init random seed to the current time, or a fixed one when recording so
+   * the same frames come out every time. */
+  srand(global.record ? RECORD_SEED : time(0));
 
   /* OpenGL initialization. */
   printf("Setting up OpenGL variables ... ");
@@ -120,7 +159,14 @@ void init(void)
   global.r_ground   =  true;
   global.bb_grass   =  true;
   global.r_fps      =  true;
-  global.world_size = 512.0;
+  global.r_instanced = true;
+  global.r_vbos     =  true;
+  global.r_queue    =  true;
+  global.r_cull     =  true;
+  global.r_grass_batch = true;
+  global.r_shadow_map = true;
+  global.r_blob_shadows = true;
+  global.r_impostors = true;
   printf("done\n");
 
   /* Global camera instance. */
@@ -142,6 +188,10 @@ void init(void)
   /* Initialise drawing functions. */
   draw_init();
 
+  /* Start the worker threads used for per-frame updates. */
+  jobs_init(global.n_threads);
+  printf("Updating with %d threads.\n", jobs_threads());
+
   /* Set global variables depending on world mode. */
   switch(global.world_mode)
   {
@@ -169,9 +219,21 @@ void init(void)
     case WORLD_MODE_EDITOR:
       printf("Setting up editor ... ");
       edit_init();
-      glutKeyboardFunc(edit_keyboard);
+      if(!global.headless)
+        glutKeyboardFunc(edit_keyboard);
+
+      /* The editor changes bones directly from the keyboard so it always
+       * simulates in step with drawing. */
+      global.sim_thread = false;
       break;
   }
+
+  /* Recording steps the world once a frame, in step with drawing. */
+  if(global.record)
+    global.sim_thread = false;
+
+  if(global.sim_thread)
+    sim_start(update_world, SIM_TICK_MS, now);
 }
 
 
@@ -212,32 +274,12 @@ int jump_time = 0;
 
 
 /**
- * Main processing function in the program. These commands are executed once
- * every frame.
+ * Moves the world on to the time now, passed seconds after the last update.
+ * Called every frame from idle, or on the simulation thread at a fixed
+ * rate when it is running.
  */
-void idle()
+void update_world(int now, float passed)
 {
-  /* Time constants used to track the period of time that has elapsed between
-   * now and the previous frame.  */
-  static int last = 0;
-  static int frames = 0;
-  static int frame_time = 0;
-  int now = glutGet(GLUT_ELAPSED_TIME);
-  float passed = (now - last) / 1000.0F;
-  int error;
-
-  /* Update FPS Counter. */
-  frames++;
-  frame_time += (now - last);
-  if(frame_time > 1000)
-  {
-    global.fps = frames / ((float)frame_time / 1000.0);
-    frame_time = frames = 0;
-    sprintf(global.fps_str, "FPS: %.1f", global.fps);
-  }
-
-  cam_update(passed, now);
-  
   switch(global.world_mode)
   {
     case WORLD_MODE_NORMAL:
@@ -253,7 +295,7 @@ void idle()
           bird->pos[1] = 20.0 * sin(2 * MY_PI * jump_time
               / (JUMP_LEN - 200) * 0.5);
 
-        jump_time += now - last;
+        jump_time += (int)(passed * 1000.0 + 0.5);
       }
       break;
 
@@ -265,11 +307,51 @@ void idle()
       flight_update(now);
       break;
   }
+}
+
+
+/**
+ * Main processing function in the program. These commands are executed once
+ * every frame.
+ */
+void idle()
+{
+  /* Time constants used to track the period of time that has elapsed between
+   * now and the previous frame.  */
+  static int last = 0;
+  static int frames = 0;
+  static int frame_time = 0;
+  int now = elapsed();
+  float passed = (now - last) / 1000.0F;
+  int error;
+
+  /* Update FPS Counter. */
+  frames++;
+  frame_time += (now - last);
+  if(frame_time > 1000)
+  {
+    global.fps = frames / ((float)frame_time / 1000.0);
+    frame_time = frames = 0;
+    sprintf(global.fps_str, "FPS: %.1f Draws: %d Sent: %dKB States: %d",
+        global.fps, global.draw_calls, global.upload_bytes / 1024,
+        global.state_changes);
+    sprintf(global.cull_str, "Culled: %d models %d meshes %d grass",
+        global.culled_models, global.culled_meshes, global.culled_grass);
+    sprintf(global.lod_str, "Shadows: %d whole %d blobs Impostors: %d",
+        global.shadow_models, global.shadow_blobs, global.impostors);
+  }
+
+  cam_update(passed, now);
+
+  /* With a simulation thread the world moves on by itself. */
+  if(!global.sim_thread)
+    update_world(now, passed);
 
   if((error = glGetError()))
     printf("GL Error: %s\n", gluErrorString(error));
 
-  glutPostRedisplay();
+  if(!global.headless)
+    glutPostRedisplay();
   last = now;
 }
 
@@ -284,6 +366,9 @@ void cleanup()
   camera *cam = cam_get();
   free(cam);
 
+  record_stop();
+  sim_stop();
+
   draw_cleanup();
 
   if(global.world_mode == WORLD_MODE_FLIGHT)
@@ -291,6 +376,8 @@ void cleanup()
 
   if(global.world_mode == WORLD_MODE_EDITOR)
     edit_cleanup();
+
+  jobs_shutdown();
 }
 
 
@@ -317,14 +404,14 @@ void main_menu(int value)
       R_TGL(bb_grass);
       break;
     case MM_RANDOMIZE_GRASS:
-      gen_grass(GRASS_COUNT, global.world_size, GRASS_ROT, GRASS_SIZE);
+      gen_grass(global.grass_count, global.world_size, GRASS_ROT, GRASS_SIZE);
       break;
     case MM_EXIT:
       cleanup();
-      exit(0);
+      exit(record_failed() ? EXIT_FAILURE : EXIT_SUCCESS);
       break;
     case MM_SCREENSHOT:
-      captureFrame("Screenshot");
+      record_shot("Screenshot");
       break;
   }
 }
@@ -351,6 +438,36 @@ void render_menu(int value)
         glShadeModel(GL_SMOOTH);
       R_TGL(r_shading);
       break;
+    case RM_INSTANCED:
+      R_TGL(r_instanced);
+      break;
+    case RM_SKINNED:
+      R_TGL(r_skinned);
+      break;
+    case RM_VBOS:
+      R_TGL(r_vbos);
+      break;
+    case RM_QUEUE:
+      R_TGL(r_queue);
+      break;
+    case RM_CULL:
+      R_TGL(r_cull);
+      break;
+    case RM_GRASS_BATCH:
+      R_TGL(r_grass_batch);
+      break;
+    case RM_SHADOW_MAP:
+      R_TGL(r_shadow_map);
+      break;
+    case RM_BLOB_SHADOWS:
+      R_TGL(r_blob_shadows);
+      break;
+    case RM_IMPOSTORS:
+      R_TGL(r_impostors);
+      break;
+    case RM_GLSL:
+      R_TGL(r_glsl);
+      break;
   }
 }
 
@@ -386,6 +503,15 @@ void special_keys(int key, int mx, int my)
     case GLUT_KEY_F8:
       main_menu(MM_T_FPS);
       break;
+    case GLUT_KEY_F9:
+      render_menu(RM_INSTANCED);
+      break;
+    case GLUT_KEY_F10:
+      render_menu(RM_SKINNED);
+      break;
+    case GLUT_KEY_F11:
+      render_menu(RM_VBOS);
+      break;
     case GLUT_KEY_F12:
       main_menu(MM_SCREENSHOT);
       break;
@@ -399,7 +525,9 @@ void special_keys(int key, int mx, int my)
  */
 void anim_menu(int value)
 {
-  int now = glutGet(GLUT_ELAPSED_TIME);
+  int now = elapsed();
+
+  sim_lock();
   start_animation(bird, value, now + 50);
   jumping = false;
 
@@ -418,6 +546,7 @@ void anim_menu(int value)
       jump_time = 0;
       break;
   }
+  sim_unlock();
 }
 
 
@@ -429,13 +558,27 @@ void anim_menu(int value)
  */
 void keyboard (unsigned char key, int x, int y)
 {
-  int now = glutGet(GLUT_ELAPSED_TIME);
+  int now = elapsed();
 
   switch(key)
   {
     case ' ':
       if(global.world_mode == WORLD_MODE_FLIGHT)
+      {
+        sim_lock();
         flight_add_bird(now);
+        sim_unlock();
+      }
+      break;
+
+    case 8:
+    case 127:
+      if(global.world_mode == WORLD_MODE_FLIGHT)
+      {
+        sim_lock();
+        flight_remove_bird();
+        sim_unlock();
+      }
       break;
 
     case 'w':
@@ -452,7 +595,8 @@ void keyboard (unsigned char key, int x, int y)
       break;
 
     case 27:
-      exit(0);
+      cleanup();
+      exit(record_failed() ? EXIT_FAILURE : EXIT_SUCCESS);
       break;
   }
 
@@ -485,6 +629,158 @@ void keyboard_up(unsigned char key, int mx, int my)
 }
 
 
+/**
+ * Draws global.headless frames offscreen, with no window or display server,
+ * through the same update and drawing as the GLUT loop, and prints how long
+ * they took.
+ */
+int run_headless()
+{
+  int i, start, ms;
+  bool ok;
+
+  if(!headless_init(HEADLESS_WIDTH, HEADLESS_HEIGHT))
+    return EXIT_FAILURE;
+
+  init();
+  reshape(HEADLESS_WIDTH, HEADLESS_HEIGHT);
+
+  /* Timed by the real clock, as elapsed() is simulated when recording. */
+  start = headless_clock();
+  for(i = 0; i < global.headless; i++)
+  {
+    idle();
+    draw_scene();
+  }
+  glFinish();
+  ms = headless_clock() - start;
+
+  printf("Drew %d frames in %d ms, %.2f ms a frame (%.1f FPS).\n",
+      global.headless, ms, (float)ms / global.headless,
+      ms > 0 ? global.headless * 1000.0 / ms : 0.0);
+  printf("Last frame: %d draws, %dKB sent, %d state changes.\n",
+      global.draw_calls, global.upload_bytes / 1024, global.state_changes);
+
+  /* Frames drawn for the check aren't part of any recording. */
+  ok = true;
+  if(global.check >= 0)
+  {
+    record_stop();
+    ok = run_check();
+  }
+
+  cleanup();
+  headless_cleanup();
+  return ok && !record_failed() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * Draws the frame as it stands, through the GLSL pipeline or not, and
+ * returns a copy of it read back, or NULL if there is no memory for it.
+ */
+unsigned char *check_draw(bool glsl)
+{
+  unsigned char *pixels = malloc(global.ww * global.wh * 3);
+
+  if(!pixels)
+  {
+    fprintf(stderr, "ERROR(check_draw): Out of memory.\n");
+    return NULL;
+  }
+
+  global.r_glsl = glsl;
+  draw_scene();
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, global.ww, global.wh, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+  return pixels;
+}
+
+
+/**
+ * Draws the same frame with and without the GLSL pipeline and compares
+ * them. Returns false if any pixel differs by more than global.check in
+ * any channel.
+ */
+bool check_pipeline(const char *name)
+{
+  unsigned char *fixed, *glsl;
+  int i, j, diff, worst = 0, over = 0, n = global.ww * global.wh;
+
+  fixed = check_draw(false);
+  glsl  = check_draw(true);
+  if(!fixed || !glsl)
+  {
+    free(fixed);
+    free(glsl);
+    return false;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    diff = 0;
+    for(j = 0; j < 3; j++)
+      if(abs(fixed[i * 3 + j] - glsl[i * 3 + j]) > diff)
+        diff = abs(fixed[i * 3 + j] - glsl[i * 3 + j]);
+    if(diff > worst)
+      worst = diff;
+    if(diff > global.check)
+      over++;
+  }
+
+  printf("%-16s %8d pixels over, worst %3d: %s\n", name, over, worst,
+      over ? "FAILED" : "ok");
+
+  free(fixed);
+  free(glsl);
+  return over == 0;
+}
+
+
+/**
+ * Checks the GLSL pipeline draws the frame just drawn the same as the
+ * fixed function pipeline, textured, untextured, flat shaded, in
+ * wireframe and with each kind of shadow. Returns false if any differ.
+ */
+bool run_check()
+{
+  bool ok = true, glsl = global.r_glsl, map = global.r_shadow_map;
+  bool skinned = global.r_skinned;
+
+  printf("Comparing the GLSL and fixed function pipelines, allowing %d.\n",
+      global.check);
+
+  ok = check_pipeline("textured") && ok;
+
+  global.r_shadow_map = !map;
+  ok = check_pipeline(map ? "flat shadows" : "shadow maps") && ok;
+  global.r_shadow_map = map;
+
+  global.r_texture = false;
+  ok = check_pipeline("untextured") && ok;
+  global.r_texture = true;
+
+  glShadeModel(GL_FLAT);
+  ok = check_pipeline("flat shaded") && ok;
+  glShadeModel(GL_SMOOTH);
+
+  global.r_wire = true;
+  ok = check_pipeline("wireframe") && ok;
+  global.r_wire = false;
+
+  /* Instanced and skinned birds are drawn by shaders of their own, so
+   * turn them off to draw every bird through the pipeline too. */
+  global.r_instanced = global.r_skinned = false;
+  ok = check_pipeline("bone meshes") && ok;
+  global.r_instanced = true;
+  global.r_skinned = skinned;
+
+  global.r_glsl = glsl;
+  return ok;
+}
+
+
 /**
  * The main entry point of the program. Sets our world mode, sets up GLUT
  * and our menu system and gets the ball rolling.
@@ -495,6 +791,12 @@ int main(int argc, char** argv)
 
   /* Work out command line arguments. */
   global.world_mode = WORLD_MODE_NORMAL;
+  global.pack_tol   = PACK_TOLERANCE;
+  global.grass_count = GRASS_COUNT;
+  global.world_size = 512.0;
+  global.shadow_lod = SHADOW_LOD;
+  global.imp_lod    = IMPOSTOR_LOD;
+  global.check      = -1;
   for(i = 0; i < argc; i++)
   {
     if(argv[i][0] == '-')
@@ -503,9 +805,53 @@ int main(int argc, char** argv)
         global.world_mode = WORLD_MODE_EDITOR;
       else if(streq(argv[i] + 1, "f"))
         global.world_mode = WORLD_MODE_FLIGHT;
+      else if(streq(argv[i] + 1, "b"))
+        global.flocking = true;
+      else if(streq(argv[i] + 1, "c"))
+        global.pack_anims = true;
+      else if(streq(argv[i] + 1, "ct") && i + 1 < argc)
+      {
+        global.pack_anims = true;
+        global.pack_tol = atof(argv[++i]);
+      }
+      else if(streq(argv[i] + 1, "t"))
+        global.sim_thread = true;
+      else if(streq(argv[i] + 1, "s"))
+        global.r_skinned = true;
+      else if(streq(argv[i] + 1, "p"))
+        global.r_glsl = true;
+      else if(streq(argv[i] + 1, "j") && i + 1 < argc)
+        global.n_threads = atoi(argv[++i]);
+      else if(streq(argv[i] + 1, "g") && i + 1 < argc)
+        global.grass_count = atoi(argv[++i]);
+      else if(streq(argv[i] + 1, "d") && i + 1 < argc)
+        global.grass_density = atoi(argv[++i]);
+      else if(streq(argv[i] + 1, "w") && i + 1 < argc)
+        global.world_size = atof(argv[++i]);
+      else if(streq(argv[i] + 1, "l") && i + 1 < argc)
+        global.shadow_lod = atof(argv[++i]);
+      else if(streq(argv[i] + 1, "i") && i + 1 < argc)
+        global.imp_lod = atof(argv[++i]);
+      else if(streq(argv[i] + 1, "record") && i + 1 < argc)
+        global.record = argv[++i];
+      else if(streq(argv[i] + 1, "png") && i + 3 < argc)
+      {
+        capture_options(atoi(argv[i + 1]), pngstrip_filter_id(argv[i + 2]),
+            atoi(argv[i + 3]));
+        i += 3;
+      }
+      else if(streq(argv[i] + 1, "headless") && i + 1 < argc)
+        global.headless = atoi(argv[++i]);
+      else if(streq(argv[i] + 1, "check") && i + 1 < argc)
+        global.check = atoi(argv[++i]);
+      else if(streq(argv[i] + 1, "bench"))
+        return bench_run(argv[i + 1], argc - i - 2, argv + i + 2);
     }
   }
 
+  if(global.headless > 0)
+    return run_headless();
+
   /* GLUT initialization. */
   glutInit(&argc, argv);
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL);
@@ -530,6 +876,16 @@ int main(int argc, char** argv)
   glutAddMenuEntry("Toggle Textured", RM_TEXTURE);
   glutAddMenuEntry("Toggle Wire-Frame", RM_WIRE);
   glutAddMenuEntry("Toogle Shading", RM_SHADING);
+  glutAddMenuEntry("Toggle Instancing", RM_INSTANCED);
+  glutAddMenuEntry("Toggle Skinning", RM_SKINNED);
+  glutAddMenuEntry("Toggle Vertex Buffers", RM_VBOS);
+  glutAddMenuEntry("Toggle Render Queue", RM_QUEUE);
+  glutAddMenuEntry("Toggle Culling", RM_CULL);
+  glutAddMenuEntry("Toggle Grass Batching", RM_GRASS_BATCH);
+  glutAddMenuEntry("Toggle Shadow Maps", RM_SHADOW_MAP);
+  glutAddMenuEntry("Toggle Blob Shadows", RM_BLOB_SHADOWS);
+  glutAddMenuEntry("Toggle Impostors", RM_IMPOSTORS);
+  glutAddMenuEntry("Toggle GLSL Pipeline", RM_GLSL);
 
   if(global.world_mode == WORLD_MODE_NORMAL)
   {
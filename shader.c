@@ -0,0 +1,334 @@
+/**
+ * shader.c
+ *
+ * Compiles and links GLSL programs and checks what the OpenGL driver can do.
+ * Errors are printed with the driver's log and reported by returning 0, so
+ * callers can carry on with the fixed function pipeline instead.
+ */
+
+#include "shader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Function prototypes. */
+GLuint shader_compile(const char *name, GLenum type, const char **srcs,
+    int n);
+GLuint shader_link(const char *name, GLuint vs, GLuint fs,
+    const char **attribs, int first);
+void shader_log(const char *name, GLuint obj, bool program);
+bool gl_core_profile();
+
+
+/**
+ * Put in front of every vertex shader. light_sun colours a vertex with the
+ * eye space normal n the same way the fixed function pipeline lights it by
+ * light 0, the sun, or passes the colour through if lit is off.
+ */
+const char *shader_vert_prelude =
+  "#version 120\n"
+  "uniform bool lit;\n"
+  "void light_sun(vec3 n)\n"
+  "{\n"
+  "  vec3 h = normalize(gl_LightSource[0].halfVector.xyz);\n"
+  "  float d, s;\n"
+  "\n"
+  "  if(!lit)\n"
+  "  {\n"
+  "    gl_FrontColor = gl_Color;\n"
+  "    gl_FrontSecondaryColor = vec4(0.0);\n"
+  "    return;\n"
+  "  }\n"
+  "\n"
+  "  d = max(dot(n, normalize(gl_LightSource[0].position.xyz)), 0.0);\n"
+  "  s = d > 0.0 ? pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess)\n"
+  "              : 0.0;\n"
+  "\n"
+  "  gl_FrontColor = gl_FrontLightModelProduct.sceneColor +\n"
+  "                  gl_FrontLightProduct[0].ambient +\n"
+  "                  gl_FrontLightProduct[0].diffuse * d;\n"
+  "  gl_FrontColor.a = gl_FrontMaterial.diffuse.a;\n"
+  "  gl_FrontSecondaryColor = gl_FrontLightProduct[0].specular * s;\n"
+  "}\n";
+
+const char *shader_frag_prelude =
+  "#version 120\n";
+
+/**
+ * Put after the #version line of the shaders built by shader_build_core,
+ * which only use uniforms and attributes and none of the built in state.
+ * They are written against GLSL 1.20, writing their colour to frag_colour
+ * and putting SHADE in front of varyings that follow the shade model, and
+ * these bring them up to date on GLSL 1.30 and later, where SHADE can be
+ * flat.
+ */
+const char *shader_core_old =
+  "#define SHADE\n"
+  "#define frag_colour gl_FragColor\n";
+
+const char *shader_core_vert =
+  "#define attribute in\n"
+  "#define varying out\n";
+
+const char *shader_core_frag =
+  "#define varying in\n"
+  "#define texture2D texture\n"
+  "#define shadow2DProj(s, c) vec4(textureProj(s, c))\n"
+  "out vec4 frag_colour;\n";
+
+const char *shader_core_shade =
+  "#ifdef FLAT\n"
+  "#define SHADE flat\n"
+  "#else\n"
+  "#define SHADE\n"
+  "#endif\n";
+
+/**
+ * Fragment shader to go with light_sun. Modulates by texture unit 0 if
+ * textured is set and adds the specular highlight on top.
+ */
+const char *shader_frag_lit =
+  "uniform bool textured;\n"
+  "uniform sampler2D tex;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 c = gl_Color;\n"
+  "\n"
+  "  if(textured)\n"
+  "    c *= texture2D(tex, gl_TexCoord[0].st);\n"
+  "  gl_FragColor = vec4(c.rgb + gl_SecondaryColor.rgb, c.a);\n"
+  "}\n";
+
+
+/**
+ * Returns true if the OpenGL version of the current context is at least
+ * major.minor.
+ */
+bool gl_has_version(int major, int minor)
+{
+  const char *version = (const char *)glGetString(GL_VERSION);
+  int ma = 0, mi = 0;
+
+  if(version == NULL || sscanf(version, "%d.%d", &ma, &mi) < 1)
+    return false;
+
+  return ma > major || (ma == major && mi >= minor);
+}
+
+
+/**
+ * Returns true if the current context has the named extension. The list is
+ * split into words so that one name being the start of another doesn't
+ * count.
+ */
+bool gl_has_extension(const char *name)
+{
+  const char *list = (const char *)glGetString(GL_EXTENSIONS);
+  const char *at;
+  size_t len = strlen(name);
+
+  if(list == NULL || len == 0)
+    return false;
+
+  for(at = strstr(list, name); at; at = strstr(at + len, name))
+    if((at == list || at[-1] == ' ') && (at[len] == ' ' || at[len] == '\0'))
+      return true;
+
+  return false;
+}
+
+
+/**
+ * Returns true if the current context is a core profile one, without any
+ * of the fixed function state.
+ */
+bool gl_core_profile()
+{
+  GLint mask = 0;
+
+  if(!gl_has_version(3, 2))
+    return false;
+
+  glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &mask);
+  return (mask & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+}
+
+
+/**
+ * Prints the info log of a shader or program that failed to build.
+ */
+void shader_log(const char *name, GLuint obj, bool program)
+{
+  GLint len = 0;
+  char *log;
+
+  if(program)
+    glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
+  else
+    glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
+
+  if(len <= 1 || (log = malloc(len)) == NULL)
+    return;
+
+  if(program)
+    glGetProgramInfoLog(obj, len, NULL, log);
+  else
+    glGetShaderInfoLog(obj, len, NULL, log);
+
+  fprintf(stderr, "%s: %s\n", name, log);
+  free(log);
+}
+
+
+/**
+ * Compiles one shader stage from n pieces of source, the first being its
+ * prelude. Returns 0 if it doesn't compile.
+ */
+GLuint shader_compile(const char *name, GLenum type, const char **srcs,
+    int n)
+{
+  GLuint shader = glCreateShader(type);
+  GLint ok = GL_FALSE;
+
+  glShaderSource(shader, n, srcs, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+
+  if(!ok)
+  {
+    fprintf(stderr, "ERROR(shader_compile): %s %s shader failed.\n", name,
+        type == GL_VERTEX_SHADER ? "vertex" : "fragment");
+    shader_log(name, shader, false);
+    glDeleteShader(shader);
+    return 0;
+  }
+
+  return shader;
+}
+
+
+/**
+ * Builds a program from vertex and fragment shader source, which go after
+ * the preludes above and so leave out the #version line. The NULL ended
+ * list of attribute names, if any, is bound to locations from first onwards
+ * before linking. Returns the program, or 0 if it could not be built.
+ */
+GLuint shader_build(const char *name, const char *vert, const char *frag,
+    const char **attribs, int first)
+{
+  const char *vs_srcs[2], *fs_srcs[2];
+
+  if(!gl_has_version(2, 0))
+    return 0;
+
+  vs_srcs[0] = shader_vert_prelude;
+  vs_srcs[1] = vert;
+  fs_srcs[0] = shader_frag_prelude;
+  fs_srcs[1] = frag;
+
+  return shader_link(name, shader_compile(name, GL_VERTEX_SHADER, vs_srcs, 2),
+      shader_compile(name, GL_FRAGMENT_SHADER, fs_srcs, 2), attribs, first);
+}
+
+
+/**
+ * As shader_build, for shaders that take everything from uniforms and
+ * attributes and so also build on a core profile context. They are written
+ * as shader_core_old above expects. defines goes in front of both stages,
+ * after the #version line; defining FLAT in it makes the SHADE varyings
+ * flat where GLSL can.
+ */
+GLuint shader_build_core(const char *name, const char *defines,
+    const char *vert, const char *frag, const char **attribs, int first)
+{
+  const char *vs_srcs[5], *fs_srcs[5];
+
+  if(!gl_has_version(2, 0))
+    return 0;
+
+  if(gl_core_profile())
+    vs_srcs[0] = "#version 150\n";
+  else if(gl_has_version(3, 0))
+    vs_srcs[0] = "#version 130\n";
+  else
+    vs_srcs[0] = "#version 120\n";
+
+  fs_srcs[0] = vs_srcs[0];
+  vs_srcs[1] = fs_srcs[1] = defines;
+
+  if(gl_has_version(3, 0))
+  {
+    vs_srcs[2] = shader_core_vert;
+    fs_srcs[2] = shader_core_frag;
+    vs_srcs[3] = fs_srcs[3] = shader_core_shade;
+  }
+  else
+  {
+    vs_srcs[2] = fs_srcs[2] = shader_core_old;
+    vs_srcs[3] = fs_srcs[3] = "";
+  }
+
+  vs_srcs[4] = vert;
+  fs_srcs[4] = frag;
+
+  return shader_link(name, shader_compile(name, GL_VERTEX_SHADER, vs_srcs, 5),
+      shader_compile(name, GL_FRAGMENT_SHADER, fs_srcs, 5), attribs, first);
+}
+
+
+/**
+ * Links a vertex and fragment shader into a program, binding the NULL
+ * ended list of attribute names to locations from first on, and deletes
+ * the shaders. Either shader may be 0 if it failed to compile. Returns the
+ * program, or 0 if it could not be built.
+ */
+GLuint shader_link(const char *name, GLuint vs, GLuint fs,
+    const char **attribs, int first)
+{
+  GLuint prog;
+  GLint ok = GL_FALSE;
+  int i;
+
+  if(!vs || !fs)
+  {
+    if(vs) glDeleteShader(vs);
+    if(fs) glDeleteShader(fs);
+    return 0;
+  }
+
+  prog = glCreateProgram();
+  glAttachShader(prog, vs);
+  glAttachShader(prog, fs);
+
+  for(i = 0; attribs && attribs[i]; i++)
+    glBindAttribLocation(prog, first + i, attribs[i]);
+
+  glLinkProgram(prog);
+
+  /* The program keeps what it needs once linked. */
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+
+  glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+  if(!ok)
+  {
+    fprintf(stderr, "ERROR(shader_build): %s failed to link.\n", name);
+    shader_log(name, prog, true);
+    glDeleteProgram(prog);
+    return 0;
+  }
+
+  return prog;
+}
+
+
+/**
+ * Deletes a program made by shader_build. 0 is ignored.
+ */
+void shader_free(GLuint prog)
+{
+  if(prog)
+    glDeleteProgram(prog);
+}
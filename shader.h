@@ -0,0 +1,34 @@
+/**
+ * shader.h
+ *
+ * Helpers for the few places that use GLSL and newer parts of OpenGL than
+ * the fixed function pipeline everything else is drawn with.
+ */
+
+#ifndef _SHADER_H_
+#define _SHADER_H_
+
+#include <GLUT/glut.h>
+
+#ifdef __APPLE__
+#include <OpenGL/glext.h>
+#else
+#include <GL/glext.h>
+#endif
+
+#include "global.h"
+
+
+/* Interface. */
+extern const char *shader_frag_lit;
+
+extern bool gl_has_version(int major, int minor);
+extern bool gl_has_extension(const char *name);
+extern GLuint shader_build(const char *name, const char *vert,
+    const char *frag, const char **attribs, int first);
+extern GLuint shader_build_core(const char *name, const char *defines,
+    const char *vert, const char *frag, const char **attribs, int first);
+extern void shader_free(GLuint prog);
+
+
+#endif
@@ -0,0 +1,501 @@
+/**
+ * sim.c
+ *
+ * Implementation of the simulation thread in sim.h.
+ *
+ * Snapshots are kept in a small ring. The simulation thread only ever
+ * writes the slot after the latest one and the renderer reads the latest
+ * slot and the one before it, so they are normally well apart. Each slot
+ * has a sequence number which is odd while it is being written; the
+ * renderer reads the numbers before and after copying and simply tries
+ * again if either slot changed underneath it. Neither side ever waits on
+ * the other.
+ *
+ * A snapshot is a flat array of floats holding, for each registered model,
+ * its six position values followed by three rotations per bone. Alongside
+ * it are the register slot of each model and where its floats start, so
+ * that models removed or moved between snapshots are never blended with
+ * some other model.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sim.h"
+#include "3d.h"
+#include "drawing.h"
+#include "mem.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_POS_SIZE 6
+#define SIM_READ_TRIES 4
+
+
+typedef struct sim_snap
+{
+  volatile unsigned int seq;    /* Odd while being written. */
+  int time;                     /* Simulation time of the snapshot. */
+  int count;                    /* Number of models held. */
+  float *data;                  /* Model positions and poses. */
+  int cap;                      /* Floats allocated for data. */
+  int *ids;                     /* Register slot of each model. */
+  int *offsets;                 /* Start of each model in data. */
+  int ids_cap;                  /* Models allocated for ids and offsets. */
+} sim_snap;
+
+/**
+ * Buffers that have been replaced by bigger ones. The renderer may still be
+ * part way through reading one, so they're kept until the thread stops.
+ */
+typedef struct sim_retired sim_retired;
+struct sim_retired
+{
+  void *data;
+  sim_retired *next;
+};
+
+
+static sim_snap snaps[SIM_SNAPSHOTS];
+static volatile int latest = -1;
+static sim_retired *retired = NULL;
+
+static pthread_t sim_thread;
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool running = false;
+static sim_step_func sim_step = NULL;
+static int tick = SIM_TICK_MS;
+static int sim_time = 0;
+
+static struct timespec clock_start;
+static int clock_offset = 0;
+
+/* Render side copy of the interpolated snapshot. */
+static float *view = NULL;
+static int *view_offsets = NULL, *view_ids = NULL;
+static int view_cap = 0, view_count = 0, view_offsets_cap = 0;
+
+
+/* Function prototypes. */
+void sim_snapshot(int time);
+void *sim_loop(void *arg);
+int model_floats(model *mdl);
+float lerp_angle(float a, float b, float t);
+void sim_retire(void *data);
+void *sim_grow(void *data, size_t size);
+bool snap_reserve(sim_snap *snap, int count, int size);
+bool view_reserve(int count, int size);
+
+
+/**
+ * Returns the current time in milliseconds on the same scale as the time
+ * the simulation was started with.
+ */
+int sim_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return clock_offset + (ts.tv_sec - clock_start.tv_sec) * 1000 +
+    (ts.tv_nsec - clock_start.tv_nsec) / 1000000;
+}
+
+
+/**
+ * Number of floats a model takes up in a snapshot.
+ */
+int model_floats(model *mdl)
+{
+  return SIM_POS_SIZE + mdl->n_bones * TRANS_SIZE;
+}
+
+
+/**
+ * Interpolates between two angles in degrees the short way around.
+ */
+float lerp_angle(float a, float b, float t)
+{
+  float diff = b - a;
+
+  diff -= 360.0 * floor(diff / 360.0 + 0.5);
+  return a + diff * t;
+}
+
+
+/**
+ * Keeps a buffer that the renderer may still be reading until the thread
+ * stops.
+ */
+void sim_retire(void *data)
+{
+  sim_retired *old;
+
+  if(!data) return;
+
+  NEW(old);
+  if(old)
+  {
+    old->data = data;
+    old->next = retired;
+    retired = old;
+  }
+}
+
+
+/**
+ * Swaps a snapshot buffer for a new one of size bytes, retiring the old
+ * one. Returns NULL if the memory could not be found.
+ */
+void *sim_grow(void *data, size_t size)
+{
+  void *grown = malloc(size);
+
+  if(grown)
+    sim_retire(data);
+  return grown;
+}
+
+
+/**
+ * Grows a snapshot if more models have been added so that it can hold
+ * count models taking up size floats.
+ */
+bool snap_reserve(sim_snap *snap, int count, int size)
+{
+  float *data;
+  int *ints;
+
+  if(size > snap->cap)
+  {
+    if(!(data = sim_grow(snap->data, sizeof(float) * size * 2)))
+      return false;
+    snap->data = data;
+    snap->cap  = size * 2;
+  }
+
+  if(count + 1 > snap->ids_cap)
+  {
+    if(!(ints = sim_grow(snap->ids, sizeof(int) * (count + 1) * 2)))
+      return false;
+    snap->ids = ints;
+    if(!(ints = sim_grow(snap->offsets, sizeof(int) * (count + 1) * 2)))
+      return false;
+    snap->offsets = ints;
+    snap->ids_cap = (count + 1) * 2;
+  }
+
+  return true;
+}
+
+
+/**
+ * Copies every registered model into the slot after the latest one and
+ * publishes it. Called on the simulation thread with the lock held, so the
+ * model register can't change while it's being read.
+ */
+void sim_snapshot(int time)
+{
+  int slot = (latest + 1) % SIM_SNAPSHOTS;
+  sim_snap *snap = snaps + slot;
+  instance *inst;
+  int i, count = draw_model_count(), size = 0;
+
+  for(i = 0; i < count; i++)
+    size += model_floats(draw_model_get(i)->base);
+
+  snap->seq++;
+  __sync_synchronize();
+
+  /* Nothing is published if the memory can't be found; the slot is left
+   * empty so it's never blended and the renderer keeps the older ones. */
+  if(!snap_reserve(snap, count, size))
+  {
+    snap->count = 0;
+    __sync_synchronize();
+    snap->seq++;
+    return;
+  }
+
+  size = 0;
+  for(i = 0; i < count; i++)
+  {
+    inst = draw_model_get(i);
+    snap->ids[i] = draw_model_slot(i);
+    snap->offsets[i] = size;
+
+    memcpy(snap->data + size, instance_pos(inst),
+        sizeof(float) * SIM_POS_SIZE);
+
+    /* Bone rotations in skel_make_array order. */
+    instance_copy_pose(inst, snap->data + size + SIM_POS_SIZE);
+    size += model_floats(inst->base);
+  }
+  snap->offsets[count] = size;
+
+  snap->time  = time;
+  snap->count = count;
+
+  __sync_synchronize();
+  snap->seq++;
+  __sync_synchronize();
+  latest = slot;
+}
+
+
+/**
+ * Main loop of the simulation thread. Steps are taken on a fixed schedule
+ * whatever the frame rate. If the thread falls too far behind it skips
+ * ahead rather than trying to catch up all at once.
+ */
+void *sim_loop(void *arg)
+{
+  struct timespec nap;
+  int now, ahead;
+
+  while(running)
+  {
+    now = sim_clock();
+    ahead = sim_time + tick - now;
+
+    if(ahead > 0)
+    {
+      nap.tv_sec  = ahead / 1000;
+      nap.tv_nsec = (ahead % 1000) * 1000000;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+
+    if(-ahead > tick * SIM_MAX_CATCHUP)
+      sim_time = now - tick;
+
+    pthread_mutex_lock(&sim_mutex);
+    sim_time += tick;
+    sim_step(sim_time, tick / 1000.0);
+    sim_snapshot(sim_time);
+    pthread_mutex_unlock(&sim_mutex);
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Starts stepping the world with the given function every tick_ms
+ * milliseconds. now is the current time on the clock the rest of the
+ * program uses, which sim_clock then follows.
+ */
+void sim_start(sim_step_func step, int tick_ms, int now)
+{
+  if(running || !step) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &clock_start);
+  clock_offset = now;
+
+  sim_step = step;
+  tick     = tick_ms > 0 ? tick_ms : SIM_TICK_MS;
+  sim_time = now;
+  latest   = -1;
+  running  = true;
+
+  if(pthread_create(&sim_thread, NULL, sim_loop, NULL))
+  {
+    fprintf(stderr, "ERROR(sim_start): Unable to start thread.\n");
+    running = false;
+    return;
+  }
+
+  printf("Simulating on its own thread every %d ms.\n", tick);
+}
+
+
+/**
+ * Stops the simulation thread and frees the snapshots.
+ */
+void sim_stop()
+{
+  sim_retired *old;
+  int i;
+
+  if(!running) return;
+
+  running = false;
+  pthread_join(sim_thread, NULL);
+
+  for(i = 0; i < SIM_SNAPSHOTS; i++)
+  {
+    FREE(snaps[i].data);
+    FREE(snaps[i].ids);
+    FREE(snaps[i].offsets);
+    snaps[i].data = NULL;
+    snaps[i].ids = snaps[i].offsets = NULL;
+    snaps[i].cap = snaps[i].count = snaps[i].ids_cap = 0;
+  }
+
+  while(retired)
+  {
+    old = retired;
+    retired = old->next;
+    free(old->data);
+    free(old);
+  }
+
+  FREE(view);
+  FREE(view_offsets);
+  FREE(view_ids);
+  view = NULL;
+  view_offsets = view_ids = NULL;
+  view_cap = view_offsets_cap = view_count = 0;
+  latest = -1;
+}
+
+
+/**
+ * Locks the simulation while the caller changes the world, for instance
+ * by adding models. Does nothing if the simulation isn't running.
+ */
+void sim_lock()
+{
+  if(running)
+    pthread_mutex_lock(&sim_mutex);
+}
+
+
+/**
+ * Lets the simulation carry on after sim_lock.
+ */
+void sim_unlock()
+{
+  if(running)
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+
+/**
+ * Makes sure the render side view can hold count models taking up size
+ * floats. Only called on the rendering thread.
+ */
+bool view_reserve(int count, int size)
+{
+  float *new_view;
+  int *ints;
+
+  if(count + 1 > view_offsets_cap)
+  {
+    ints = realloc(view_offsets, sizeof(int) * (count + 1) * 2);
+    if(!ints) return false;
+    view_offsets = ints;
+
+    ints = realloc(view_ids, sizeof(int) * (count + 1) * 2);
+    if(!ints) return false;
+    view_ids = ints;
+
+    view_offsets_cap = (count + 1) * 2;
+  }
+
+  if(size > view_cap)
+  {
+    new_view = realloc(view, sizeof(float) * size * 2);
+    if(!new_view) return false;
+    view = new_view;
+    view_cap = size * 2;
+  }
+
+  return true;
+}
+
+
+/**
+ * Builds the view of the world to draw now. The renderer runs one tick
+ * behind the simulation so that it can always interpolate between the two
+ * newest snapshots. Models that weren't in the same place in both are
+ * drawn as they are in the newest.
+ */
+void sim_interpolate()
+{
+  sim_snap *curr, *prev;
+  unsigned int curr_seq, prev_seq;
+  int l, i, j, try, count, size, start;
+  float t, *a, *b, *out;
+
+  for(try = 0; try < SIM_READ_TRIES; try++)
+  {
+    l = latest;
+    if(l < 0) return;
+
+    curr = snaps + l;
+    prev = snaps + (l + SIM_SNAPSHOTS - 1) % SIM_SNAPSHOTS;
+
+    curr_seq = curr->seq;
+    prev_seq = prev->seq;
+    __sync_synchronize();
+
+    if((curr_seq & 1) || (prev_seq & 1))
+      continue;
+
+    /* Only one snapshot so far, so there's nothing to blend with. */
+    if(prev->count == 0 || prev->time >= curr->time)
+      prev = curr;
+
+    count = curr->count;
+    if(!view_reserve(count, curr->offsets[count]))
+      return;
+
+    t = (sim_clock() - tick - prev->time) /
+      (float)(curr->time - prev->time);
+    if(prev == curr || t > 1.0) t = 1.0;
+    if(t < 0.0) t = 0.0;
+
+    /* Positions blend linearly and everything else is an angle. */
+    for(i = 0; i < count; i++)
+    {
+      start = curr->offsets[i];
+      size  = curr->offsets[i + 1] - start;
+      b     = curr->data + start;
+      out   = view + start;
+
+      view_offsets[i] = start;
+      view_ids[i] = curr->ids[i];
+
+      if(i >= prev->count || prev->ids[i] != curr->ids[i] ||
+          prev->offsets[i] != start || prev->offsets[i + 1] - start != size)
+      {
+        memcpy(out, b, sizeof(float) * size);
+        continue;
+      }
+
+      a = prev->data + start;
+      for(j = 0; j < 3; j++)
+        out[j] = a[j] + (b[j] - a[j]) * t;
+      for(; j < size; j++)
+        out[j] = lerp_angle(a[j], b[j], t);
+    }
+
+    __sync_synchronize();
+    if(curr->seq == curr_seq && prev->seq == prev_seq)
+    {
+      view_count = count;
+      return;
+    }
+  }
+}
+
+
+/**
+ * Gives the interpolated position and pose of a registered model. Returns
+ * false if no snapshot of the model has been taken yet, or the model has
+ * moved in the register since the last one.
+ */
+bool sim_view(int index, float **pos, float **pose)
+{
+  if(index < 0 || index >= view_count ||
+      view_ids[index] != draw_model_slot(index))
+    return false;
+
+  *pos  = view + view_offsets[index];
+  *pose = *pos + SIM_POS_SIZE;
+  return true;
+}
@@ -0,0 +1,38 @@
+/**
+ * sim.h
+ *
+ * Fixed time step simulation on its own thread. The simulation thread
+ * steps the world every SIM_TICK_MS milliseconds and after each step takes
+ * a snapshot of where every registered model is and how it is posed. The
+ * renderer never touches the simulated models; it draws from the last two
+ * snapshots, interpolated to the time being drawn.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "global.h"
+
+#define SIM_TICK_MS 20
+#define SIM_SNAPSHOTS 4
+#define SIM_MAX_CATCHUP 5
+
+
+/**
+ * A step function advances the world to the time now, which is passed
+ * seconds after the previous step.
+ */
+typedef void (*sim_step_func)(int now, float passed);
+
+
+/* Interface. */
+extern void sim_start(sim_step_func step, int tick_ms, int now);
+extern void sim_stop();
+extern void sim_lock();
+extern void sim_unlock();
+extern int sim_clock();
+extern void sim_interpolate();
+extern bool sim_view(int index, float **pos, float **pose);
+
+
+#endif
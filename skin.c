@@ -0,0 +1,367 @@
+/**
+ * skin.c
+ *
+ * Builds and draws skinned meshes. Each frame the matrix palette, one
+ * matrix per bone taking the bind pose to the current one, is worked out
+ * on the CPU. A vertex shader then blends the two matrices of each vertex
+ * and draws the whole model from one vertex buffer. Without shaders the
+ * same blending is done on the CPU into a vertex array instead, which is
+ * slower but still a single draw call.
+ */
+
+#include "skin.h"
+#include "mem.h"
+#include "shader.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SKIN_STR(x) SKIN_STR_(x)
+#define SKIN_STR_(x) #x
+
+
+/* Function prototypes. */
+bool skin_init();
+
+
+const char *skin_vert_src =
+  "attribute vec2 bones, weights;\n"
+  "uniform mat4 palette[" SKIN_STR(SKIN_MAX_BONES) "];\n"
+  "void main()\n"
+  "{\n"
+  "  mat4 m = palette[int(bones.x)] * weights.x +\n"
+  "           palette[int(bones.y)] * weights.y;\n"
+  "\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix * (m * gl_Vertex);\n"
+  "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+  "  light_sun(normalize(gl_NormalMatrix * (mat3(m) * gl_Normal)));\n"
+  "}\n";
+
+const char *skin_attribs[] = {"bones", "weights", NULL};
+
+int skin_state = 0;             /* 0 untried, 1 ready, -1 unsupported. */
+GLuint skin_prog = 0;
+GLint skin_palette_loc, skin_lit_loc, skin_textured_loc;
+
+
+/**
+ * Merges the bone meshes of a model into one skinned mesh, in the pose its
+ * bones are in now. A vertex follows its own bone, except that over the
+ * first SKIN_BLEND of the bone it is blended more and more with the parent
+ * bone, so at the joint it sits on the end of the parent. Returns NULL if
+ * the model has no meshes or memory runs out.
+ */
+skin_mesh *skin_build(model *mdl)
+{
+  skin_mesh *skin;
+  float m[16], *bind = NULL, *out, *src, *v, blend, w;
+  int *parent = NULL, i, j, p, count = 0;
+  bone *b, *c;
+
+  if(!mdl || !mdl->bone_array)
+    return NULL;
+
+  for(i = 0; i < mdl->n_bones; i++)
+    if(mdl->bone_array[i]->geometry)
+      count += mdl->bone_array[i]->tri_count;
+  if(count == 0)
+    return NULL;
+
+  NEW(skin);
+  CHECK(skin);
+  memset(skin, 0, sizeof(skin_mesh));
+
+  skin->n_verts  = count;
+  skin->n_bones  = mdl->n_bones;
+  skin->verts    = malloc(sizeof(float) * SKIN_VERT_SIZE * count);
+  skin->skinned  = malloc(sizeof(float) * 8 * count);
+  skin->inv_bind = malloc(sizeof(float) * 16 * skin->n_bones);
+  skin->palette  = malloc(sizeof(float) * 16 * skin->n_bones);
+  bind   = malloc(sizeof(float) * 16 * skin->n_bones);
+  parent = malloc(sizeof(int) * skin->n_bones);
+
+  if(!skin->verts || !skin->skinned || !skin->inv_bind || !skin->palette ||
+     !bind || !parent)
+  {
+    fprintf(stderr, "ERROR(skin_build): Out of memory.\n");
+    FREE(bind);
+    FREE(parent);
+    skin_free(skin);
+    return NULL;
+  }
+
+  /* Bind pose matrices, in bone array order, and their inverses. */
+  m4_identity(m);
+  out = bind;
+  skel_pose_matrices(mdl->root, NULL, m, &out, 16);
+  for(i = 0; i < skin->n_bones; i++)
+    m4_rigid_inverse(skin->inv_bind + i * 16, bind + i * 16);
+
+  /* Find the parent of each bone, -1 for the root. */
+  for(i = 0; i < skin->n_bones; i++)
+    parent[i] = -1;
+  for(i = 0; i < skin->n_bones; i++)
+    for(c = mdl->bone_array[i]->child; c; c = c->sibling)
+      for(j = 0; j < skin->n_bones; j++)
+        if(mdl->bone_array[j] == c)
+          parent[j] = i;
+
+  v = skin->verts;
+  for(i = 0; i < skin->n_bones; i++)
+  {
+    b = mdl->bone_array[i];
+    if(!b->geometry)
+      continue;
+
+    /* Only blend into a parent that has a mesh to meet. */
+    p = parent[i];
+    if(p >= 0 && !mdl->bone_array[p]->geometry)
+      p = -1;
+    blend = b->length * SKIN_BLEND;
+    out = bind + i * 16;
+
+    for(j = 0; j < b->tri_count; j++, v += SKIN_VERT_SIZE)
+    {
+      src = b->geometry + j * 8;
+
+      v[0] = src[0];
+      v[1] = src[1];
+      v[2] = out[0] * src[2] + out[4] * src[3] + out[8]  * src[4];
+      v[3] = out[1] * src[2] + out[5] * src[3] + out[9]  * src[4];
+      v[4] = out[2] * src[2] + out[6] * src[3] + out[10] * src[4];
+      v[5] = out[0] * src[5] + out[4] * src[6] + out[8]  * src[7] + out[12];
+      v[6] = out[1] * src[5] + out[5] * src[6] + out[9]  * src[7] + out[13];
+      v[7] = out[2] * src[5] + out[6] * src[6] + out[10] * src[7] + out[14];
+
+      w = (p >= 0 && blend > 0.0) ? clamp(src[5] / blend, 0.0, 1.0) : 1.0;
+      v[8]  = i;
+      v[9]  = p >= 0 ? p : i;
+      v[10] = w;
+      v[11] = 1.0 - w;
+    }
+  }
+
+  free(bind);
+  free(parent);
+
+  return skin;
+}
+
+
+/**
+ * Frees a skinned mesh and its vertex buffer, if it has one.
+ */
+void skin_free(skin_mesh *skin)
+{
+  if(!skin) return;
+
+  if(skin->vbo)
+    glDeleteBuffers(1, &skin->vbo);
+
+  FREE(skin->verts);
+  FREE(skin->skinned);
+  FREE(skin->inv_bind);
+  FREE(skin->palette);
+  free(skin);
+}
+
+
+/**
+ * Works out the matrix palette for a pose of the skeleton the mesh was
+ * built from, into 16 floats a bone at palette. A NULL pose uses the
+ * rotations in the bones.
+ */
+void skin_palette(skin_mesh *skin, bone *root, float *pose, float *palette)
+{
+  float m[16], *out = palette;
+  int i;
+
+  m4_identity(m);
+  skel_pose_matrices(root, pose ? &pose : NULL, m, &out, 16);
+
+  for(i = 0; i < skin->n_bones; i++)
+  {
+    memcpy(m, palette + i * 16, sizeof(m));
+    m4_mul(palette + i * 16, m, skin->inv_bind + i * 16);
+  }
+}
+
+
+/**
+ * Skins the mesh with a palette on the CPU, into the T2F_N3F_V3F array
+ * skin->skinned.
+ */
+void skin_cpu(skin_mesh *skin, float *palette)
+{
+  float m[12], *a, *b, *v = skin->verts, *out = skin->skinned, len;
+  int i, k;
+
+  for(i = 0; i < skin->n_verts; i++, v += SKIN_VERT_SIZE, out += 8)
+  {
+    a = palette + (int)v[8] * 16;
+    b = palette + (int)v[9] * 16;
+
+    /* Only the top three rows matter for rigid bones. */
+    for(k = 0; k < 12; k++)
+      m[k] = a[k + k / 3] * v[10] + b[k + k / 3] * v[11];
+
+    out[0] = v[0];
+    out[1] = v[1];
+    out[2] = m[0] * v[2] + m[3] * v[3] + m[6] * v[4];
+    out[3] = m[1] * v[2] + m[4] * v[3] + m[7] * v[4];
+    out[4] = m[2] * v[2] + m[5] * v[3] + m[8] * v[4];
+    out[5] = m[0] * v[5] + m[3] * v[6] + m[6] * v[7] + m[9];
+    out[6] = m[1] * v[5] + m[4] * v[6] + m[7] * v[7] + m[10];
+    out[7] = m[2] * v[5] + m[5] * v[6] + m[8] * v[7] + m[11];
+
+    len = sqrt(out[2] * out[2] + out[3] * out[3] + out[4] * out[4]);
+    if(len > 0.0)
+    {
+      out[2] /= len;
+      out[3] /= len;
+      out[4] /= len;
+    }
+  }
+}
+
+
+/**
+ * Builds the skinning shader the first time it is needed. Returns false if
+ * the driver can't run it, in which case meshes are skinned on the CPU.
+ */
+bool skin_init()
+{
+  GLint comps = 0;
+
+  if(skin_state)
+    return skin_state > 0;
+
+  skin_state = -1;
+
+  /* The palette has to fit, with room for the built in uniforms. */
+  if(!gl_has_version(2, 0))
+    return false;
+  glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &comps);
+  if(comps < SKIN_MAX_BONES * 16 + 128)
+    return false;
+
+  skin_prog = shader_build("skin", skin_vert_src, shader_frag_lit,
+      skin_attribs, SKIN_ATTRIB);
+  if(!skin_prog)
+    return false;
+
+  skin_palette_loc  = glGetUniformLocation(skin_prog, "palette");
+  skin_lit_loc      = glGetUniformLocation(skin_prog, "lit");
+  skin_textured_loc = glGetUniformLocation(skin_prog, "textured");
+
+  glUseProgram(skin_prog);
+  glUniform1i(glGetUniformLocation(skin_prog, "tex"), 0);
+  glUseProgram(0);
+
+  skin_state = 1;
+  return true;
+}
+
+
+/**
+ * Returns true if a skinned mesh can be drawn by the shader.
+ */
+bool skin_on_gpu(skin_mesh *skin)
+{
+  return skin->n_bones <= SKIN_MAX_BONES && skin_init();
+}
+
+
+/**
+ * Gets ready to draw a skinned mesh one or more times with skin_submit. On
+ * the GPU the program and vertex arrays are set up here, from the buffer
+ * object if it was given one when loaded. Lighting and texturing follow
+ * whatever is enabled now.
+ */
+void skin_begin(skin_mesh *skin)
+{
+  GLsizei stride = sizeof(float) * SKIN_VERT_SIZE;
+  char *verts = NULL;
+
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  if(!skin_on_gpu(skin))
+    return;
+
+  if(skin->vbo && global.r_vbos)
+    glBindBuffer(GL_ARRAY_BUFFER, skin->vbo);
+  else
+    verts = (char *)skin->verts;
+
+  glUseProgram(skin_prog);
+  glUniform1i(skin_lit_loc, glIsEnabled(GL_LIGHTING));
+  glUniform1i(skin_textured_loc, glIsEnabled(GL_TEXTURE_2D));
+
+  glInterleavedArrays(GL_T2F_N3F_V3F, stride, verts);
+  glVertexAttribPointer(SKIN_ATTRIB, 2, GL_FLOAT, GL_FALSE, stride,
+      verts + sizeof(float) * 8);
+  glVertexAttribPointer(SKIN_ATTRIB + 1, 2, GL_FLOAT, GL_FALSE, stride,
+      verts + sizeof(float) * 10);
+  glEnableVertexAttribArray(SKIN_ATTRIB);
+  glEnableVertexAttribArray(SKIN_ATTRIB + 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/**
+ * Draws a skinned mesh with a palette from skin_palette, between
+ * skin_begin and skin_end.
+ */
+void skin_submit(skin_mesh *skin, float *palette)
+{
+  GLenum mode = global.r_wire ? GL_LINES : GL_TRIANGLES;
+
+  if(skin_on_gpu(skin))
+  {
+    glUniformMatrix4fv(skin_palette_loc, skin->n_bones, GL_FALSE, palette);
+    global.upload_bytes += sizeof(float) * 16 * skin->n_bones;
+
+    /* Without a buffer object the vertices go over every time. */
+    if(!skin->vbo || !global.r_vbos)
+      global.upload_bytes += sizeof(float) * SKIN_VERT_SIZE * skin->n_verts;
+  }
+  else
+  {
+    skin_cpu(skin, palette);
+    glInterleavedArrays(GL_T2F_N3F_V3F, 0, skin->skinned);
+    global.upload_bytes += sizeof(float) * 8 * skin->n_verts;
+  }
+
+  glDrawArrays(mode, 0, skin->n_verts);
+  global.draw_calls++;
+}
+
+
+/**
+ * Puts back the state changed by skin_begin.
+ */
+void skin_end(skin_mesh *skin)
+{
+  if(skin_on_gpu(skin))
+  {
+    glDisableVertexAttribArray(SKIN_ATTRIB);
+    glDisableVertexAttribArray(SKIN_ATTRIB + 1);
+    glUseProgram(0);
+  }
+  glPopClientAttrib();
+}
+
+
+/**
+ * Draws a skinned mesh posed by the flat rotations in pose, as for
+ * draw_skeleton_pose, with whatever state and matrices are current.
+ */
+void skin_draw(skin_mesh *skin, bone *root, float *pose)
+{
+  skin_palette(skin, root, pose, skin->palette);
+
+  skin_begin(skin);
+  skin_submit(skin, skin->palette);
+  skin_end(skin);
+}
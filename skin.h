@@ -0,0 +1,54 @@
+/**
+ * skin.h
+ *
+ * Models drawn as one skinned mesh instead of a rigid mesh per bone. The
+ * bone meshes are merged in the pose the model loads in, and every vertex
+ * is tied to its own bone and, close to the joint, to the parent bone as
+ * well. Vertices either side of a joint then move together, so the joints
+ * don't crack open, and a whole model is one draw call.
+ */
+
+#ifndef _SKIN_H_
+#define _SKIN_H_
+
+#include "global.h"
+#include "3d.h"
+
+#define SKIN_VERT_SIZE 12       /* T2F_N3F_V3F then 2 bones and 2 weights. */
+#define SKIN_MAX_BONES 32       /* Palette size in the skinning shader. */
+#define SKIN_BLEND     0.25     /* Part of a bone blended with its parent. */
+#define SKIN_ATTRIB    10       /* Attribute location of the bone indices. */
+
+
+/**
+ * A skinned mesh. Positions and normals are in model space in the bind
+ * pose, and inv_bind takes them from there back into each bone's space.
+ */
+struct _skin_mesh
+{
+  float *verts;                 /* SKIN_VERT_SIZE floats per vertex. */
+  int n_verts;
+
+  int n_bones;
+  float *inv_bind;              /* Inverse bind matrix of each bone. */
+  float *palette;               /* Scratch matrices for skin_draw. */
+  float *skinned;               /* Scratch T2F_N3F_V3F for skinning on CPU. */
+
+  unsigned int vbo;             /* Copy of verts on the card, or 0. */
+};
+
+
+/* Interface. */
+extern skin_mesh *skin_build(model *mdl);
+extern void skin_free(skin_mesh *skin);
+extern void skin_palette(skin_mesh *skin, bone *root, float *pose,
+    float *palette);
+extern void skin_cpu(skin_mesh *skin, float *palette);
+extern bool skin_on_gpu(skin_mesh *skin);
+extern void skin_begin(skin_mesh *skin);
+extern void skin_submit(skin_mesh *skin, float *palette);
+extern void skin_end(skin_mesh *skin);
+extern void skin_draw(skin_mesh *skin, bone *root, float *pose);
+
+
+#endif
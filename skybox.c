@@ -8,6 +8,7 @@
  * it.
  */
 #include "drawing.h"
+#include "pipeline.h"
 
 #define SKY_SIZE 10.0
 
@@ -28,7 +29,8 @@ char *sky_files[] = { "data/sky/zn.png",           /* 0 - z-axis negative. */
 typedef struct _skybox
 {
   int texture[6];
-  int dlist;
+  float verts[24][5];           /* Positions and texture coordinates of
+                                 * each face in turn. */
 } skybox;
 
 skybox sky;
@@ -52,128 +54,82 @@ void skybox_init()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   }
 
-  skybox_gen_lists(SKY_SIZE);
+  skybox_gen_arrays(SKY_SIZE);
   sb_made = true;
 }
 
 
 /**
- * Generates a display list for a skybox. Since the display box is being
- * drawn every frame, we create a display list that can be used to speed
- * up the rendering. This is done independently of the client code.
+ * Fills in the corners of each face of a skybox of the given size, in the
+ * same order as the textures, to be drawn as a fan each.
  */
-void skybox_gen_lists(float size)
+void skybox_gen_arrays(float size)
 {
-  float f = size, ts = 0.0, tl = 1.0;
-  int i, draw_type;
-
-  sky.dlist = glGenLists(2);
-
-  for(i = 0; i < 2; i++)
+  /* Each face's corners, as signs of the size, going round from the one
+   * at texture coordinate (0, 0). */
+  static const float corners[24][3] = {
+    {-1, -1, -1}, { 1, -1, -1}, { 1,  1, -1}, {-1,  1, -1},   /* Neg Z. */
+    { 1, -1, -1}, { 1, -1,  1}, { 1,  1,  1}, { 1,  1, -1},   /* Pos X. */
+    { 1, -1,  1}, {-1, -1,  1}, {-1,  1,  1}, { 1,  1,  1},   /* Pos Z. */
+    {-1, -1,  1}, {-1, -1, -1}, {-1,  1, -1}, {-1,  1,  1},   /* Neg X. */
+    {-1,  1, -1}, { 1,  1, -1}, { 1,  1,  1}, {-1,  1,  1},   /* Pos Y. */
+    {-1, -1,  1}, { 1, -1,  1}, { 1, -1, -1}, {-1, -1, -1},   /* Neg Y. */
+  };
+  static const float tcoords[4][2] = {
+    {0.0, 0.0}, {1.0, 0.0}, {1.0, 1.0}, {0.0, 1.0}
+  };
+  int i, j;
+
+  for(i = 0; i < 24; i++)
   {
-    /* Generate display list. */
-    glNewList(sky.dlist + i, GL_COMPILE);
-
-    /* Disable the depth buffer so that the sky is drawn first before anything
-     * else and other drawing occurs over the sky. In other words: depth
-     * values for the sky are not recorded. */
-    glDisable(GL_DEPTH_TEST);
-
-    if(i == 0)
-    {
-      draw_type = GL_QUADS;
-    }
-    else
-    {
-      draw_type = GL_LINE_LOOP;
-      glDisable(GL_TEXTURE_2D);
-      glColor4f(0.57, 0.85, 1.0, 1.0);
-    }
-
-    /* The following could have been done with Vertex Arrays and generated
-     * in a loop, but since it was going into a display list, it was a little
-     * easier just to do it by hand. */
-
-    /* Neg Z Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[0]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f(-f, -f, -f);
-      glTexCoord2f(tl, ts); glVertex3f( f, -f, -f);
-      glTexCoord2f(tl, tl); glVertex3f( f,  f, -f);
-      glTexCoord2f(ts, tl); glVertex3f(-f,  f, -f);
-    glEnd();
-
-    /* Pos X Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[1]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f(f, -f, -f);
-      glTexCoord2f(tl, ts); glVertex3f(f, -f,  f);
-      glTexCoord2f(tl, tl); glVertex3f(f,  f,  f);
-      glTexCoord2f(ts, tl); glVertex3f(f,  f, -f);
-    glEnd();
-
-    /* Pos Z Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[2]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f( f, -f, f);
-      glTexCoord2f(tl, ts); glVertex3f(-f, -f, f);
-      glTexCoord2f(tl, tl); glVertex3f(-f,  f, f);
-      glTexCoord2f(ts, tl); glVertex3f( f,  f, f);
-    glEnd();
-
-    /* Neg X Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[3]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f(-f, -f,  f);
-      glTexCoord2f(tl, ts); glVertex3f(-f, -f, -f);
-      glTexCoord2f(tl, tl); glVertex3f(-f,  f, -f);
-      glTexCoord2f(ts, tl); glVertex3f(-f,  f,  f);
-    glEnd();
-
-    /* Pos Y Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[4]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f(-f, f, -f);
-      glTexCoord2f(tl, ts); glVertex3f( f, f, -f);
-      glTexCoord2f(tl, tl); glVertex3f( f, f,  f);
-      glTexCoord2f(ts, tl); glVertex3f(-f, f,  f);
-    glEnd();
-
-    /* Neg Y Dir. */
-    glBindTexture(GL_TEXTURE_2D, sky.texture[5]);
-    glBegin(draw_type);
-      glTexCoord2f(ts, ts); glVertex3f(-f, -f,  f);
-      glTexCoord2f(tl, ts); glVertex3f( f, -f,  f);
-      glTexCoord2f(tl, tl); glVertex3f( f, -f, -f);
-      glTexCoord2f(ts, tl); glVertex3f(-f, -f, -f);
-    glEnd();
-
-    glEndList();
+    for(j = 0; j < 3; j++)
+      sky.verts[i][j] = corners[i][j] * size;
+    sky.verts[i][3] = tcoords[i % 4][0];
+    sky.verts[i][4] = tcoords[i % 4][1];
   }
 }
 
 
 /**
- * Just executes the display list generated above.
+ * Draws the sky. The depth buffer is left alone so that the sky is drawn
+ * first before anything else and other drawing occurs over the sky.
  */
 bool skybox_render()
 {
+  bool piped;
+  int i;
+
   if(!sb_made)
     return false;
 
   glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glDisable(GL_DEPTH_TEST);
 
   if(global.r_wire)
-    glCallList(sky.dlist + 1);
-  else 
   {
-    if(global.r_texture)
-      glEnable(GL_TEXTURE_2D);
-    else
-      glColor4f(0.57, 0.85, 1.0, 1.0);
-    glCallList(sky.dlist);
+    glDisable(GL_TEXTURE_2D);
+    glColor4f(0.57, 0.85, 1.0, 1.0);
+  }
+  else if(global.r_texture)
+  {
+    glEnable(GL_TEXTURE_2D);
+    glColor4f(1.0, 1.0, 1.0, 1.0);
+  }
+  else
+    glColor4f(0.57, 0.85, 1.0, 1.0);
+
+  piped = pipe_begin();
+  pipe_arrays(sky.verts[0], 5, 0, -1, 3);
+  for(i = 0; i < 6; i++)
+  {
+    glBindTexture(GL_TEXTURE_2D, sky.texture[i]);
+    glDrawArrays(global.r_wire ? GL_LINE_LOOP : GL_TRIANGLE_FAN, i * 4, 4);
   }
+  if(piped)
+    pipe_end();
 
+  glPopClientAttrib();
   glPopAttrib();
 
   return true;
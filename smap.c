@@ -0,0 +1,298 @@
+/**
+ * smap.c
+ *
+ * The sun is straight along sun_pos, so each map is an orthographic view
+ * down it. A cascade's map is fitted round a sphere holding its slice of
+ * the view, and pulled back towards the sun so that anything up to
+ * SMAP_REACH above the slice still casts into it. Fitting to a sphere
+ * keeps the map the same size as the camera turns, and the map is moved in
+ * whole texels so its edges don't crawl as the camera moves.
+ *
+ * The slices are split part evenly and part by the log of distance, since
+ * an even split spends most of the first map on what is right in front of
+ * the camera and a log split leaves the far slices huge.
+ *
+ * While the scene is drawn after, the maps are bound on the texture units
+ * after the first and handed to the pipeline program, which takes the eye
+ * space position of each fragment into the map of the slice it falls in
+ * and shades it as in shadow where the map says something is between it
+ * and the sun. That way the ground and the lit models take their shadows
+ * as they are drawn, instead of the ground being drawn a second time over
+ * itself to blend them in.
+ */
+
+#include "smap.h"
+#include "pipeline.h"
+#include "shader.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+int smap_state = 0;             /* 0 untried, 1 ready, -1 unsupported. */
+
+GLuint smap_fbo = 0;
+GLuint smap_maps[SMAP_CASCADES];
+
+float smap_light[16];           /* World to looking down from the sun. */
+float smap_proj[SMAP_CASCADES][16];
+float smap_to_map[SMAP_CASCADES][16];
+float smap_splits[SMAP_CASCADES];
+
+
+/**
+ * Checks the driver can render to depth textures and compare against them
+ * in a shader, and sets up the maps. Only does the work once. Returns false
+ * if shadow maps can't be used, in which case flat shadows should be drawn
+ * instead.
+ */
+bool smap_init()
+{
+  GLint units = 0;
+  GLenum status;
+  int i;
+
+  if(smap_state)
+    return smap_state > 0;
+
+  smap_state = -1;
+
+  glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+  if(!gl_has_version(3, 0) && !gl_has_extension("GL_ARB_framebuffer_object"))
+    return false;
+  if(units < SMAP_CASCADES + 1)
+    return false;
+
+  if(!pipe_init())
+    return false;
+
+  glGenTextures(SMAP_CASCADES, smap_maps);
+  for(i = 0; i < SMAP_CASCADES; i++)
+  {
+    glBindTexture(GL_TEXTURE_2D, smap_maps[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SMAP_SIZE,
+        SMAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+        GL_COMPARE_R_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  /* Only depth is drawn, so there is nothing to draw or read colour to. */
+  glGenFramebuffers(1, &smap_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, smap_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+      smap_maps[0], 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if(status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    fprintf(stderr, "ERROR(smap_init): Can't draw to a depth texture.\n");
+    smap_cleanup();
+    smap_state = -1;
+    return false;
+  }
+
+  smap_state = 1;
+  return true;
+}
+
+
+/**
+ * Frees the maps. smap_init may be called again after.
+ */
+void smap_cleanup()
+{
+  if(smap_fbo)
+  {
+    glDeleteFramebuffers(1, &smap_fbo);
+    glDeleteTextures(SMAP_CASCADES, smap_maps);
+  }
+  smap_fbo = 0;
+
+  smap_state = 0;
+}
+
+
+/**
+ * Fits the cascades to the camera for a frame. view is the camera's
+ * modelview matrix, with the projection set up as it will be drawn with,
+ * and sun is the sun's direction.
+ */
+void smap_begin(float view[16], float sun[4])
+{
+  float proj[16], inv[16], to_light[16], m[16], bias[16];
+  float x[3], y[3], z[3], up[3] = {0.0, 1.0, 0.0};
+  float near, far, d[2], eye[3], p[8][3], c[3], r, texel, t;
+  int i, j, k;
+
+  /* Looking down from the sun, with z back towards it. */
+  v_copy(z, sun);
+  v_norm(z);
+  if(fabs(z[1]) > 0.99)
+  {
+    up[0] = 1.0;
+    up[1] = 0.0;
+  }
+  v_cross(x, up, z);
+  v_norm(x);
+  v_cross(y, z, x);
+
+  m4_identity(smap_light);
+  for(i = 0; i < 3; i++)
+  {
+    smap_light[i * 4 + 0] = x[i];
+    smap_light[i * 4 + 1] = y[i];
+    smap_light[i * 4 + 2] = z[i];
+  }
+
+  glGetFloatv(GL_PROJECTION_MATRIX, proj);
+  near = proj[14] / (proj[10] - 1.0);
+  far  = proj[14] / (proj[10] + 1.0);
+
+  m4_rigid_inverse(inv, view);
+  m4_mul(to_light, smap_light, inv);
+
+  /* Takes -1 to 1 into 0 to 1 for looking up the maps. */
+  m4_identity(bias);
+  m4_translate(bias, 0.5, 0.5, 0.5);
+  m4_scale(bias, 0.5, 0.5, 0.5);
+
+  d[1] = near;
+  for(i = 0; i < SMAP_CASCADES; i++)
+  {
+    t = (i + 1.0) / SMAP_CASCADES;
+    d[0] = d[1];
+    d[1] = SMAP_LAMBDA * near * pow(far / near, t) +
+           (1.0 - SMAP_LAMBDA) * (near + (far - near) * t);
+    smap_splits[i] = d[1];
+
+    /* The corners of the slice, seen from the sun. */
+    v_clear(c);
+    for(k = 0; k < 8; k++)
+    {
+      eye[2] = -d[k / 4];
+      eye[0] = (k & 1 ? 1.0 : -1.0) * d[k / 4] / proj[0];
+      eye[1] = (k & 2 ? 1.0 : -1.0) * d[k / 4] / proj[5];
+      m4_point(p[k], to_light, eye);
+      v_add(c, p[k]);
+    }
+    v_scale(c, 1.0 / 8.0);
+
+    r = 0.0;
+    for(k = 0; k < 8; k++)
+    {
+      for(j = 0; j < 3; j++)
+        eye[j] = p[k][j] - c[j];
+      r = fmax(r, sqrt(v_dot(eye, eye)));
+    }
+
+    texel = 2.0 * r / SMAP_SIZE;
+    c[0] = floor(c[0] / texel) * texel;
+    c[1] = floor(c[1] / texel) * texel;
+
+    m4_ortho(smap_proj[i], c[0] - r, c[0] + r, c[1] - r, c[1] + r,
+        -(c[2] + r + SMAP_REACH), -(c[2] - r));
+
+    m4_mul(m, smap_proj[i], to_light);
+    m4_mul(smap_to_map[i], bias, m);
+  }
+}
+
+
+/**
+ * Readies for drawing what casts shadows into cascade i. Everything drawn
+ * until smap_cascade_end only goes into the map.
+ */
+void smap_cascade_begin(int i)
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, smap_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+      smap_maps[i], 0);
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glViewport(0, 0, SMAP_SIZE, SMAP_SIZE);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_TRUE);
+  glEnable(GL_DEPTH_TEST);
+  glDisable(GL_BLEND);
+  glDisable(GL_STENCIL_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_TEXTURE_2D);
+  glDisable(GL_LIGHTING);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SMAP_SLOPE, SMAP_BIAS);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadMatrixf(smap_proj[i]);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadMatrixf(smap_light);
+
+  global.state_changes += 3;
+}
+
+
+/**
+ * Goes back to drawing the scene after smap_cascade_begin.
+ */
+void smap_cascade_end()
+{
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+
+  glPopAttrib();
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+/**
+ * Binds the maps for what is drawn from now on to take its shadows from,
+ * through the pipeline program. Unlit fragments in full shadow have the
+ * shadow colour blended over them with an alpha of darkness.
+ */
+void smap_bind(float darkness)
+{
+  int i;
+
+  for(i = 0; i < SMAP_CASCADES; i++)
+  {
+    glActiveTexture(GL_TEXTURE1 + i);
+    glBindTexture(GL_TEXTURE_2D, smap_maps[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  pipe_shadows((float *)smap_to_map, smap_splits, darkness);
+
+  global.state_changes += SMAP_CASCADES;
+}
+
+
+/**
+ * Stops what is drawn from taking shadows after smap_bind.
+ */
+void smap_unbind()
+{
+  int i;
+
+  pipe_shadows(NULL, NULL, 0.0);
+
+  for(i = 0; i < SMAP_CASCADES; i++)
+  {
+    glActiveTexture(GL_TEXTURE1 + i);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
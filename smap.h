@@ -0,0 +1,36 @@
+/**
+ * smap.h
+ *
+ * Cascaded shadow maps. Whatever casts shadows is drawn once from the sun
+ * into a depth texture for each cascade, and the ground and the models look
+ * themselves up in them as they are drawn, instead of every model being
+ * drawn again squashed flat onto the ground through the stencil buffer.
+ * The view is cut into slices by distance and each slice gets a map of its
+ * own, so shadows near the camera stay sharp however big the world is.
+ */
+
+#ifndef _SMAP_H_
+#define _SMAP_H_
+
+#include "global.h"
+
+#define SMAP_CASCADES 3         /* Slices of the view, as in the shaders. */
+#define SMAP_SIZE     1024      /* Width and height of each map. */
+#define SMAP_LAMBDA   0.75      /* How far the slices are spread evenly
+                                 * (0) or by the log of distance (1). */
+#define SMAP_REACH    256.0     /* How far towards the sun casters are. */
+#define SMAP_SLOPE    2.0       /* Depth offset to stop shadow acne, */
+#define SMAP_BIAS     4.0       /* by slope and by a constant. */
+
+
+/* Interface. */
+extern bool smap_init();
+extern void smap_cleanup();
+extern void smap_begin(float view[16], float sun[4]);
+extern void smap_cascade_begin(int i);
+extern void smap_cascade_end();
+extern void smap_bind(float darkness);
+extern void smap_unbind();
+
+
+#endif
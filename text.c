@@ -0,0 +1,256 @@
+/**
+ * text.c
+ *
+ * The font is GLUT's 8 by 13 bitmap font, the X11 misc-fixed one, baked
+ * into a texture with a cell for each printable character. Text is drawn
+ * as a pair of triangles a character, lined up with the pixels and
+ * sampled without filtering, so it comes out exactly as glBitmap would
+ * have drawn it, and the same through the GLSL pipeline as without it.
+ */
+
+#include "text.h"
+#include "pipeline.h"
+
+#include <GLUT/glut.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define TEXT_FIRST  32          /* First character in the font. */
+#define TEXT_COUNT  95          /* Characters in the font. */
+#define TEXT_COLS   16          /* Cells across the texture. */
+#define TEXT_W       8          /* Width and height of a character. */
+#define TEXT_H      13
+#define TEXT_BELOW   3          /* Rows below the baseline. */
+#define TEXT_TEX   128          /* Width and height of the texture. */
+#define TEXT_CHUNK  64          /* Characters sent in one draw. */
+
+
+/* Each character's rows from the top, leftmost pixel in the top bit. */
+static const unsigned char text_font[TEXT_COUNT][TEXT_H] = {
+  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /*   */
+  {0x00,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x00,0x10,0x00,0x00,0x00}, /* ! */
+  {0x00,0x24,0x24,0x24,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* " */
+  {0x00,0x00,0x24,0x24,0x7e,0x24,0x7e,0x24,0x24,0x00,0x00,0x00,0x00}, /* # */
+  {0x00,0x10,0x3c,0x50,0x50,0x38,0x14,0x14,0x78,0x10,0x00,0x00,0x00}, /* $ */
+  {0x00,0x22,0x52,0x24,0x08,0x08,0x10,0x24,0x2a,0x44,0x00,0x00,0x00}, /* % */
+  {0x00,0x00,0x00,0x30,0x48,0x48,0x30,0x4a,0x44,0x3a,0x00,0x00,0x00}, /* & */
+  {0x00,0x38,0x30,0x40,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* ' */
+  {0x00,0x04,0x08,0x08,0x10,0x10,0x10,0x08,0x08,0x04,0x00,0x00,0x00}, /* ( */
+  {0x00,0x20,0x10,0x10,0x08,0x08,0x08,0x10,0x10,0x20,0x00,0x00,0x00}, /* ) */
+  {0x00,0x00,0x00,0x24,0x18,0x7e,0x18,0x24,0x00,0x00,0x00,0x00,0x00}, /* * */
+  {0x00,0x00,0x00,0x10,0x10,0x7c,0x10,0x10,0x00,0x00,0x00,0x00,0x00}, /* + */
+  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x38,0x30,0x40,0x00,0x00}, /* , */
+  {0x00,0x00,0x00,0x00,0x00,0x7e,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* - */
+  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10,0x38,0x10,0x00,0x00}, /* . */
+  {0x00,0x02,0x02,0x04,0x08,0x10,0x20,0x40,0x80,0x80,0x00,0x00,0x00}, /* / */
+  {0x00,0x18,0x24,0x42,0x42,0x42,0x42,0x42,0x24,0x18,0x00,0x00,0x00}, /* 0 */
+  {0x00,0x10,0x30,0x50,0x10,0x10,0x10,0x10,0x10,0x7c,0x00,0x00,0x00}, /* 1 */
+  {0x00,0x3c,0x42,0x42,0x02,0x04,0x18,0x20,0x40,0x7e,0x00,0x00,0x00}, /* 2 */
+  {0x00,0x7e,0x02,0x04,0x08,0x1c,0x02,0x02,0x42,0x3c,0x00,0x00,0x00}, /* 3 */
+  {0x00,0x04,0x0c,0x14,0x24,0x44,0x44,0x7e,0x04,0x04,0x00,0x00,0x00}, /* 4 */
+  {0x00,0x7e,0x40,0x40,0x5c,0x62,0x02,0x02,0x42,0x3c,0x00,0x00,0x00}, /* 5 */
+  {0x00,0x1c,0x20,0x40,0x40,0x5c,0x62,0x42,0x42,0x3c,0x00,0x00,0x00}, /* 6 */
+  {0x00,0x7e,0x02,0x04,0x08,0x08,0x10,0x10,0x20,0x20,0x00,0x00,0x00}, /* 7 */
+  {0x00,0x3c,0x42,0x42,0x42,0x3c,0x42,0x42,0x42,0x3c,0x00,0x00,0x00}, /* 8 */
+  {0x00,0x3c,0x42,0x42,0x46,0x3a,0x02,0x02,0x04,0x38,0x00,0x00,0x00}, /* 9 */
+  {0x00,0x00,0x00,0x10,0x38,0x10,0x00,0x00,0x10,0x38,0x10,0x00,0x00}, /* : */
+  {0x00,0x00,0x00,0x10,0x38,0x10,0x00,0x00,0x38,0x30,0x40,0x00,0x00}, /* ; */
+  {0x00,0x02,0x04,0x08,0x10,0x20,0x10,0x08,0x04,0x02,0x00,0x00,0x00}, /* < */
+  {0x00,0x00,0x00,0x00,0x7e,0x00,0x00,0x7e,0x00,0x00,0x00,0x00,0x00}, /* = */
+  {0x00,0x40,0x20,0x10,0x08,0x04,0x08,0x10,0x20,0x40,0x00,0x00,0x00}, /* > */
+  {0x00,0x3c,0x42,0x42,0x02,0x04,0x08,0x08,0x00,0x08,0x00,0x00,0x00}, /* ? */
+  {0x00,0x3c,0x42,0x42,0x4e,0x52,0x56,0x4a,0x40,0x3c,0x00,0x00,0x00}, /* @ */
+  {0x00,0x18,0x24,0x42,0x42,0x42,0x7e,0x42,0x42,0x42,0x00,0x00,0x00}, /* A */
+  {0x00,0xfc,0x42,0x42,0x42,0x7c,0x42,0x42,0x42,0xfc,0x00,0x00,0x00}, /* B */
+  {0x00,0x3c,0x42,0x40,0x40,0x40,0x40,0x40,0x42,0x3c,0x00,0x00,0x00}, /* C */
+  {0x00,0xfc,0x42,0x42,0x42,0x42,0x42,0x42,0x42,0xfc,0x00,0x00,0x00}, /* D */
+  {0x00,0x7e,0x40,0x40,0x40,0x78,0x40,0x40,0x40,0x7e,0x00,0x00,0x00}, /* E */
+  {0x00,0x7e,0x40,0x40,0x40,0x78,0x40,0x40,0x40,0x40,0x00,0x00,0x00}, /* F */
+  {0x00,0x3c,0x42,0x40,0x40,0x40,0x4e,0x42,0x46,0x3a,0x00,0x00,0x00}, /* G */
+  {0x00,0x42,0x42,0x42,0x42,0x7e,0x42,0x42,0x42,0x42,0x00,0x00,0x00}, /* H */
+  {0x00,0x7c,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x7c,0x00,0x00,0x00}, /* I */
+  {0x00,0x1f,0x04,0x04,0x04,0x04,0x04,0x04,0x44,0x38,0x00,0x00,0x00}, /* J */
+  {0x00,0x42,0x44,0x48,0x50,0x60,0x50,0x48,0x44,0x42,0x00,0x00,0x00}, /* K */
+  {0x00,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x7e,0x00,0x00,0x00}, /* L */
+  {0x00,0x82,0x82,0xc6,0xaa,0x92,0x92,0x82,0x82,0x82,0x00,0x00,0x00}, /* M */
+  {0x00,0x42,0x42,0x62,0x52,0x4a,0x46,0x42,0x42,0x42,0x00,0x00,0x00}, /* N */
+  {0x00,0x3c,0x42,0x42,0x42,0x42,0x42,0x42,0x42,0x3c,0x00,0x00,0x00}, /* O */
+  {0x00,0x7c,0x42,0x42,0x42,0x7c,0x40,0x40,0x40,0x40,0x00,0x00,0x00}, /* P */
+  {0x00,0x3c,0x42,0x42,0x42,0x42,0x42,0x52,0x4a,0x3c,0x02,0x00,0x00}, /* Q */
+  {0x00,0x7c,0x42,0x42,0x42,0x7c,0x50,0x48,0x44,0x42,0x00,0x00,0x00}, /* R */
+  {0x00,0x3c,0x42,0x40,0x40,0x3c,0x02,0x02,0x42,0x3c,0x00,0x00,0x00}, /* S */
+  {0x00,0xfe,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x00,0x00,0x00}, /* T */
+  {0x00,0x42,0x42,0x42,0x42,0x42,0x42,0x42,0x42,0x3c,0x00,0x00,0x00}, /* U */
+  {0x00,0x82,0x82,0x44,0x44,0x44,0x28,0x28,0x28,0x10,0x00,0x00,0x00}, /* V */
+  {0x00,0x82,0x82,0x82,0x82,0x92,0x92,0x92,0xaa,0x44,0x00,0x00,0x00}, /* W */
+  {0x00,0x82,0x82,0x44,0x28,0x10,0x28,0x44,0x82,0x82,0x00,0x00,0x00}, /* X */
+  {0x00,0x82,0x82,0x44,0x28,0x10,0x10,0x10,0x10,0x10,0x00,0x00,0x00}, /* Y */
+  {0x00,0x7e,0x02,0x04,0x08,0x10,0x20,0x40,0x40,0x7e,0x00,0x00,0x00}, /* Z */
+  {0x00,0x3c,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x3c,0x00,0x00,0x00}, /* [ */
+  {0x00,0x80,0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x02,0x00,0x00,0x00}, /* \ */
+  {0x00,0x78,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x78,0x00,0x00,0x00}, /* ] */
+  {0x00,0x10,0x28,0x44,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* ^ */
+  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xfe,0x00,0x00}, /* _ */
+  {0x00,0x38,0x18,0x04,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* ` */
+  {0x00,0x00,0x00,0x00,0x3c,0x02,0x3e,0x42,0x46,0x3a,0x00,0x00,0x00}, /* a */
+  {0x00,0x40,0x40,0x40,0x5c,0x62,0x42,0x42,0x62,0x5c,0x00,0x00,0x00}, /* b */
+  {0x00,0x00,0x00,0x00,0x3c,0x42,0x40,0x40,0x42,0x3c,0x00,0x00,0x00}, /* c */
+  {0x00,0x02,0x02,0x02,0x3a,0x46,0x42,0x42,0x46,0x3a,0x00,0x00,0x00}, /* d */
+  {0x00,0x00,0x00,0x00,0x3c,0x42,0x7e,0x40,0x42,0x3c,0x00,0x00,0x00}, /* e */
+  {0x00,0x1c,0x22,0x20,0x20,0x7c,0x20,0x20,0x20,0x20,0x00,0x00,0x00}, /* f */
+  {0x00,0x00,0x00,0x00,0x3a,0x44,0x44,0x38,0x40,0x3c,0x42,0x3c,0x00}, /* g */
+  {0x00,0x40,0x40,0x40,0x5c,0x62,0x42,0x42,0x42,0x42,0x00,0x00,0x00}, /* h */
+  {0x00,0x00,0x10,0x00,0x30,0x10,0x10,0x10,0x10,0x7c,0x00,0x00,0x00}, /* i */
+  {0x00,0x00,0x04,0x00,0x0c,0x04,0x04,0x04,0x04,0x44,0x44,0x38,0x00}, /* j */
+  {0x00,0x40,0x40,0x40,0x44,0x48,0x70,0x48,0x44,0x42,0x00,0x00,0x00}, /* k */
+  {0x00,0x30,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x7c,0x00,0x00,0x00}, /* l */
+  {0x00,0x00,0x00,0x00,0xec,0x92,0x92,0x92,0x92,0x82,0x00,0x00,0x00}, /* m */
+  {0x00,0x00,0x00,0x00,0x5c,0x62,0x42,0x42,0x42,0x42,0x00,0x00,0x00}, /* n */
+  {0x00,0x00,0x00,0x00,0x3c,0x42,0x42,0x42,0x42,0x3c,0x00,0x00,0x00}, /* o */
+  {0x00,0x00,0x00,0x00,0x5c,0x62,0x42,0x62,0x5c,0x40,0x40,0x40,0x00}, /* p */
+  {0x00,0x00,0x00,0x00,0x3a,0x46,0x42,0x46,0x3a,0x02,0x02,0x02,0x00}, /* q */
+  {0x00,0x00,0x00,0x00,0x5c,0x22,0x20,0x20,0x20,0x20,0x00,0x00,0x00}, /* r */
+  {0x00,0x00,0x00,0x00,0x3c,0x42,0x30,0x0c,0x42,0x3c,0x00,0x00,0x00}, /* s */
+  {0x00,0x00,0x20,0x20,0x7c,0x20,0x20,0x20,0x22,0x1c,0x00,0x00,0x00}, /* t */
+  {0x00,0x00,0x00,0x00,0x44,0x44,0x44,0x44,0x44,0x3a,0x00,0x00,0x00}, /* u */
+  {0x00,0x00,0x00,0x00,0x44,0x44,0x44,0x28,0x28,0x10,0x00,0x00,0x00}, /* v */
+  {0x00,0x00,0x00,0x00,0x82,0x82,0x92,0x92,0xaa,0x44,0x00,0x00,0x00}, /* w */
+  {0x00,0x00,0x00,0x00,0x42,0x24,0x18,0x18,0x24,0x42,0x00,0x00,0x00}, /* x */
+  {0x00,0x00,0x00,0x00,0x42,0x42,0x42,0x46,0x3a,0x02,0x42,0x3c,0x00}, /* y */
+  {0x00,0x00,0x00,0x00,0x7e,0x04,0x08,0x10,0x20,0x7e,0x00,0x00,0x00}, /* z */
+  {0x00,0x0e,0x10,0x10,0x08,0x30,0x08,0x10,0x10,0x0e,0x00,0x00,0x00}, /* { */
+  {0x00,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x00,0x00,0x00}, /* | */
+  {0x00,0x70,0x08,0x08,0x10,0x0c,0x10,0x08,0x08,0x70,0x00,0x00,0x00}, /* } */
+  {0x00,0x24,0x54,0x48,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}  /* ~ */
+};
+
+GLuint text_tex = 0;
+
+
+/**
+ * Bakes the font into a texture. Returns false if there is no memory for
+ * it, in which case text isn't drawn.
+ */
+bool text_init()
+{
+  unsigned char *pixels;
+  int c, row, x, at;
+
+  if(text_tex)
+    return true;
+
+  pixels = calloc(TEXT_TEX * TEXT_TEX, 4);
+  if(!pixels)
+    return false;
+
+  /* White, so the text takes the current colour, and see through round
+   * each character. The bottom row of the texture comes first. */
+  for(c = 0; c < TEXT_COUNT; c++)
+    for(row = 0; row < TEXT_H; row++)
+      for(x = 0; x < TEXT_W; x++)
+      {
+        at = (c / TEXT_COLS * TEXT_H + TEXT_H - 1 - row) * TEXT_TEX +
+             c % TEXT_COLS * TEXT_W + x;
+        memset(pixels + at * 4, 0xff, 3);
+        pixels[at * 4 + 3] = text_font[c][row] & (0x80 >> x) ? 0xff : 0;
+      }
+
+  glGenTextures(1, &text_tex);
+  glBindTexture(GL_TEXTURE_2D, text_tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEXT_TEX, TEXT_TEX, 0, GL_RGBA,
+      GL_UNSIGNED_BYTE, pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  free(pixels);
+  return true;
+}
+
+
+/**
+ * Frees the font texture.
+ */
+void text_cleanup()
+{
+  if(text_tex)
+    glDeleteTextures(1, &text_tex);
+  text_tex = 0;
+}
+
+
+/**
+ * Draws a string in the current colour with its baseline starting at x, y
+ * in the current matrices, which should take those to pixels. Characters
+ * not in the font are left as gaps.
+ */
+void text_draw(const char *string, int x, int y)
+{
+  float verts[TEXT_CHUNK * 6][5], *v;
+  float s0, t0, s1, t1, x0, y0;
+  int i, j, n, c;
+  bool piped;
+
+  /* The corners of each character, as two triangles. */
+  static const int corner[6][2] = {
+    {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}
+  };
+
+  if(!text_tex)
+    return;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, text_tex);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+  piped = pipe_begin();
+  pipe_arrays(verts[0], 5, 0, -1, 3);
+
+  while(*string)
+  {
+    for(n = 0; n < TEXT_CHUNK && *string; string++, x += TEXT_W)
+    {
+      /* Spaces are left as gaps, and so is anything not in the font. */
+      c = (unsigned char)*string - TEXT_FIRST;
+      if(c <= 0 || c >= TEXT_COUNT)
+        continue;
+
+      s0 = (float)(c % TEXT_COLS * TEXT_W) / TEXT_TEX;
+      t0 = (float)(c / TEXT_COLS * TEXT_H) / TEXT_TEX;
+      s1 = s0 + (float)TEXT_W / TEXT_TEX;
+      t1 = t0 + (float)TEXT_H / TEXT_TEX;
+      x0 = x;
+      y0 = y - TEXT_BELOW;
+
+      for(i = 0; i < 6; i++)
+      {
+        v = verts[n * 6 + i];
+        j = corner[i][0];
+        v[0] = x0 + j * TEXT_W;
+        v[3] = j ? s1 : s0;
+        j = corner[i][1];
+        v[1] = y0 + j * TEXT_H;
+        v[4] = j ? t1 : t0;
+        v[2] = 0.0;
+      }
+      n++;
+    }
+
+    if(n > 0)
+      glDrawArrays(GL_TRIANGLES, 0, n * 6);
+  }
+
+  if(piped)
+    pipe_end();
+
+  glPopClientAttrib();
+  glPopAttrib();
+}
@@ -0,0 +1,20 @@
+/**
+ * text.h
+ *
+ * Draws text from a bitmap font kept in a texture, through the GLSL
+ * pipeline when it is on, for the FPS display and the mode lines.
+ */
+
+#ifndef _TEXT_H_
+#define _TEXT_H_
+
+#include "global.h"
+
+
+/* Interface. */
+extern bool text_init();
+extern void text_cleanup();
+extern void text_draw(const char *string, int x, int y);
+
+
+#endif
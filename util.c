@@ -134,3 +134,184 @@ float clamp(float value, float min, float max)
 }
 
 
+
+
+/**
+ * Approximate sine and cosine of an angle in radians between -PI and PI.
+ * A parabola through the sine curve is squared back towards it, which is
+ * good to about 0.001 and far cheaper than sin and cos.
+ *
+ * source: devmaster.net/forums/topic/4648-fast-and-accurate-sinecosine/
+ */
+void fast_sincos(float x, float *s, float *c)
+{
+  const float b = 4.0 / MY_PI, cc = -4.0 / (MY_PI * MY_PI), p = 0.225;
+  float y;
+
+  y  = b * x + cc * x * fabs(x);
+  *s = p * (y * fabs(y) - y) + y;
+
+  /* Cosine is sine a quarter turn on. */
+  x += MY_PI / 2;
+  if(x > MY_PI)
+    x -= 2 * MY_PI;
+
+  y  = b * x + cc * x * fabs(x);
+  *c = p * (y * fabs(y) - y) + y;
+}
+
+
+/**
+ * Sets a 4x4 matrix to the identity. Matrices here are column major, the
+ * same as OpenGL's, so they can be handed straight to it.
+ */
+void m4_identity(float m[16])
+{
+  int i;
+
+  for(i = 0; i < 16; i++)
+    m[i] = (i % 5 == 0) ? 1.0 : 0.0;
+}
+
+
+/**
+ * Multiplies m on the right by a translation, as glTranslatef does to the
+ * current matrix.
+ */
+void m4_translate(float m[16], float x, float y, float z)
+{
+  int i;
+
+  for(i = 0; i < 4; i++)
+    m[12 + i] += x * m[i] + y * m[4 + i] + z * m[8 + i];
+}
+
+
+/**
+ * Multiplies m on the right by a scale, as glScalef does to the current
+ * matrix.
+ */
+void m4_scale(float m[16], float x, float y, float z)
+{
+  int i;
+
+  for(i = 0; i < 4; i++)
+  {
+    m[i]     *= x;
+    m[4 + i] *= y;
+    m[8 + i] *= z;
+  }
+}
+
+
+/**
+ * Sets m to an orthographic projection, as glOrtho would multiply by.
+ */
+void m4_ortho(float m[16], float l, float r, float b, float t, float n,
+    float f)
+{
+  m4_identity(m);
+  m[0]  =  2.0 / (r - l);
+  m[5]  =  2.0 / (t - b);
+  m[10] = -2.0 / (f - n);
+  m[12] = -(r + l) / (r - l);
+  m[13] = -(t + b) / (t - b);
+  m[14] = -(f + n) / (f - n);
+}
+
+
+/**
+ * Multiplies m on the right by a rotation of deg degrees around the X, Y or
+ * Z axis, as glRotatef does with that axis.
+ */
+void m4_rotate(float m[16], float deg, int axis)
+{
+  int i, a, b;
+  float s, c, u, v;
+
+  if(deg == 0.0)
+    return;
+
+  s = sin(RAD(deg));
+  c = cos(RAD(deg));
+
+  /* The two columns that get mixed, in right handed order. */
+  a = (axis + 1) % 3 * 4;
+  b = (axis + 2) % 3 * 4;
+
+  for(i = 0; i < 4; i++)
+  {
+    u = m[a + i];
+    v = m[b + i];
+    m[a + i] =  c * u + s * v;
+    m[b + i] = -s * u + c * v;
+  }
+}
+
+
+
+/**
+ * Multiplies two 4x4 matrices, r = m0 * m1. r may not be either of them.
+ */
+void m4_mul(float r[16], float m0[16], float m1[16])
+{
+  int i, j;
+
+  for(i = 0; i < 4; i++)
+    for(j = 0; j < 4; j++)
+      r[i * 4 + j] = m0[j]     * m1[i * 4]     + m0[4 + j]  * m1[i * 4 + 1] +
+                     m0[8 + j] * m1[i * 4 + 2] + m0[12 + j] * m1[i * 4 + 3];
+}
+
+
+/**
+ * Inverts a matrix made only of rotations and translations, which is just
+ * the transposed rotation and the translation undone. r may not be m.
+ */
+void m4_rigid_inverse(float r[16], float m[16])
+{
+  int i, j;
+
+  for(i = 0; i < 3; i++)
+  {
+    for(j = 0; j < 3; j++)
+      r[i * 4 + j] = m[j * 4 + i];
+    r[i * 4 + 3] = 0.0;
+  }
+
+  for(i = 0; i < 3; i++)
+    r[12 + i] = -(r[i] * m[12] + r[4 + i] * m[13] + r[8 + i] * m[14]);
+  r[15] = 1.0;
+}
+
+
+/**
+ * Transforms the point p by m into r.
+ */
+void m4_point(float r[3], float m[16], float p[3])
+{
+  int i;
+
+  for(i = 0; i < 3; i++)
+    r[i] = m[i] * p[0] + m[4 + i] * p[1] + m[8 + i] * p[2] + m[12 + i];
+}
+
+
+/**
+ * Returns how far along a ray from org along the unit vector dir it first
+ * hits a sphere, given as its centre then radius, 0 if it starts inside,
+ * or -1 if it misses.
+ */
+float ray_sphere(float org[3], float dir[3], float sphere[4])
+{
+  float d[3], b, c, disc;
+
+  v_sub(d, org, sphere);
+  b = v_dot(d, dir);
+  c = v_dot(d, d) - sphere[3] * sphere[3];
+  disc = b * b - c;
+  if(disc < 0.0 || (b > 0.0 && c > 0.0))
+    return -1.0;
+
+  return -b - sqrt(disc) > 0.0 ? -b - sqrt(disc) : 0.0;
+}
@@ -15,5 +15,16 @@ void v_print(float v[3]);
 void v_clear(float v[3]);
 float mod(float value, int mod);
 float clamp(float value, float min, float max);
+void fast_sincos(float x, float *s, float *c);
+void m4_identity(float m[16]);
+void m4_translate(float m[16], float x, float y, float z);
+void m4_rotate(float m[16], float deg, int axis);
+void m4_scale(float m[16], float x, float y, float z);
+void m4_ortho(float m[16], float l, float r, float b, float t, float n,
+    float f);
+void m4_mul(float r[16], float m0[16], float m1[16]);
+void m4_rigid_inverse(float r[16], float m[16]);
+void m4_point(float r[3], float m[16], float p[3]);
+float ray_sphere(float org[3], float dir[3], float sphere[4]);
 
 #endif
@@ -0,0 +1,292 @@
+/**
+ * video.c
+ *
+ * Converting to YUV works on a pair of rows at a time, as each chroma
+ * sample covers a square of four pixels. Where SSE2 is available 32 pixels
+ * of each row are taken at once: six loads of packed RGB are sorted into
+ * separate red, green and blue registers by five rounds of byte unpacks,
+ * the luma of every pixel is worked out in 16 bit lanes, and neighbouring
+ * pixels of both rows are summed for the chroma. Whatever is left at the
+ * end of a row, and everything without SSE2, is done a pixel at a time
+ * with the same integer sums, so the output is the same either way.
+ *
+ *   Y = (( 66 R + 129 G +  25 B + 128) >> 8) + 16
+ *   U = ((-38 R -  74 G + 112 B + 128) >> 8) + 128
+ *   V = ((112 R -  94 G -  18 B + 128) >> 8) + 128
+ *
+ * with U and V taken from the rounded average of the four pixels.
+ */
+
+#include "video.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/* Function prototypes. */
+void video_pair(unsigned char *ya, unsigned char *yb, unsigned char *u,
+    unsigned char *v, const unsigned char *a, const unsigned char *b,
+    int x, int w);
+
+
+/**
+ * Returns the number of bytes in one 4:2:0 frame w by h.
+ */
+int video_yuv_size(int w, int h)
+{
+  return w * h + 2 * ((w + 1) / 2) * ((h + 1) / 2);
+}
+
+
+/**
+ * Converts the pixels from x to the end of row a, and row b below it, to
+ * luma in ya and yb and chroma in u and v, one pixel at a time. For the
+ * last row of an odd height frame b and yb are NULL, and each chroma
+ * sample averages the pixels there are.
+ */
+void video_pair(unsigned char *ya, unsigned char *yb, unsigned char *u,
+    unsigned char *v, const unsigned char *a, const unsigned char *b,
+    int x, int w)
+{
+  const unsigned char *p;
+  int r, g, bl, n, i, j;
+
+  for(; x < w; x += 2)
+  {
+    r = g = bl = n = 0;
+    for(j = 0; j < 2; j++)
+    {
+      p = j ? b : a;
+      if(!p)
+        continue;
+      for(i = x; i < x + 2 && i < w; i++)
+      {
+        (j ? yb : ya)[i] = ((66 * p[i * 3] + 129 * p[i * 3 + 1] +
+            25 * p[i * 3 + 2] + 128) >> 8) + 16;
+        r += p[i * 3];
+        g += p[i * 3 + 1];
+        bl += p[i * 3 + 2];
+        n++;
+      }
+    }
+
+    r = (r + n / 2) / n;
+    g = (g + n / 2) / n;
+    bl = (bl + n / 2) / n;
+
+    /* Offset so the shift is of a positive number; 32768 is 128 << 8. */
+    u[x / 2] = (-38 * r - 74 * g + 112 * bl + 128 + 32768) >> 8;
+    v[x / 2] = (112 * r - 94 * g - 18 * bl + 128 + 32768) >> 8;
+  }
+}
+
+
+#ifdef __SSE2__
+/**
+ * Sorts 32 packed RGB pixels in six registers into two registers of each
+ * of red, green and blue, in that order.
+ */
+static void video_deinterleave(__m128i c[6])
+{
+  __m128i t[6];
+  int round, i;
+
+  for(round = 0; round < 5; round++)
+  {
+    for(i = 0; i < 3; i++)
+    {
+      t[i * 2]     = _mm_unpacklo_epi8(c[i], c[i + 3]);
+      t[i * 2 + 1] = _mm_unpackhi_epi8(c[i], c[i + 3]);
+    }
+    for(i = 0; i < 6; i++)
+      c[i] = t[i];
+  }
+}
+
+
+/**
+ * Works out the luma of 16 pixels from their red, green and blue.
+ */
+static __m128i video_luma(__m128i r, __m128i g, __m128i b)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i kr = _mm_set1_epi16(66), kg = _mm_set1_epi16(129);
+  const __m128i kb = _mm_set1_epi16(25), half = _mm_set1_epi16(128);
+  const __m128i base = _mm_set1_epi16(16);
+  __m128i y[2], c[3];
+  int i;
+
+  /* The sum fits in 16 bits unsigned, so is shifted logically. */
+  for(i = 0; i < 2; i++)
+  {
+    c[0] = i ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+    c[1] = i ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+    c[2] = i ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+    y[i] = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(c[0], kr),
+        _mm_mullo_epi16(c[1], kg)), _mm_add_epi16(_mm_mullo_epi16(c[2], kb),
+        half));
+    y[i] = _mm_add_epi16(_mm_srli_epi16(y[i], 8), base);
+  }
+
+  return _mm_packus_epi16(y[0], y[1]);
+}
+
+
+/**
+ * Returns the rounded averages of the 8 squares of four pixels in 16
+ * pixels of two rows of one colour, in 16 bit lanes.
+ */
+static __m128i video_average(__m128i a, __m128i b)
+{
+  const __m128i low = _mm_set1_epi16(0xff), two = _mm_set1_epi16(2);
+  __m128i sum;
+
+  sum = _mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8));
+  sum = _mm_add_epi16(sum, _mm_and_si128(b, low));
+  sum = _mm_add_epi16(sum, _mm_srli_epi16(b, 8));
+  return _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+}
+
+
+/**
+ * Works out one chroma channel of 8 averaged pixels with the weights kr,
+ * kg and kb, in 16 bit lanes.
+ */
+static __m128i video_chroma(__m128i r, __m128i g, __m128i b, int kr, int kg,
+    int kb)
+{
+  __m128i c;
+
+  c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)),
+      _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+  c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+  c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+#endif
+
+
+/**
+ * Converts a w by h frame of RGB rows from the bottom up to 4:2:0 YUV top
+ * down, the Y plane followed by the U and V planes, in video_yuv_size(w, h)
+ * bytes.
+ */
+void video_rgb_to_yuv(unsigned char *yuv, const unsigned char *rgb, int w,
+    int h)
+{
+  int cw = (w + 1) / 2, ch = (h + 1) / 2, row, x;
+  unsigned char *ya, *yb, *u, *v;
+  const unsigned char *a, *b;
+#ifdef __SSE2__
+  __m128i ca[6], cb[6], r[2], g[2], bl[2];
+  int i;
+#endif
+
+  for(row = 0; row < h; row += 2)
+  {
+    a  = rgb + (h - 1 - row) * w * 3;
+    b  = row + 1 < h ? a - w * 3 : NULL;
+    ya = yuv + row * w;
+    yb = b ? ya + w : NULL;
+    u  = yuv + w * h + row / 2 * cw;
+    v  = u + cw * ch;
+    x  = 0;
+
+#ifdef __SSE2__
+    for(; b && x + 32 <= w; x += 32)
+    {
+      for(i = 0; i < 6; i++)
+      {
+        ca[i] = _mm_loadu_si128((const __m128i *)(a + x * 3) + i);
+        cb[i] = _mm_loadu_si128((const __m128i *)(b + x * 3) + i);
+      }
+      video_deinterleave(ca);
+      video_deinterleave(cb);
+
+      for(i = 0; i < 2; i++)
+      {
+        _mm_storeu_si128((__m128i *)(ya + x + i * 16),
+            video_luma(ca[i], ca[i + 2], ca[i + 4]));
+        _mm_storeu_si128((__m128i *)(yb + x + i * 16),
+            video_luma(cb[i], cb[i + 2], cb[i + 4]));
+
+        r[i]  = video_average(ca[i], cb[i]);
+        g[i]  = video_average(ca[i + 2], cb[i + 2]);
+        bl[i] = video_average(ca[i + 4], cb[i + 4]);
+      }
+
+      _mm_storeu_si128((__m128i *)(u + x / 2), _mm_packus_epi16(
+          video_chroma(r[0], g[0], bl[0], -38, -74, 112),
+          video_chroma(r[1], g[1], bl[1], -38, -74, 112)));
+      _mm_storeu_si128((__m128i *)(v + x / 2), _mm_packus_epi16(
+          video_chroma(r[0], g[0], bl[0], 112, -94, -18),
+          video_chroma(r[1], g[1], bl[1], 112, -94, -18)));
+    }
+#endif
+
+    video_pair(ya, yb, u, v, a, b, x, w);
+  }
+}
+
+
+/**
+ * Same as video_rgb_to_yuv, a pixel at a time, for comparison.
+ */
+void video_rgb_to_yuv_scalar(unsigned char *yuv, const unsigned char *rgb,
+    int w, int h)
+{
+  int cw = (w + 1) / 2, ch = (h + 1) / 2, row;
+  const unsigned char *a;
+  unsigned char *u;
+
+  for(row = 0; row < h; row += 2)
+  {
+    a = rgb + (h - 1 - row) * w * 3;
+    u = yuv + w * h + row / 2 * cw;
+    video_pair(yuv + row * w, row + 1 < h ? yuv + (row + 1) * w : NULL,
+        u, u + cw * ch, a, row + 1 < h ? a - w * 3 : NULL, 0, w);
+  }
+}
+
+
+/**
+ * Writes the header of a Y4M stream of w by h frames, fps a second.
+ * Returns false if it could not be written.
+ */
+bool video_y4m_header(FILE *out, int w, int h, int fps)
+{
+  return fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", w, h,
+      fps) > 0;
+}
+
+
+/**
+ * Writes a frame from video_rgb_to_yuv to a Y4M stream. Returns false if it
+ * could not be written.
+ */
+bool video_y4m_frame(FILE *out, const unsigned char *yuv, int w, int h)
+{
+  int size = video_yuv_size(w, h);
+
+  return fputs("FRAME\n", out) >= 0 &&
+         fwrite(yuv, 1, size, out) == (size_t)size;
+}
+
+
+/**
+ * Writes a frame of RGB rows from the bottom up to a raw stream, top row
+ * first. Returns false if it could not be written.
+ */
+bool video_rgb_frame(FILE *out, const unsigned char *rgb, int w, int h)
+{
+  int row;
+
+  for(row = h - 1; row >= 0; row--)
+    if(fwrite(rgb + row * w * 3, 1, w * 3, out) != (size_t)(w * 3))
+      return false;
+  return true;
+}
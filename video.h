@@ -0,0 +1,35 @@
+/**
+ * video.h
+ *
+ * Uncompressed video streams for frames read back from GL, which a video
+ * encoder such as ffmpeg can take straight from a file or pipe as they are
+ * written. Frames are given as glReadPixels leaves them, tightly packed RGB
+ * rows from the bottom up, and are written top down.
+ *
+ * Y4M streams hold each frame as 4:2:0 YUV, with the BT.601 studio range
+ * of values most encoders expect. Raw streams hold the RGB pixels as they
+ * are, with nothing to say how big a frame is.
+ */
+
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+#include "global.h"
+
+#include <stdio.h>
+
+
+/* Interface. */
+extern int video_yuv_size(int w, int h);
+extern void video_rgb_to_yuv(unsigned char *yuv, const unsigned char *rgb,
+    int w, int h);
+extern void video_rgb_to_yuv_scalar(unsigned char *yuv,
+    const unsigned char *rgb, int w, int h);
+extern bool video_y4m_header(FILE *out, int w, int h, int fps);
+extern bool video_y4m_frame(FILE *out, const unsigned char *yuv, int w,
+    int h);
+extern bool video_rgb_frame(FILE *out, const unsigned char *rgb, int w,
+    int h);
+
+
+#endif